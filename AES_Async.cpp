@@ -0,0 +1,383 @@
+// AES_Async.cpp : Asynchronous cipher jobs on a work-stealing worker pool.
+//
+#include "AES_Async.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+struct AsyncQueue::Task {
+    AsyncJob job;
+    AsyncCallback done;
+    size_t chunk_bytes;
+    size_t chunk_count;
+    // Every split makes one piece, so chunk_count of them always suffice.
+    std::vector<Piece> pieces;
+    std::atomic<size_t> next_piece;
+    std::atomic<size_t> chunks_left;
+    // Set by the first chunk to throw; later chunks are skipped.
+    std::atomic<bool> failed;
+    AsyncResult result;
+};
+
+namespace {
+
+bool Divisible(AsyncMode mode) {
+    return mode == ASYNC_ECB_ENCRYPT || mode == ASYNC_ECB_DECRYPT ||
+           mode == ASYNC_CTR || mode == ASYNC_XTS_ENCRYPT ||
+           mode == ASYNC_XTS_DECRYPT;
+}
+
+void CheckJob(const AsyncJob& job) {
+    if (!job.key) {
+        throw std::invalid_argument("Async job has no key");
+    }
+    if (job.length && (!job.in || !job.out)) {
+        throw std::invalid_argument("Async job has no buffers");
+    }
+    switch (job.mode) {
+    case ASYNC_ECB_ENCRYPT:
+    case ASYNC_ECB_DECRYPT:
+        if (job.length % BLOCK_SIZE) {
+            throw std::invalid_argument("ECB length must be a multiple of 16");
+        }
+        break;
+    case ASYNC_GCM_ENCRYPT:
+    case ASYNC_GCM_DECRYPT:
+        if (!job.gcm_key || job.iv_length == 0 || job.iv_length > 16) {
+            throw std::invalid_argument("GCM job needs a GcmKey and a 1..16 byte IV");
+        }
+        if (job.length > GCM_MAX_BYTES) {
+            throw std::invalid_argument("GCM: message longer than 2^36 - 32 bytes");
+        }
+        break;
+    case ASYNC_XTS_ENCRYPT:
+    case ASYNC_XTS_DECRYPT:
+        if (!job.tweak_key || job.sector_size < BLOCK_SIZE ||
+            job.length % job.sector_size) {
+            throw std::invalid_argument(
+                "XTS job needs a tweak key and whole sectors of at least 16 bytes");
+        }
+        if (job.key->number_rounds == job.tweak_key->number_rounds &&
+            std::memcmp(job.key->enc_keys, job.tweak_key->enc_keys,
+                        2 * BLOCK_SIZE) == 0) {
+            throw std::invalid_argument("XTS: data and tweak keys must differ");
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// Bytes per chunk: ASYNC_CHUNK_BYTES, or whole sectors for XTS.
+size_t ChunkBytes(const AsyncJob& job) {
+    if (job.mode == ASYNC_XTS_ENCRYPT || job.mode == ASYNC_XTS_DECRYPT) {
+        return std::max<size_t>(1, ASYNC_CHUNK_BYTES / job.sector_size) *
+               job.sector_size;
+    }
+    return ASYNC_CHUNK_BYTES;
+}
+
+void RunChunk(const AsyncJob& job, size_t offset, size_t length,
+              AsyncResult& result) {
+    const unsigned char* in = job.in + offset;
+    unsigned char* out = job.out + offset;
+    switch (job.mode) {
+    case ASYNC_ECB_ENCRYPT:
+        EncryptBlocks(*job.key, in, out, length / BLOCK_SIZE);
+        break;
+    case ASYNC_ECB_DECRYPT:
+        DecryptBlocks(*job.key, in, out, length / BLOCK_SIZE);
+        break;
+    case ASYNC_CTR: {
+        unsigned char counter[16];
+        std::memcpy(counter, job.iv, 16);
+        AddCounter(counter, offset / BLOCK_SIZE);
+        CtrCrypt(*job.key, counter, in, out, length);
+        break;
+    }
+    case ASYNC_CBC_ENCRYPT:
+        result.length = CbcEncrypt(*job.key, job.iv, in, length, out);
+        break;
+    case ASYNC_CBC_DECRYPT:
+        result.ok = CbcDecrypt(*job.key, job.iv, in, length, out, result.length);
+        break;
+    case ASYNC_GCM_ENCRYPT:
+        GcmEncrypt(*job.gcm_key, job.iv, job.iv_length, job.aad,
+                   job.aad_length, in, length, out, result.tag);
+        break;
+    case ASYNC_GCM_DECRYPT:
+        result.ok = GcmDecrypt(*job.gcm_key, job.iv, job.iv_length, job.aad,
+                               job.aad_length, in, length, out, job.tag);
+        break;
+    case ASYNC_XTS_ENCRYPT:
+        XtsEncryptSectors(*job.key, *job.tweak_key,
+                          job.sector + offset / job.sector_size, in, out,
+                          job.sector_size, length / job.sector_size);
+        break;
+    case ASYNC_XTS_DECRYPT:
+        XtsDecryptSectors(*job.key, *job.tweak_key,
+                          job.sector + offset / job.sector_size, in, out,
+                          job.sector_size, length / job.sector_size);
+        break;
+    }
+}
+
+} // namespace
+
+
+AsyncQueue::StealDeque::StealDeque() : top_(0), bottom_(0) {
+    for (std::atomic<Piece*>& slot : slots_) {
+        slot.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+bool AsyncQueue::StealDeque::Push(Piece* piece) {
+    int64_t bottom = bottom_.load(std::memory_order_relaxed);
+    int64_t top = top_.load(std::memory_order_acquire);
+    if (bottom - top >= capacity) {
+        return false;
+    }
+    slots_[bottom & (capacity - 1)].store(piece, std::memory_order_relaxed);
+    // Publishes the piece's fields along with the slot.
+    bottom_.store(bottom + 1, std::memory_order_release);
+    return true;
+}
+
+AsyncQueue::Piece* AsyncQueue::StealDeque::Pop() {
+    int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+    bottom_.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t top = top_.load(std::memory_order_relaxed);
+    if (top > bottom) {
+        bottom_.store(bottom + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    Piece* piece = slots_[bottom & (capacity - 1)].load(std::memory_order_relaxed);
+    if (top == bottom) {
+        // Last entry: race the thieves for it.
+        if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                          std::memory_order_relaxed)) {
+            piece = nullptr;
+        }
+        bottom_.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return piece;
+}
+
+AsyncQueue::Piece* AsyncQueue::StealDeque::Steal() {
+    int64_t top = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t bottom = bottom_.load(std::memory_order_acquire);
+    if (top >= bottom) {
+        return nullptr;
+    }
+    Piece* piece = slots_[top & (capacity - 1)].load(std::memory_order_relaxed);
+    if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                      std::memory_order_relaxed)) {
+        return nullptr;
+    }
+    return piece;
+}
+
+bool AsyncQueue::StealDeque::Full() const {
+    return bottom_.load(std::memory_order_relaxed) -
+           top_.load(std::memory_order_acquire) >= capacity;
+}
+
+bool AsyncQueue::StealDeque::Empty() const {
+    return top_.load(std::memory_order_acquire) >=
+           bottom_.load(std::memory_order_acquire);
+}
+
+
+AsyncQueue::AsyncQueue(unsigned thread_count)
+    : incoming_count_(0), idle_(0), outstanding_(0), stopping_(false) {
+    if (thread_count == 0) {
+        thread_count = std::thread::hardware_concurrency();
+    }
+    if (thread_count == 0) {
+        thread_count = 1;
+    }
+    for (unsigned i = 0; i < thread_count; i++) {
+        deques_.emplace_back(new StealDeque);
+    }
+    for (unsigned i = 0; i < thread_count; i++) {
+        workers_.emplace_back(&AsyncQueue::WorkerLoop, this, i);
+    }
+}
+
+AsyncQueue::~AsyncQueue() {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        all_done_.wait(lock, [this] { return outstanding_ == 0; });
+        stopping_ = true;
+    }
+    work_ready_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+void AsyncQueue::Submit(const AsyncJob& job, AsyncCallback done) {
+    CheckJob(job);
+    Task* task = new Task;
+    task->job = job;
+    task->done = std::move(done);
+    task->chunk_bytes = Divisible(job.mode) ? ChunkBytes(job) : job.length;
+    task->chunk_count = task->chunk_bytes
+        ? (job.length + task->chunk_bytes - 1) / task->chunk_bytes : 1;
+    if (task->chunk_count == 0) {
+        task->chunk_count = 1;
+    }
+    task->pieces.resize(task->chunk_count);
+    task->next_piece.store(0, std::memory_order_relaxed);
+    task->chunks_left.store(task->chunk_count, std::memory_order_relaxed);
+    task->failed.store(false, std::memory_order_relaxed);
+    task->result.ok = true;
+    task->result.length = job.length;
+    std::memset(task->result.tag, 0, sizeof(task->result.tag));
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        incoming_.push_back(task);
+        incoming_count_.fetch_add(1);
+        outstanding_++;
+    }
+    work_ready_.notify_one();
+}
+
+std::future<AsyncResult> AsyncQueue::Submit(const AsyncJob& job) {
+    auto promise = std::make_shared<std::promise<AsyncResult>>();
+    std::future<AsyncResult> result = promise->get_future();
+    Submit(job, [promise](const AsyncResult& done) {
+        if (done.error) {
+            promise->set_exception(done.error);
+        } else {
+            promise->set_value(done);
+        }
+    });
+    return result;
+}
+
+bool AsyncQueue::HasWork() {
+    if (incoming_count_.load()) {
+        return true;
+    }
+    for (const std::unique_ptr<StealDeque>& deque : deques_) {
+        if (!deque->Empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+AsyncQueue::Piece* AsyncQueue::Start(Task* task) {
+    Piece* piece = &task->pieces[task->next_piece.fetch_add(1)];
+    piece->task = task;
+    piece->begin = 0;
+    piece->end = task->chunk_count;
+    return piece;
+}
+
+void AsyncQueue::Run(unsigned index, Piece* piece) {
+    Task* task = piece->task;
+    // Keep the first chunk and offer the rest, halving as we go, so a
+    // thief always takes the biggest block of work available.
+    bool offered = false;
+    while (piece->end - piece->begin > 1) {
+        if (deques_[index]->Full()) {
+            // Run the rest of the piece here, chunk by chunk.
+            break;
+        }
+        size_t middle = piece->begin + (piece->end - piece->begin) / 2;
+        Piece* upper = &task->pieces[task->next_piece.fetch_add(1)];
+        upper->task = task;
+        upper->begin = middle;
+        upper->end = piece->end;
+        deques_[index]->Push(upper);
+        piece->end = middle;
+        offered = true;
+    }
+    // Pairs with the idle_ increment in WorkerLoop: either a sleeper sees
+    // the pushed pieces or we see the sleeper.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (offered && idle_.load()) {
+        { std::lock_guard<std::mutex> lock(mutex_); }
+        work_ready_.notify_all();
+    }
+
+    const AsyncJob& job = task->job;
+    size_t chunks = piece->end - piece->begin;
+    for (size_t chunk = piece->begin; chunk < piece->end; chunk++) {
+        size_t offset = chunk * task->chunk_bytes;
+        size_t length = std::min(task->chunk_bytes, job.length - offset);
+        if (task->failed.load(std::memory_order_relaxed)) {
+            break;
+        }
+        // An exception must not escape a worker thread, which would end
+        // the process; the first one is kept for the result.
+        try {
+            RunChunk(job, offset, length, task->result);
+        } catch (...) {
+            if (!task->failed.exchange(true)) {
+                task->result.error = std::current_exception();
+                task->result.ok = false;
+            }
+        }
+    }
+    if (task->chunks_left.fetch_sub(chunks) == chunks) {
+        Finish(task);
+    }
+}
+
+void AsyncQueue::Finish(Task* task) {
+    try {
+        task->done(task->result);
+    } catch (...) {
+        // Dropped: the caller that submitted the job has moved on.
+    }
+    delete task;
+    bool last;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        last = --outstanding_ == 0;
+    }
+    if (last) {
+        all_done_.notify_all();
+    }
+}
+
+void AsyncQueue::WorkerLoop(unsigned index) {
+    StealDeque& own = *deques_[index];
+    for (;;) {
+        // New jobs first, then our own chunks, then someone else's.
+        Piece* piece = nullptr;
+        if (incoming_count_.load()) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!incoming_.empty()) {
+                piece = Start(incoming_.front());
+                incoming_.pop_front();
+                incoming_count_.fetch_sub(1);
+            }
+        }
+        if (!piece) {
+            piece = own.Pop();
+        }
+        for (size_t i = 1; !piece && i < deques_.size(); i++) {
+            piece = deques_[(index + i) % deques_.size()]->Steal();
+        }
+        if (piece) {
+            Run(index, piece);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_.fetch_add(1);
+        work_ready_.wait(lock, [this] { return stopping_ || HasWork(); });
+        idle_.fetch_sub(1);
+        if (stopping_) {
+            return;
+        }
+    }
+}
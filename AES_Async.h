@@ -0,0 +1,154 @@
+// AES_Async.h : Asynchronous cipher jobs on a work-stealing worker pool.
+//
+// A request thread hands a job (key, mode, buffers) to an AsyncQueue and
+// carries on; the job runs on the queue's workers and completion is
+// reported through a callback or a std::future. The buffers, keys and
+// aad a job refers to must stay valid until it completes.
+//
+// Jobs of ECB, CTR and XTS are cut into ASYNC_CHUNK_BYTES chunks that
+// workers split off and steal from each other's deques, so one large
+// buffer is spread over every worker. Between chunks a worker takes any
+// newly submitted job first, so small requests are not queued behind a
+// large one. CBC and GCM jobs run as one piece: CBC encryption and the
+// GHASH chain are serial, and CBC decryption checks padding over the
+// whole message.
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "AES_Modes.h"
+
+// Unit of work for the divisible modes.
+#define ASYNC_CHUNK_BYTES (64 * 1024)
+
+enum AsyncMode {
+    ASYNC_ECB_ENCRYPT,
+    ASYNC_ECB_DECRYPT,
+    ASYNC_CTR,
+    ASYNC_CBC_ENCRYPT,
+    ASYNC_CBC_DECRYPT,
+    ASYNC_GCM_ENCRYPT,
+    ASYNC_GCM_DECRYPT,
+    ASYNC_XTS_ENCRYPT,
+    ASYNC_XTS_DECRYPT,
+};
+
+// Fields a mode does not use are ignored.
+struct AsyncJob {
+    AsyncMode mode;
+    const AesKey* key;
+    // XTS tweak key; sectors of sector_size bytes numbered from sector.
+    const AesKey* tweak_key;
+    uint64_t sector;
+    size_t sector_size;
+    // GCM key material built from key.
+    const GcmKey* gcm_key;
+    // CTR counter, CBC IV, or the first iv_length bytes of the GCM IV.
+    unsigned char iv[16];
+    size_t iv_length;
+    const unsigned char* aad;
+    size_t aad_length;
+    const unsigned char* in;
+    unsigned char* out;
+    size_t length;
+    // Expected GCM tag when decrypting.
+    unsigned char tag[16];
+};
+
+struct AsyncResult {
+    // False for a CBC padding or GCM tag failure, or when error is set.
+    bool ok;
+    // Bytes written to out: the padded length for CBC encryption, the
+    // unpadded length for CBC decryption, length otherwise.
+    size_t length;
+    // GCM tag when encrypting.
+    unsigned char tag[16];
+    // The exception a mode threw while running the job, e.g. std::bad_alloc
+    // from the thread pool; out is not valid then.
+    std::exception_ptr error;
+};
+
+typedef std::function<void(const AsyncResult&)> AsyncCallback;
+
+class AsyncQueue {
+public:
+    // thread_count == 0 uses std::thread::hardware_concurrency().
+    explicit AsyncQueue(unsigned thread_count = 0);
+    // Waits for every submitted job to complete.
+    ~AsyncQueue();
+
+    AsyncQueue(const AsyncQueue&) = delete;
+    AsyncQueue& operator=(const AsyncQueue&) = delete;
+
+    // Queues job; done runs on a worker thread once all of it is done.
+    // An exception thrown by done is caught and dropped, since there is
+    // no one left to report it to. Throws std::invalid_argument, without
+    // queuing, if a key the mode needs is missing or length does not suit
+    // the mode, GCM's limit included.
+    void Submit(const AsyncJob& job, AsyncCallback done);
+    // The future rethrows AsyncResult::error instead of returning it.
+    std::future<AsyncResult> Submit(const AsyncJob& job);
+
+    unsigned Size() const { return static_cast<unsigned>(workers_.size()); }
+
+private:
+    struct Task;
+
+    // Chunks [begin, end) of a task; the owner keeps halving it and
+    // pushes the upper halves where thieves can take them.
+    struct Piece {
+        Task* task;
+        size_t begin;
+        size_t end;
+    };
+
+    // Chase-Lev deque: only the owner pushes and pops at the bottom,
+    // other workers steal from the top.
+    class StealDeque {
+    public:
+        StealDeque();
+        // Push fails only when Full(), which the owner checks first.
+        bool Push(Piece* piece);
+        Piece* Pop();
+        Piece* Steal();
+        // Owner only: a full deque stays full until the owner pops.
+        bool Full() const;
+        bool Empty() const;
+
+    private:
+        static const int64_t capacity = 256;
+        std::atomic<int64_t> top_;
+        std::atomic<int64_t> bottom_;
+        std::atomic<Piece*> slots_[capacity];
+    };
+
+    void WorkerLoop(unsigned index);
+    bool HasWork();
+    Piece* Start(Task* task);
+    void Run(unsigned index, Piece* piece);
+    void Finish(Task* task);
+
+    std::vector<std::thread> workers_;
+    std::vector<std::unique_ptr<StealDeque>> deques_;
+
+    std::mutex mutex_;
+    std::condition_variable work_ready_;
+    std::condition_variable all_done_;
+    // Submitted jobs no worker has picked up yet.
+    std::deque<Task*> incoming_;
+    std::atomic<size_t> incoming_count_;
+    std::atomic<unsigned> idle_;
+    size_t outstanding_;
+    bool stopping_;
+};
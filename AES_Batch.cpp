@@ -0,0 +1,51 @@
+// AES_Batch.cpp : Single blocks under many keys, interleaved.
+//
+#include "AES_UNSW.h"
+#include "AES_Engine.h"
+
+// Jobs gathered per engine call: a multiple of every engine's interleave
+// width, small enough for the pointer arrays to stay on the stack.
+#define BATCH_GROUP_BLOCKS 64
+
+namespace {
+
+bool SameSchedule(const AesKey& a, const AesKey& b) {
+    return a.engine == b.engine && a.number_rounds == b.number_rounds;
+}
+
+void CryptBlockBatch(const BlockJob* jobs, size_t count, bool encrypting) {
+    const unsigned char* keys[BATCH_GROUP_BLOCKS];
+    const unsigned char* in[BATCH_GROUP_BLOCKS];
+    unsigned char* out[BATCH_GROUP_BLOCKS];
+
+    size_t i = 0;
+    while (i < count) {
+        const AesKey& first = *jobs[i].key;
+        size_t n = 0;
+        while (i + n < count && n < BATCH_GROUP_BLOCKS &&
+               SameSchedule(first, *jobs[i + n].key)) {
+            const BlockJob& job = jobs[i + n];
+            keys[n] = encrypting ? job.key->enc_keys : job.key->dec_keys;
+            in[n] = job.in;
+            out[n] = job.out;
+            n++;
+        }
+        if (encrypting) {
+            first.engine->encrypt_multi_key(keys, first.number_rounds, in, out, n);
+        } else {
+            first.engine->decrypt_multi_key(keys, first.number_rounds, in, out, n);
+        }
+        i += n;
+    }
+}
+
+} // namespace
+
+
+void EncryptBlockBatch(const BlockJob* jobs, size_t count) {
+    CryptBlockBatch(jobs, count, true);
+}
+
+void DecryptBlockBatch(const BlockJob* jobs, size_t count) {
+    CryptBlockBatch(jobs, count, false);
+}
@@ -0,0 +1,492 @@
+// AES_Bench.cpp : Throughput benchmark of every engine and mode.
+//
+// Every case works in place on one buffer allocated up front, so memory
+// use is --max-size plus a block whatever the number of cases. Times are
+// wall clock; cycles come from the time-stamp counter, which ticks at the
+// nominal frequency rather than the boosted one.
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "AES_Bench.h"
+#include "AES_Codec.h"
+#include "AES_KeyCache.h"
+#include "AES_Modes.h"
+#include "AES_Perf.h"
+#include "AES_ThreadPool.h"
+
+#if defined(AES_X86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+// Sizes go 16, 64, 256, ... bytes.
+#define BENCH_SIZE_STEP 4
+#define BENCH_DEFAULT_MAX_SIZE (1ull << 30)
+#define BENCH_XTS_SECTOR 4096
+#define BENCH_BATCH_KEYS 64
+#define BENCH_BATCH_JOBS 1024
+// CMAC messages of the batch rows are 1..BENCH_CMAC_MAX_MESSAGE bytes,
+// control-message sized.
+#define BENCH_CMAC_MAX_MESSAGE 64
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct BenchOptions {
+    bool json;
+    size_t max_size;
+    int key_bytes;
+    // Seconds each case is repeated for, at least one call.
+    double min_seconds;
+    // Larger sizes of a case are skipped once one call is predicted to
+    // take longer than this.
+    double max_call_seconds;
+    std::string engine_filter;
+    std::string mode_filter;
+};
+
+struct Timing {
+    uint64_t iterations;
+    double seconds;
+    uint64_t cycles;
+};
+
+struct BenchCase {
+    const char* mode;
+    const char* operation;
+    // Whether the mode splits large buffers across DefaultThreadPool().
+    bool parallel;
+    // Runs the operation once over `bytes` bytes of the buffer.
+    std::function<void(size_t bytes)> run;
+};
+
+uint64_t ReadCycles() {
+#if defined(AES_X86)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Calls body in doubling batches until min_seconds have passed, so the
+// clock is read rarely even for single-block cases.
+template <typename Body>
+Timing Measure(double min_seconds, Body&& body) {
+    Timing timing = {};
+    uint64_t batch = 1;
+    Clock::time_point start = Clock::now();
+    uint64_t start_cycles = ReadCycles();
+    for (;;) {
+        for (uint64_t i = 0; i < batch; i++) {
+            body();
+        }
+        timing.iterations += batch;
+        timing.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        if (timing.seconds >= min_seconds) {
+            break;
+        }
+        batch *= 2;
+    }
+    timing.cycles = ReadCycles() - start_cycles;
+    return timing;
+}
+
+class Reporter {
+public:
+    explicit Reporter(const BenchOptions& options) : options_(options), rows_(0) {
+        if (options_.json) {
+            const CpuFeatures& cpu = GetCpuFeatures();
+            std::cout << "{\n  \"key_bits\": " << 8 * options_.key_bytes
+                      << ",\n  \"threads_available\": "
+                      << DefaultThreadPool().Capacity()
+                      << ",\n  \"cpu\": {\"aesni\": " << Bool(cpu.aesni)
+                      << ", \"pclmul\": " << Bool(cpu.pclmul)
+                      << ", \"avx2\": " << Bool(cpu.avx2)
+                      << "},\n  \"results\": [";
+        } else {
+            std::cout << "engine,mode,operation,key_bits,bytes,threads,"
+                         "iterations,seconds,gb_per_s,cycles_per_byte\n";
+        }
+    }
+
+    ~Reporter() {
+        if (options_.json) {
+            std::cout << "\n  ]\n}" << std::endl;
+        } else {
+            std::cout.flush();
+        }
+    }
+
+    void Row(const char* engine, const char* mode, const char* operation,
+             size_t bytes, unsigned threads, const Timing& timing) {
+        double total = static_cast<double>(bytes) * timing.iterations;
+        double gb_per_s = total / timing.seconds / 1e9;
+        double cycles_per_byte = timing.cycles / total;
+        if (options_.json) {
+            std::cout << (rows_ ? ",\n" : "\n")
+                      << "    {\"engine\": \"" << engine
+                      << "\", \"mode\": \"" << mode
+                      << "\", \"operation\": \"" << operation
+                      << "\", \"bytes\": " << bytes
+                      << ", \"threads\": " << threads
+                      << ", \"iterations\": " << timing.iterations
+                      << ", \"seconds\": " << timing.seconds
+                      << ", \"gb_per_s\": " << gb_per_s
+                      << ", \"cycles_per_byte\": " << cycles_per_byte << "}";
+        } else {
+            std::cout << engine << ',' << mode << ',' << operation << ','
+                      << 8 * options_.key_bytes << ',' << bytes << ','
+                      << threads << ',' << timing.iterations << ','
+                      << timing.seconds << ',' << gb_per_s << ','
+                      << cycles_per_byte << '\n';
+        }
+        rows_++;
+    }
+
+private:
+    static const char* Bool(bool value) { return value ? "true" : "false"; }
+
+    const BenchOptions& options_;
+    size_t rows_;
+};
+
+// 1, 2, 4, ... and finally every thread the pool has.
+std::vector<unsigned> ThreadCounts() {
+    unsigned capacity = DefaultThreadPool().Capacity();
+    std::vector<unsigned> counts;
+    for (unsigned n = 1; n < capacity; n *= 2) {
+        counts.push_back(n);
+    }
+    counts.push_back(capacity);
+    return counts;
+}
+
+std::vector<const AesEngine*> Engines() {
+    std::vector<const AesEngine*> engines = {
+        &portable_engine, &table_engine, &bitslice_engine,
+    };
+#if defined(AES_X86)
+    if (GetCpuFeatures().aesni) {
+        engines.push_back(&aesni_engine);
+        engines.push_back(&aesni_x4_engine);
+    }
+#endif
+    return engines;
+}
+
+bool Selected(const std::string& filter, const char* name) {
+    return filter.empty() || filter == name;
+}
+
+void BenchEngine(const AesEngine& engine, const BenchOptions& options,
+                 unsigned char* buffer, Reporter& reporter) {
+    unsigned char key_bytes[2 * 32];
+    for (int i = 0; i < 2 * 32; i++) {
+        key_bytes[i] = static_cast<unsigned char>(i * 29 + 7);
+    }
+    AesKey key, tweak_key;
+    BuildAesKey(key, key_bytes, options.key_bytes, engine);
+    BuildAesKey(tweak_key, key_bytes + 32, options.key_bytes, engine);
+    GcmKey gcm_key;
+    BuildGcmKey(gcm_key, key);
+    CmacKey cmac_key;
+    BuildCmacKey(cmac_key, key);
+    const unsigned char iv[16] = { 0xA5, 0x5A };
+    unsigned char tag[16];
+    ThreadPool& pool = DefaultThreadPool();
+
+    // Per-key and per-block costs, with the key size or block as the unit.
+    if (Selected(options.mode_filter, "key")) {
+        alignas(16) unsigned char schedule[MAX_ROUND_KEY_BYTES];
+        reporter.Row(engine.name, "key", "expand", options.key_bytes, 1,
+            Measure(options.min_seconds, [&] {
+                engine.expand_key(key_bytes, options.key_bytes, schedule);
+            }));
+        AesKey built;
+        reporter.Row(engine.name, "key", "build", options.key_bytes, 1,
+            Measure(options.min_seconds, [&] {
+                BuildAesKey(built, key_bytes, options.key_bytes, engine);
+            }));
+        KeyCache cache(1, engine);
+        reporter.Row(engine.name, "key", "cached", options.key_bytes, 1,
+            Measure(options.min_seconds, [&] {
+                cache.Get(key_bytes, options.key_bytes);
+            }));
+    }
+    if (Selected(options.mode_filter, "block")) {
+        alignas(16) unsigned char block[16] = {};
+        // Chained through the same block so calls cannot overlap.
+        reporter.Row(engine.name, "block", "encrypt", BLOCK_SIZE, 1,
+            Measure(options.min_seconds, [&] { EncryptBlock(key, block, block); }));
+        reporter.Row(engine.name, "block", "decrypt", BLOCK_SIZE, 1,
+            Measure(options.min_seconds, [&] { DecryptBlock(key, block, block); }));
+    }
+
+    // One block under each of BENCH_BATCH_KEYS keys in turn, as a gateway
+    // serving many tenants would see it.
+    if (Selected(options.mode_filter, "multikey")) {
+        std::vector<AesKey> keys(BENCH_BATCH_KEYS);
+        for (size_t k = 0; k < keys.size(); k++) {
+            key_bytes[0] = static_cast<unsigned char>(k);
+            BuildAesKey(keys[k], key_bytes, options.key_bytes, engine);
+        }
+        std::vector<BlockJob> jobs(BENCH_BATCH_JOBS);
+        for (size_t i = 0; i < jobs.size(); i++) {
+            unsigned char* block = buffer + BLOCK_SIZE * i;
+            jobs[i].key = &keys[i % keys.size()];
+            jobs[i].in = block;
+            jobs[i].out = block;
+        }
+        reporter.Row(engine.name, "multikey", "encrypt", BLOCK_SIZE * jobs.size(), 1,
+            Measure(options.min_seconds, [&] {
+                EncryptBlockBatch(jobs.data(), jobs.size()); }));
+        reporter.Row(engine.name, "multikey", "decrypt", BLOCK_SIZE * jobs.size(), 1,
+            Measure(options.min_seconds, [&] {
+                DecryptBlockBatch(jobs.data(), jobs.size()); }));
+    }
+
+    // BENCH_BATCH_JOBS short messages of mixed lengths, tagged one at a
+    // time and as one batch.
+    if (Selected(options.mode_filter, "cmac")) {
+        std::vector<CmacJob> jobs(BENCH_BATCH_JOBS);
+        std::vector<unsigned char> tags(BLOCK_SIZE * jobs.size());
+        size_t total = 0;
+        for (size_t i = 0; i < jobs.size(); i++) {
+            jobs[i].in = buffer + BENCH_CMAC_MAX_MESSAGE * (i % 64);
+            jobs[i].length = 1 + (i * 37) % BENCH_CMAC_MAX_MESSAGE;
+            jobs[i].tag = &tags[BLOCK_SIZE * i];
+            total += jobs[i].length;
+        }
+        reporter.Row(engine.name, "cmac", "serial", total, 1,
+            Measure(options.min_seconds, [&] {
+                for (const CmacJob& job : jobs) {
+                    Cmac(cmac_key, job.in, job.length, job.tag);
+                } }));
+        reporter.Row(engine.name, "cmac", "batch", total, 1,
+            Measure(options.min_seconds, [&] {
+                CmacBatch(cmac_key, jobs.data(), jobs.size()); }));
+    }
+
+    const BenchCase cases[] = {
+        { "ecb", "encrypt", false, [&](size_t bytes) {
+            EncryptBlocks(key, buffer, buffer, bytes / BLOCK_SIZE); } },
+        { "ecb", "decrypt", false, [&](size_t bytes) {
+            DecryptBlocks(key, buffer, buffer, bytes / BLOCK_SIZE); } },
+        // Encryption appends a padding block; the buffer has room for it.
+        { "cbc", "encrypt", false, [&](size_t bytes) {
+            CbcEncrypt(key, iv, buffer, bytes, buffer); } },
+        // The padding check fails on benchmark data after all the work.
+        { "cbc", "decrypt", true, [&](size_t bytes) {
+            size_t plain_length;
+            CbcDecrypt(key, iv, buffer, bytes, buffer, plain_length); } },
+        { "ctr", "crypt", true, [&](size_t bytes) {
+            CtrCrypt(key, iv, buffer, buffer, bytes); } },
+        { "gcm", "encrypt", false, [&](size_t bytes) {
+            GcmEncrypt(gcm_key, iv, 12, nullptr, 0, buffer, bytes, buffer, tag); } },
+        // GcmDecrypt would also wipe the output on the bad tag, so the
+        // incremental calls time the decryption alone.
+        { "gcm", "decrypt", false, [&](size_t bytes) {
+            GcmState state;
+            GcmStart(state, gcm_key, iv, 12, nullptr, 0);
+            GcmDecryptUpdate(state, buffer, buffer, bytes);
+            GcmFinish(state, tag); } },
+        { "cmac", "tag", false, [&](size_t bytes) {
+            Cmac(cmac_key, buffer, bytes, tag); } },
+        { "xts", "encrypt", true, [&](size_t bytes) {
+            size_t sector = std::min<size_t>(bytes, BENCH_XTS_SECTOR);
+            XtsEncryptSectors(key, tweak_key, 0, buffer, buffer, sector,
+                              bytes / sector); } },
+        { "xts", "decrypt", true, [&](size_t bytes) {
+            size_t sector = std::min<size_t>(bytes, BENCH_XTS_SECTOR);
+            XtsDecryptSectors(key, tweak_key, 0, buffer, buffer, sector,
+                              bytes / sector); } },
+    };
+
+    std::vector<unsigned> thread_counts = ThreadCounts();
+    for (const BenchCase& bench_case : cases) {
+        if (!Selected(options.mode_filter, bench_case.mode)) {
+            continue;
+        }
+        for (unsigned threads : thread_counts) {
+            bool threaded = threads > 1;
+            if (threaded && !bench_case.parallel) {
+                break;
+            }
+            pool.SetSize(threads);
+            // Below ParallelMinBytes() the thread count makes no difference,
+            // so only the single-thread pass measures small sizes.
+            size_t bytes = threaded ? ParallelMinBytes() : BLOCK_SIZE;
+            double bytes_per_second = 0;
+            for (; bytes <= options.max_size; bytes *= BENCH_SIZE_STEP) {
+                if (bytes_per_second > 0 &&
+                    bytes / bytes_per_second > options.max_call_seconds) {
+                    std::cerr << engine.name << ' ' << bench_case.mode << ' '
+                              << bench_case.operation << ": skipping " << bytes
+                              << " bytes and up with " << threads
+                              << " threads (--max-call-seconds)" << std::endl;
+                    break;
+                }
+                Timing timing = Measure(options.min_seconds,
+                                        [&] { bench_case.run(bytes); });
+                bytes_per_second = bytes * timing.iterations / timing.seconds;
+                reporter.Row(engine.name, bench_case.mode, bench_case.operation,
+                             bytes, threads, timing);
+            }
+        }
+        pool.SetSize(0);
+    }
+}
+
+// Hex and base64 of cipher output, reported under the engine name
+// "codec". Everything stays in the one buffer: n bytes at n..2n are
+// encoded in place over 0..2n, and the text is decoded to 2n..3n.
+void BenchCodec(const BenchOptions& options, unsigned char* buffer,
+                Reporter& reporter) {
+    char* text = reinterpret_cast<char*>(buffer);
+    for (int base64 = 0; base64 < 2; base64++) {
+        const char* mode = base64 ? "base64" : "hex";
+        if (!Selected(options.mode_filter, mode)) {
+            continue;
+        }
+        for (size_t bytes = BLOCK_SIZE; 3 * bytes <= options.max_size;
+             bytes *= BENCH_SIZE_STEP) {
+            size_t text_length = base64 ? Base64EncodedLength(bytes)
+                                        : HexEncodedLength(bytes);
+            reporter.Row("codec", mode, "encode", bytes, 1,
+                Measure(options.min_seconds, [&] {
+                    if (base64) {
+                        Base64Encode(buffer + bytes, bytes, text);
+                    } else {
+                        HexEncode(buffer + bytes, bytes, text);
+                    }
+                }));
+            unsigned char* decoded = buffer + 2 * bytes;
+            size_t decoded_length;
+            reporter.Row("codec", mode, "decode", bytes, 1,
+                Measure(options.min_seconds, [&] {
+                    if (base64) {
+                        Base64Decode(text, text_length, decoded, decoded_length);
+                    } else {
+                        HexDecode(text, text_length, decoded);
+                    }
+                }));
+        }
+    }
+}
+
+// Accepts a plain byte count or one with a K, M or G suffix.
+bool ParseSize(const std::string& text, size_t& size) {
+    char* end = nullptr;
+    unsigned long long value = std::strtoull(text.c_str(), &end, 10);
+    if (end == text.c_str()) {
+        return false;
+    }
+    std::string suffix(end);
+    if (suffix == "K" || suffix == "k") {
+        value <<= 10;
+    } else if (suffix == "M" || suffix == "m") {
+        value <<= 20;
+    } else if (suffix == "G" || suffix == "g") {
+        value <<= 30;
+    } else if (!suffix.empty()) {
+        return false;
+    }
+    size = static_cast<size_t>(value);
+    return size >= BLOCK_SIZE;
+}
+
+bool ParseSeconds(const std::string& text, double& seconds) {
+    char* end = nullptr;
+    seconds = std::strtod(text.c_str(), &end);
+    return end != text.c_str() && *end == '\0' && seconds >= 0;
+}
+
+void PrintUsage() {
+    std::cerr << "Usage: AES_UNSW bench [--format csv|json] [--max-size BYTES[K|M|G]]\n"
+                 "                      [--key-bits 128|192|256] [--engine NAME]\n"
+                 "                      [--mode key|block|multikey|ecb|cbc|ctr|gcm|cmac|xts|hex|base64]\n"
+                 "                      [--min-seconds S] [--max-call-seconds S]"
+              << std::endl;
+}
+
+} // namespace
+
+
+int RunBenchmark(int argc, char* argv[]) {
+    BenchOptions options;
+    options.json = false;
+    options.max_size = BENCH_DEFAULT_MAX_SIZE;
+    options.key_bytes = 16;
+    options.min_seconds = 0.2;
+    options.max_call_seconds = 5;
+
+    // argv[1] is "bench".
+    for (int i = 2; i < argc; i += 2) {
+        std::string option(argv[i]);
+        if (i + 1 >= argc) {
+            PrintUsage();
+            return 2;
+        }
+        std::string value(argv[i + 1]);
+        bool valid = true;
+        if (option == "--format") {
+            valid = value == "csv" || value == "json";
+            options.json = value == "json";
+        } else if (option == "--max-size") {
+            valid = ParseSize(value, options.max_size);
+        } else if (option == "--key-bits") {
+            options.key_bytes = std::atoi(value.c_str()) / 8;
+            valid = options.key_bytes == 16 || options.key_bytes == 24 ||
+                    options.key_bytes == 32;
+        } else if (option == "--engine") {
+            options.engine_filter = value;
+        } else if (option == "--mode") {
+            options.mode_filter = value;
+        } else if (option == "--min-seconds") {
+            valid = ParseSeconds(value, options.min_seconds);
+        } else if (option == "--max-call-seconds") {
+            valid = ParseSeconds(value, options.max_call_seconds);
+        } else {
+            valid = false;
+        }
+        if (!valid) {
+            PrintUsage();
+            return 2;
+        }
+    }
+
+    // Room for the CBC padding block; filled once so that no case pays for
+    // first-touch page faults.
+    std::vector<unsigned char> buffer(
+        std::max<size_t>(options.max_size, BLOCK_SIZE * BENCH_BATCH_JOBS) + BLOCK_SIZE);
+    for (size_t i = 0; i < buffer.size(); i++) {
+        buffer[i] = static_cast<unsigned char>(i * 131 + (i >> 8));
+    }
+
+    Reporter reporter(options);
+    for (const AesEngine* engine : Engines()) {
+        if (Selected(options.engine_filter, engine->name)) {
+            BenchEngine(*engine, options, buffer.data(), reporter);
+        }
+    }
+    if (Selected(options.engine_filter, "codec")) {
+        BenchCodec(options, buffer.data(), reporter);
+    }
+#if AES_PERF_ENABLED
+    // Counters from every case above, kept off stdout so the results
+    // stay machine readable.
+    DumpPerfCounters(std::cerr);
+#endif
+    return 0;
+}
@@ -0,0 +1,17 @@
+// AES_Bench.h : Throughput benchmark of every engine and mode.
+//
+#pragma once
+
+// Runs `AES_UNSW bench [options]` and returns the process exit code: 0 on
+// success, 2 on bad arguments.
+//
+// For every engine this CPU can run, measures key expansion, single-block
+// encrypt/decrypt and ECB, CBC, CTR, GCM, CMAC and XTS over message sizes
+// from 16 bytes up to --max-size in powers of 4. Sizes large enough for
+// the modes to go parallel are repeated for 1, 2, 4, ... threads up to
+// every core. CMAC is also timed over a batch of short messages, one call
+// per message and as one CmacBatch. Hex and base64 encoding and decoding
+// are measured too, under the engine name "codec". Each row reports GB/s
+// and cycles/byte, as CSV or JSON on stdout so that results from two
+// releases can be diffed.
+int RunBenchmark(int argc, char* argv[]);
@@ -0,0 +1,470 @@
+// AES_BitsliceCore.inl : Bitsliced AES rounds, written once against a
+// generic word of 64-bit lanes.
+//
+// AES_BitsliceEngine.cpp includes this file once per vector width, inside
+// a namespace that first defines:
+//   Word             LANES independent 64-bit lanes supporting ^ & | ~
+//                    and per-lane << and >> by a constant
+//   LANES            number of 64-bit lanes in a Word
+//   Broadcast(x)     Word with every lane set to x
+//   LoadLanes(p)     Word from LANES consecutive uint64_t
+//   StoreLanes(p, w) the reverse of LoadLanes
+// and uses WipeStack(p, n) of the including file to clear the bitsliced
+// round keys from the stack before returning.
+//
+// Every lane carries four blocks in the layout of T. Pornin's aes_ct64:
+// q[j] holds bit j of every state byte, so SubBytes is a boolean circuit
+// over q[0..7] and ShiftRows/MixColumns are fixed shifts and masks. No
+// memory access, branch or shift count depends on key or data.
+
+const int BLOCKS = 4 * LANES;
+
+// Swaps the bits selected by cl in x with the bits selected by ch in y.
+inline void SwapBits(Word& x, Word& y, uint64_t cl, uint64_t ch, int s) {
+    Word a = x;
+    Word b = y;
+    x = (a & Broadcast(cl)) | ((b & Broadcast(cl)) << s);
+    y = ((a & Broadcast(ch)) >> s) | (b & Broadcast(ch));
+}
+
+// Moves between the interleaved byte layout and bit planes. It is an
+// involution, so the same transform is used on the way in and out.
+inline void Ortho(Word q[8]) {
+    const uint64_t m1l = 0x5555555555555555ULL, m1h = 0xAAAAAAAAAAAAAAAAULL;
+    const uint64_t m2l = 0x3333333333333333ULL, m2h = 0xCCCCCCCCCCCCCCCCULL;
+    const uint64_t m4l = 0x0F0F0F0F0F0F0F0FULL, m4h = 0xF0F0F0F0F0F0F0F0ULL;
+    SwapBits(q[0], q[1], m1l, m1h, 1);
+    SwapBits(q[2], q[3], m1l, m1h, 1);
+    SwapBits(q[4], q[5], m1l, m1h, 1);
+    SwapBits(q[6], q[7], m1l, m1h, 1);
+    SwapBits(q[0], q[2], m2l, m2h, 2);
+    SwapBits(q[1], q[3], m2l, m2h, 2);
+    SwapBits(q[4], q[6], m2l, m2h, 2);
+    SwapBits(q[5], q[7], m2l, m2h, 2);
+    SwapBits(q[0], q[4], m4l, m4h, 4);
+    SwapBits(q[1], q[5], m4l, m4h, 4);
+    SwapBits(q[2], q[6], m4l, m4h, 4);
+    SwapBits(q[3], q[7], m4l, m4h, 4);
+}
+
+// Spreads the four little-endian words of a block over two 64-bit values,
+// one byte of every 16 bits, as Ortho expects.
+inline void InterleaveIn(uint64_t& q0, uint64_t& q1, const unsigned char* in) {
+    uint64_t x[4];
+    for (int i = 0; i < 4; i++) {
+        x[i] = (uint64_t)in[4 * i] | ((uint64_t)in[4 * i + 1] << 8) |
+               ((uint64_t)in[4 * i + 2] << 16) | ((uint64_t)in[4 * i + 3] << 24);
+        x[i] |= x[i] << 16;
+        x[i] &= 0x0000FFFF0000FFFFULL;
+        x[i] |= x[i] << 8;
+        x[i] &= 0x00FF00FF00FF00FFULL;
+    }
+    q0 = x[0] | (x[2] << 8);
+    q1 = x[1] | (x[3] << 8);
+}
+
+inline void InterleaveOut(unsigned char* out, uint64_t q0, uint64_t q1) {
+    uint64_t x[4];
+    x[0] = q0 & 0x00FF00FF00FF00FFULL;
+    x[1] = q1 & 0x00FF00FF00FF00FFULL;
+    x[2] = (q0 >> 8) & 0x00FF00FF00FF00FFULL;
+    x[3] = (q1 >> 8) & 0x00FF00FF00FF00FFULL;
+    for (int i = 0; i < 4; i++) {
+        x[i] |= x[i] >> 8;
+        x[i] &= 0x0000FFFF0000FFFFULL;
+        uint32_t w = (uint32_t)x[i] | (uint32_t)(x[i] >> 16);
+        out[4 * i] = (unsigned char)w;
+        out[4 * i + 1] = (unsigned char)(w >> 8);
+        out[4 * i + 2] = (unsigned char)(w >> 16);
+        out[4 * i + 3] = (unsigned char)(w >> 24);
+    }
+}
+
+// Loads up to BLOCKS blocks; missing blocks are zero.
+inline void LoadBlocks(const unsigned char* in, size_t blocks, Word q[8]) {
+    uint64_t lanes[8][LANES] = {};
+    for (size_t b = 0; b < blocks; b++) {
+        size_t lane = b >> 2;
+        size_t slot = b & 3;
+        InterleaveIn(lanes[slot][lane], lanes[slot + 4][lane], in + 16 * b);
+    }
+    for (int j = 0; j < 8; j++) {
+        q[j] = LoadLanes(lanes[j]);
+    }
+    Ortho(q);
+}
+
+inline void StoreBlocks(Word q[8], unsigned char* out, size_t blocks) {
+    uint64_t lanes[8][LANES];
+    Ortho(q);
+    for (int j = 0; j < 8; j++) {
+        StoreLanes(lanes[j], q[j]);
+    }
+    for (size_t b = 0; b < blocks; b++) {
+        size_t lane = b >> 2;
+        size_t slot = b & 3;
+        InterleaveOut(out + 16 * b, lanes[slot][lane], lanes[slot + 4][lane]);
+    }
+}
+
+// Round keys are the same for every block, so each is bitsliced once and
+// broadcast to all lanes.
+inline void ExpandRoundKeys(const unsigned char round_keys[], int number_rounds,
+                            Word sk[][8]) {
+    for (int round = 0; round <= number_rounds; round++) {
+        uint64_t lo, hi;
+        InterleaveIn(lo, hi, round_keys + 16 * round);
+        for (int j = 0; j < 4; j++) {
+            sk[round][j] = Broadcast(lo);
+            sk[round][j + 4] = Broadcast(hi);
+        }
+        Ortho(sk[round]);
+    }
+}
+
+inline void AddRoundKey(Word q[8], const Word sk[8]) {
+    for (int j = 0; j < 8; j++) {
+        q[j] = q[j] ^ sk[j];
+    }
+}
+
+// S-box as a 113 gate circuit (Boyar and Peralta): a linear layer, the
+// GF(2^8) inversion in tower-field form, and a linear layer folding in the
+// affine transform.
+inline void SubBytes(Word q[8]) {
+    Word x0 = q[7], x1 = q[6], x2 = q[5], x3 = q[4];
+    Word x4 = q[3], x5 = q[2], x6 = q[1], x7 = q[0];
+
+    Word y14 = x3 ^ x5;
+    Word y13 = x0 ^ x6;
+    Word y9 = x0 ^ x3;
+    Word y8 = x0 ^ x5;
+    Word t0 = x1 ^ x2;
+    Word y1 = t0 ^ x7;
+    Word y4 = y1 ^ x3;
+    Word y12 = y13 ^ y14;
+    Word y2 = y1 ^ x0;
+    Word y5 = y1 ^ x6;
+    Word y3 = y5 ^ y8;
+    Word t1 = x4 ^ y12;
+    Word y15 = t1 ^ x5;
+    Word y20 = t1 ^ x1;
+    Word y6 = y15 ^ x7;
+    Word y10 = y15 ^ t0;
+    Word y11 = y20 ^ y9;
+    Word y7 = x7 ^ y11;
+    Word y17 = y10 ^ y11;
+    Word y19 = y10 ^ y8;
+    Word y16 = t0 ^ y11;
+    Word y21 = y13 ^ y16;
+    Word y18 = x0 ^ y16;
+
+    Word t2 = y12 & y15;
+    Word t3 = y3 & y6;
+    Word t4 = t3 ^ t2;
+    Word t5 = y4 & x7;
+    Word t6 = t5 ^ t2;
+    Word t7 = y13 & y16;
+    Word t8 = y5 & y1;
+    Word t9 = t8 ^ t7;
+    Word t10 = y2 & y7;
+    Word t11 = t10 ^ t7;
+    Word t12 = y9 & y11;
+    Word t13 = y14 & y17;
+    Word t14 = t13 ^ t12;
+    Word t15 = y8 & y10;
+    Word t16 = t15 ^ t12;
+    Word t17 = t4 ^ t14;
+    Word t18 = t6 ^ t16;
+    Word t19 = t9 ^ t14;
+    Word t20 = t11 ^ t16;
+    Word t21 = t17 ^ y20;
+    Word t22 = t18 ^ y19;
+    Word t23 = t19 ^ y21;
+    Word t24 = t20 ^ y18;
+    Word t25 = t21 ^ t22;
+    Word t26 = t21 & t23;
+    Word t27 = t24 ^ t26;
+    Word t28 = t25 & t27;
+    Word t29 = t28 ^ t22;
+    Word t30 = t23 ^ t24;
+    Word t31 = t22 ^ t26;
+    Word t32 = t31 & t30;
+    Word t33 = t32 ^ t24;
+    Word t34 = t23 ^ t33;
+    Word t35 = t27 ^ t33;
+    Word t36 = t24 & t35;
+    Word t37 = t36 ^ t34;
+    Word t38 = t27 ^ t36;
+    Word t39 = t29 & t38;
+    Word t40 = t25 ^ t39;
+    Word t41 = t40 ^ t37;
+    Word t42 = t29 ^ t33;
+    Word t43 = t29 ^ t40;
+    Word t44 = t33 ^ t37;
+    Word t45 = t42 ^ t41;
+    Word z0 = t44 & y15;
+    Word z1 = t37 & y6;
+    Word z2 = t33 & x7;
+    Word z3 = t43 & y16;
+    Word z4 = t40 & y1;
+    Word z5 = t29 & y7;
+    Word z6 = t42 & y11;
+    Word z7 = t45 & y17;
+    Word z8 = t41 & y10;
+    Word z9 = t44 & y12;
+    Word z10 = t37 & y3;
+    Word z11 = t33 & y4;
+    Word z12 = t43 & y13;
+    Word z13 = t40 & y5;
+    Word z14 = t29 & y2;
+    Word z15 = t42 & y9;
+    Word z16 = t45 & y14;
+    Word z17 = t41 & y8;
+
+    Word t46 = z15 ^ z16;
+    Word t47 = z10 ^ z11;
+    Word t48 = z5 ^ z13;
+    Word t49 = z9 ^ z10;
+    Word t50 = z2 ^ z12;
+    Word t51 = z2 ^ z5;
+    Word t52 = z7 ^ z8;
+    Word t53 = z0 ^ z3;
+    Word t54 = z6 ^ z7;
+    Word t55 = z16 ^ z17;
+    Word t56 = z12 ^ t48;
+    Word t57 = t50 ^ t53;
+    Word t58 = z4 ^ t46;
+    Word t59 = z3 ^ t54;
+    Word t60 = t46 ^ t57;
+    Word t61 = z14 ^ t57;
+    Word t62 = t52 ^ t58;
+    Word t63 = t49 ^ t58;
+    Word t64 = z4 ^ t59;
+    Word t65 = t61 ^ t62;
+    Word t66 = z1 ^ t63;
+    Word s0 = t59 ^ t63;
+    Word s6 = t56 ^ ~t62;
+    Word s7 = t48 ^ ~t60;
+    Word t67 = t64 ^ t65;
+    Word s3 = t53 ^ t66;
+    Word s4 = t51 ^ t66;
+    Word s5 = t47 ^ t65;
+    Word s1 = t64 ^ ~s3;
+    Word s2 = t55 ^ ~t67;
+
+    q[7] = s0; q[6] = s1; q[5] = s2; q[4] = s3;
+    q[3] = s4; q[2] = s5; q[1] = s6; q[0] = s7;
+}
+
+// Inverse affine transform of the S-box: bit i becomes
+// b(i+2) ^ b(i+5) ^ b(i+7) ^ bit i of {05}.
+inline void InverseAffine(Word q[8]) {
+    Word t[8];
+    for (int i = 0; i < 8; i++) {
+        t[i] = q[(i + 2) & 7] ^ q[(i + 5) & 7] ^ q[(i + 7) & 7];
+    }
+    for (int i = 0; i < 8; i++) {
+        q[i] = t[i];
+    }
+    q[0] = ~q[0];
+    q[2] = ~q[2];
+}
+
+// InvS = InverseAffine o S o InverseAffine, so the forward circuit is reused.
+inline void InverseSubBytes(Word q[8]) {
+    InverseAffine(q);
+    SubBytes(q);
+    InverseAffine(q);
+}
+
+inline void ShiftRows(Word q[8]) {
+    for (int i = 0; i < 8; i++) {
+        Word x = q[i];
+        q[i] = (x & Broadcast(0x000000000000FFFFULL))
+             | ((x & Broadcast(0x00000000FFF00000ULL)) >> 4)
+             | ((x & Broadcast(0x00000000000F0000ULL)) << 12)
+             | ((x & Broadcast(0x0000FF0000000000ULL)) >> 8)
+             | ((x & Broadcast(0x000000FF00000000ULL)) << 8)
+             | ((x & Broadcast(0xF000000000000000ULL)) >> 12)
+             | ((x & Broadcast(0x0FFF000000000000ULL)) << 4);
+    }
+}
+
+inline void InverseShiftRows(Word q[8]) {
+    for (int i = 0; i < 8; i++) {
+        Word x = q[i];
+        q[i] = (x & Broadcast(0x000000000000FFFFULL))
+             | ((x & Broadcast(0x000000000FFF0000ULL)) << 4)
+             | ((x & Broadcast(0x00000000F0000000ULL)) >> 12)
+             | ((x & Broadcast(0x0000FF0000000000ULL)) >> 8)
+             | ((x & Broadcast(0x000000FF00000000ULL)) << 8)
+             | ((x & Broadcast(0xFFF0000000000000ULL)) >> 4)
+             | ((x & Broadcast(0x000F000000000000ULL)) << 12);
+    }
+}
+
+// Row i + 1 of a column is 16 bits further along a lane, row i + 2 is 32.
+inline Word NextRow(Word x) {
+    return (x >> 16) | (x << 48);
+}
+
+inline Word OppositeRow(Word x) {
+    return (x << 32) | (x >> 32);
+}
+
+// b(i) = 2 a(i) ^ 3 a(i+1) ^ a(i+2) ^ a(i+3); multiplying by {02} moves
+// plane j to j + 1 and folds plane 7 back in as {1b}.
+inline void MixColumns(Word q[8]) {
+    Word q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+    Word q4 = q[4], q5 = q[5], q6 = q[6], q7 = q[7];
+    Word r0 = NextRow(q0), r1 = NextRow(q1), r2 = NextRow(q2), r3 = NextRow(q3);
+    Word r4 = NextRow(q4), r5 = NextRow(q5), r6 = NextRow(q6), r7 = NextRow(q7);
+
+    q[0] = q7 ^ r7 ^ r0 ^ OppositeRow(q0 ^ r0);
+    q[1] = q0 ^ r0 ^ q7 ^ r7 ^ r1 ^ OppositeRow(q1 ^ r1);
+    q[2] = q1 ^ r1 ^ r2 ^ OppositeRow(q2 ^ r2);
+    q[3] = q2 ^ r2 ^ q7 ^ r7 ^ r3 ^ OppositeRow(q3 ^ r3);
+    q[4] = q3 ^ r3 ^ q7 ^ r7 ^ r4 ^ OppositeRow(q4 ^ r4);
+    q[5] = q4 ^ r4 ^ r5 ^ OppositeRow(q5 ^ r5);
+    q[6] = q5 ^ r5 ^ r6 ^ OppositeRow(q6 ^ r6);
+    q[7] = q6 ^ r6 ^ r7 ^ OppositeRow(q7 ^ r7);
+}
+
+inline void Xtime(Word t[8]) {
+    Word t7 = t[7];
+    t[7] = t[6];
+    t[6] = t[5];
+    t[5] = t[4];
+    t[4] = t[3] ^ t7;
+    t[3] = t[2] ^ t7;
+    t[2] = t[1];
+    t[1] = t[0] ^ t7;
+    t[0] = t7;
+}
+
+// Inverse(M) = M x {05, 00, 04, 00}: first a(i) ^= 4 (a(i) ^ a(i+2)),
+// then the forward MixColumns.
+inline void InverseMixColumns(Word q[8]) {
+    Word t[8];
+    for (int j = 0; j < 8; j++) {
+        t[j] = q[j] ^ OppositeRow(q[j]);
+    }
+    Xtime(t);
+    Xtime(t);
+    for (int j = 0; j < 8; j++) {
+        q[j] = q[j] ^ t[j];
+    }
+    MixColumns(q);
+}
+
+inline void EncryptRounds(const Word sk[][8], int number_rounds, Word q[8]) {
+    AddRoundKey(q, sk[0]);
+    for (int round = 1; round < number_rounds; round++) {
+        SubBytes(q);
+        ShiftRows(q);
+        MixColumns(q);
+        AddRoundKey(q, sk[round]);
+    }
+    SubBytes(q);
+    ShiftRows(q);
+    AddRoundKey(q, sk[number_rounds]);
+}
+
+// Equivalent inverse cipher: sk must come from the inverted schedule.
+inline void DecryptRounds(const Word sk[][8], int number_rounds, Word q[8]) {
+    AddRoundKey(q, sk[0]);
+    for (int round = 1; round < number_rounds; round++) {
+        InverseSubBytes(q);
+        InverseShiftRows(q);
+        InverseMixColumns(q);
+        AddRoundKey(q, sk[round]);
+    }
+    InverseSubBytes(q);
+    InverseShiftRows(q);
+    AddRoundKey(q, sk[number_rounds]);
+}
+
+inline void EncryptBlocks(const unsigned char enc_keys[], int number_rounds,
+                          const unsigned char* in, unsigned char* out,
+                          size_t blocks) {
+    Word sk[MAX_ROUNDS + 1][8];
+    Word q[8];
+    ExpandRoundKeys(enc_keys, number_rounds, sk);
+    while (blocks) {
+        size_t n = blocks < (size_t)BLOCKS ? blocks : (size_t)BLOCKS;
+        LoadBlocks(in, n, q);
+        EncryptRounds(sk, number_rounds, q);
+        StoreBlocks(q, out, n);
+        in += 16 * n;
+        out += 16 * n;
+        blocks -= n;
+    }
+    WipeStack(sk, sizeof(sk));
+}
+
+inline void DecryptBlocks(const unsigned char dec_keys[], int number_rounds,
+                          const unsigned char* in, unsigned char* out,
+                          size_t blocks) {
+    Word sk[MAX_ROUNDS + 1][8];
+    Word q[8];
+    ExpandRoundKeys(dec_keys, number_rounds, sk);
+    while (blocks) {
+        size_t n = blocks < (size_t)BLOCKS ? blocks : (size_t)BLOCKS;
+        LoadBlocks(in, n, q);
+        DecryptRounds(sk, number_rounds, q);
+        StoreBlocks(q, out, n);
+        in += 16 * n;
+        out += 16 * n;
+        blocks -= n;
+    }
+    WipeStack(sk, sizeof(sk));
+}
+
+// Each block under its own schedule: round key r of block b is bitsliced
+// into block b's position, exactly as LoadBlocks places the block itself,
+// so AddRoundKey applies every block's own key.
+inline void LoadMultiKeyRoundKeys(const unsigned char* const keys[],
+                                  size_t blocks, int number_rounds,
+                                  Word sk[][8]) {
+    unsigned char round_keys[16 * BLOCKS];
+    for (int round = 0; round <= number_rounds; round++) {
+        for (size_t b = 0; b < blocks; b++) {
+            std::memcpy(round_keys + 16 * b, keys[b] + 16 * round, 16);
+        }
+        LoadBlocks(round_keys, blocks, sk[round]);
+    }
+    WipeStack(round_keys, sizeof(round_keys));
+}
+
+// Gathered through a buffer so out[i] may equal in[i].
+inline void CryptMultiKey(const unsigned char* const keys[], int number_rounds,
+                          const unsigned char* const in[],
+                          unsigned char* const out[], size_t count,
+                          bool encrypting) {
+    Word sk[MAX_ROUNDS + 1][8];
+    Word q[8];
+    unsigned char blocks_buffer[16 * BLOCKS];
+    while (count) {
+        size_t n = count < (size_t)BLOCKS ? count : (size_t)BLOCKS;
+        for (size_t b = 0; b < n; b++) {
+            std::memcpy(blocks_buffer + 16 * b, in[b], 16);
+        }
+        LoadBlocks(blocks_buffer, n, q);
+        LoadMultiKeyRoundKeys(keys, n, number_rounds, sk);
+        if (encrypting) {
+            EncryptRounds(sk, number_rounds, q);
+        } else {
+            DecryptRounds(sk, number_rounds, q);
+        }
+        StoreBlocks(q, blocks_buffer, n);
+        for (size_t b = 0; b < n; b++) {
+            std::memcpy(out[b], blocks_buffer + 16 * b, 16);
+        }
+        keys += n;
+        in += n;
+        out += n;
+        count -= n;
+    }
+    WipeStack(sk, sizeof(sk));
+}
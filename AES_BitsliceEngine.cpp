@@ -0,0 +1,277 @@
+// AES_BitsliceEngine.cpp : Constant-time bitsliced AES engine.
+//
+// Processes independent blocks side by side: 4 per 64-bit lane, so 8 per
+// pass with SSE2 and 16 with AVX2. The S-box is evaluated as a boolean
+// circuit, so nothing indexes memory with secret data. Meant for batches
+// (CTR keystream, CBC decryption, multi-block calls); a lone block costs
+// as much as a full pass.
+#include <cstddef>
+#include <cstring>
+
+#include "AES_UNSW.h"
+#include "AES_Engine.h"
+
+#if defined(AES_X86)
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Zeroes key material left in stack buffers, through volatile so the
+// stores are not dropped as dead.
+void WipeStack(void* data, size_t length) {
+    volatile unsigned char* wipe = static_cast<unsigned char*>(data);
+    for (size_t i = 0; i < length; i++) {
+        wipe[i] = 0;
+    }
+}
+
+// Portable form: one 64-bit lane in a general purpose register.
+namespace bitslice64 {
+
+typedef uint64_t Word;
+const int LANES = 1;
+
+inline Word Broadcast(uint64_t x) { return x; }
+inline Word LoadLanes(const uint64_t* p) { return p[0]; }
+inline void StoreLanes(uint64_t* p, Word w) { p[0] = w; }
+
+#include "AES_BitsliceCore.inl"
+
+} // namespace bitslice64
+
+#if defined(AES_X86)
+
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("sse2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#endif
+
+namespace bitslice_sse2 {
+
+struct Word { __m128i v; };
+const int LANES = 2;
+
+inline Word MakeWord(__m128i v) { Word w = { v }; return w; }
+inline Word operator^(Word a, Word b) { return MakeWord(_mm_xor_si128(a.v, b.v)); }
+inline Word operator&(Word a, Word b) { return MakeWord(_mm_and_si128(a.v, b.v)); }
+inline Word operator|(Word a, Word b) { return MakeWord(_mm_or_si128(a.v, b.v)); }
+inline Word operator~(Word a) { return MakeWord(_mm_xor_si128(a.v, _mm_set1_epi32(-1))); }
+inline Word operator<<(Word a, int n) { return MakeWord(_mm_slli_epi64(a.v, n)); }
+inline Word operator>>(Word a, int n) { return MakeWord(_mm_srli_epi64(a.v, n)); }
+inline Word Broadcast(uint64_t x) { return MakeWord(_mm_set1_epi64x((long long)x)); }
+inline Word LoadLanes(const uint64_t* p) {
+    return MakeWord(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+}
+inline void StoreLanes(uint64_t* p, Word w) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), w.v);
+}
+
+#include "AES_BitsliceCore.inl"
+
+} // namespace bitslice_sse2
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+
+namespace bitslice_avx2 {
+
+struct Word { __m256i v; };
+const int LANES = 4;
+
+inline Word MakeWord(__m256i v) { Word w = { v }; return w; }
+inline Word operator^(Word a, Word b) { return MakeWord(_mm256_xor_si256(a.v, b.v)); }
+inline Word operator&(Word a, Word b) { return MakeWord(_mm256_and_si256(a.v, b.v)); }
+inline Word operator|(Word a, Word b) { return MakeWord(_mm256_or_si256(a.v, b.v)); }
+inline Word operator~(Word a) { return MakeWord(_mm256_xor_si256(a.v, _mm256_set1_epi32(-1))); }
+inline Word operator<<(Word a, int n) { return MakeWord(_mm256_slli_epi64(a.v, n)); }
+inline Word operator>>(Word a, int n) { return MakeWord(_mm256_srli_epi64(a.v, n)); }
+inline Word Broadcast(uint64_t x) { return MakeWord(_mm256_set1_epi64x((long long)x)); }
+inline Word LoadLanes(const uint64_t* p) {
+    return MakeWord(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+}
+inline void StoreLanes(uint64_t* p, Word w) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), w.v);
+}
+
+#include "AES_BitsliceCore.inl"
+
+// Non-inline entry points so the AVX2 code is only reached through the
+// runtime check below.
+void EncryptBlocksAvx2(const unsigned char enc_keys[], int number_rounds,
+                       const unsigned char* in, unsigned char* out,
+                       size_t blocks) {
+    EncryptBlocks(enc_keys, number_rounds, in, out, blocks);
+}
+
+void DecryptBlocksAvx2(const unsigned char dec_keys[], int number_rounds,
+                       const unsigned char* in, unsigned char* out,
+                       size_t blocks) {
+    DecryptBlocks(dec_keys, number_rounds, in, out, blocks);
+}
+
+void CryptMultiKeyAvx2(const unsigned char* const keys[], int number_rounds,
+                       const unsigned char* const in[],
+                       unsigned char* const out[], size_t count,
+                       bool encrypting) {
+    CryptMultiKey(keys, number_rounds, in, out, count, encrypting);
+}
+
+} // namespace bitslice_avx2
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#endif // AES_X86
+
+
+void BitsliceEncryptBlocks(const unsigned char enc_keys[], int number_rounds,
+                           const unsigned char* in, unsigned char* out,
+                           size_t blocks) {
+#if defined(AES_X86)
+    if (GetCpuFeatures().avx2) {
+        bitslice_avx2::EncryptBlocksAvx2(enc_keys, number_rounds, in, out, blocks);
+    } else {
+        bitslice_sse2::EncryptBlocks(enc_keys, number_rounds, in, out, blocks);
+    }
+#else
+    bitslice64::EncryptBlocks(enc_keys, number_rounds, in, out, blocks);
+#endif
+}
+
+void BitsliceDecryptBlocks(const unsigned char dec_keys[], int number_rounds,
+                           const unsigned char* in, unsigned char* out,
+                           size_t blocks) {
+#if defined(AES_X86)
+    if (GetCpuFeatures().avx2) {
+        bitslice_avx2::DecryptBlocksAvx2(dec_keys, number_rounds, in, out, blocks);
+    } else {
+        bitslice_sse2::DecryptBlocks(dec_keys, number_rounds, in, out, blocks);
+    }
+#else
+    bitslice64::DecryptBlocks(dec_keys, number_rounds, in, out, blocks);
+#endif
+}
+
+// Independent keys cost a bitsliced schedule per pass instead of one per
+// call, but every pass still fills all 8 or 16 block slots.
+void BitsliceCryptMultiKey(const unsigned char* const keys[], int number_rounds,
+                           const unsigned char* const in[],
+                           unsigned char* const out[], size_t count,
+                           bool encrypting) {
+#if defined(AES_X86)
+    if (GetCpuFeatures().avx2) {
+        bitslice_avx2::CryptMultiKeyAvx2(keys, number_rounds, in, out, count,
+                                         encrypting);
+    } else {
+        bitslice_sse2::CryptMultiKey(keys, number_rounds, in, out, count,
+                                     encrypting);
+    }
+#else
+    bitslice64::CryptMultiKey(keys, number_rounds, in, out, count, encrypting);
+#endif
+}
+
+void BitsliceEncryptMultiKey(const unsigned char* const keys[], int number_rounds,
+                             const unsigned char* const in[],
+                             unsigned char* const out[], size_t count) {
+    BitsliceCryptMultiKey(keys, number_rounds, in, out, count, true);
+}
+
+void BitsliceDecryptMultiKey(const unsigned char* const keys[], int number_rounds,
+                             const unsigned char* const in[],
+                             unsigned char* const out[], size_t count) {
+    BitsliceCryptMultiKey(keys, number_rounds, in, out, count, false);
+}
+
+// Same schedule as PortableExpandKey, with SubWord evaluated by the S-box
+// circuit instead of s_box lookups indexed by key bytes.
+void BitsliceExpandKey(const unsigned char* key, int key_bytes,
+                       unsigned char enc_keys[]) {
+    int key_words = key_bytes >> 2;
+    int total_words = 4 * (key_words + 7);
+    unsigned char rcon = 0x01;
+    std::memcpy(enc_keys, key, key_bytes);
+
+    for (int i = key_words; i < total_words; i++) {
+        unsigned char* w = enc_keys + 4 * i;
+        std::memcpy(w, w - 4, 4);
+        bool rotate = (i % key_words) == 0;
+        if (rotate || (key_words > 6 && (i % key_words) == 4)) {
+            unsigned char block[16] = {};
+            for (int k = 0; k < 4; k++) {
+                block[k] = rotate ? w[(k + 1) & 3] : w[k];
+            }
+            bitslice64::Word q[8];
+            bitslice64::LoadBlocks(block, 1, q);
+            bitslice64::SubBytes(q);
+            bitslice64::StoreBlocks(q, block, 1);
+            std::memcpy(w, block, 4);
+            WipeStack(block, sizeof(block));
+            WipeStack(q, sizeof(q));
+            if (rotate) {
+                w[0] ^= rcon;
+                rcon = xtime(rcon);
+            }
+        }
+        for (int k = 0; k < 4; k++) {
+            w[k] ^= w[k - 4 * key_words];
+        }
+    }
+}
+
+// Lone blocks use the narrowest form; the work is the same either way.
+void BitsliceEncryptBlock(const unsigned char enc_keys[], int number_rounds,
+                          const unsigned char in[16], unsigned char out[16]) {
+    bitslice64::EncryptBlocks(enc_keys, number_rounds, in, out, 1);
+}
+
+void BitsliceDecryptBlock(const unsigned char dec_keys[], int number_rounds,
+                          const unsigned char in[16], unsigned char out[16]) {
+    bitslice64::DecryptBlocks(dec_keys, number_rounds, in, out, 1);
+}
+
+// Equivalent inverse cipher schedule, with InvMixColumns evaluated on the
+// bit planes so key setup stays free of table lookups as well.
+void BitsliceInvertKey(const unsigned char enc_keys[], int number_rounds,
+                       unsigned char dec_keys[]) {
+    std::memcpy(dec_keys, enc_keys + 16 * number_rounds, 16);
+    for (int round = 1; round < number_rounds; round++) {
+        bitslice64::Word q[8];
+        bitslice64::LoadBlocks(enc_keys + 16 * (number_rounds - round), 1, q);
+        bitslice64::InverseMixColumns(q);
+        bitslice64::StoreBlocks(q, dec_keys + 16 * round, 1);
+    }
+    std::memcpy(dec_keys + 16 * number_rounds, enc_keys, 16);
+}
+
+} // namespace
+
+
+const AesEngine bitslice_engine = {
+    "bitslice",
+    BitsliceExpandKey,
+    BitsliceInvertKey,
+    BitsliceEncryptBlock,
+    BitsliceDecryptBlock,
+    BitsliceEncryptBlocks,
+    BitsliceDecryptBlocks,
+    BitsliceEncryptMultiKey,
+    BitsliceDecryptMultiKey,
+};
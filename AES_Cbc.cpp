@@ -0,0 +1,125 @@
+// AES_Cbc.cpp : Cipher block chaining with PKCS#7 padding.
+//
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "AES_Modes.h"
+#include "AES_Perf.h"
+#include "AES_ThreadPool.h"
+
+// Ciphertext blocks decrypted per DecryptBlocks call.
+#define CBC_BATCH_BLOCKS 32
+
+namespace {
+
+// Decrypts whole blocks. chain_in is the ciphertext block preceding in[0]
+// (the IV for the first block of the message). Each batch is written back
+// to front, so out may equal in.
+void CbcDecryptRange(const AesKey& key, const unsigned char chain_in[16],
+                     const unsigned char* in, unsigned char* out,
+                     size_t blocks) {
+    AES_PERF_SCOPE(PERF_CBC_DECRYPT, BLOCK_SIZE * blocks);
+    alignas(16) unsigned char plain[CBC_BATCH_BLOCKS * BLOCK_SIZE];
+    unsigned char chain[BLOCK_SIZE];
+    unsigned char next_chain[BLOCK_SIZE];
+    std::memcpy(chain, chain_in, BLOCK_SIZE);
+
+    while (blocks) {
+        size_t n = std::min<size_t>(blocks, CBC_BATCH_BLOCKS);
+        DecryptBlocks(key, in, plain, n);
+        std::memcpy(next_chain, in + BLOCK_SIZE * (n - 1), BLOCK_SIZE);
+        for (size_t i = n - 1; i > 0; i--) {
+            XorBytes(out + BLOCK_SIZE * i, plain + BLOCK_SIZE * i,
+                     in + BLOCK_SIZE * (i - 1), BLOCK_SIZE);
+        }
+        XorBytes(out, plain, chain, BLOCK_SIZE);
+        std::memcpy(chain, next_chain, BLOCK_SIZE);
+        in += BLOCK_SIZE * n;
+        out += BLOCK_SIZE * n;
+        blocks -= n;
+    }
+}
+
+// Returns the padding length, or 0 if the last block is not valid PKCS#7.
+// Every byte is examined whatever the padding value, so the time taken
+// does not reveal where the padding went wrong.
+size_t CheckPadding(const unsigned char last_block[BLOCK_SIZE]) {
+    unsigned pad = last_block[BLOCK_SIZE - 1];
+    unsigned bad = (unsigned)(pad == 0) | (unsigned)(pad > BLOCK_SIZE);
+    for (unsigned i = 0; i < BLOCK_SIZE; i++) {
+        // All ones when byte i lies inside the claimed padding.
+        unsigned in_pad = 0u - (unsigned)(BLOCK_SIZE - i <= pad);
+        bad |= in_pad & (last_block[i] ^ pad);
+    }
+    return bad ? 0 : pad;
+}
+
+} // namespace
+
+
+size_t CbcEncrypt(const AesKey& key, const unsigned char iv[16],
+                  const unsigned char* in, size_t length, unsigned char* out) {
+    AES_PERF_SCOPE(PERF_CBC_ENCRYPT, BLOCK_SIZE * (length / BLOCK_SIZE + 1));
+    unsigned char chain[BLOCK_SIZE];
+    std::memcpy(chain, iv, BLOCK_SIZE);
+
+    size_t full_blocks = length / BLOCK_SIZE;
+    for (size_t i = 0; i < full_blocks; i++) {
+        XorBytes(chain, chain, in + BLOCK_SIZE * i, BLOCK_SIZE);
+        EncryptBlock(key, chain, chain);
+        std::memcpy(out + BLOCK_SIZE * i, chain, BLOCK_SIZE);
+    }
+
+    unsigned char last_block[BLOCK_SIZE];
+    size_t tail = length - BLOCK_SIZE * full_blocks;
+    size_t pad = BLOCK_SIZE - tail;
+    std::memcpy(last_block, in + BLOCK_SIZE * full_blocks, tail);
+    std::memset(last_block + tail, static_cast<int>(pad), pad);
+    XorBytes(chain, chain, last_block, BLOCK_SIZE);
+    EncryptBlock(key, chain, chain);
+    std::memcpy(out + BLOCK_SIZE * full_blocks, chain, BLOCK_SIZE);
+
+    return BLOCK_SIZE * (full_blocks + 1);
+}
+
+
+bool CbcDecrypt(const AesKey& key, const unsigned char iv[16],
+                const unsigned char* in, size_t length, unsigned char* out,
+                size_t& plain_length) {
+    if (length == 0 || length % BLOCK_SIZE) {
+        return false;
+    }
+    size_t blocks = length / BLOCK_SIZE;
+
+    if (length < ParallelMinBytes()) {
+        CbcDecryptRange(key, iv, in, out, blocks);
+    } else {
+        ThreadPool& pool = DefaultThreadPool();
+        size_t parts = pool.Size();
+        // The ciphertext block before each range is copied up front: when
+        // decrypting in place the neighbouring range may overwrite it.
+        std::vector<unsigned char> chains(BLOCK_SIZE * parts);
+        for (size_t p = 0; p < parts; p++) {
+            size_t begin = blocks * p / parts;
+            std::memcpy(&chains[BLOCK_SIZE * p],
+                        begin ? in + BLOCK_SIZE * (begin - 1) : iv, BLOCK_SIZE);
+        }
+        pool.ParallelFor(parts, parts, [&](size_t first, size_t last) {
+            for (size_t p = first; p < last; p++) {
+                size_t begin = blocks * p / parts;
+                size_t end = blocks * (p + 1) / parts;
+                CbcDecryptRange(key, &chains[BLOCK_SIZE * p],
+                                in + BLOCK_SIZE * begin,
+                                out + BLOCK_SIZE * begin, end - begin);
+            }
+        });
+    }
+
+    size_t pad = CheckPadding(out + length - BLOCK_SIZE);
+    if (!pad) {
+        return false;
+    }
+    plain_length = length - pad;
+    return true;
+}
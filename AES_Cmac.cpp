@@ -0,0 +1,134 @@
+// AES_Cmac.cpp : CMAC message authentication, one message or many in lockstep.
+//
+#include <cstring>
+
+#include "AES_Modes.h"
+
+namespace {
+
+// out = in * x in GF(2^128), the block taken big-endian as in SP 800-38B:
+// a one-bit left shift, reduced by 0x87 when the top bit falls off.
+void DoubleSubkey(const unsigned char in[16], unsigned char out[16]) {
+    unsigned char carry = in[0] >> 7;
+    for (int i = 0; i < 15; i++) {
+        out[i] = static_cast<unsigned char>((in[i] << 1) | (in[i + 1] >> 7));
+    }
+    out[15] = static_cast<unsigned char>((in[15] << 1) ^ (0x87 & (0u - carry)));
+}
+
+struct CmacLane {
+    const CmacJob* job;
+    // Next block to absorb.
+    const unsigned char* next;
+    // Blocks still to absorb, the masked last one included.
+    size_t blocks;
+    // Bytes in the last block: 16 if whole, 0..15 if it is padded.
+    size_t last_length;
+};
+
+void StartLane(CmacLane& lane, unsigned char state[16], const CmacJob& job) {
+    lane.job = &job;
+    lane.next = job.in;
+    lane.blocks = job.length ? (job.length + BLOCK_SIZE - 1) / BLOCK_SIZE : 1;
+    lane.last_length = job.length - BLOCK_SIZE * (lane.blocks - 1);
+    std::memset(state, 0, BLOCK_SIZE);
+}
+
+// M_last: the last block XORed with K1 if whole, otherwise padded with a
+// one bit and zeros and XORed with K2.
+void MaskLastBlock(const CmacKey& cmac_key, const CmacLane& lane,
+                   unsigned char block[16]) {
+    if (lane.last_length == BLOCK_SIZE) {
+        XorBytes(block, lane.next, cmac_key.k1, BLOCK_SIZE);
+        return;
+    }
+    std::memset(block, 0, BLOCK_SIZE);
+    if (lane.last_length) {
+        std::memcpy(block, lane.next, lane.last_length);
+    }
+    block[lane.last_length] = 0x80;
+    XorBytes(block, block, cmac_key.k2, BLOCK_SIZE);
+}
+
+} // namespace
+
+
+void BuildCmacKey(CmacKey& cmac_key, const AesKey& key) {
+    cmac_key.key = &key;
+    unsigned char l[16] = {};
+    EncryptBlock(key, l, l);
+    DoubleSubkey(l, cmac_key.k1);
+    DoubleSubkey(cmac_key.k1, cmac_key.k2);
+    volatile unsigned char* wipe = l;
+    for (size_t i = 0; i < sizeof(l); i++) {
+        wipe[i] = 0;
+    }
+}
+
+void WipeCmacKey(CmacKey& cmac_key) {
+    volatile unsigned char* wipe = cmac_key.k1;
+    for (size_t i = 0; i < sizeof(cmac_key.k1); i++) {
+        wipe[i] = 0;
+    }
+    wipe = cmac_key.k2;
+    for (size_t i = 0; i < sizeof(cmac_key.k2); i++) {
+        wipe[i] = 0;
+    }
+}
+
+void Cmac(const CmacKey& cmac_key, const unsigned char* in, size_t length,
+          unsigned char tag[16]) {
+    CmacJob job = { in, length, tag };
+    CmacBatch(cmac_key, &job, 1);
+}
+
+// The chaining values of the active lanes sit side by side in state, so
+// every step is one EncryptBlocks call over up to CMAC_LANES blocks that
+// the engine interleaves round by round. A lane that finishes is filled
+// from the last active one, keeping the active lanes contiguous, and the
+// next job starts in the free slot on the following step.
+void CmacBatch(const CmacKey& cmac_key, const CmacJob* jobs, size_t count) {
+    alignas(16) unsigned char state[CMAC_LANES * BLOCK_SIZE];
+    CmacLane lanes[CMAC_LANES];
+    size_t active = 0;
+    size_t next_job = 0;
+
+    for (;;) {
+        while (active < CMAC_LANES && next_job < count) {
+            StartLane(lanes[active], state + BLOCK_SIZE * active, jobs[next_job]);
+            active++;
+            next_job++;
+        }
+        if (!active) {
+            break;
+        }
+
+        for (size_t i = 0; i < active; i++) {
+            CmacLane& lane = lanes[i];
+            unsigned char* chain = state + BLOCK_SIZE * i;
+            if (lane.blocks > 1) {
+                XorBytes(chain, chain, lane.next, BLOCK_SIZE);
+                lane.next += BLOCK_SIZE;
+            } else {
+                unsigned char last[16];
+                MaskLastBlock(cmac_key, lane, last);
+                XorBytes(chain, chain, last, BLOCK_SIZE);
+            }
+        }
+        EncryptBlocks(*cmac_key.key, state, state, active);
+
+        for (size_t i = 0; i < active;) {
+            if (--lanes[i].blocks) {
+                i++;
+                continue;
+            }
+            std::memcpy(lanes[i].job->tag, state + BLOCK_SIZE * i, BLOCK_SIZE);
+            active--;
+            if (i != active) {
+                lanes[i] = lanes[active];
+                std::memcpy(state + BLOCK_SIZE * i, state + BLOCK_SIZE * active,
+                            BLOCK_SIZE);
+            }
+        }
+    }
+}
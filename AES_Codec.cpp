@@ -0,0 +1,686 @@
+// AES_Codec.cpp : Hex and base64 text forms of binary data.
+//
+// The SIMD paths follow Muła and Lemire, "Faster Base64 Encoding and
+// Decoding Using AVX2 Instructions" (2018): each step loads all its input
+// before it stores anything, which is what lets encoding run in place.
+#include "AES_Codec.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "AES_Cpu.h"
+
+#if defined(AES_X86)
+#include <emmintrin.h>
+#include <immintrin.h>
+#include <tmmintrin.h>
+#endif
+
+namespace {
+
+const char hex_digits[] = "0123456789ABCDEF";
+const char base64_alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+int HexValue(unsigned char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+int Base64Value(unsigned char c) {
+    if (c >= 'A' && c <= 'Z') {
+        return c - 'A';
+    }
+    if (c >= 'a' && c <= 'z') {
+        return c - 'a' + 26;
+    }
+    if (c >= '0' && c <= '9') {
+        return c - '0' + 52;
+    }
+    if (c == '+') {
+        return 62;
+    }
+    if (c == '/') {
+        return 63;
+    }
+    return -1;
+}
+
+#if defined(AES_X86)
+
+// Each returns how much of the input it handled, in whole steps; the
+// caller finishes the rest with the next narrower path.
+
+// 0xFF in every byte where lo <= c <= hi.
+AES_TARGET("ssse3")
+inline __m128i InRange(__m128i c, char lo, char hi) {
+    __m128i offset = _mm_sub_epi8(c, _mm_set1_epi8(lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(offset, _mm_set1_epi8(static_cast<char>(hi - lo))),
+                          offset);
+}
+
+AES_TARGET("avx2")
+inline __m256i InRange(__m256i c, char lo, char hi) {
+    __m256i offset = _mm256_sub_epi8(c, _mm256_set1_epi8(lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(offset, _mm256_set1_epi8(static_cast<char>(hi - lo))),
+                             offset);
+}
+
+// Nibbles to digits through one table lookup per nibble, then the high
+// and low digits interleaved.
+AES_TARGET("ssse3")
+size_t HexEncodeSsse3(const unsigned char* in, size_t length, char* out) {
+    const __m128i digits = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hex_digits));
+    const __m128i low_nibbles = _mm_set1_epi8(0x0F);
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        __m128i high = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(x, 4), low_nibbles));
+        __m128i low = _mm_shuffle_epi8(digits, _mm_and_si128(x, low_nibbles));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i),
+                         _mm_unpacklo_epi8(high, low));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i + 16),
+                         _mm_unpackhi_epi8(high, low));
+    }
+    return i;
+}
+
+// The unpacks work within 128-bit lanes, so the lanes are put back in
+// order before the stores.
+AES_TARGET("avx2")
+size_t HexEncodeAvx2(const unsigned char* in, size_t length, char* out) {
+    const __m256i digits = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(hex_digits)));
+    const __m256i low_nibbles = _mm256_set1_epi8(0x0F);
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+        __m256i high = _mm256_shuffle_epi8(digits,
+            _mm256_and_si256(_mm256_srli_epi16(x, 4), low_nibbles));
+        __m256i low = _mm256_shuffle_epi8(digits, _mm256_and_si256(x, low_nibbles));
+        __m256i first = _mm256_unpacklo_epi8(high, low);
+        __m256i second = _mm256_unpackhi_epi8(high, low);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 2 * i),
+                            _mm256_permute2x128_si256(first, second, 0x20));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 2 * i + 32),
+                            _mm256_permute2x128_si256(first, second, 0x31));
+    }
+    return i;
+}
+
+// Digits to nibbles, then each pair of nibbles multiplied and added into
+// one byte: high * 16 + low.
+AES_TARGET("ssse3")
+inline __m128i HexValues(__m128i c, __m128i& valid) {
+    __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+    __m128i digit = InRange(c, '0', '9');
+    __m128i letter = InRange(lower, 'a', 'f');
+    valid = _mm_and_si128(valid, _mm_or_si128(digit, letter));
+    return _mm_or_si128(
+        _mm_and_si128(digit, _mm_sub_epi8(c, _mm_set1_epi8('0'))),
+        _mm_and_si128(letter, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+}
+
+AES_TARGET("ssse3")
+size_t HexDecodeSsse3(const char* in, size_t length, unsigned char* out,
+                      bool& ok) {
+    const __m128i weights = _mm_set1_epi16(0x0110);
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m128i valid = _mm_set1_epi8(-1);
+        __m128i a = HexValues(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)), valid);
+        __m128i b = HexValues(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 16)), valid);
+        if (_mm_movemask_epi8(valid) != 0xFFFF) {
+            ok = false;
+            return i;
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i / 2),
+                         _mm_packus_epi16(_mm_maddubs_epi16(a, weights),
+                                          _mm_maddubs_epi16(b, weights)));
+    }
+    return i;
+}
+
+AES_TARGET("avx2")
+inline __m256i HexValues(__m256i c, __m256i& valid) {
+    __m256i lower = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+    __m256i digit = InRange(c, '0', '9');
+    __m256i letter = InRange(lower, 'a', 'f');
+    valid = _mm256_and_si256(valid, _mm256_or_si256(digit, letter));
+    return _mm256_or_si256(
+        _mm256_and_si256(digit, _mm256_sub_epi8(c, _mm256_set1_epi8('0'))),
+        _mm256_and_si256(letter, _mm256_sub_epi8(lower, _mm256_set1_epi8('a' - 10))));
+}
+
+AES_TARGET("avx2")
+size_t HexDecodeAvx2(const char* in, size_t length, unsigned char* out,
+                     bool& ok) {
+    const __m256i weights = _mm256_set1_epi16(0x0110);
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64) {
+        __m256i valid = _mm256_set1_epi8(-1);
+        __m256i a = HexValues(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i)), valid);
+        __m256i b = HexValues(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i + 32)), valid);
+        if (_mm256_movemask_epi8(valid) != -1) {
+            ok = false;
+            return i;
+        }
+        __m256i packed = _mm256_packus_epi16(_mm256_maddubs_epi16(a, weights),
+                                             _mm256_maddubs_epi16(b, weights));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i / 2),
+                            _mm256_permute4x64_epi64(packed, 0xD8));
+    }
+    return i;
+}
+
+// Spreads each 3-byte group of the low 12 bytes over 4 bytes, one 6-bit
+// index per byte, then maps the indices to the alphabet by range: every
+// range is the index plus a constant, looked up from a 16-entry table.
+AES_TARGET("ssse3")
+inline __m128i Base64Chars(__m128i x) {
+    x = _mm_shuffle_epi8(x, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+                                          7, 6, 8, 7, 10, 9, 11, 10));
+    __m128i ac = _mm_mulhi_epu16(_mm_and_si128(x, _mm_set1_epi32(0x0FC0FC00)),
+                                 _mm_set1_epi32(0x04000040));
+    __m128i bd = _mm_mullo_epi16(_mm_and_si128(x, _mm_set1_epi32(0x003F03F0)),
+                                 _mm_set1_epi32(0x01000010));
+    __m128i indices = _mm_or_si128(ac, bd);
+    // 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12.
+    __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    range = _mm_or_si128(range, _mm_and_si128(
+        _mm_cmpgt_epi8(_mm_set1_epi8(26), indices), _mm_set1_epi8(13)));
+    const __m128i shifts = _mm_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    return _mm_add_epi8(indices, _mm_shuffle_epi8(shifts, range));
+}
+
+AES_TARGET("ssse3")
+size_t Base64EncodeSsse3(const unsigned char* in, size_t groups, char* out) {
+    size_t g = 0;
+    // 16 bytes are loaded for the 12 used.
+    for (; g + 6 <= groups; g += 4) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 3 * g));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4 * g), Base64Chars(x));
+    }
+    return g;
+}
+
+AES_TARGET("avx2")
+inline __m256i Base64Chars(__m256i x) {
+    x = _mm256_shuffle_epi8(x, _mm256_setr_epi8(
+        1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+        1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+    __m256i ac = _mm256_mulhi_epu16(_mm256_and_si256(x, _mm256_set1_epi32(0x0FC0FC00)),
+                                    _mm256_set1_epi32(0x04000040));
+    __m256i bd = _mm256_mullo_epi16(_mm256_and_si256(x, _mm256_set1_epi32(0x003F03F0)),
+                                    _mm256_set1_epi32(0x01000010));
+    __m256i indices = _mm256_or_si256(ac, bd);
+    __m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    range = _mm256_or_si256(range, _mm256_and_si256(
+        _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices), _mm256_set1_epi8(13)));
+    const __m256i shifts = _mm256_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    return _mm256_add_epi8(indices, _mm256_shuffle_epi8(shifts, range));
+}
+
+// Each lane takes 12 bytes from its own load, so no load reaches before
+// in.
+AES_TARGET("avx2")
+size_t Base64EncodeAvx2(const unsigned char* in, size_t groups, char* out) {
+    size_t g = 0;
+    for (; g + 10 <= groups; g += 8) {
+        const unsigned char* src = in + 3 * g;
+        __m256i x = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src))),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 12)), 1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 4 * g), Base64Chars(x));
+    }
+    return g;
+}
+
+// Characters to 6-bit values by range, as in Base64Value, then every 4
+// values merged into 3 bytes by two multiply-adds.
+AES_TARGET("ssse3")
+inline __m128i Base64Values(__m128i c, __m128i& valid) {
+    __m128i upper = InRange(c, 'A', 'Z');
+    __m128i lower = InRange(c, 'a', 'z');
+    __m128i digit = InRange(c, '0', '9');
+    __m128i plus = _mm_cmpeq_epi8(c, _mm_set1_epi8('+'));
+    __m128i slash = _mm_cmpeq_epi8(c, _mm_set1_epi8('/'));
+    valid = _mm_or_si128(_mm_or_si128(upper, lower),
+                         _mm_or_si128(digit, _mm_or_si128(plus, slash)));
+    __m128i shift = _mm_or_si128(
+        _mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-'A')),
+                     _mm_and_si128(lower, _mm_set1_epi8(26 - 'a'))),
+        _mm_or_si128(_mm_and_si128(digit, _mm_set1_epi8(52 - '0')),
+                     _mm_or_si128(_mm_and_si128(plus, _mm_set1_epi8(62 - '+')),
+                                  _mm_and_si128(slash, _mm_set1_epi8(63 - '/')))));
+    __m128i values = _mm_add_epi8(c, shift);
+    __m128i pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    __m128i groups = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+    return _mm_shuffle_epi8(groups, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+                                                  14, 13, 12, -1, -1, -1, -1));
+}
+
+// Exactly 12 bytes are stored per 16 characters, so out may end with the
+// data.
+AES_TARGET("ssse3")
+size_t Base64DecodeSsse3(const char* in, size_t groups, unsigned char* out,
+                         bool& ok) {
+    size_t g = 0;
+    for (; g + 4 <= groups; g += 4) {
+        __m128i valid;
+        __m128i x = Base64Values(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 4 * g)), valid);
+        if (_mm_movemask_epi8(valid) != 0xFFFF) {
+            ok = false;
+            return g;
+        }
+        unsigned char* dst = out + 3 * g;
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst), x);
+        uint32_t last = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_srli_si128(x, 8)));
+        std::memcpy(dst + 8, &last, 4);
+    }
+    return g;
+}
+
+AES_TARGET("avx2")
+inline __m256i Base64Values(__m256i c, __m256i& valid) {
+    __m256i upper = InRange(c, 'A', 'Z');
+    __m256i lower = InRange(c, 'a', 'z');
+    __m256i digit = InRange(c, '0', '9');
+    __m256i plus = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('+'));
+    __m256i slash = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('/'));
+    valid = _mm256_or_si256(_mm256_or_si256(upper, lower),
+                            _mm256_or_si256(digit, _mm256_or_si256(plus, slash)));
+    __m256i shift = _mm256_or_si256(
+        _mm256_or_si256(_mm256_and_si256(upper, _mm256_set1_epi8(-'A')),
+                        _mm256_and_si256(lower, _mm256_set1_epi8(26 - 'a'))),
+        _mm256_or_si256(_mm256_and_si256(digit, _mm256_set1_epi8(52 - '0')),
+                        _mm256_or_si256(_mm256_and_si256(plus, _mm256_set1_epi8(62 - '+')),
+                                        _mm256_and_si256(slash, _mm256_set1_epi8(63 - '/')))));
+    __m256i values = _mm256_add_epi8(c, shift);
+    __m256i pairs = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+    __m256i groups = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+    groups = _mm256_shuffle_epi8(groups, _mm256_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    // The 12 bytes of each lane made contiguous.
+    return _mm256_permutevar8x32_epi32(groups, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+}
+
+AES_TARGET("avx2")
+size_t Base64DecodeAvx2(const char* in, size_t groups, unsigned char* out,
+                        bool& ok) {
+    size_t g = 0;
+    for (; g + 8 <= groups; g += 8) {
+        __m256i valid;
+        __m256i x = Base64Values(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + 4 * g)), valid);
+        if (_mm256_movemask_epi8(valid) != -1) {
+            ok = false;
+            return g;
+        }
+        unsigned char* dst = out + 3 * g;
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm256_castsi256_si128(x));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + 16), _mm256_extracti128_si256(x, 1));
+    }
+    return g;
+}
+
+#endif // AES_X86
+
+// Whole 3-byte groups to 4 characters each.
+void EncodeBase64Groups(const unsigned char* in, size_t groups, char* out) {
+    size_t g = 0;
+#if defined(AES_X86)
+    const CpuFeatures& cpu = GetCpuFeatures();
+    if (cpu.avx2) {
+        g = Base64EncodeAvx2(in, groups, out);
+    }
+    if (cpu.ssse3) {
+        g += Base64EncodeSsse3(in + 3 * g, groups - g, out + 4 * g);
+    }
+#endif
+    for (; g < groups; g++) {
+        const unsigned char* src = in + 3 * g;
+        uint32_t bits = (uint32_t(src[0]) << 16) | (uint32_t(src[1]) << 8) | src[2];
+        char* dst = out + 4 * g;
+        dst[0] = base64_alphabet[bits >> 18];
+        dst[1] = base64_alphabet[(bits >> 12) & 0x3F];
+        dst[2] = base64_alphabet[(bits >> 6) & 0x3F];
+        dst[3] = base64_alphabet[bits & 0x3F];
+    }
+}
+
+// Whole groups of 4 characters without padding to 3 bytes each.
+bool DecodeBase64Groups(const char* in, size_t groups, unsigned char* out) {
+    size_t g = 0;
+    bool ok = true;
+#if defined(AES_X86)
+    const CpuFeatures& cpu = GetCpuFeatures();
+    if (cpu.avx2) {
+        g = Base64DecodeAvx2(in, groups, out, ok);
+    }
+    if (ok && cpu.ssse3) {
+        g += Base64DecodeSsse3(in + 4 * g, groups - g, out + 3 * g, ok);
+    }
+    if (!ok) {
+        return false;
+    }
+#endif
+    for (; g < groups; g++) {
+        const char* src = in + 4 * g;
+        int a = Base64Value(src[0]);
+        int b = Base64Value(src[1]);
+        int c = Base64Value(src[2]);
+        int d = Base64Value(src[3]);
+        if ((a | b | c | d) < 0) {
+            return false;
+        }
+        uint32_t bits = (uint32_t(a) << 18) | (uint32_t(b) << 12) | (uint32_t(c) << 6) | uint32_t(d);
+        unsigned char* dst = out + 3 * g;
+        dst[0] = static_cast<unsigned char>(bits >> 16);
+        dst[1] = static_cast<unsigned char>(bits >> 8);
+        dst[2] = static_cast<unsigned char>(bits);
+    }
+    return true;
+}
+
+// A group that may end the text: "xx==" and "xxx=" decode to 1 and 2
+// bytes, whose unused bits must be zero.
+bool DecodeLastBase64Group(const char group[4], unsigned char* out,
+                           size_t& written) {
+    char text[4];
+    std::memcpy(text, group, 4);
+    if (text[3] != '=') {
+        written = 3;
+        return DecodeBase64Groups(text, 1, out);
+    }
+    int a = Base64Value(text[0]);
+    int b = Base64Value(text[1]);
+    if ((a | b) < 0) {
+        return false;
+    }
+    if (text[2] == '=') {
+        if (b & 0x0F) {
+            return false;
+        }
+        out[0] = static_cast<unsigned char>((a << 2) | (b >> 4));
+        written = 1;
+        return true;
+    }
+    int c = Base64Value(text[2]);
+    if (c < 0 || (c & 0x03)) {
+        return false;
+    }
+    out[0] = static_cast<unsigned char>((a << 2) | (b >> 4));
+    out[1] = static_cast<unsigned char>((b << 4) | (c >> 2));
+    written = 2;
+    return true;
+}
+
+} // namespace
+
+
+void HexEncode(const unsigned char* in, size_t length, char* out) {
+    size_t i = 0;
+#if defined(AES_X86)
+    const CpuFeatures& cpu = GetCpuFeatures();
+    if (cpu.avx2) {
+        i = HexEncodeAvx2(in, length, out);
+    }
+    if (cpu.ssse3) {
+        i += HexEncodeSsse3(in + i, length - i, out + 2 * i);
+    }
+#endif
+    for (; i < length; i++) {
+        unsigned char byte = in[i];
+        out[2 * i] = hex_digits[byte >> 4];
+        out[2 * i + 1] = hex_digits[byte & 0x0F];
+    }
+}
+
+bool HexDecode(const char* in, size_t length, unsigned char* out) {
+    if (length % 2) {
+        return false;
+    }
+    size_t i = 0;
+#if defined(AES_X86)
+    const CpuFeatures& cpu = GetCpuFeatures();
+    bool ok = true;
+    if (cpu.avx2) {
+        i = HexDecodeAvx2(in, length, out, ok);
+    }
+    if (ok && cpu.ssse3) {
+        i += HexDecodeSsse3(in + i, length - i, out + i / 2, ok);
+    }
+    if (!ok) {
+        return false;
+    }
+#endif
+    for (; i < length; i += 2) {
+        int high = HexValue(in[i]);
+        int low = HexValue(in[i + 1]);
+        if ((high | low) < 0) {
+            return false;
+        }
+        out[i / 2] = static_cast<unsigned char>((high << 4) | low);
+    }
+    return true;
+}
+
+// Groups are encoded front to back, so group g is read before the text of
+// groups 0..g-1 can reach it, even in place. The short last group is
+// copied out before anything is written.
+void Base64Encode(const unsigned char* in, size_t length, char* out) {
+    size_t groups = length / 3;
+    size_t rest = length % 3;
+    unsigned char last[3] = {};
+    for (size_t i = 0; i < rest; i++) {
+        last[i] = in[3 * groups + i];
+    }
+    EncodeBase64Groups(in, groups, out);
+    if (rest) {
+        char* dst = out + 4 * groups;
+        EncodeBase64Groups(last, 1, dst);
+        dst[3] = '=';
+        if (rest == 1) {
+            dst[2] = '=';
+        }
+    }
+}
+
+bool Base64Decode(const char* in, size_t length, unsigned char* out,
+                  size_t& decoded_length) {
+    if (length % 4) {
+        return false;
+    }
+    if (!length) {
+        decoded_length = 0;
+        return true;
+    }
+    size_t groups = length / 4 - 1;
+    size_t last;
+    if (!DecodeBase64Groups(in, groups, out) ||
+        !DecodeLastBase64Group(in + 4 * groups, out + 3 * groups, last)) {
+        return false;
+    }
+    decoded_length = 3 * groups + last;
+    return true;
+}
+
+
+TextEncodeStream::TextEncodeStream() : encoding_(TEXT_HEX), carry_length_(0) {}
+
+void TextEncodeStream::Init(TextEncoding encoding) {
+    encoding_ = encoding;
+    carry_length_ = 0;
+}
+
+size_t TextEncodeStream::UpdateLength(size_t length) const {
+    if (encoding_ == TEXT_HEX) {
+        return HexEncodedLength(length);
+    }
+    return (carry_length_ + length) / 3 * 4;
+}
+
+// Group g of the update is read at offset + 3 * g - carry and the groups
+// before it end at 4 * g, so an offset of groups + carry keeps the text
+// behind the bytes still to be read.
+Span<uint8_t> TextEncodeStream::Prepare(Span<char> out, size_t length) const {
+    size_t offset = encoding_ == TEXT_HEX
+        ? length : UpdateLength(length) / 4 + carry_length_;
+    if (out.size() < UpdateLength(length) || out.size() < offset + length) {
+        throw std::invalid_argument("Text encoding: output too short for in-place encoding");
+    }
+    return Span<uint8_t>(reinterpret_cast<uint8_t*>(out.data() + offset), length);
+}
+
+size_t TextEncodeStream::Update(Span<const uint8_t> in, Span<char> out) {
+    size_t written = UpdateLength(in.size());
+    if (out.size() < written) {
+        throw std::invalid_argument("Text encoding: output shorter than the text");
+    }
+    if (encoding_ == TEXT_HEX) {
+        HexEncode(in.data(), in.size(), out.data());
+        return written;
+    }
+
+    const unsigned char* src = in.data();
+    size_t length = in.size();
+    size_t groups = written / 4;
+    if (!groups) {
+        std::memcpy(carry_ + carry_length_, src, length);
+        carry_length_ += length;
+        return 0;
+    }
+    // Kept before encoding, which may overwrite it in place.
+    size_t rest = (carry_length_ + length) % 3;
+    unsigned char tail[2];
+    std::memcpy(tail, src + length - rest, rest);
+
+    char* dst = out.data();
+    if (carry_length_) {
+        unsigned char group[3];
+        std::memcpy(group, carry_, carry_length_);
+        std::memcpy(group + carry_length_, src, 3 - carry_length_);
+        src += 3 - carry_length_;
+        EncodeBase64Groups(group, 1, dst);
+        dst += 4;
+        groups--;
+    }
+    EncodeBase64Groups(src, groups, dst);
+    std::memcpy(carry_, tail, rest);
+    carry_length_ = rest;
+    return written;
+}
+
+size_t TextEncodeStream::Final(Span<char> out) {
+    if (!carry_length_) {
+        return 0;
+    }
+    if (out.size() < 4) {
+        throw std::invalid_argument("Text encoding: output shorter than the text");
+    }
+    Base64Encode(carry_, carry_length_, out.data());
+    carry_length_ = 0;
+    return 4;
+}
+
+
+TextDecodeStream::TextDecodeStream()
+    : encoding_(TEXT_HEX), carry_length_(0), finished_(false), failed_(false) {}
+
+void TextDecodeStream::Init(TextEncoding encoding) {
+    encoding_ = encoding;
+    carry_length_ = 0;
+    finished_ = false;
+    failed_ = false;
+}
+
+size_t TextDecodeStream::UpdateMaxLength(size_t length) const {
+    if (encoding_ == TEXT_HEX) {
+        return (carry_length_ + length) / 2;
+    }
+    return Base64DecodedMaxLength(carry_length_ + length);
+}
+
+bool TextDecodeStream::Update(Span<const char> in, Span<uint8_t> out,
+                              size_t& written) {
+    if (out.size() < UpdateMaxLength(in.size())) {
+        throw std::invalid_argument("Text decoding: output shorter than the data");
+    }
+    written = 0;
+    if (failed_ || (finished_ && !in.empty())) {
+        failed_ = true;
+        return false;
+    }
+    const size_t group_length = encoding_ == TEXT_HEX ? 2 : 4;
+    const char* src = in.data();
+    size_t length = in.size();
+    unsigned char* dst = out.data();
+
+    // Decodes whole groups; only the last may carry base64 padding.
+    auto decode = [&](const char* text, size_t groups) {
+        if (encoding_ == TEXT_HEX) {
+            if (!HexDecode(text, 2 * groups, dst + written)) {
+                return false;
+            }
+            written += groups;
+            return true;
+        }
+        if (!DecodeBase64Groups(text, groups - 1, dst + written)) {
+            return false;
+        }
+        written += 3 * (groups - 1);
+        size_t last;
+        if (!DecodeLastBase64Group(text + 4 * (groups - 1), dst + written, last)) {
+            return false;
+        }
+        written += last;
+        finished_ = last < 3;
+        return true;
+    };
+
+    if (carry_length_) {
+        size_t take = std::min(group_length - carry_length_, length);
+        std::memcpy(carry_ + carry_length_, src, take);
+        carry_length_ += take;
+        src += take;
+        length -= take;
+        if (carry_length_ < group_length) {
+            return true;
+        }
+        carry_length_ = 0;
+        if (!decode(carry_, 1)) {
+            failed_ = true;
+            return false;
+        }
+    }
+    size_t groups = length / group_length;
+    if (groups && (finished_ || !decode(src, groups))) {
+        failed_ = true;
+        return false;
+    }
+    carry_length_ = length % group_length;
+    if (carry_length_ && finished_) {
+        failed_ = true;
+        return false;
+    }
+    std::memcpy(carry_, src + groups * group_length, carry_length_);
+    return true;
+}
+
+bool TextDecodeStream::Final() {
+    return !failed_ && !carry_length_;
+}
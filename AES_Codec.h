@@ -0,0 +1,113 @@
+// AES_Codec.h : Hex and base64 text forms of binary data.
+//
+// Encoders and decoders write into caller buffers of a length known up
+// front, so nothing is allocated per character. On x86 they run 16 bytes
+// per step with SSSE3 and 32 with AVX2, picked at runtime.
+//
+// Encoding can run in place: cipher output written to the end of the text
+// buffer is expanded into it front to back, so ciphertext goes from the
+// cipher to its text form without an intermediate copy.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "AES_Span.h"
+
+// Upper-case hex, as HexConvert has always printed. Writes
+// HexEncodedLength(length) characters and no terminator. in may be the
+// last length bytes of out.
+inline size_t HexEncodedLength(size_t length) { return 2 * length; }
+
+void HexEncode(const unsigned char* in, size_t length, char* out);
+
+// Either case is accepted. Writes length / 2 bytes; out may equal in.
+// Returns false if length is odd or a character is not a hex digit, in
+// which case out holds nothing meaningful.
+bool HexDecode(const char* in, size_t length, unsigned char* out);
+
+// Base64 with the standard alphabet and '=' padding (RFC 4648 section 4),
+// without line breaks. in may be the last length bytes of out.
+inline size_t Base64EncodedLength(size_t length) { return (length + 2) / 3 * 4; }
+
+void Base64Encode(const unsigned char* in, size_t length, char* out);
+
+// Longest decoding of length characters; the padding makes the real
+// length up to two bytes shorter.
+inline size_t Base64DecodedMaxLength(size_t length) { return length / 4 * 3; }
+
+// Writes decoded_length bytes; out may equal in. Returns false, without
+// setting decoded_length, if length is not a multiple of 4, a character is
+// outside the alphabet, padding appears before the last group, or the
+// unused bits of the last group are not zero.
+bool Base64Decode(const char* in, size_t length, unsigned char* out,
+                  size_t& decoded_length);
+
+enum TextEncoding {
+    TEXT_HEX,
+    TEXT_BASE64,
+};
+
+// Encoding over a stream: chained Update calls produce the same text as
+// one encode of their concatenation. Base64 carries up to two bytes of an
+// unfinished group between calls.
+class TextEncodeStream {
+public:
+    TextEncodeStream();
+
+    void Init(TextEncoding encoding);
+
+    // Characters the next Update writes for length more bytes.
+    size_t UpdateLength(size_t length) const;
+
+    // Where in out the next length bytes must be written for Update to
+    // encode them in place, for instance as the output of
+    // CtrStream::Update. Throws std::invalid_argument if out is too short
+    // to hold both them and their text.
+    Span<uint8_t> Prepare(Span<char> out, size_t length) const;
+
+    // out must hold UpdateLength(in.size()) characters. in must not
+    // overlap out unless it is the span Prepare returned. Returns the
+    // characters written.
+    size_t Update(Span<const uint8_t> in, Span<char> out);
+
+    // Writes the padded last base64 group, at most 4 characters, and
+    // returns how many.
+    size_t Final(Span<char> out);
+
+private:
+    TextEncoding encoding_;
+    unsigned char carry_[2];
+    size_t carry_length_;
+};
+
+// Decoding over a stream, for text that arrives in pieces of any length.
+// Incomplete groups are carried between calls.
+class TextDecodeStream {
+public:
+    TextDecodeStream();
+
+    void Init(TextEncoding encoding);
+
+    // Largest number of bytes the next Update writes for length more
+    // characters.
+    size_t UpdateMaxLength(size_t length) const;
+
+    // out must hold UpdateMaxLength(in.size()) bytes and must not overlap
+    // in: a group carried from the last call decodes ahead of it. Sets
+    // written to the bytes decoded. Returns false on malformed text,
+    // including anything after base64 padding; the stream is then unusable
+    // until the next Init.
+    bool Update(Span<const char> in, Span<uint8_t> out, size_t& written);
+
+    // Returns false if the text stopped inside a group or an earlier
+    // Update failed.
+    bool Final();
+
+private:
+    TextEncoding encoding_;
+    char carry_[4];
+    size_t carry_length_;
+    bool finished_;
+    bool failed_;
+};
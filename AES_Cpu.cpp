@@ -0,0 +1,71 @@
+// AES_Cpu.cpp : CPUID based feature detection.
+//
+#include "AES_Cpu.h"
+
+#if defined(AES_X86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace {
+
+#if defined(AES_X86)
+void Cpuid(int leaf, int subleaf, unsigned int regs[4]) {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuidex(info, leaf, subleaf);
+    for (int i = 0; i < 4; i++) {
+        regs[i] = (unsigned int)info[i];
+    }
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// AVX state must be enabled by the OS (XCR0 bits 1 and 2), not just
+// advertised by the CPU.
+bool OsSavesYmm() {
+#if defined(_MSC_VER)
+    return (_xgetbv(0) & 0x6) == 0x6;
+#else
+    unsigned int eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (eax & 0x6) == 0x6;
+#endif
+}
+#endif
+
+CpuFeatures DetectCpuFeatures() {
+    CpuFeatures features = {};
+#if defined(AES_X86)
+    unsigned int regs[4];
+    Cpuid(0, 0, regs);
+    unsigned int max_leaf = regs[0];
+
+    Cpuid(1, 0, regs);
+    features.sse2 = (regs[3] >> 26) & 1;
+    features.ssse3 = (regs[2] >> 9) & 1;
+    features.sse41 = (regs[2] >> 19) & 1;
+    features.aesni = (regs[2] >> 25) & 1;
+    features.pclmul = (regs[2] >> 1) & 1;
+    bool osxsave = (regs[2] >> 27) & 1;
+    bool avx = (regs[2] >> 28) & 1;
+
+    if (max_leaf >= 7 && osxsave && avx && OsSavesYmm()) {
+        Cpuid(7, 0, regs);
+        features.avx2 = (regs[1] >> 5) & 1;
+    }
+#endif
+    return features;
+}
+
+} // namespace
+
+
+const CpuFeatures& GetCpuFeatures() {
+    static const CpuFeatures features = DetectCpuFeatures();
+    return features;
+}
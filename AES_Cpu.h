@@ -0,0 +1,27 @@
+// AES_Cpu.h : CPU feature detection used to pick a round engine at runtime.
+//
+#pragma once
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define AES_X86 1
+#endif
+
+// GCC and Clang only emit instructions for features enabled on the command
+// line unless a function opts in; MSVC always accepts the intrinsics.
+#if defined(__GNUC__) || defined(__clang__)
+#define AES_TARGET(features) __attribute__((target(features)))
+#else
+#define AES_TARGET(features)
+#endif
+
+struct CpuFeatures {
+    bool sse2;
+    bool ssse3;
+    bool sse41;
+    bool aesni;
+    bool pclmul;
+    bool avx2;
+};
+
+// Queried through CPUID once, on first use.
+const CpuFeatures& GetCpuFeatures();
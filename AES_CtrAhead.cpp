@@ -0,0 +1,274 @@
+// AES_CtrAhead.cpp : CTR stream with keystream computed ahead of the data.
+//
+// The ring is a single-producer, single-consumer queue of keystream
+// bytes. produced_ and consumed_ count bytes from the start of the stream;
+// byte p of the stream lives at ring_[p & mask_] and belongs to counter
+// block iv + p / 16. Refills write REFILL-sized, aligned pieces, or a
+// shorter last one at the stream's limit, so a refill never wraps around
+// the ring. Whoever refills holds fill_mutex_; the caller reads keystream
+// without it.
+#include "AES_CtrAhead.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+void Wipe(unsigned char* data, size_t length) {
+    volatile unsigned char* wipe = data;
+    for (size_t i = 0; i < length; i++) {
+        wipe[i] = 0;
+    }
+}
+
+// Encrypted to fingerprint a key: equal for equal key bytes, and telling
+// nothing about the key without it.
+const unsigned char fingerprint_label[16] = {
+    'C', 'T', 'R', ' ', 'a', 'h', 'e', 'a', 'd', ' ', 'k', 'e', 'y', 0, 0, 0,
+};
+
+// (a - b) mod 2^128 for counter blocks taken as big-endian integers, if it
+// fits in 64 bits; otherwise max.
+uint64_t CounterDistance(const unsigned char a[16], const unsigned char b[16]) {
+    uint64_t high = 0;
+    uint64_t low = 0;
+    unsigned borrow = 0;
+    for (int i = 15; i >= 0; i--) {
+        unsigned diff = 0x100u + a[i] - b[i] - borrow;
+        borrow = diff < 0x100u;
+        unsigned char byte = static_cast<unsigned char>(diff);
+        if (i >= 8) {
+            low |= static_cast<uint64_t>(byte) << (8 * (15 - i));
+        } else {
+            high |= static_cast<uint64_t>(byte) << (8 * (7 - i));
+        }
+    }
+    return high ? std::numeric_limits<uint64_t>::max() : low;
+}
+
+} // namespace
+
+
+CtrAheadStream::CtrAheadStream(size_t lookahead)
+    : key_(nullptr), limit_(0), produced_(0), consumed_(0), filler_waiting_(false),
+      stopping_(false) {
+    size_t size = 2 * CTR_AHEAD_REFILL_BYTES;
+    while (size < lookahead) {
+        size <<= 1;
+    }
+    ring_.assign(size, 0);
+    mask_ = size - 1;
+    std::memset(iv_, 0, sizeof(iv_));
+    std::memset(fingerprint_, 0, sizeof(fingerprint_));
+    filler_ = std::thread(&CtrAheadStream::FillerLoop, this);
+}
+
+CtrAheadStream::~CtrAheadStream() {
+    {
+        std::lock_guard<std::mutex> lock(fill_mutex_);
+        stopping_ = true;
+    }
+    space_ready_.notify_one();
+    filler_.join();
+    Final();
+    for (UsedRange& range : used_) {
+        Wipe(range.fingerprint, sizeof(range.fingerprint));
+        Wipe(range.first, sizeof(range.first));
+    }
+}
+
+void CtrAheadStream::Init(const AesKey& key, Span<const uint8_t> iv) {
+    if (iv.size() != BLOCK_SIZE) {
+        throw std::invalid_argument("CTR: the initial counter is 16 bytes");
+    }
+    unsigned char fingerprint[16];
+    EncryptBlock(key, fingerprint_label, fingerprint);
+    {
+        std::lock_guard<std::mutex> lock(fill_mutex_);
+        Retire();
+        // The new stream may run up to the nearest range of the same key
+        // that starts at or after iv, and must not start inside one.
+        uint64_t limit = std::numeric_limits<uint64_t>::max();
+        for (const UsedRange& range : used_) {
+            if (std::memcmp(range.fingerprint, fingerprint, BLOCK_SIZE) != 0) {
+                continue;
+            }
+            if (CounterDistance(iv.data(), range.first) < range.blocks) {
+                Wipe(fingerprint, sizeof(fingerprint));
+                throw std::invalid_argument("CTR: the counters were already used under this key");
+            }
+            limit = std::min(limit, CounterDistance(range.first, iv.data()));
+        }
+        Wipe(ring_.data(), ring_.size());
+        key_ = &key;
+        std::memcpy(iv_, iv.data(), BLOCK_SIZE);
+        std::memcpy(fingerprint_, fingerprint, BLOCK_SIZE);
+        limit_ = limit;
+        produced_.store(0, std::memory_order_relaxed);
+        consumed_.store(0);
+    }
+    Wipe(fingerprint, sizeof(fingerprint));
+    space_ready_.notify_one();
+}
+
+// Called with fill_mutex_ held. Records the counter blocks the current
+// stream handed out, partly used and discarded ones included, and ends it.
+void CtrAheadStream::Retire() {
+    uint64_t consumed = consumed_.load(std::memory_order_relaxed);
+    if (key_ && consumed) {
+        UsedRange range;
+        std::memcpy(range.fingerprint, fingerprint_, BLOCK_SIZE);
+        std::memcpy(range.first, iv_, BLOCK_SIZE);
+        range.blocks = (consumed + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        used_.push_back(range);
+    }
+    key_ = nullptr;
+}
+
+// Called with fill_mutex_ held. Computes the next REFILL bytes of
+// keystream if the ring has room for them, or fewer just before the
+// stream's limit; nothing is computed past it.
+bool CtrAheadStream::Refill() {
+    if (!key_) {
+        return false;
+    }
+    uint64_t produced = produced_.load(std::memory_order_relaxed);
+    uint64_t consumed = consumed_.load(std::memory_order_acquire);
+    if (ring_.size() - (produced - consumed) < CTR_AHEAD_REFILL_BYTES) {
+        return false;
+    }
+    size_t count = static_cast<size_t>(std::min<uint64_t>(
+        CTR_AHEAD_REFILL_BYTES / BLOCK_SIZE, limit_ - produced / BLOCK_SIZE));
+    if (!count) {
+        return false;
+    }
+    // Counter blocks are laid out in the ring and encrypted in place.
+    unsigned char* blocks = &ring_[produced & mask_];
+    unsigned char counter[16];
+    std::memcpy(counter, iv_, BLOCK_SIZE);
+    AddCounter(counter, produced / BLOCK_SIZE);
+    for (size_t i = 0; i < count; i++) {
+        std::memcpy(blocks + BLOCK_SIZE * i, counter, BLOCK_SIZE);
+        AddCounter(counter, 1);
+    }
+    EncryptBlocks(*key_, blocks, blocks, count);
+    produced_.store(produced + BLOCK_SIZE * count, std::memory_order_release);
+    return true;
+}
+
+void CtrAheadStream::FillerLoop() {
+    std::unique_lock<std::mutex> lock(fill_mutex_);
+    while (!stopping_) {
+        if (Refill()) {
+            continue;
+        }
+        // Check again after announcing the wait: either the caller sees
+        // the flag and wakes us, or we see the space it freed.
+        filler_waiting_.store(true);
+        if (!Refill()) {
+            space_ready_.wait(lock);
+        }
+        filler_waiting_.store(false);
+    }
+}
+
+void CtrAheadStream::Update(Span<const uint8_t> in, Span<uint8_t> out) {
+    if (out.size() < in.size()) {
+        throw std::invalid_argument("Stream update: output shorter than input");
+    }
+    const unsigned char* src = in.data();
+    unsigned char* dst = out.data();
+    size_t length = in.size();
+    while (length) {
+        uint64_t consumed = consumed_.load(std::memory_order_relaxed);
+        uint64_t ready = produced_.load(std::memory_order_acquire) - consumed;
+        if (!ready) {
+            // The thread is behind: compute the next piece here rather
+            // than wait for it.
+            std::lock_guard<std::mutex> lock(fill_mutex_);
+            if (!key_) {
+                throw std::invalid_argument("CTR: stream used before Init");
+            }
+            // With the ring empty, Refill only fails at the limit.
+            if (produced_.load(std::memory_order_relaxed) == consumed && !Refill()) {
+                throw std::invalid_argument("CTR: the stream reached counters already used under this key");
+            }
+            continue;
+        }
+        size_t offset = static_cast<size_t>(consumed & mask_);
+        size_t n = static_cast<size_t>(std::min<uint64_t>(
+            std::min<uint64_t>(length, ready), ring_.size() - offset));
+        XorBytes(dst, src, &ring_[offset], n);
+        // Used keystream would decrypt the packet it was used for.
+        std::memset(&ring_[offset], 0, n);
+        consumed_.store(consumed + n);
+        src += n;
+        dst += n;
+        length -= n;
+    }
+
+    // The thread is woken once half the ring is free, so it refills in
+    // long runs instead of once per packet.
+    if (filler_waiting_.load() &&
+        ring_.size() - (produced_.load() - consumed_.load(std::memory_order_relaxed)) >=
+            ring_.size() / 2) {
+        { std::lock_guard<std::mutex> lock(fill_mutex_); }
+        space_ready_.notify_one();
+    }
+}
+
+void CtrAheadStream::Skip(uint64_t bytes) {
+    uint64_t consumed = consumed_.load(std::memory_order_relaxed);
+    for (uint64_t i = 0; i < bytes; i++) {
+        ring_[(consumed + i) & mask_] = 0;
+    }
+    consumed_.store(consumed + bytes);
+}
+
+void CtrAheadStream::EncryptPacket(Span<const uint8_t> in, Span<uint8_t> out,
+                                   unsigned char counter[16]) {
+    // A partly used block was produced whole, so the rest of it is in the
+    // ring and can be skipped.
+    uint64_t used = consumed_.load(std::memory_order_relaxed) % BLOCK_SIZE;
+    if (used) {
+        Skip(BLOCK_SIZE - used);
+    }
+    size_t ignored;
+    Position(counter, ignored);
+    Update(in, out);
+}
+
+void CtrAheadStream::Discard(unsigned char counter[16]) {
+    {
+        std::lock_guard<std::mutex> lock(fill_mutex_);
+        Wipe(ring_.data(), ring_.size());
+        consumed_.store(produced_.load(std::memory_order_relaxed));
+    }
+    space_ready_.notify_one();
+    size_t ignored;
+    Position(counter, ignored);
+}
+
+void CtrAheadStream::Position(unsigned char counter[16], size_t& used) const {
+    uint64_t consumed = consumed_.load(std::memory_order_relaxed);
+    std::memcpy(counter, iv_, BLOCK_SIZE);
+    AddCounter(counter, consumed / BLOCK_SIZE);
+    used = static_cast<size_t>(consumed % BLOCK_SIZE);
+}
+
+size_t CtrAheadStream::Ready() const {
+    return static_cast<size_t>(produced_.load(std::memory_order_acquire) -
+                               consumed_.load(std::memory_order_relaxed));
+}
+
+void CtrAheadStream::Final() {
+    std::lock_guard<std::mutex> lock(fill_mutex_);
+    Retire();
+    Wipe(ring_.data(), ring_.size());
+    Wipe(iv_, sizeof(iv_));
+    Wipe(fingerprint_, sizeof(fingerprint_));
+    produced_.store(0, std::memory_order_relaxed);
+    consumed_.store(0);
+}
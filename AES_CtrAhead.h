@@ -0,0 +1,118 @@
+// AES_CtrAhead.h : CTR stream with keystream computed ahead of the data.
+//
+// CTR keystream does not depend on the data, so a background thread can
+// compute it before the packets arrive. The stream keeps up to
+// `lookahead` bytes of keystream ready in a ring; encrypting a packet is
+// then an SSE2 XOR against it, with no AES on the caller's path. When
+// packets outrun the thread, the caller computes the missing keystream
+// itself, in order, so the output never depends on timing.
+//
+// Every keystream block is produced for exactly one counter value and
+// handed out at most once: the counter only moves forward, and Discard and
+// packet alignment skip keystream rather than rewind. Each stream records
+// the counter blocks it used under a fingerprint of its key, E(key, label),
+// which is the same for every AesKey holding the same key bytes. Init
+// refuses an iv inside a recorded range of the same key, and a stream stops
+// with an error before it runs into one.
+//
+// The record is kept for the lifetime of the object only and covers only
+// the streams run through it. Counters used under the same key by another
+// CtrAheadStream, by CtrStream or CtrCrypt, or by an earlier process are
+// not seen: the caller must still give each of those its own counter
+// range, e.g. a fresh random iv per key or per stream.
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "AES_Modes.h"
+#include "AES_Span.h"
+
+// Keystream kept ready when no lookahead is given.
+#define CTR_AHEAD_DEFAULT_BYTES (64 * 1024)
+// Keystream computed per refill step, by either thread.
+#define CTR_AHEAD_REFILL_BYTES (4 * 1024)
+
+class CtrAheadStream {
+public:
+    // lookahead is rounded up to a power of two of at least two refills.
+    explicit CtrAheadStream(size_t lookahead = CTR_AHEAD_DEFAULT_BYTES);
+    ~CtrAheadStream();
+
+    CtrAheadStream(const CtrAheadStream&) = delete;
+    CtrAheadStream& operator=(const CtrAheadStream&) = delete;
+
+    // Starts a stream whose first counter block is iv and begins filling
+    // the ring. key must outlive the stream. Throws std::invalid_argument
+    // if iv is not 16 bytes, or if this object already used the counter
+    // block iv under the same key bytes, in this stream or an earlier one.
+    void Init(const AesKey& key, Span<const uint8_t> iv);
+
+    // CTR over the stream: consecutive calls produce the same bytes as
+    // one CtrCrypt over their concatenation. out may equal in. Throws
+    // std::invalid_argument when the stream reaches a counter block that
+    // an earlier stream used under the same key; out is then written only
+    // up to that block.
+    void Update(Span<const uint8_t> in, Span<uint8_t> out);
+
+    // Encrypts one packet starting on a fresh counter block, which is
+    // written to counter for the receiver. The rest of a partly used
+    // block is skipped, never reused.
+    void EncryptPacket(Span<const uint8_t> in, Span<uint8_t> out,
+                       unsigned char counter[16]);
+
+    // Drops and wipes all precomputed keystream; the stream carries on
+    // from the first counter that was never computed. Returns through
+    // counter the counter block of the next keystream byte.
+    void Discard(unsigned char counter[16]);
+
+    // Counter block of the next keystream byte, and how many bytes of
+    // that block are already used.
+    void Position(unsigned char counter[16], size_t& used) const;
+
+    // Keystream bytes ready now.
+    size_t Ready() const;
+
+    // Stops the thread's work on this stream and wipes the ring. The
+    // counters the stream used stay recorded.
+    void Final();
+
+private:
+    // Counter blocks [first, first + blocks) used under the key with the
+    // fingerprint.
+    struct UsedRange {
+        unsigned char fingerprint[16];
+        unsigned char first[16];
+        uint64_t blocks;
+    };
+
+    bool Refill();
+    void FillerLoop();
+    void Skip(uint64_t bytes);
+    void Retire();
+
+    std::vector<unsigned char> ring_;
+    size_t mask_;
+
+    // Protects key_, iv_ and the producer side of the ring.
+    mutable std::mutex fill_mutex_;
+    std::condition_variable space_ready_;
+    const AesKey* key_;
+    unsigned char iv_[16];
+    unsigned char fingerprint_[16];
+    // Counter blocks the stream may use before it reaches a recorded
+    // range of its key.
+    uint64_t limit_;
+    std::vector<UsedRange> used_;
+    // Byte positions in the stream: produced_ is written under
+    // fill_mutex_, consumed_ only by the caller's thread.
+    std::atomic<uint64_t> produced_;
+    std::atomic<uint64_t> consumed_;
+    std::atomic<bool> filler_waiting_;
+    bool stopping_;
+    std::thread filler_;
+};
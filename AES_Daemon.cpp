@@ -0,0 +1,871 @@
+// AES_Daemon.cpp : Local encryption offload daemon over a Unix domain socket.
+//
+// A single thread polls the listening socket and every client. Requests
+// are held as they are read until the batch window closes; then the batch
+// is run, each client's requests in the order they were sent, and the
+// responses are queued on each client's socket in that order. Bulk
+// requests in a batch still use DefaultThreadPool() through the modes.
+#include "AES_Daemon.h"
+
+#include <iostream>
+
+#if defined(_WIN32)
+
+int RunDaemon(int, char*[], const std::string&) {
+    std::cerr << "The daemon needs Unix domain sockets and is not available "
+                 "on this system." << std::endl;
+    return 1;
+}
+
+#else
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "AES_KeyArena.h"
+#include "AES_Modes.h"
+#include "AES_Tune.h"
+
+// Unsent responses held for one client before its requests are left
+// unread.
+#define DAEMON_MAX_QUEUED_BYTES (1 << 20)
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+volatile std::sig_atomic_t stop_requested = 0;
+
+void RequestStop(int) {
+    stop_requested = 1;
+}
+
+void Wipe(void* data, size_t length) {
+    volatile unsigned char* wipe = static_cast<unsigned char*>(data);
+    for (size_t i = 0; i < length; i++) {
+        wipe[i] = 0;
+    }
+}
+
+struct ClientKey {
+    AesKey* key;
+    GcmKey gcm_key;
+};
+
+struct ClientStats {
+    uint64_t requests;
+    uint64_t bytes;
+    uint64_t failures;
+    // Nanoseconds from a request being read to its response being queued.
+    uint64_t latency_total;
+    uint64_t latency_max;
+};
+
+struct Client {
+    int id;
+    int fd;
+    unsigned char* shared;
+    size_t shared_bytes;
+    // Bytes of a request still being read, and responses not yet sent.
+    std::vector<unsigned char> input;
+    std::vector<unsigned char> output;
+    // key_id - 1 indexes keys; unloaded keys leave a null entry.
+    std::vector<std::unique_ptr<ClientKey>> keys;
+    ClientStats stats;
+    Clock::time_point connected;
+    bool closing;
+    // Set in RunBatch once a request of this client has to wait for the
+    // next step.
+    bool blocked;
+};
+
+struct Pending {
+    Client* client;
+    DaemonRequest request;
+    DaemonResponse response;
+    Clock::time_point arrived;
+    // The region descriptor of DAEMON_ATTACH, otherwise -1.
+    int fd;
+    // The key of DAEMON_LOAD_KEY, built when the request is read so the
+    // key bytes are not held, and installed under its id in order; null if
+    // the key was refused.
+    std::unique_ptr<ClientKey> loaded;
+};
+
+// Whether [offset, offset + length) lies in the client's region.
+bool InRegion(const Client& client, uint64_t offset, uint64_t length) {
+    return offset <= client.shared_bytes && length <= client.shared_bytes - offset;
+}
+
+bool Overlap(uint64_t a, uint64_t a_length, uint64_t b, uint64_t b_length) {
+    return a_length && b_length && a < b + b_length && b < a + a_length;
+}
+
+// A region is only mapped if the file already holds all of it and is
+// sealed against shrinking: pages cut off by a later ftruncate would
+// kill the daemon with SIGBUS on first access.
+bool SafeRegion(int fd, uint64_t length) {
+    struct stat info;
+    if (fstat(fd, &info) < 0 || info.st_size < 0 ||
+        static_cast<uint64_t>(info.st_size) < length) {
+        return false;
+    }
+#if defined(F_GET_SEALS)
+    int seals = fcntl(fd, F_GET_SEALS);
+    return seals >= 0 && (seals & F_SEAL_SHRINK);
+#else
+    // No file seals here; the size check is all that can be done.
+    return true;
+#endif
+}
+
+class Daemon {
+public:
+    Daemon(int listener, int window_us, size_t max_batch)
+        : listener_(listener), window_(std::chrono::microseconds(window_us)),
+          max_batch_(max_batch), arena_(DAEMON_KEY_SLOTS), next_client_(1) {}
+    ~Daemon();
+
+    void Run();
+
+private:
+    void Accept();
+    void Read(Client& client);
+    void Flush(Client& client);
+    void Drop(Client& client);
+    void Handle(Client& client, const DaemonRequest& request, int attached_fd);
+    void Attach(Pending& pending);
+    std::unique_ptr<ClientKey> BuildKey(const DaemonRequest& request);
+    void InstallKey(Pending& pending);
+    ClientKey* FindKey(Client& client, uint32_t key_id);
+    void ReleaseKey(ClientKey& key);
+    bool Check(Client& client, const DaemonRequest& request);
+    bool Batchable(Pending& pending);
+    bool Conflicts(const Pending& pending) const;
+    void RunBatch();
+    void RunShared();
+    void RunAlone(Pending& pending);
+    void Finish(Pending& pending);
+    void Respond(Client& client, const DaemonResponse& response,
+                 Clock::time_point arrived, uint64_t bytes);
+    std::string StatsText() const;
+    void PrintStats(const Client& client) const;
+
+    int listener_;
+    Clock::duration window_;
+    size_t max_batch_;
+    KeyArena arena_;
+    int next_client_;
+    std::map<int, std::unique_ptr<Client>> clients_;
+    std::vector<Pending> batch_;
+    // Scratch for RunBatch, kept between batches: indexes into batch_ of
+    // the requests of the current step, and of those already run.
+    std::vector<size_t> shared_;
+    std::vector<size_t> alone_;
+    std::vector<char> done_;
+    // Scratch for the batched block path.
+    std::vector<BlockJob> encrypt_jobs_;
+    std::vector<BlockJob> decrypt_jobs_;
+    std::vector<unsigned char> counters_;
+};
+
+Daemon::~Daemon() {
+    for (auto& entry : clients_) {
+        PrintStats(*entry.second);
+        Drop(*entry.second);
+    }
+}
+
+void Daemon::Run() {
+    std::vector<pollfd> fds;
+    std::vector<Client*> polled;
+    while (!stop_requested) {
+        fds.assign(1, pollfd{ listener_, POLLIN, 0 });
+        polled.clear();
+        for (auto& entry : clients_) {
+            Client& client = *entry.second;
+            // A client that stops reading its responses is not read either.
+            short events = client.output.size() < DAEMON_MAX_QUEUED_BYTES ? POLLIN : 0;
+            if (!client.output.empty()) {
+                events |= POLLOUT;
+            }
+            fds.push_back(pollfd{ client.fd, events, 0 });
+            polled.push_back(&client);
+        }
+
+        // Sleep until input arrives, or until the open batch's window
+        // closes.
+        int64_t wait_us = -1;
+        if (!batch_.empty()) {
+            wait_us = std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::microseconds>(
+                batch_.front().arrived + window_ - Clock::now()).count());
+        }
+#if defined(__linux__)
+        timespec wait = { static_cast<time_t>(wait_us / 1000000),
+                          static_cast<long>(wait_us % 1000000 * 1000) };
+        int ready = ppoll(fds.data(), fds.size(), wait_us < 0 ? nullptr : &wait, nullptr);
+#else
+        // poll() counts in milliseconds, so the window is rounded up.
+        int ready = poll(fds.data(), fds.size(),
+                         wait_us < 0 ? -1 : static_cast<int>((wait_us + 999) / 1000));
+#endif
+        if (ready < 0 && errno != EINTR) {
+            std::cerr << "poll: " << std::strerror(errno) << std::endl;
+            return;
+        }
+
+        if (ready > 0) {
+            if (fds[0].revents & POLLIN) {
+                Accept();
+            }
+            for (size_t i = 0; i < polled.size(); i++) {
+                Client& client = *polled[i];
+                if (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) {
+                    Read(client);
+                }
+                if (!client.closing && (fds[i + 1].revents & POLLOUT)) {
+                    Flush(client);
+                }
+            }
+        }
+
+        if (!batch_.empty() &&
+            (batch_.size() >= max_batch_ ||
+             Clock::now() >= batch_.front().arrived + window_)) {
+            RunBatch();
+        }
+
+        for (auto it = clients_.begin(); it != clients_.end();) {
+            if (it->second->closing) {
+                PrintStats(*it->second);
+                Drop(*it->second);
+                it = clients_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+}
+
+void Daemon::Accept() {
+    int fd = accept(listener_, nullptr, nullptr);
+    if (fd < 0) {
+        return;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    std::unique_ptr<Client> client(new Client());
+    client->id = next_client_++;
+    client->fd = fd;
+    client->shared = nullptr;
+    client->shared_bytes = 0;
+    client->connected = Clock::now();
+    client->closing = false;
+    client->blocked = false;
+    clients_[fd] = std::move(client);
+}
+
+void Daemon::Read(Client& client) {
+    unsigned char buffer[64 * sizeof(DaemonRequest)];
+    for (;;) {
+        // The descriptor of DAEMON_ATTACH rides along as ancillary data.
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+        iovec io = { buffer, sizeof(buffer) };
+        msghdr message;
+        std::memset(&message, 0, sizeof(message));
+        message.msg_iov = &io;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        ssize_t received = recvmsg(client.fd, &message, 0);
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            client.closing = true;
+            return;
+        }
+
+        int attached_fd = -1;
+        for (cmsghdr* header = CMSG_FIRSTHDR(&message); header;
+             header = CMSG_NXTHDR(&message, header)) {
+            if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS) {
+                std::memcpy(&attached_fd, CMSG_DATA(header), sizeof(int));
+            }
+        }
+
+        client.input.insert(client.input.end(), buffer, buffer + received);
+        Wipe(buffer, static_cast<size_t>(received));
+        size_t used = 0;
+        while (client.input.size() - used >= sizeof(DaemonRequest) && !client.closing) {
+            DaemonRequest request;
+            std::memcpy(&request, client.input.data() + used, sizeof(request));
+            used += sizeof(request);
+            Handle(client, request, attached_fd);
+            attached_fd = -1;
+            Wipe(&request, sizeof(request));
+        }
+        Wipe(client.input.data(), used);
+        client.input.erase(client.input.begin(), client.input.begin() + used);
+        if (attached_fd >= 0) {
+            close(attached_fd);
+        }
+    }
+}
+
+void Daemon::Flush(Client& client) {
+    while (!client.output.empty()) {
+        ssize_t sent = send(client.fd, client.output.data(), client.output.size(),
+                            MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (sent <= 0) {
+            client.closing = true;
+            return;
+        }
+        client.output.erase(client.output.begin(), client.output.begin() + sent);
+    }
+}
+
+void Daemon::Drop(Client& client) {
+    for (Pending& pending : batch_) {
+        if (pending.client != &client) {
+            continue;
+        }
+        if (pending.fd >= 0) {
+            close(pending.fd);
+        }
+        if (pending.loaded) {
+            ReleaseKey(*pending.loaded);
+        }
+        Wipe(&pending.request, sizeof(pending.request));
+    }
+    batch_.erase(std::remove_if(batch_.begin(), batch_.end(),
+                                [&](const Pending& p) { return p.client == &client; }),
+                 batch_.end());
+    for (std::unique_ptr<ClientKey>& key : client.keys) {
+        if (key) {
+            ReleaseKey(*key);
+        }
+    }
+    client.keys.clear();
+    if (client.shared) {
+        munmap(client.shared, client.shared_bytes);
+    }
+    close(client.fd);
+}
+
+void Daemon::Handle(Client& client, const DaemonRequest& request, int attached_fd) {
+    // Only DAEMON_ATTACH carries a descriptor. One sent with any other
+    // request is closed here, or each would hold a slot of the daemon's
+    // descriptor table until exit.
+    if (attached_fd >= 0 && request.op != DAEMON_ATTACH) {
+        close(attached_fd);
+        attached_fd = -1;
+    }
+    batch_.emplace_back();
+    Pending& pending = batch_.back();
+    pending.client = &client;
+    pending.request = request;
+    std::memset(&pending.response, 0, sizeof(pending.response));
+    pending.response.request_id = request.request_id;
+    pending.response.status = DAEMON_OK;
+    pending.arrived = Clock::now();
+    pending.fd = attached_fd;
+    if (request.op == DAEMON_LOAD_KEY) {
+        pending.loaded = BuildKey(request);
+        Wipe(pending.request.key, sizeof(pending.request.key));
+    }
+}
+
+void Daemon::Attach(Pending& pending) {
+    Client& client = *pending.client;
+    const DaemonRequest& request = pending.request;
+    int fd = pending.fd;
+    pending.fd = -1;
+    pending.response.status = DAEMON_BAD_REQUEST;
+    if (fd >= 0 && !client.shared && request.length && SafeRegion(fd, request.length)) {
+        void* shared = mmap(nullptr, request.length, PROT_READ | PROT_WRITE,
+                            MAP_SHARED, fd, 0);
+        if (shared != MAP_FAILED) {
+            client.shared = static_cast<unsigned char*>(shared);
+            client.shared_bytes = request.length;
+            pending.response.status = DAEMON_OK;
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+// Key schedules live only in the locked arena, never on the heap where
+// they could be swapped out or dumped; with every slot in use the key is
+// refused.
+std::unique_ptr<ClientKey> Daemon::BuildKey(const DaemonRequest& request) {
+    std::unique_ptr<ClientKey> key(new ClientKey());
+    key->key = arena_.Allocate();
+    if (!key->key) {
+        key.reset();
+        return key;
+    }
+    try {
+        BuildAesKey(*key->key, request.key, static_cast<int>(request.key_bytes));
+        BuildGcmKey(key->gcm_key, *key->key);
+    } catch (const std::invalid_argument&) {
+        ReleaseKey(*key);
+        key.reset();
+    }
+    return key;
+}
+
+void Daemon::InstallKey(Pending& pending) {
+    Client& client = *pending.client;
+    if (!pending.loaded) {
+        pending.response.status = DAEMON_BAD_REQUEST;
+        return;
+    }
+    // Reuse the first free id.
+    size_t index = 0;
+    while (index < client.keys.size() && client.keys[index]) {
+        index++;
+    }
+    if (index == client.keys.size()) {
+        client.keys.emplace_back();
+    }
+    client.keys[index] = std::move(pending.loaded);
+    pending.response.key_id = static_cast<uint32_t>(index + 1);
+}
+
+ClientKey* Daemon::FindKey(Client& client, uint32_t key_id) {
+    if (key_id == 0 || key_id > client.keys.size()) {
+        return nullptr;
+    }
+    return client.keys[key_id - 1].get();
+}
+
+void Daemon::ReleaseKey(ClientKey& key) {
+    Wipe(&key.gcm_key, sizeof(key.gcm_key));
+    arena_.Release(key.key);
+    key.key = nullptr;
+}
+
+// Every range a request reads or writes must lie in the client's region.
+bool Daemon::Check(Client& client, const DaemonRequest& request) {
+    uint64_t length = request.length;
+    uint64_t out_length = length;
+    switch (request.op) {
+    case DAEMON_ENCRYPT_ECB:
+    case DAEMON_DECRYPT_ECB:
+        if (length % BLOCK_SIZE) {
+            return false;
+        }
+        break;
+    case DAEMON_CTR:
+        break;
+    case DAEMON_ENCRYPT_CBC:
+        out_length = (length / BLOCK_SIZE + 1) * BLOCK_SIZE;
+        break;
+    case DAEMON_DECRYPT_CBC:
+        break;
+    case DAEMON_ENCRYPT_GCM:
+    case DAEMON_DECRYPT_GCM:
+        // GcmEncrypt and GcmDecrypt throw past the mode's limit.
+        if (length > GCM_MAX_BYTES || request.iv_length == 0 ||
+            request.iv_length > 16 ||
+            !InRegion(client, request.aad_offset, request.aad_length)) {
+            return false;
+        }
+        break;
+    case DAEMON_STATS:
+        return InRegion(client, request.out_offset, length);
+    default:
+        return false;
+    }
+    return InRegion(client, request.in_offset, length) &&
+           InRegion(client, request.out_offset, out_length);
+}
+
+// The single ECB blocks and short CTR requests that can share the
+// multi-key block path, if their key and ranges are valid.
+bool Daemon::Batchable(Pending& pending) {
+    const DaemonRequest& request = pending.request;
+    Client& client = *pending.client;
+    bool block = (request.op == DAEMON_ENCRYPT_ECB || request.op == DAEMON_DECRYPT_ECB) &&
+                 request.length == BLOCK_SIZE;
+    bool keystream = request.op == DAEMON_CTR && request.length <= DAEMON_BATCH_CTR_BYTES;
+    return (block || keystream) && client.shared && Check(client, request) &&
+           FindKey(client, request.key_id);
+}
+
+// Whether pending reads what an earlier request of the same client in the
+// step writes, or writes what such a request reads or writes. The step
+// loads every block before it stores any output, so the pair would not
+// see each other's effect; the later one waits for the next step.
+bool Daemon::Conflicts(const Pending& pending) const {
+    const DaemonRequest& request = pending.request;
+    for (size_t index : shared_) {
+        const Pending& earlier = batch_[index];
+        if (earlier.client != pending.client) {
+            continue;
+        }
+        const DaemonRequest& other = earlier.request;
+        if (Overlap(request.in_offset, request.length, other.out_offset, other.length) ||
+            Overlap(request.out_offset, request.length, other.in_offset, other.length) ||
+            Overlap(request.out_offset, request.length, other.out_offset, other.length)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Each client's requests run in the order they were sent, so a request
+// sees the keys loaded and unloaded and the output written by the ones
+// before it. Every step takes, from each client, the batchable requests
+// ahead of its first one that is not, and runs them together; then that
+// first other request of each client runs on its own.
+void Daemon::RunBatch() {
+    done_.assign(batch_.size(), 0);
+    size_t remaining = batch_.size();
+    while (remaining) {
+        shared_.clear();
+        alone_.clear();
+        for (Pending& pending : batch_) {
+            pending.client->blocked = false;
+        }
+        for (size_t i = 0; i < batch_.size(); i++) {
+            Pending& pending = batch_[i];
+            if (done_[i] || pending.client->blocked) {
+                continue;
+            }
+            if (Batchable(pending) && !Conflicts(pending)) {
+                shared_.push_back(i);
+            } else {
+                alone_.push_back(i);
+                pending.client->blocked = true;
+            }
+        }
+
+        RunShared();
+        for (size_t i : shared_) {
+            Finish(batch_[i]);
+            done_[i] = 1;
+        }
+        for (size_t i : alone_) {
+            // A request the checks let through by mistake fails on its
+            // own instead of ending the daemon for every client.
+            try {
+                RunAlone(batch_[i]);
+            } catch (const std::exception&) {
+                batch_[i].response.status = DAEMON_BAD_REQUEST;
+                batch_[i].response.length = 0;
+            }
+            Finish(batch_[i]);
+            done_[i] = 1;
+        }
+        remaining -= shared_.size() + alone_.size();
+    }
+    for (Pending& pending : batch_) {
+        Wipe(&pending.request, sizeof(pending.request));
+    }
+    batch_.clear();
+}
+
+void Daemon::RunShared() {
+    // Gather every block of the step: single ECB blocks and the counter
+    // blocks of short CTR requests, from any client, under any key.
+    encrypt_jobs_.clear();
+    decrypt_jobs_.clear();
+    size_t counter_blocks = 0;
+    for (size_t index : shared_) {
+        const DaemonRequest& request = batch_[index].request;
+        if (request.op == DAEMON_CTR) {
+            counter_blocks += (request.length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        }
+    }
+    // Counter blocks are encrypted in place into keystream.
+    counters_.resize(counter_blocks * BLOCK_SIZE);
+    size_t next_counter = 0;
+
+    for (size_t index : shared_) {
+        const DaemonRequest& request = batch_[index].request;
+        Client& client = *batch_[index].client;
+        const AesKey* key = FindKey(client, request.key_id)->key;
+        const unsigned char* in = client.shared + request.in_offset;
+        unsigned char* out = client.shared + request.out_offset;
+        if (request.op == DAEMON_ENCRYPT_ECB) {
+            encrypt_jobs_.push_back(BlockJob{ key, in, out });
+        } else if (request.op == DAEMON_DECRYPT_ECB) {
+            decrypt_jobs_.push_back(BlockJob{ key, in, out });
+        } else {
+            unsigned char counter[16];
+            std::memcpy(counter, request.iv, 16);
+            for (size_t done = 0; done < request.length; done += BLOCK_SIZE) {
+                unsigned char* block = &counters_[next_counter * BLOCK_SIZE];
+                std::memcpy(block, counter, 16);
+                encrypt_jobs_.push_back(BlockJob{ key, block, block });
+                AddCounter(counter, 1);
+                next_counter++;
+            }
+        }
+    }
+
+    EncryptBlockBatch(encrypt_jobs_.data(), encrypt_jobs_.size());
+    DecryptBlockBatch(decrypt_jobs_.data(), decrypt_jobs_.size());
+
+    next_counter = 0;
+    for (size_t index : shared_) {
+        Pending& pending = batch_[index];
+        const DaemonRequest& request = pending.request;
+        Client& client = *pending.client;
+        if (request.op == DAEMON_CTR) {
+            XorBytes(client.shared + request.out_offset, client.shared + request.in_offset,
+                     &counters_[next_counter * BLOCK_SIZE], request.length);
+            next_counter += (request.length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        }
+        pending.response.length = request.length;
+    }
+    Wipe(counters_.data(), counters_.size());
+}
+
+void Daemon::RunAlone(Pending& pending) {
+    const DaemonRequest& request = pending.request;
+    DaemonResponse& response = pending.response;
+    Client& client = *pending.client;
+
+    switch (request.op) {
+    case DAEMON_ATTACH:
+        Attach(pending);
+        return;
+    case DAEMON_LOAD_KEY:
+        InstallKey(pending);
+        return;
+    case DAEMON_UNLOAD_KEY:
+        if (ClientKey* key = FindKey(client, request.key_id)) {
+            ReleaseKey(*key);
+            client.keys[request.key_id - 1].reset();
+        } else {
+            response.status = DAEMON_UNKNOWN_KEY;
+        }
+        return;
+    default:
+        break;
+    }
+
+    if (!client.shared || !Check(client, request)) {
+        response.status = DAEMON_BAD_REQUEST;
+        return;
+    }
+    const unsigned char* in = client.shared + request.in_offset;
+    unsigned char* out = client.shared + request.out_offset;
+    const unsigned char* aad = client.shared + request.aad_offset;
+    size_t length = static_cast<size_t>(request.length);
+
+    if (request.op == DAEMON_STATS) {
+        std::string text = StatsText();
+        response.length = std::min<size_t>(text.size(), length);
+        std::memcpy(out, text.data(), static_cast<size_t>(response.length));
+        return;
+    }
+
+    const ClientKey* found = FindKey(client, request.key_id);
+    if (!found) {
+        response.status = DAEMON_UNKNOWN_KEY;
+        return;
+    }
+    const ClientKey& key = *found;
+    response.length = length;
+    size_t plain_length = 0;
+    switch (request.op) {
+    case DAEMON_ENCRYPT_ECB:
+        EncryptBlocks(*key.key, in, out, length / BLOCK_SIZE);
+        break;
+    case DAEMON_DECRYPT_ECB:
+        DecryptBlocks(*key.key, in, out, length / BLOCK_SIZE);
+        break;
+    case DAEMON_CTR:
+        CtrCrypt(*key.key, request.iv, in, out, length);
+        break;
+    case DAEMON_ENCRYPT_CBC:
+        response.length = CbcEncrypt(*key.key, request.iv, in, length, out);
+        break;
+    case DAEMON_DECRYPT_CBC:
+        if (CbcDecrypt(*key.key, request.iv, in, length, out, plain_length)) {
+            response.length = plain_length;
+        } else {
+            response.status = DAEMON_AUTH_FAILED;
+            response.length = 0;
+        }
+        break;
+    case DAEMON_ENCRYPT_GCM:
+        GcmEncrypt(key.gcm_key, request.iv, request.iv_length, aad,
+                   static_cast<size_t>(request.aad_length), in, length, out,
+                   response.tag);
+        break;
+    case DAEMON_DECRYPT_GCM:
+        if (!GcmDecrypt(key.gcm_key, request.iv, request.iv_length, aad,
+                        static_cast<size_t>(request.aad_length), in, length,
+                        out, request.tag)) {
+            response.status = DAEMON_AUTH_FAILED;
+            response.length = 0;
+        }
+        break;
+    }
+}
+
+// Payload bytes count toward the statistics for data requests that ran.
+void Daemon::Finish(Pending& pending) {
+    const DaemonRequest& request = pending.request;
+    uint32_t status = pending.response.status;
+    bool ran = request.op >= DAEMON_ENCRYPT_ECB && request.op < DAEMON_STATS &&
+               (status == DAEMON_OK || status == DAEMON_AUTH_FAILED);
+    Respond(*pending.client, pending.response, pending.arrived, ran ? request.length : 0);
+}
+
+void Daemon::Respond(Client& client, const DaemonResponse& response,
+                     Clock::time_point arrived, uint64_t bytes) {
+    const unsigned char* record = reinterpret_cast<const unsigned char*>(&response);
+    client.output.insert(client.output.end(), record, record + sizeof(response));
+
+    uint64_t latency = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - arrived).count());
+    client.stats.requests++;
+    client.stats.bytes += bytes;
+    client.stats.failures += response.status != DAEMON_OK;
+    client.stats.latency_total += latency;
+    client.stats.latency_max = std::max(client.stats.latency_max, latency);
+    Flush(client);
+}
+
+std::string Daemon::StatsText() const {
+    std::ostringstream text;
+    text << "client  requests  failures         bytes  mean_us   max_us     MB/s\n";
+    for (const auto& entry : clients_) {
+        const Client& client = *entry.second;
+        const ClientStats& stats = client.stats;
+        double seconds = std::chrono::duration<double>(Clock::now() - client.connected).count();
+        text << std::setw(6) << client.id << std::setw(10) << stats.requests
+             << std::setw(10) << stats.failures << std::setw(14) << stats.bytes
+             << std::fixed << std::setprecision(1) << std::setw(9)
+             << (stats.requests ? stats.latency_total / 1e3 / stats.requests : 0.0)
+             << std::setw(9) << stats.latency_max / 1e3 << std::setw(9)
+             << (seconds > 0 ? stats.bytes / seconds / 1e6 : 0.0) << '\n';
+    }
+    return text.str();
+}
+
+void Daemon::PrintStats(const Client& client) const {
+    const ClientStats& stats = client.stats;
+    double seconds = std::chrono::duration<double>(Clock::now() - client.connected).count();
+    std::cout << "client " << client.id << ": " << stats.requests << " requests, "
+              << stats.failures << " failed, " << stats.bytes << " bytes, mean "
+              << std::fixed << std::setprecision(1)
+              << (stats.requests ? stats.latency_total / 1e3 / stats.requests : 0.0)
+              << " us, max " << stats.latency_max / 1e3 << " us, "
+              << (seconds > 0 ? stats.bytes / seconds / 1e6 : 0.0) << " MB/s"
+              << std::endl;
+}
+
+bool ParseCount(const char* text, long& value) {
+    char* end = nullptr;
+    value = std::strtol(text, &end, 10);
+    return end != text && *end == '\0' && value >= 0;
+}
+
+} // namespace
+
+
+int RunDaemon(int argc, char* argv[], const std::string& profile_path) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0]
+                  << " daemon <socket path> [--window-us N] [--max-batch N]"
+                  << std::endl;
+        return 2;
+    }
+    std::string path(argv[2]);
+    long window_us = DAEMON_DEFAULT_WINDOW_US;
+    long max_batch = DAEMON_DEFAULT_MAX_BATCH;
+    for (int i = 3; i < argc; i++) {
+        std::string option(argv[i]);
+        long* target = option == "--window-us" ? &window_us
+                     : option == "--max-batch" ? &max_batch : nullptr;
+        if (!target || i + 1 >= argc || !ParseCount(argv[++i], *target)) {
+            std::cerr << "Bad option " << option << std::endl;
+            return 2;
+        }
+    }
+    if (max_batch < 1) {
+        max_batch = 1;
+    }
+
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path too long: " << path << std::endl;
+        return 2;
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    if (!profile_path.empty()) {
+        TuneAtStartup(profile_path);
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        std::cerr << "socket: " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+    // Only this user may connect: the socket is created under a 0077 mask.
+    unlink(path.c_str());
+    mode_t mask = umask(0077);
+    int bound = bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    umask(mask);
+    if (bound < 0 || listen(listener, 64) < 0) {
+        std::cerr << "Cannot listen on " << path << ": " << std::strerror(errno)
+                  << std::endl;
+        close(listener);
+        return 1;
+    }
+    fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK);
+
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = RequestStop;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    std::cout << "Listening on " << path << std::endl;
+    {
+        Daemon daemon(listener, static_cast<int>(window_us),
+                      static_cast<size_t>(max_batch));
+        daemon.Run();
+    }
+    close(listener);
+    unlink(path.c_str());
+    return 0;
+}
+
+#endif // _WIN32
@@ -0,0 +1,141 @@
+// AES_Daemon.h : Local encryption offload daemon over a Unix domain socket.
+//
+// One daemon per host holds the keys and runs the cipher for any number
+// of local processes. A client connects to the daemon's socket and hands
+// it a shared-memory region (the descriptor travels over the socket with
+// SCM_RIGHTS). Payloads stay in that region: a request names a key and
+// offsets into the region, and the daemon writes its output back there,
+// so only the fixed-size request and response records cross the socket.
+//
+// Requests that arrive within --window-us of each other are processed as
+// one batch. The single-block ECB requests and the keystream of short CTR
+// requests of every client in the batch go through one EncryptBlockBatch
+// or DecryptBlockBatch call, so many small requests under different keys
+// share the engine's multi-key path. Longer requests and CBC and GCM run
+// on their own. Each client's requests, key loads and unloads included,
+// still take effect in the order it sent them.
+//
+// The region must be sealed against shrinking (F_SEAL_SHRINK) where the
+// system has file seals, and at least as long as the attach request says;
+// otherwise the attach is refused.
+//
+// POSIX only; on other systems RunDaemon reports that and DaemonClient
+// throws.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Runs `AES_UNSW daemon <socket path> [--window-us N] [--max-batch N]`
+// until SIGINT or SIGTERM and returns the process exit code: 0 on a clean
+// stop, 1 if the socket cannot be set up, 2 on bad arguments. Per-client
+// statistics are printed as each client disconnects and at exit. Once
+// the arguments are accepted, the tuning plan is read from profile_path,
+// or measured and saved there on the first start; an empty path keeps
+// the current plan.
+int RunDaemon(int argc, char* argv[], const std::string& profile_path = std::string());
+
+// Requests at most this far apart are batched together.
+#define DAEMON_DEFAULT_WINDOW_US 200
+// A batch is run early once it holds this many requests.
+#define DAEMON_DEFAULT_MAX_BATCH 256
+// CTR requests up to this size share the batched block path.
+#define DAEMON_BATCH_CTR_BYTES 4096
+// Keys held by all clients together, in locked memory; a load past it is
+// refused with DAEMON_BAD_REQUEST.
+#define DAEMON_KEY_SLOTS 1024
+
+enum DaemonOp {
+    // Sent once, first, with the shared-memory descriptor; length is the
+    // region size.
+    DAEMON_ATTACH,
+    // The first key_bytes bytes of key; the response carries key_id, or
+    // DAEMON_BAD_REQUEST if all DAEMON_KEY_SLOTS are in use.
+    DAEMON_LOAD_KEY,
+    DAEMON_UNLOAD_KEY,
+    // ECB over length bytes, a multiple of 16.
+    DAEMON_ENCRYPT_ECB,
+    DAEMON_DECRYPT_ECB,
+    // CTR with iv as the initial counter.
+    DAEMON_CTR,
+    // CBC with PKCS#7 padding; the output may be up to 16 bytes longer
+    // than the input when encrypting.
+    DAEMON_ENCRYPT_CBC,
+    DAEMON_DECRYPT_CBC,
+    // GCM with the first iv_length bytes of iv and aad_length bytes of
+    // aad at aad_offset; tag is returned when encrypting and checked when
+    // decrypting.
+    DAEMON_ENCRYPT_GCM,
+    DAEMON_DECRYPT_GCM,
+    // Writes every client's statistics as text at out_offset, at most
+    // length bytes; the response length is the text length.
+    DAEMON_STATS,
+};
+
+enum DaemonStatus {
+    DAEMON_OK,
+    DAEMON_BAD_REQUEST,
+    DAEMON_UNKNOWN_KEY,
+    // CBC padding or GCM tag check failed; the output is not valid.
+    DAEMON_AUTH_FAILED,
+};
+
+// Fixed-size records in host byte order; the socket never leaves the host.
+struct DaemonRequest {
+    uint64_t request_id;
+    uint32_t op;
+    uint32_t key_id;
+    uint64_t in_offset;
+    uint64_t out_offset;
+    uint64_t length;
+    uint64_t aad_offset;
+    uint64_t aad_length;
+    unsigned char iv[16];
+    uint32_t iv_length;
+    uint32_t key_bytes;
+    unsigned char tag[16];
+    unsigned char key[32];
+};
+
+struct DaemonResponse {
+    // Echoed from the request; responses to one client come in order.
+    uint64_t request_id;
+    uint32_t status;
+    uint32_t key_id;
+    // Bytes written at out_offset.
+    uint64_t length;
+    unsigned char tag[16];
+};
+
+// Client side of the protocol. Payloads are written to and read from
+// Buffer(); requests can be pipelined with Send and Receive, or made one
+// at a time with Call. Not thread-safe; use one client per thread.
+class DaemonClient {
+public:
+    // Connects and shares a region of shared_bytes. Throws
+    // std::runtime_error if the daemon cannot be reached.
+    DaemonClient(const std::string& socket_path, size_t shared_bytes);
+    ~DaemonClient();
+
+    DaemonClient(const DaemonClient&) = delete;
+    DaemonClient& operator=(const DaemonClient&) = delete;
+
+    unsigned char* Buffer() const { return shared_; }
+    size_t BufferSize() const { return shared_bytes_; }
+
+    // Hands key to the daemon and returns its key_id. Throws
+    // std::runtime_error if the daemon refuses it.
+    uint32_t LoadKey(const unsigned char* key, int key_bytes);
+
+    // Sends request under the next request_id and returns that id.
+    uint64_t Send(const DaemonRequest& request);
+    DaemonResponse Receive();
+    DaemonResponse Call(const DaemonRequest& request);
+
+private:
+    int socket_;
+    unsigned char* shared_;
+    size_t shared_bytes_;
+    uint64_t next_id_;
+};
@@ -0,0 +1,218 @@
+// AES_DaemonClient.cpp : Client side of the local encryption daemon.
+//
+#include "AES_Daemon.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#if defined(_WIN32)
+
+DaemonClient::DaemonClient(const std::string&, size_t)
+    : socket_(-1), shared_(nullptr), shared_bytes_(0), next_id_(1) {
+    throw std::runtime_error("The daemon is not available on this system");
+}
+
+DaemonClient::~DaemonClient() {}
+
+uint32_t DaemonClient::LoadKey(const unsigned char*, int) { return 0; }
+uint64_t DaemonClient::Send(const DaemonRequest&) { return 0; }
+DaemonResponse DaemonClient::Receive() { return DaemonResponse(); }
+DaemonResponse DaemonClient::Call(const DaemonRequest&) { return DaemonResponse(); }
+
+#else
+
+#include <cerrno>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+// An anonymous shared-memory file: nothing is left in the file system for
+// another process to open. It is sealed against shrinking where the system
+// has file seals, since the daemon refuses to map a region that could be
+// cut short under it.
+int CreateSharedFile(size_t bytes) {
+#if defined(__linux__)
+    int fd = memfd_create("aes-daemon", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+    std::string name = "/aes-daemon-" + std::to_string(getpid());
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0) {
+        shm_unlink(name.c_str());
+    }
+#endif
+    if (fd >= 0 && ftruncate(fd, static_cast<off_t>(bytes)) < 0) {
+        close(fd);
+        fd = -1;
+    }
+#if defined(F_ADD_SEALS)
+    if (fd >= 0 && fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL) < 0) {
+        close(fd);
+        fd = -1;
+    }
+#endif
+    return fd;
+}
+
+void WriteAll(int fd, const void* data, size_t length) {
+    const char* next = static_cast<const char*>(data);
+    while (length) {
+        ssize_t sent = send(fd, next, length, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            throw std::runtime_error("Lost the connection to the daemon");
+        }
+        next += sent;
+        length -= static_cast<size_t>(sent);
+    }
+}
+
+void ReadAll(int fd, void* data, size_t length) {
+    char* next = static_cast<char*>(data);
+    while (length) {
+        ssize_t received = recv(fd, next, length, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            throw std::runtime_error("Lost the connection to the daemon");
+        }
+        next += received;
+        length -= static_cast<size_t>(received);
+    }
+}
+
+} // namespace
+
+
+DaemonClient::DaemonClient(const std::string& socket_path, size_t shared_bytes)
+    : socket_(-1), shared_(nullptr), shared_bytes_(shared_bytes), next_id_(1) {
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path) || shared_bytes == 0) {
+        throw std::invalid_argument("Bad daemon socket path or buffer size");
+    }
+    std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+    socket_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socket_ < 0 ||
+        connect(socket_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        if (socket_ >= 0) {
+            close(socket_);
+        }
+        throw std::runtime_error("Cannot connect to the daemon at " + socket_path);
+    }
+
+    int shared_fd = CreateSharedFile(shared_bytes);
+    void* shared = shared_fd < 0 ? MAP_FAILED
+        : mmap(nullptr, shared_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, shared_fd, 0);
+    if (shared == MAP_FAILED) {
+        if (shared_fd >= 0) {
+            close(shared_fd);
+        }
+        close(socket_);
+        throw std::runtime_error("Cannot create the shared buffer");
+    }
+    shared_ = static_cast<unsigned char*>(shared);
+
+    DaemonRequest attach;
+    std::memset(&attach, 0, sizeof(attach));
+    attach.request_id = next_id_++;
+    attach.op = DAEMON_ATTACH;
+    attach.length = shared_bytes;
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    std::memset(control, 0, sizeof(control));
+    iovec io = { &attach, sizeof(attach) };
+    msghdr message;
+    std::memset(&message, 0, sizeof(message));
+    message.msg_iov = &io;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(header), &shared_fd, sizeof(int));
+    ssize_t sent = sendmsg(socket_, &message, MSG_NOSIGNAL);
+    close(shared_fd);
+
+    DaemonResponse response;
+    std::memset(&response, 0, sizeof(response));
+    try {
+        if (sent != static_cast<ssize_t>(sizeof(attach))) {
+            throw std::runtime_error("Lost the connection to the daemon");
+        }
+        response = Receive();
+    } catch (...) {
+        munmap(shared_, shared_bytes_);
+        close(socket_);
+        throw;
+    }
+    if (response.status != DAEMON_OK) {
+        munmap(shared_, shared_bytes_);
+        close(socket_);
+        throw std::runtime_error("The daemon refused the shared buffer");
+    }
+}
+
+DaemonClient::~DaemonClient() {
+    munmap(shared_, shared_bytes_);
+    close(socket_);
+}
+
+uint32_t DaemonClient::LoadKey(const unsigned char* key, int key_bytes) {
+    DaemonRequest request;
+    std::memset(&request, 0, sizeof(request));
+    if (key_bytes <= 0 || key_bytes > static_cast<int>(sizeof(request.key))) {
+        throw std::invalid_argument("unsupported AES key size");
+    }
+    request.op = DAEMON_LOAD_KEY;
+    request.key_bytes = static_cast<uint32_t>(key_bytes);
+    std::memcpy(request.key, key, static_cast<size_t>(key_bytes));
+    DaemonResponse response = Call(request);
+    volatile unsigned char* wipe = request.key;
+    for (size_t i = 0; i < sizeof(request.key); i++) {
+        wipe[i] = 0;
+    }
+    if (response.status != DAEMON_OK) {
+        throw std::runtime_error("The daemon refused the key");
+    }
+    return response.key_id;
+}
+
+uint64_t DaemonClient::Send(const DaemonRequest& request) {
+    DaemonRequest stamped = request;
+    stamped.request_id = next_id_++;
+    WriteAll(socket_, &stamped, sizeof(stamped));
+    volatile unsigned char* wipe = stamped.key;
+    for (size_t i = 0; i < sizeof(stamped.key); i++) {
+        wipe[i] = 0;
+    }
+    return stamped.request_id;
+}
+
+DaemonResponse DaemonClient::Receive() {
+    DaemonResponse response;
+    ReadAll(socket_, &response, sizeof(response));
+    return response;
+}
+
+DaemonResponse DaemonClient::Call(const DaemonRequest& request) {
+    uint64_t id = Send(request);
+    DaemonResponse response = Receive();
+    if (response.request_id != id) {
+        throw std::runtime_error("Out-of-order response from the daemon");
+    }
+    return response;
+}
+
+#endif // _WIN32
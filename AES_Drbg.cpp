@@ -0,0 +1,320 @@
+// AES_Drbg.cpp : CTR_DRBG random bit generator for IVs, nonces and keys.
+//
+// Section references are to NIST SP 800-90A rev. 1.
+#include "AES_Drbg.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include "AES_Modes.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <bcrypt.h>
+#if defined(_MSC_VER)
+#pragma comment(lib, "bcrypt.lib")
+#endif
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/random.h>
+#endif
+#endif
+
+// Key bytes of AES-256.
+#define DRBG_KEY_BYTES 32
+
+namespace {
+
+void Wipe(unsigned char* data, size_t length) {
+    volatile unsigned char* wipe = data;
+    for (size_t i = 0; i < length; i++) {
+        wipe[i] = 0;
+    }
+}
+
+// E(key, counter + 1), E(key, counter + 2), ... over length bytes, the
+// blocks encrypted in place in one multi-block call. counter is advanced
+// past the blocks used.
+void Keystream(const AesKey& key, unsigned char counter[16],
+               unsigned char* out, size_t length) {
+    size_t blocks = length / BLOCK_SIZE;
+    for (size_t i = 0; i < blocks; i++) {
+        AddCounter(counter, 1);
+        std::memcpy(out + BLOCK_SIZE * i, counter, BLOCK_SIZE);
+    }
+    EncryptBlocks(key, out, out, blocks);
+    size_t rest = length % BLOCK_SIZE;
+    if (rest) {
+        unsigned char block[16];
+        AddCounter(counter, 1);
+        EncryptBlock(key, counter, block);
+        std::memcpy(out + BLOCK_SIZE * blocks, block, rest);
+        Wipe(block, sizeof(block));
+    }
+}
+
+// Seed material of DRBG_SEED_BYTES: the input padded with zeros.
+void PadInput(Span<const uint8_t> input, unsigned char padded[DRBG_SEED_BYTES]) {
+    if (input.size() > DRBG_SEED_BYTES) {
+        throw std::invalid_argument("CTR_DRBG: input longer than the seed");
+    }
+    std::memset(padded, 0, DRBG_SEED_BYTES);
+    if (!input.empty()) {
+        std::memcpy(padded, input.data(), input.size());
+    }
+}
+
+} // namespace
+
+
+CtrDrbg::CtrDrbg() : reseed_counter_(0), instantiated_(false) {
+    std::memset(v_, 0, sizeof(v_));
+}
+
+CtrDrbg::~CtrDrbg() {
+    Uninstantiate();
+}
+
+// CTR_DRBG_Update (10.2.1.2): the next three keystream blocks, XORed with
+// the provided data, become the new key and counter.
+void CtrDrbg::Update(const unsigned char provided[DRBG_SEED_BYTES]) {
+    unsigned char temp[DRBG_SEED_BYTES];
+    Keystream(key_, v_, temp, DRBG_SEED_BYTES);
+    XorBytes(temp, temp, provided, DRBG_SEED_BYTES);
+    BuildAesKey(key_, temp, DRBG_KEY_BYTES);
+    std::memcpy(v_, temp + DRBG_KEY_BYTES, BLOCK_SIZE);
+    Wipe(temp, sizeof(temp));
+}
+
+// 10.2.1.3.1: seed material is entropy XOR personalization, mixed into a
+// zero key and counter.
+void CtrDrbg::Instantiate(Span<const uint8_t> entropy,
+                          Span<const uint8_t> personalization) {
+    if (entropy.size() != DRBG_SEED_BYTES) {
+        throw std::invalid_argument("CTR_DRBG: entropy input must be 48 bytes");
+    }
+    unsigned char seed[DRBG_SEED_BYTES];
+    PadInput(personalization, seed);
+    XorBytes(seed, seed, entropy.data(), DRBG_SEED_BYTES);
+    const unsigned char zero_key[DRBG_KEY_BYTES] = {};
+    BuildAesKey(key_, zero_key, DRBG_KEY_BYTES);
+    std::memset(v_, 0, sizeof(v_));
+    Update(seed);
+    Wipe(seed, sizeof(seed));
+    reseed_counter_ = 1;
+    instantiated_ = true;
+}
+
+// 10.2.1.4.1.
+void CtrDrbg::Reseed(Span<const uint8_t> entropy, Span<const uint8_t> additional) {
+    if (!instantiated_) {
+        throw std::invalid_argument("CTR_DRBG: reseed before instantiate");
+    }
+    if (entropy.size() != DRBG_SEED_BYTES) {
+        throw std::invalid_argument("CTR_DRBG: entropy input must be 48 bytes");
+    }
+    unsigned char seed[DRBG_SEED_BYTES];
+    PadInput(additional, seed);
+    XorBytes(seed, seed, entropy.data(), DRBG_SEED_BYTES);
+    Update(seed);
+    Wipe(seed, sizeof(seed));
+    reseed_counter_ = 1;
+}
+
+// 10.2.1.5.1. The same padded additional input, or zeros, goes into the
+// update before and after the output.
+bool CtrDrbg::Generate(Span<uint8_t> out, Span<const uint8_t> additional) {
+    if (!instantiated_) {
+        throw std::invalid_argument("CTR_DRBG: generate before instantiate");
+    }
+    if (out.size() > DRBG_MAX_REQUEST_BYTES) {
+        throw std::invalid_argument("CTR_DRBG: request longer than 2^19 bits");
+    }
+    if (reseed_counter_ > DRBG_RESEED_INTERVAL) {
+        return false;
+    }
+    unsigned char extra[DRBG_SEED_BYTES];
+    PadInput(additional, extra);
+    if (!additional.empty()) {
+        Update(extra);
+    }
+    Keystream(key_, v_, out.data(), out.size());
+    Update(extra);
+    Wipe(extra, sizeof(extra));
+    reseed_counter_++;
+    return true;
+}
+
+void CtrDrbg::Uninstantiate() {
+    if (instantiated_) {
+        WipeAesKey(key_);
+    }
+    Wipe(v_, sizeof(v_));
+    reseed_counter_ = 0;
+    instantiated_ = false;
+}
+
+
+void OsRandomBytes(unsigned char* out, size_t length) {
+#if defined(_WIN32)
+    while (length) {
+        ULONG piece = static_cast<ULONG>(std::min<size_t>(length, 1 << 30));
+        if (BCryptGenRandom(nullptr, out, piece, BCRYPT_USE_SYSTEM_PREFERRED_RNG) < 0) {
+            throw std::runtime_error("The system random number generator failed");
+        }
+        out += piece;
+        length -= piece;
+    }
+#else
+#if defined(__linux__)
+    while (length) {
+        ssize_t got = getrandom(out, length, 0);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got < 0) {
+            break;
+        }
+        out += got;
+        length -= static_cast<size_t>(got);
+    }
+    if (!length) {
+        return;
+    }
+#endif
+    // Kernels without getrandom, and the other POSIX systems.
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    while (fd >= 0 && length) {
+        ssize_t got = read(fd, out, length);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            break;
+        }
+        out += got;
+        length -= static_cast<size_t>(got);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (length) {
+        throw std::runtime_error("The system random number generator failed");
+    }
+#endif
+}
+
+
+namespace {
+
+// Bumped in the child after fork, which would otherwise carry on with the
+// parent's state and buffer and repeat its output.
+std::atomic<uint64_t> fork_generation(0);
+std::once_flag fork_hook;
+std::atomic<uint64_t> generators_seeded(0);
+
+struct ThreadGenerator {
+    CtrDrbg drbg;
+    std::unique_ptr<unsigned char[]> buffer;
+    // Unused bytes at the end of buffer.
+    size_t available;
+    uint64_t generation;
+    bool seeded;
+
+    ThreadGenerator() : available(0), generation(0), seeded(false) {}
+
+    ~ThreadGenerator() {
+        if (buffer) {
+            Wipe(buffer.get(), DRBG_MAX_REQUEST_BYTES);
+        }
+    }
+
+    // The personalization string tells apart generators seeded at the
+    // same moment, should the system ever return the same entropy twice.
+    void Seed() {
+#if !defined(_WIN32)
+        std::call_once(fork_hook, [] {
+            pthread_atfork(nullptr, nullptr, [] { fork_generation.fetch_add(1); });
+        });
+        uint64_t process = static_cast<uint64_t>(getpid());
+#else
+        uint64_t process = GetCurrentProcessId();
+#endif
+        uint64_t personal[4] = {
+            process,
+            static_cast<uint64_t>(std::hash<std::thread::id>()(std::this_thread::get_id())),
+            static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()),
+            generators_seeded.fetch_add(1),
+        };
+        unsigned char entropy[DRBG_SEED_BYTES];
+        OsRandomBytes(entropy, sizeof(entropy));
+        drbg.Instantiate(Span<const uint8_t>(entropy, sizeof(entropy)),
+                         Span<const uint8_t>(reinterpret_cast<const uint8_t*>(personal),
+                                             sizeof(personal)));
+        Wipe(entropy, sizeof(entropy));
+        if (!buffer) {
+            buffer.reset(new unsigned char[DRBG_MAX_REQUEST_BYTES]);
+        }
+        Wipe(buffer.get(), DRBG_MAX_REQUEST_BYTES);
+        available = 0;
+        generation = fork_generation.load();
+        seeded = true;
+    }
+
+    void Fill(unsigned char* out, size_t length) {
+        Span<uint8_t> span(out, length);
+        if (!drbg.Generate(span)) {
+            unsigned char entropy[DRBG_SEED_BYTES];
+            OsRandomBytes(entropy, sizeof(entropy));
+            drbg.Reseed(Span<const uint8_t>(entropy, sizeof(entropy)));
+            Wipe(entropy, sizeof(entropy));
+            drbg.Generate(span);
+        }
+    }
+};
+
+thread_local ThreadGenerator thread_generator;
+
+} // namespace
+
+
+void RandomBytes(unsigned char* out, size_t length) {
+    ThreadGenerator& generator = thread_generator;
+    if (!generator.seeded ||
+        generator.generation != fork_generation.load(std::memory_order_relaxed)) {
+        generator.Seed();
+    }
+    while (length) {
+        if (!generator.available) {
+            // Whole requests go straight to the caller.
+            if (length >= DRBG_MAX_REQUEST_BYTES) {
+                generator.Fill(out, DRBG_MAX_REQUEST_BYTES);
+                out += DRBG_MAX_REQUEST_BYTES;
+                length -= DRBG_MAX_REQUEST_BYTES;
+                continue;
+            }
+            generator.Fill(generator.buffer.get(), DRBG_MAX_REQUEST_BYTES);
+            generator.available = DRBG_MAX_REQUEST_BYTES;
+        }
+        size_t n = std::min(length, generator.available);
+        unsigned char* next =
+            generator.buffer.get() + DRBG_MAX_REQUEST_BYTES - generator.available;
+        std::memcpy(out, next, n);
+        // Bytes handed out are not kept.
+        std::memset(next, 0, n);
+        generator.available -= n;
+        out += n;
+        length -= n;
+    }
+}
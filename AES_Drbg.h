@@ -0,0 +1,74 @@
+// AES_Drbg.h : CTR_DRBG random bit generator for IVs, nonces and keys.
+//
+// CtrDrbg is the NIST SP 800-90A rev. 1 CTR_DRBG with AES-256 and a
+// 128-bit counter, without the derivation function: entropy comes from
+// the operating system and is used as full-entropy seed material. Output
+// is the CTR keystream under the DRBG's key, so a whole request runs
+// through the engine's multi-block path, and the key and counter are
+// replaced after every request so earlier output cannot be recomputed
+// from the state.
+//
+// RandomBytes serves a process from one generator per thread. Each keeps
+// a buffer refilled by one maximum-size request, so taking bytes is a
+// copy out of thread-local memory with no lock and no system call; the
+// generator reseeds from the operating system every
+// DRBG_RESEED_INTERVAL refills, and in a child process after fork.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "AES_Span.h"
+#include "AES_UNSW.h"
+
+// seedlen for AES-256: a 32-byte key and a 16-byte counter.
+#define DRBG_SEED_BYTES 48
+// Largest Generate request, 2^19 bits.
+#define DRBG_MAX_REQUEST_BYTES (1 << 16)
+// Requests between reseeds. SP 800-90A allows up to 2^48.
+#define DRBG_RESEED_INTERVAL 1024
+
+class CtrDrbg {
+public:
+    CtrDrbg();
+    ~CtrDrbg();
+
+    CtrDrbg(const CtrDrbg&) = delete;
+    CtrDrbg& operator=(const CtrDrbg&) = delete;
+
+    // entropy is DRBG_SEED_BYTES of full entropy; personalization, at most
+    // DRBG_SEED_BYTES, separates instances seeded alike. Throws
+    // std::invalid_argument on other lengths.
+    void Instantiate(Span<const uint8_t> entropy,
+                     Span<const uint8_t> personalization = Span<const uint8_t>());
+
+    // Same lengths as Instantiate. Resets the request count.
+    void Reseed(Span<const uint8_t> entropy,
+                Span<const uint8_t> additional = Span<const uint8_t>());
+
+    // Fills out, at most DRBG_MAX_REQUEST_BYTES. Returns false without
+    // output once DRBG_RESEED_INTERVAL requests have been served since the
+    // last (re)seed. Throws std::invalid_argument if out is too long or
+    // the generator was never instantiated.
+    bool Generate(Span<uint8_t> out,
+                  Span<const uint8_t> additional = Span<const uint8_t>());
+
+    // Wipes the state; Instantiate must be called again.
+    void Uninstantiate();
+
+private:
+    void Update(const unsigned char provided[DRBG_SEED_BYTES]);
+
+    AesKey key_;
+    unsigned char v_[16];
+    uint64_t reseed_counter_;
+    bool instantiated_;
+};
+
+// Fills out from the operating system: getrandom or /dev/urandom, or
+// BCryptGenRandom on Windows. Throws std::runtime_error if it cannot.
+void OsRandomBytes(unsigned char* out, size_t length);
+
+// Fills out from the calling thread's generator, instantiated from
+// OsRandomBytes on first use. Safe to call from any number of threads.
+void RandomBytes(unsigned char* out, size_t length);
@@ -0,0 +1,127 @@
+// AES_Engine.cpp : Portable engine wrapper and runtime engine selection.
+//
+#include <atomic>
+#include <cstring>
+
+#include "AES_UNSW.h"
+#include "AES_Engine.h"
+
+namespace {
+
+void PortableInvertKey(const unsigned char enc_keys[], int number_rounds,
+                       unsigned char dec_keys[]) {
+    // The reference decryptor walks the encryption schedule backwards.
+    std::memcpy(dec_keys, enc_keys, 16 * (number_rounds + 1));
+}
+
+void PortableEncryptBlock(const unsigned char enc_keys[], int number_rounds,
+                          const unsigned char in[16], unsigned char out[16]) {
+    unsigned char state_matrix[4][4];
+    for (int i = 0; i < ROW_SIZE; i++) {
+        for (int j = 0; j < COL_SIZE; j++) {
+            state_matrix[i][j] = in[i + (4 * j)];
+        }
+    }
+    ReferenceEncryptBlock(state_matrix,
+        reinterpret_cast<const unsigned char(*)[4]>(enc_keys), number_rounds);
+    for (int i = 0; i < ROW_SIZE; i++) {
+        for (int j = 0; j < COL_SIZE; j++) {
+            out[i + (4 * j)] = state_matrix[i][j];
+        }
+    }
+}
+
+void PortableDecryptBlock(const unsigned char dec_keys[], int number_rounds,
+                          const unsigned char in[16], unsigned char out[16]) {
+    unsigned char state_matrix[4][4];
+    for (int i = 0; i < ROW_SIZE; i++) {
+        for (int j = 0; j < COL_SIZE; j++) {
+            state_matrix[i][j] = in[i + (4 * j)];
+        }
+    }
+    ReferenceDecryptBlock(state_matrix,
+        reinterpret_cast<const unsigned char(*)[4]>(dec_keys), number_rounds);
+    for (int i = 0; i < ROW_SIZE; i++) {
+        for (int j = 0; j < COL_SIZE; j++) {
+            out[i + (4 * j)] = state_matrix[i][j];
+        }
+    }
+}
+
+void PortableEncryptBlocks(const unsigned char enc_keys[], int number_rounds,
+                           const unsigned char* in, unsigned char* out,
+                           size_t blocks) {
+    for (size_t i = 0; i < blocks; i++) {
+        PortableEncryptBlock(enc_keys, number_rounds, in + 16 * i, out + 16 * i);
+    }
+}
+
+void PortableDecryptBlocks(const unsigned char dec_keys[], int number_rounds,
+                           const unsigned char* in, unsigned char* out,
+                           size_t blocks) {
+    for (size_t i = 0; i < blocks; i++) {
+        PortableDecryptBlock(dec_keys, number_rounds, in + 16 * i, out + 16 * i);
+    }
+}
+
+void PortableEncryptMultiKey(const unsigned char* const keys[], int number_rounds,
+                             const unsigned char* const in[],
+                             unsigned char* const out[], size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        PortableEncryptBlock(keys[i], number_rounds, in[i], out[i]);
+    }
+}
+
+void PortableDecryptMultiKey(const unsigned char* const keys[], int number_rounds,
+                             const unsigned char* const in[],
+                             unsigned char* const out[], size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        PortableDecryptBlock(keys[i], number_rounds, in[i], out[i]);
+    }
+}
+
+const AesEngine& SelectEngine() {
+#if defined(AES_X86)
+    if (GetCpuFeatures().aesni) {
+        return aesni_engine;
+    }
+#endif
+    // Lone blocks take a whole bitsliced pass, but the table rounds would
+    // leak key bits through the cache on every one of them: CBC encryption,
+    // GCM's hash subkey and tag, CMAC. table_engine is only used when it is
+    // asked for by name.
+    return bitslice_engine;
+}
+
+// Null until SetActiveEngine: DefaultEngine() then.
+std::atomic<const AesEngine*> active_engine(nullptr);
+
+} // namespace
+
+
+const AesEngine portable_engine = {
+    "portable",
+    PortableExpandKey,
+    PortableInvertKey,
+    PortableEncryptBlock,
+    PortableDecryptBlock,
+    PortableEncryptBlocks,
+    PortableDecryptBlocks,
+    PortableEncryptMultiKey,
+    PortableDecryptMultiKey,
+};
+
+
+const AesEngine& DefaultEngine() {
+    static const AesEngine& engine = SelectEngine();
+    return engine;
+}
+
+const AesEngine& ActiveEngine() {
+    const AesEngine* engine = active_engine.load(std::memory_order_acquire);
+    return engine ? *engine : DefaultEngine();
+}
+
+void SetActiveEngine(const AesEngine& engine) {
+    active_engine.store(&engine, std::memory_order_release);
+}
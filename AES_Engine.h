@@ -0,0 +1,111 @@
+// AES_Engine.h : Interchangeable AES round engines and runtime dispatch.
+//
+// Every engine reads the same encryption key schedule: 16 bytes per round
+// key in FIPS-197 byte order, exactly what BuildKeySchedule leaves in
+// word_matrix. The decryption schedule is produced by the engine's own
+// invert_key and must only be used with that engine.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include "AES_Cpu.h"
+
+// Largest schedule we ever hold: AES-256, 15 round keys of 16 bytes.
+#define MAX_ROUNDS 14
+#define MAX_ROUND_KEY_BYTES (16 * (MAX_ROUNDS + 1))
+
+struct AesEngine {
+    const char* name;
+    // Expands key_bytes of cipher key into the encryption schedule.
+    void (*expand_key)(const unsigned char* key, int key_bytes,
+                       unsigned char enc_keys[]);
+    // Derives this engine's decryption schedule from the encryption one.
+    void (*invert_key)(const unsigned char enc_keys[], int number_rounds,
+                       unsigned char dec_keys[]);
+    void (*encrypt_block)(const unsigned char enc_keys[], int number_rounds,
+                          const unsigned char in[16], unsigned char out[16]);
+    void (*decrypt_block)(const unsigned char dec_keys[], int number_rounds,
+                          const unsigned char in[16], unsigned char out[16]);
+    // ECB over `blocks` consecutive blocks. Engines that work on several
+    // independent blocks at once (bitslicing, pipelining) do it here; the
+    // modes feed their keystream and batch work through these.
+    void (*encrypt_blocks)(const unsigned char enc_keys[], int number_rounds,
+                           const unsigned char* in, unsigned char* out,
+                           size_t blocks);
+    void (*decrypt_blocks)(const unsigned char dec_keys[], int number_rounds,
+                           const unsigned char* in, unsigned char* out,
+                           size_t blocks);
+    // One block under each of `count` schedules: in[i] -> out[i] with
+    // keys[i], every schedule having number_rounds rounds. The blocks are
+    // independent, so engines interleave them round by round as in
+    // encrypt_blocks; out[i] may equal in[i].
+    void (*encrypt_multi_key)(const unsigned char* const keys[],
+                              int number_rounds,
+                              const unsigned char* const in[],
+                              unsigned char* const out[], size_t count);
+    void (*decrypt_multi_key)(const unsigned char* const keys[],
+                              int number_rounds,
+                              const unsigned char* const in[],
+                              unsigned char* const out[], size_t count);
+};
+
+// Byte-at-a-time reference rounds (SubstituteByte/ShiftRows/MixColumns).
+extern const AesEngine portable_engine;
+
+// Word-oriented engine: the state is kept as four 32-bit columns and
+// SubBytes, ShiftRows and MixColumns are fused into four 1 KB lookup
+// tables per direction. Its lookups depend on the key and data, so the
+// cache timing leaks them; it is never selected by default.
+extern const AesEngine table_engine;
+
+// Bitsliced, constant-time engine: 8 blocks per pass with SSE2, 16 with
+// AVX2, S-box evaluated as a boolean circuit. Its decryption schedule is
+// the same equivalent inverse cipher layout the table engine uses.
+extern const AesEngine bitslice_engine;
+
+#if defined(AES_X86)
+// AESENC/AESDEC/AESKEYGENASSIST. Only usable when GetCpuFeatures().aesni.
+extern const AesEngine aesni_engine;
+
+// The same with four blocks in flight per batch step instead of eight.
+extern const AesEngine aesni_x4_engine;
+#endif
+
+// The engine new keys are built with. Until SetActiveEngine is called it
+// is DefaultEngine().
+const AesEngine& ActiveEngine();
+
+// The fastest engine this CPU supports, chosen through CPUID on first use:
+// AES-NI when present, otherwise the bitsliced rounds. Both are constant
+// time for lone blocks and batches alike.
+const AesEngine& DefaultEngine();
+
+// Makes engine the ActiveEngine() for keys built from now on; keys built
+// earlier keep the engine they were built with. Applied by the tuning
+// plan at startup.
+void SetActiveEngine(const AesEngine& engine);
+
+// Key expansion shared by the software engines.
+void PortableExpandKey(const unsigned char* key, int key_bytes,
+                       unsigned char enc_keys[]);
+
+// Calls body(std::integral_constant<int, Nr>()) for the key's round count,
+// so an engine can instantiate its rounds once per key size with Nr known
+// at compile time. The key size is then tested once per call instead of
+// once per round.
+template <typename Body>
+inline void WithRounds(int number_rounds, Body&& body) {
+    switch (number_rounds) {
+    case 10:
+        body(std::integral_constant<int, 10>());
+        break;
+    case 12:
+        body(std::integral_constant<int, 12>());
+        break;
+    default:
+        body(std::integral_constant<int, 14>());
+        break;
+    }
+}
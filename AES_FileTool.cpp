@@ -0,0 +1,303 @@
+// AES_FileTool.cpp : Streaming file encryption in CTR and GCM modes.
+//
+// The input is read in large chunks into one of two buffers and encrypted
+// in place (CTR across DefaultThreadPool()), while a writer thread writes
+// the previous chunk out. Only the two chunk buffers are ever held, so
+// memory use does not grow with the file.
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AES_Codec.h"
+#include "AES_Drbg.h"
+#include "AES_FileTool.h"
+#include "AES_Modes.h"
+#include "AES_Tune.h"
+
+// Bytes read, encrypted and written per step.
+#define FILE_CHUNK_BYTES (8 << 20)
+
+#define CTR_NONCE_BYTES 16
+#define GCM_NONCE_BYTES 12
+
+namespace {
+
+// Writes chunks on a thread of its own, one at a time, so the write of
+// chunk N overlaps the read and encryption of chunk N+1.
+class ChunkWriter {
+public:
+    explicit ChunkWriter(std::ostream& file)
+        : file_(file), data_(nullptr), length_(0), failed_(false),
+          stopping_(false), thread_(&ChunkWriter::WriterLoop, this) {}
+
+    ~ChunkWriter() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        changed_.notify_all();
+        thread_.join();
+    }
+
+    ChunkWriter(const ChunkWriter&) = delete;
+    ChunkWriter& operator=(const ChunkWriter&) = delete;
+
+    // Waits until the previous chunk is on disk, so its buffer may be
+    // refilled, then queues this one. data must stay valid until the next
+    // Write or Finish returns.
+    void Write(const unsigned char* data, size_t length) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [this] { return data_ == nullptr; });
+        data_ = data;
+        length_ = length;
+        changed_.notify_all();
+    }
+
+    // Waits for the last chunk; false if any write failed.
+    bool Finish() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [this] { return data_ == nullptr; });
+        return !failed_;
+    }
+
+private:
+    void WriterLoop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            changed_.wait(lock, [this] { return stopping_ || data_ != nullptr; });
+            if (data_ == nullptr) {
+                return;
+            }
+            const unsigned char* data = data_;
+            size_t length = length_;
+            lock.unlock();
+            file_.write(reinterpret_cast<const char*>(data),
+                        static_cast<std::streamsize>(length));
+            bool ok = static_cast<bool>(file_);
+            lock.lock();
+            failed_ = failed_ || !ok;
+            data_ = nullptr;
+            changed_.notify_all();
+        }
+    }
+
+    std::ostream& file_;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    const unsigned char* data_;
+    size_t length_;
+    bool failed_;
+    bool stopping_;
+    std::thread thread_;
+};
+
+bool ParseHex(const std::string& hex, std::vector<unsigned char>& bytes) {
+    bytes.resize(hex.size() / 2);
+    return HexDecode(hex.data(), hex.size(), bytes.data());
+}
+
+size_t ReadChunk(std::istream& file, unsigned char* buffer, size_t length) {
+    file.read(reinterpret_cast<char*>(buffer),
+              static_cast<std::streamsize>(length));
+    return static_cast<size_t>(file.gcount());
+}
+
+void PrintUsage() {
+    std::cerr << "Usage: AES_UNSW encrypt|decrypt ctr|gcm <key in hex> "
+                 "<input file> <output file>\n"
+                 "CTR uses every thread; GCM runs on one and is limited to "
+                 "2^36 - 32 bytes." << std::endl;
+}
+
+// Whether the GCM plain text of input fits the mode's limit. Inputs whose
+// size cannot be found, e.g. pipes, pass; GcmEncryptUpdate and
+// GcmDecryptUpdate still throw at the limit.
+bool FitsGcm(std::ifstream& input, bool encrypting) {
+    input.seekg(0, std::ios::end);
+    std::streamoff size = input.tellg();
+    input.clear();
+    input.seekg(0, std::ios::beg);
+    if (size < 0) {
+        input.clear();
+        return true;
+    }
+    uint64_t plain = static_cast<uint64_t>(size);
+    if (!encrypting) {
+        uint64_t framing = GCM_NONCE_BYTES + BLOCK_SIZE;
+        plain = plain > framing ? plain - framing : 0;
+    }
+    return plain <= GCM_MAX_BYTES;
+}
+
+// Streams input to output. Returns the process exit code.
+int ProcessFile(bool encrypting, bool gcm, const AesKey& key,
+                const char* input_path, const char* output_path) {
+    std::ifstream input(input_path, std::ios::binary);
+    if (!input) {
+        std::cerr << "Cannot open " << input_path << std::endl;
+        return 1;
+    }
+    if (gcm && !FitsGcm(input, encrypting)) {
+        std::cerr << input_path << " is longer than GCM allows (2^36 - 32 bytes)"
+                  << std::endl;
+        return 1;
+    }
+    std::ofstream output(output_path, std::ios::binary | std::ios::trunc);
+    if (!output) {
+        std::cerr << "Cannot create " << output_path << std::endl;
+        return 1;
+    }
+
+    // The nonce header: random when encrypting, read back when decrypting.
+    size_t nonce_bytes = gcm ? GCM_NONCE_BYTES : CTR_NONCE_BYTES;
+    unsigned char nonce[CTR_NONCE_BYTES] = {};
+    if (encrypting) {
+        RandomBytes(nonce, nonce_bytes);
+        output.write(reinterpret_cast<const char*>(nonce),
+                     static_cast<std::streamsize>(nonce_bytes));
+    } else if (ReadChunk(input, nonce, nonce_bytes) != nonce_bytes) {
+        std::cerr << input_path << " is too short to be encrypted" << std::endl;
+        return 1;
+    }
+
+    GcmKey gcm_key;
+    GcmState gcm_state;
+    if (gcm) {
+        BuildGcmKey(gcm_key, key);
+        GcmStart(gcm_state, gcm_key, nonce, nonce_bytes, nullptr, 0);
+    }
+
+    // When decrypting GCM the last 16 bytes read are held back: they are
+    // cipher text unless the end of the file follows, in which case they
+    // are the tag.
+    size_t held_bytes = (gcm && !encrypting) ? BLOCK_SIZE : 0;
+    unsigned char held[BLOCK_SIZE];
+    if (held_bytes && ReadChunk(input, held, held_bytes) != held_bytes) {
+        std::cerr << input_path << " is too short to be encrypted" << std::endl;
+        return 1;
+    }
+
+    std::vector<unsigned char> buffers[2];
+    buffers[0].resize(FILE_CHUNK_BYTES + BLOCK_SIZE);
+    buffers[1].resize(FILE_CHUNK_BYTES + BLOCK_SIZE);
+    uint64_t total_bytes = 0;
+    std::chrono::steady_clock::duration crypto_time(0);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bool written;
+    {
+        ChunkWriter writer(output);
+        for (int chunk = 0;; chunk ^= 1) {
+            unsigned char* buffer = buffers[chunk].data();
+            std::memcpy(buffer, held, held_bytes);
+            size_t length = ReadChunk(input, buffer + held_bytes, FILE_CHUNK_BYTES);
+            std::memcpy(held, buffer + length, held_bytes);
+
+            std::chrono::steady_clock::time_point crypto_start = std::chrono::steady_clock::now();
+            if (!gcm) {
+                CtrCrypt(key, nonce, buffer, buffer, length);
+                AddCounter(nonce, (length + BLOCK_SIZE - 1) / BLOCK_SIZE);
+            } else if (encrypting) {
+                GcmEncryptUpdate(gcm_state, buffer, buffer, length);
+            } else {
+                GcmDecryptUpdate(gcm_state, buffer, buffer, length);
+            }
+            crypto_time += std::chrono::steady_clock::now() - crypto_start;
+
+            if (length) {
+                writer.Write(buffer, length);
+            }
+            total_bytes += length;
+            if (length < FILE_CHUNK_BYTES) {
+                break;
+            }
+        }
+        written = writer.Finish();
+    }
+    if (input.bad()) {
+        std::cerr << "Error reading " << input_path << std::endl;
+        return 1;
+    }
+
+    if (gcm) {
+        unsigned char tag[BLOCK_SIZE];
+        GcmFinish(gcm_state, tag);
+        if (encrypting) {
+            output.write(reinterpret_cast<const char*>(tag), BLOCK_SIZE);
+        } else if (!GcmTagsEqual(tag, held)) {
+            // The plain text has already been written; it must not be kept.
+            output.close();
+            std::remove(output_path);
+            std::cerr << "Authentication failed: " << input_path
+                      << " is corrupt or the key is wrong" << std::endl;
+            return 1;
+        }
+    }
+    output.flush();
+    if (!written || !output) {
+        std::cerr << "Error writing " << output_path << std::endl;
+        return 1;
+    }
+
+    // Overall rate against the rate of the encryption alone: when the
+    // second is much higher, the run was bound by the disk.
+    double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    double crypto_seconds = std::chrono::duration<double>(crypto_time).count();
+    double megabytes = static_cast<double>(total_bytes) / (1 << 20);
+    std::cout << megabytes << " MB in " << seconds << " s: "
+              << (seconds > 0 ? megabytes / seconds : 0) << " MB/s overall, "
+              << (crypto_seconds > 0 ? megabytes / crypto_seconds : 0)
+              << " MB/s encryption" << std::endl;
+    return 0;
+}
+
+} // namespace
+
+
+int RunFileTool(int argc, char* argv[], const std::string& profile_path) {
+    if (argc != 6) {
+        PrintUsage();
+        return 2;
+    }
+    std::string direction(argv[1]);
+    std::string mode(argv[2]);
+    std::vector<unsigned char> key_bytes;
+    if ((direction != "encrypt" && direction != "decrypt") ||
+        (mode != "ctr" && mode != "gcm") || !ParseHex(argv[3], key_bytes)) {
+        PrintUsage();
+        return 2;
+    }
+
+    AesKey key;
+    try {
+        BuildAesKey(key, key_bytes.data(), static_cast<int>(key_bytes.size()));
+    } catch (const std::invalid_argument& e) {
+        std::cerr << e.what() << std::endl;
+        return 2;
+    }
+    if (!profile_path.empty()) {
+        TuneAtStartup(profile_path);
+    }
+    int status;
+    try {
+        status = ProcessFile(direction == "encrypt", mode == "gcm", key,
+                             argv[4], argv[5]);
+    } catch (const std::exception& e) {
+        // E.g. the GCM limit on an input of unknown size, the random
+        // generator or memory; the output so far is not usable.
+        std::remove(argv[5]);
+        std::cerr << "Cannot process " << argv[4] << ": " << e.what() << std::endl;
+        status = 1;
+    }
+    WipeAesKey(key);
+    return status;
+}
@@ -0,0 +1,20 @@
+// AES_FileTool.h : Command line encryption of files of any size.
+//
+#pragma once
+
+#include <string>
+
+// Runs `AES_UNSW encrypt|decrypt ctr|gcm <key in hex> <input> <output>`
+// and returns the process exit code: 0 on success, 1 when a file cannot
+// be processed or fails authentication, 2 on bad arguments. No partial
+// output file is left behind on an error. Once the arguments are
+// accepted, the tuning plan is read from profile_path, or measured and
+// saved there on the first run; an empty path keeps the current plan.
+//
+// Encrypted files start with a random nonce (a 16-byte initial counter
+// for CTR, 12 bytes for GCM); GCM files end with the 16-byte tag.
+//
+// CTR spreads each chunk over DefaultThreadPool(); GCM runs on one thread,
+// as its GHASH chain is serial, and takes at most 2^36 - 32 bytes of plain
+// text (GCM_MAX_BYTES), so longer inputs are refused before any output.
+int RunFileTool(int argc, char* argv[], const std::string& profile_path = std::string());
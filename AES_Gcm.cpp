@@ -0,0 +1,459 @@
+// AES_Gcm.cpp : Galois/Counter Mode authenticated encryption.
+//
+// GHASH multiplies by the hash subkey H in GF(2^128). With PCLMULQDQ the
+// product is formed by carry-less multiplication, four blocks at a time
+// against H^4..H^1 with a single reduction. Without it, Shoup's 4-bit
+// table method is used.
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include "AES_Modes.h"
+#include "AES_Perf.h"
+
+#if defined(AES_X86)
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+// Blocks of keystream generated and hashed per pass, as in CTR mode.
+#define GCM_BATCH_BLOCKS 32
+
+namespace {
+
+inline uint64_t LoadBigEndian64(const unsigned char* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+inline void StoreBigEndian64(unsigned char* p, uint64_t v) {
+    for (int i = 7; i >= 0; i--) {
+        p[i] = static_cast<unsigned char>(v);
+        v >>= 8;
+    }
+}
+
+// What the GCM polynomial folds back into the top of Z for each nibble
+// shifted out of its low end.
+const uint16_t last4[16] = {
+    0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+    0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0,
+};
+
+// table[i] = i * H, where nibble bit 8 stands for x^0 and bit 1 for x^3.
+void BuildTables(GcmKey& gcm_key, const unsigned char h[16]) {
+    uint64_t* high = gcm_key.h_table_high;
+    uint64_t* low = gcm_key.h_table_low;
+    uint64_t vh = LoadBigEndian64(h);
+    uint64_t vl = LoadBigEndian64(h + 8);
+
+    high[0] = 0;
+    low[0] = 0;
+    high[8] = vh;
+    low[8] = vl;
+    // Multiplying by x is a right shift in GCM bit order.
+    for (int i = 4; i > 0; i >>= 1) {
+        uint64_t reduce = (vl & 1) * 0xe100000000000000ULL;
+        vl = (vh << 63) | (vl >> 1);
+        vh = (vh >> 1) ^ reduce;
+        high[i] = vh;
+        low[i] = vl;
+    }
+    for (int i = 2; i <= 8; i *= 2) {
+        for (int j = 1; j < i; j++) {
+            high[i + j] = high[i] ^ high[j];
+            low[i + j] = low[i] ^ low[j];
+        }
+    }
+}
+
+// x = x * H, one nibble at a time from the last byte to the first.
+void TableMultiply(const GcmKey& gcm_key, unsigned char x[16]) {
+    const uint64_t* high = gcm_key.h_table_high;
+    const uint64_t* low = gcm_key.h_table_low;
+    uint64_t zh = 0;
+    uint64_t zl = 0;
+
+    for (int i = 15; i >= 0; i--) {
+        unsigned nibbles[2] = { x[i] & 0xfu, static_cast<unsigned>(x[i] >> 4) };
+        for (int n = 0; n < 2; n++) {
+            if (i != 15 || n != 0) {
+                unsigned rem = static_cast<unsigned>(zl & 0xf);
+                zl = (zh << 60) | (zl >> 4);
+                zh = (zh >> 4) ^ (static_cast<uint64_t>(last4[rem]) << 48);
+            }
+            zh ^= high[nibbles[n]];
+            zl ^= low[nibbles[n]];
+        }
+    }
+    StoreBigEndian64(x, zh);
+    StoreBigEndian64(x + 8, zl);
+}
+
+void TableGhash(const GcmKey& gcm_key, unsigned char y[16],
+                const unsigned char* data, size_t blocks) {
+    for (size_t i = 0; i < blocks; i++) {
+        XorBytes(y, y, data + BLOCK_SIZE * i, BLOCK_SIZE);
+        TableMultiply(gcm_key, y);
+    }
+}
+
+#if defined(AES_X86)
+
+// PCLMULQDQ works on little-endian lanes; GCM values are byte-reversed on
+// the way in and out so the polynomial bits line up.
+AES_TARGET("ssse3")
+inline __m128i ByteReverse(__m128i x) {
+    return _mm_shuffle_epi8(x, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+                                            8, 9, 10, 11, 12, 13, 14, 15));
+}
+
+// Adds the unreduced 256-bit product a * b into lo:mid:hi.
+AES_TARGET("pclmul,sse2")
+inline void ClmulAccumulate(__m128i a, __m128i b,
+                            __m128i& lo, __m128i& mid, __m128i& hi) {
+    lo = _mm_xor_si128(lo, _mm_clmulepi64_si128(a, b, 0x00));
+    hi = _mm_xor_si128(hi, _mm_clmulepi64_si128(a, b, 0x11));
+    mid = _mm_xor_si128(mid, _mm_clmulepi64_si128(a, b, 0x10));
+    mid = _mm_xor_si128(mid, _mm_clmulepi64_si128(a, b, 0x01));
+}
+
+// Shifts the bit-reflected product left by one and reduces it modulo
+// x^128 + x^7 + x^2 + x + 1 (Intel's carry-less multiplication white
+// paper, algorithm 5). Both steps are linear, so several products may be
+// summed first and reduced once.
+AES_TARGET("pclmul,sse2")
+inline __m128i ClmulReduce(__m128i lo, __m128i mid, __m128i hi) {
+    lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+    hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+
+    __m128i lo_carry = _mm_srli_epi32(lo, 31);
+    __m128i hi_carry = _mm_srli_epi32(hi, 31);
+    lo = _mm_slli_epi32(lo, 1);
+    hi = _mm_slli_epi32(hi, 1);
+    __m128i cross = _mm_srli_si128(lo_carry, 12);
+    hi_carry = _mm_slli_si128(hi_carry, 4);
+    lo_carry = _mm_slli_si128(lo_carry, 4);
+    lo = _mm_or_si128(lo, lo_carry);
+    hi = _mm_or_si128(hi, hi_carry);
+    hi = _mm_or_si128(hi, cross);
+
+    __m128i a = _mm_slli_epi32(lo, 31);
+    __m128i b = _mm_slli_epi32(lo, 30);
+    __m128i c = _mm_slli_epi32(lo, 25);
+    a = _mm_xor_si128(a, b);
+    a = _mm_xor_si128(a, c);
+    __m128i spill = _mm_srli_si128(a, 4);
+    a = _mm_slli_si128(a, 12);
+    lo = _mm_xor_si128(lo, a);
+
+    __m128i d = _mm_srli_epi32(lo, 1);
+    __m128i e = _mm_srli_epi32(lo, 2);
+    __m128i f = _mm_srli_epi32(lo, 7);
+    d = _mm_xor_si128(d, e);
+    d = _mm_xor_si128(d, f);
+    d = _mm_xor_si128(d, spill);
+    lo = _mm_xor_si128(lo, d);
+    return _mm_xor_si128(hi, lo);
+}
+
+AES_TARGET("pclmul,sse2")
+inline __m128i ClmulMultiply(__m128i a, __m128i b) {
+    __m128i lo = _mm_setzero_si128();
+    __m128i mid = _mm_setzero_si128();
+    __m128i hi = _mm_setzero_si128();
+    ClmulAccumulate(a, b, lo, mid, hi);
+    return ClmulReduce(lo, mid, hi);
+}
+
+AES_TARGET("pclmul,ssse3")
+void BuildPowers(GcmKey& gcm_key, const unsigned char h[16]) {
+    __m128i* powers = reinterpret_cast<__m128i*>(gcm_key.h_powers);
+    __m128i h1 = ByteReverse(_mm_loadu_si128(reinterpret_cast<const __m128i*>(h)));
+    __m128i hn = h1;
+    _mm_store_si128(powers, h1);
+    for (int i = 1; i < 4; i++) {
+        hn = ClmulMultiply(hn, h1);
+        _mm_store_si128(powers + i, hn);
+    }
+}
+
+// Y = (((Y ^ X1) H ^ X2) H ^ X3) H ^ X4) H, evaluated as
+// (Y ^ X1) H^4 ^ X2 H^3 ^ X3 H^2 ^ X4 H so the four multiplies overlap.
+AES_TARGET("pclmul,ssse3")
+void ClmulGhash(const GcmKey& gcm_key, unsigned char y[16],
+                const unsigned char* data, size_t blocks) {
+    const __m128i* powers = reinterpret_cast<const __m128i*>(gcm_key.h_powers);
+    const __m128i* src = reinterpret_cast<const __m128i*>(data);
+    __m128i h1 = _mm_load_si128(powers);
+    __m128i h2 = _mm_load_si128(powers + 1);
+    __m128i h3 = _mm_load_si128(powers + 2);
+    __m128i h4 = _mm_load_si128(powers + 3);
+    __m128i acc = ByteReverse(_mm_loadu_si128(reinterpret_cast<const __m128i*>(y)));
+    size_t i = 0;
+
+    for (; i + 4 <= blocks; i += 4) {
+        __m128i x0 = _mm_xor_si128(acc, ByteReverse(_mm_loadu_si128(src + i)));
+        __m128i x1 = ByteReverse(_mm_loadu_si128(src + i + 1));
+        __m128i x2 = ByteReverse(_mm_loadu_si128(src + i + 2));
+        __m128i x3 = ByteReverse(_mm_loadu_si128(src + i + 3));
+        __m128i lo = _mm_setzero_si128();
+        __m128i mid = _mm_setzero_si128();
+        __m128i hi = _mm_setzero_si128();
+        ClmulAccumulate(x0, h4, lo, mid, hi);
+        ClmulAccumulate(x1, h3, lo, mid, hi);
+        ClmulAccumulate(x2, h2, lo, mid, hi);
+        ClmulAccumulate(x3, h1, lo, mid, hi);
+        acc = ClmulReduce(lo, mid, hi);
+    }
+    for (; i < blocks; i++) {
+        acc = ClmulMultiply(_mm_xor_si128(acc, ByteReverse(_mm_loadu_si128(src + i))), h1);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(y), ByteReverse(acc));
+}
+
+#endif // AES_X86
+
+void Ghash(const GcmKey& gcm_key, unsigned char y[16],
+           const unsigned char* data, size_t blocks) {
+#if defined(AES_X86)
+    if (gcm_key.use_clmul) {
+        ClmulGhash(gcm_key, y, data, blocks);
+        return;
+    }
+#endif
+    TableGhash(gcm_key, y, data, blocks);
+}
+
+// A trailing partial block is hashed as if zero padded.
+void GhashBytes(const GcmKey& gcm_key, unsigned char y[16],
+                const unsigned char* data, size_t length) {
+    size_t full_blocks = length / BLOCK_SIZE;
+    Ghash(gcm_key, y, data, full_blocks);
+    size_t tail = length - BLOCK_SIZE * full_blocks;
+    if (tail) {
+        unsigned char last_block[BLOCK_SIZE] = {};
+        std::memcpy(last_block, data + BLOCK_SIZE * full_blocks, tail);
+        Ghash(gcm_key, y, last_block, 1);
+    }
+}
+
+void HashLengths(const GcmKey& gcm_key, unsigned char y[16],
+                 uint64_t first_bytes, uint64_t second_bytes) {
+    unsigned char lengths[BLOCK_SIZE];
+    StoreBigEndian64(lengths, first_bytes * 8);
+    StoreBigEndian64(lengths + 8, second_bytes * 8);
+    Ghash(gcm_key, y, lengths, 1);
+}
+
+// Only the low 32 bits of the counter block are incremented.
+void Increment32(unsigned char counter[16]) {
+    for (int i = 15; i >= 12; i--) {
+        if (++counter[i]) {
+            break;
+        }
+    }
+}
+
+// Pre-counter block J0: IV || 0^31 || 1 for a 96-bit IV, GHASH of the
+// padded IV and its length otherwise.
+void DeriveJ0(const GcmKey& gcm_key, const unsigned char* iv,
+              size_t iv_length, unsigned char j0[16]) {
+    if (iv_length == 12) {
+        std::memcpy(j0, iv, 12);
+        j0[12] = 0;
+        j0[13] = 0;
+        j0[14] = 0;
+        j0[15] = 1;
+        return;
+    }
+    std::memset(j0, 0, BLOCK_SIZE);
+    GhashBytes(gcm_key, j0, iv, iv_length);
+    HashLengths(gcm_key, j0, 0, iv_length);
+}
+
+void CheckLength(uint64_t length) {
+    if (length > GCM_MAX_BYTES) {
+        throw std::invalid_argument("GCM: message longer than 2^36 - 32 bytes");
+    }
+}
+
+// CTR encryption stitched with GHASH: each batch of keystream is applied
+// and the cipher text hashed while it is still in L1. counter is the last
+// counter block used and is advanced. Decryption hashes the input before
+// overwriting it, so in may equal out.
+void CryptAndHash(const GcmKey& gcm_key, unsigned char counter[16],
+                  const unsigned char* in, unsigned char* out, size_t length,
+                  unsigned char y[16], bool encrypting) {
+    alignas(16) unsigned char counter_blocks[GCM_BATCH_BLOCKS * BLOCK_SIZE];
+    alignas(16) unsigned char keystream[GCM_BATCH_BLOCKS * BLOCK_SIZE];
+
+    while (length) {
+        size_t blocks = std::min<size_t>(GCM_BATCH_BLOCKS,
+                                         (length + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        for (size_t i = 0; i < blocks; i++) {
+            Increment32(counter);
+            std::memcpy(counter_blocks + BLOCK_SIZE * i, counter, BLOCK_SIZE);
+        }
+        EncryptBlocks(*gcm_key.key, counter_blocks, keystream, blocks);
+
+        size_t bytes = std::min(length, blocks * BLOCK_SIZE);
+        if (!encrypting) {
+            GhashBytes(gcm_key, y, in, bytes);
+        }
+        XorBytes(out, in, keystream, bytes);
+        if (encrypting) {
+            GhashBytes(gcm_key, y, out, bytes);
+        }
+        in += bytes;
+        out += bytes;
+        length -= bytes;
+    }
+}
+
+// Runs bytes through the block left unfinished by the previous update:
+// XOR with its keystream, cipher text kept aside until the block fills
+// up and can be hashed. Returns the bytes consumed.
+size_t UpdatePartial(GcmState& state, const unsigned char* in,
+                     unsigned char* out, size_t length, bool encrypting) {
+    size_t n = std::min(length, BLOCK_SIZE - state.partial_length);
+    for (size_t i = 0; i < n; i++) {
+        unsigned char byte = in[i];
+        out[i] = byte ^ state.keystream[state.partial_length + i];
+        state.partial[state.partial_length + i] = encrypting ? out[i] : byte;
+    }
+    state.partial_length += n;
+    if (state.partial_length == BLOCK_SIZE) {
+        Ghash(*state.gcm_key, state.hash, state.partial, 1);
+        state.partial_length = 0;
+    }
+    return n;
+}
+
+// Whole blocks go through the stitched path; a trailing partial block is
+// encrypted now and hashed once it is completed or at GcmFinish.
+void GcmUpdate(GcmState& state, const unsigned char* in, unsigned char* out,
+               size_t length, bool encrypting) {
+    AES_PERF_SCOPE(encrypting ? PERF_GCM_ENCRYPT : PERF_GCM_DECRYPT, length);
+    CheckLength(state.length + length);
+    state.length += length;
+
+    if (state.partial_length) {
+        size_t n = UpdatePartial(state, in, out, length, encrypting);
+        in += n;
+        out += n;
+        length -= n;
+    }
+    size_t bulk = length - length % BLOCK_SIZE;
+    CryptAndHash(*state.gcm_key, state.counter, in, out, bulk, state.hash,
+                 encrypting);
+    if (length > bulk) {
+        Increment32(state.counter);
+        EncryptBlock(*state.gcm_key->key, state.counter, state.keystream);
+        UpdatePartial(state, in + bulk, out + bulk, length - bulk, encrypting);
+    }
+}
+
+} // namespace
+
+
+void BuildGcmKey(GcmKey& gcm_key, const AesKey& key) {
+    unsigned char h[BLOCK_SIZE] = {};
+    EncryptBlock(key, h, h);
+    gcm_key.key = &key;
+    BuildTables(gcm_key, h);
+    gcm_key.use_clmul = false;
+#if defined(AES_X86)
+    const CpuFeatures& cpu = GetCpuFeatures();
+    if (cpu.pclmul && cpu.ssse3) {
+        BuildPowers(gcm_key, h);
+        gcm_key.use_clmul = true;
+    }
+#endif
+}
+
+
+void GcmStart(GcmState& state, const GcmKey& gcm_key, const unsigned char* iv,
+              size_t iv_length, const unsigned char* aad, size_t aad_length) {
+    if (iv_length == 0) {
+        throw std::invalid_argument("GCM: the IV must not be empty");
+    }
+    state.gcm_key = &gcm_key;
+    DeriveJ0(gcm_key, iv, iv_length, state.j0);
+    std::memcpy(state.counter, state.j0, BLOCK_SIZE);
+    std::memset(state.hash, 0, BLOCK_SIZE);
+    GhashBytes(gcm_key, state.hash, aad, aad_length);
+    state.aad_length = aad_length;
+    state.length = 0;
+    state.partial_length = 0;
+}
+
+
+void GcmEncryptUpdate(GcmState& state, const unsigned char* in,
+                      unsigned char* out, size_t length) {
+    GcmUpdate(state, in, out, length, true);
+}
+
+
+void GcmDecryptUpdate(GcmState& state, const unsigned char* in,
+                      unsigned char* out, size_t length) {
+    GcmUpdate(state, in, out, length, false);
+}
+
+
+// tag = E(J0) ^ GHASH(A, C).
+void GcmFinish(GcmState& state, unsigned char tag[16]) {
+    const GcmKey& gcm_key = *state.gcm_key;
+    GhashBytes(gcm_key, state.hash, state.partial, state.partial_length);
+    state.partial_length = 0;
+    HashLengths(gcm_key, state.hash, state.aad_length, state.length);
+    unsigned char mask[BLOCK_SIZE];
+    EncryptBlock(*gcm_key.key, state.j0, mask);
+    XorBytes(tag, state.hash, mask, BLOCK_SIZE);
+}
+
+
+bool GcmTagsEqual(const unsigned char a[16], const unsigned char b[16]) {
+    // No early exit, so timing does not leak the position of the first
+    // wrong byte.
+    unsigned char diff = 0;
+    for (int i = 0; i < BLOCK_SIZE; i++) {
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
+
+void GcmEncrypt(const GcmKey& gcm_key, const unsigned char* iv,
+                size_t iv_length, const unsigned char* aad,
+                size_t aad_length, const unsigned char* in, size_t length,
+                unsigned char* out, unsigned char tag[16]) {
+    AES_PERF_SCOPE(PERF_GCM_ENCRYPT, length);
+    GcmState state;
+    GcmStart(state, gcm_key, iv, iv_length, aad, aad_length);
+    GcmEncryptUpdate(state, in, out, length);
+    GcmFinish(state, tag);
+}
+
+
+bool GcmDecrypt(const GcmKey& gcm_key, const unsigned char* iv,
+                size_t iv_length, const unsigned char* aad,
+                size_t aad_length, const unsigned char* in, size_t length,
+                unsigned char* out, const unsigned char tag[16]) {
+    AES_PERF_SCOPE(PERF_GCM_DECRYPT, length);
+    GcmState state;
+    unsigned char expected[BLOCK_SIZE];
+    GcmStart(state, gcm_key, iv, iv_length, aad, aad_length);
+    GcmDecryptUpdate(state, in, out, length);
+    GcmFinish(state, expected);
+    if (!GcmTagsEqual(expected, tag)) {
+        std::memset(out, 0, length);
+        return false;
+    }
+    return true;
+}
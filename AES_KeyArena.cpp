@@ -0,0 +1,152 @@
+// AES_KeyArena.cpp : Locked pool of key-schedule slots.
+//
+#include "AES_KeyArena.h"
+
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define CACHE_LINE_BYTES 64
+
+namespace {
+
+size_t PageBytes() {
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#else
+    long page = sysconf(_SC_PAGESIZE);
+    return page > 0 ? static_cast<size_t>(page) : 4096;
+#endif
+}
+
+unsigned char* MapPages(size_t bytes) {
+#if defined(_WIN32)
+    return static_cast<unsigned char*>(
+        VirtualAlloc(nullptr, bytes, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+#else
+    void* pages = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return pages == MAP_FAILED ? nullptr : static_cast<unsigned char*>(pages);
+#endif
+}
+
+void UnmapPages(unsigned char* pages, size_t bytes) {
+#if defined(_WIN32)
+    (void)bytes;
+    VirtualFree(pages, 0, MEM_RELEASE);
+#else
+    munmap(pages, bytes);
+#endif
+}
+
+bool LockPages(unsigned char* pages, size_t bytes) {
+#if defined(_WIN32)
+    return VirtualLock(pages, bytes) != 0;
+#else
+#if defined(MADV_DONTDUMP)
+    madvise(pages, bytes, MADV_DONTDUMP);
+#endif
+    return mlock(pages, bytes) == 0;
+#endif
+}
+
+void UnlockPages(unsigned char* pages, size_t bytes) {
+#if defined(_WIN32)
+    VirtualUnlock(pages, bytes);
+#else
+    munlock(pages, bytes);
+#endif
+}
+
+void Wipe(unsigned char* data, size_t length) {
+    volatile unsigned char* wipe = data;
+    for (size_t i = 0; i < length; i++) {
+        wipe[i] = 0;
+    }
+}
+
+} // namespace
+
+
+KeyArena::KeyArena(size_t slot_count)
+    : slot_bytes_((sizeof(AesKey) + CACHE_LINE_BYTES - 1) & ~size_t(CACHE_LINE_BYTES - 1)),
+      slot_count_(slot_count), free_(nullptr), in_use_(0) {
+    if (slot_count == 0) {
+        throw std::invalid_argument("Key arena needs at least one slot");
+    }
+    size_t page = PageBytes();
+    mapped_bytes_ = (slot_bytes_ * slot_count + page - 1) / page * page;
+    // Fresh anonymous pages are already zero.
+    base_ = MapPages(mapped_bytes_);
+    if (!base_) {
+        throw std::bad_alloc();
+    }
+    locked_ = LockPages(base_, mapped_bytes_);
+
+    // Chained back to front so slots are handed out in address order.
+    for (size_t i = slot_count; i-- > 0;) {
+        FreeSlot* slot = reinterpret_cast<FreeSlot*>(base_ + i * slot_bytes_);
+        slot->next = free_;
+        free_ = slot;
+    }
+}
+
+KeyArena::~KeyArena() {
+    // Wipe everything, including slots never released.
+    Wipe(base_, mapped_bytes_);
+    if (locked_) {
+        UnlockPages(base_, mapped_bytes_);
+    }
+    UnmapPages(base_, mapped_bytes_);
+}
+
+AesKey* KeyArena::Allocate() {
+    FreeSlot* slot;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        slot = free_;
+        if (!slot) {
+            return nullptr;
+        }
+        free_ = slot->next;
+        in_use_++;
+    }
+    slot->next = nullptr;
+    return new (slot) AesKey();
+}
+
+void KeyArena::Release(AesKey* key) {
+    if (!key) {
+        return;
+    }
+    if (!Owns(key)) {
+        throw std::invalid_argument("Key was not allocated from this arena");
+    }
+    Wipe(reinterpret_cast<unsigned char*>(key), slot_bytes_);
+    FreeSlot* slot = reinterpret_cast<FreeSlot*>(key);
+    std::lock_guard<std::mutex> lock(mutex_);
+    slot->next = free_;
+    free_ = slot;
+    in_use_--;
+}
+
+bool KeyArena::Owns(const AesKey* key) const {
+    uintptr_t address = reinterpret_cast<uintptr_t>(key);
+    uintptr_t base = reinterpret_cast<uintptr_t>(base_);
+    return address >= base && address < base + slot_bytes_ * slot_count_ &&
+           (address - base) % slot_bytes_ == 0;
+}
+
+size_t KeyArena::InUse() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return in_use_;
+}
@@ -0,0 +1,58 @@
+// AES_KeyArena.h : Locked pool of key-schedule slots.
+//
+// All slots are reserved when the arena is created: one run of pages,
+// locked into RAM (mlock, VirtualLock on Windows) and kept out of core
+// dumps where the OS allows it. Each slot holds one AesKey and starts on
+// a cache line of its own. Allocate and Release pop and push a free list
+// under a mutex, so session setup costs no allocator call or syscall, and
+// every slot is zeroised when it is released.
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+
+#include "AES_UNSW.h"
+
+class KeyArena {
+public:
+    // Reserves slot_count slots. Throws std::invalid_argument for 0 and
+    // std::bad_alloc if the pages cannot be mapped.
+    explicit KeyArena(size_t slot_count);
+    ~KeyArena();
+
+    KeyArena(const KeyArena&) = delete;
+    KeyArena& operator=(const KeyArena&) = delete;
+
+    // A zeroed slot, or nullptr once every slot is in use.
+    AesKey* Allocate();
+
+    // Wipes a slot from Allocate() and returns it to the pool.
+    void Release(AesKey* key);
+
+    // Whether key lies in this arena's slots.
+    bool Owns(const AesKey* key) const;
+
+    // False when the OS refused to lock the pages, typically because the
+    // locked-memory limit (ulimit -l) is too low; the slots still work but
+    // may be swapped out.
+    bool Locked() const { return locked_; }
+
+    size_t Capacity() const { return slot_count_; }
+    size_t InUse() const;
+
+private:
+    // Free slots are chained through their first bytes.
+    struct FreeSlot {
+        FreeSlot* next;
+    };
+
+    unsigned char* base_;
+    size_t mapped_bytes_;
+    size_t slot_bytes_;
+    size_t slot_count_;
+    bool locked_;
+
+    mutable std::mutex mutex_;
+    FreeSlot* free_;
+    size_t in_use_;
+};
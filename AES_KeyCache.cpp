@@ -0,0 +1,266 @@
+// AES_KeyCache.cpp : Bounded cache of expanded key schedules.
+//
+#include "AES_KeyCache.h"
+
+#include <cstring>
+#include <iterator>
+#include <random>
+#include <stdexcept>
+
+namespace {
+
+uint64_t RotateLeft(uint64_t x, int bits) {
+    return (x << bits) | (x >> (64 - bits));
+}
+
+uint64_t LoadLe64(const unsigned char* p) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; i--) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+void SipRound(uint64_t v[4]) {
+    v[0] += v[1];
+    v[1] = RotateLeft(v[1], 13) ^ v[0];
+    v[0] = RotateLeft(v[0], 32);
+    v[2] += v[3];
+    v[3] = RotateLeft(v[3], 16) ^ v[2];
+    v[0] += v[3];
+    v[3] = RotateLeft(v[3], 21) ^ v[0];
+    v[2] += v[1];
+    v[1] = RotateLeft(v[1], 17) ^ v[2];
+    v[2] = RotateLeft(v[2], 32);
+}
+
+// SipHash-2-4: a keyed PRF, so without the secret nobody can choose keys
+// that pile into one shard or bucket, and the fingerprints say nothing
+// about the keys behind them.
+uint64_t SipHash24(const uint64_t secret[2], const unsigned char* data, size_t length) {
+    uint64_t v[4] = {
+        secret[0] ^ 0x736f6d6570736575ull,
+        secret[1] ^ 0x646f72616e646f6dull,
+        secret[0] ^ 0x6c7967656e657261ull,
+        secret[1] ^ 0x7465646279746573ull,
+    };
+    size_t whole = length & ~static_cast<size_t>(7);
+    for (size_t i = 0; i < whole; i += 8) {
+        uint64_t m = LoadLe64(data + i);
+        v[3] ^= m;
+        SipRound(v);
+        SipRound(v);
+        v[0] ^= m;
+    }
+    unsigned char tail[8] = {};
+    std::memcpy(tail, data + whole, length - whole);
+    uint64_t m = LoadLe64(tail) | (static_cast<uint64_t>(length) << 56);
+    v[3] ^= m;
+    SipRound(v);
+    SipRound(v);
+    v[0] ^= m;
+    v[2] ^= 0xff;
+    for (int i = 0; i < 4; i++) {
+        SipRound(v);
+    }
+    return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+void Wipe(void* data, size_t length) {
+    volatile unsigned char* wipe = static_cast<unsigned char*>(data);
+    for (size_t i = 0; i < length; i++) {
+        wipe[i] = 0;
+    }
+}
+
+// The schedules handed out are freed through this, so a key evicted while
+// a caller still uses it is wiped once that caller lets go.
+struct DeleteAesKey {
+    KeyArena* arena;
+
+    void operator()(const AesKey* key) const {
+        AesKey* owned = const_cast<AesKey*>(key);
+        if (arena && arena->Owns(owned)) {
+            arena->Release(owned);
+        } else {
+            WipeAesKey(*owned);
+            delete owned;
+        }
+    }
+};
+
+} // namespace
+
+
+KeyCache::KeyCache(size_t capacity, const AesEngine& engine, size_t shards,
+                   KeyArena* arena)
+    : engine_(engine), arena_(arena), evict_cursor_(0) {
+    if (capacity == 0) {
+        throw std::invalid_argument("Key cache capacity must be at least 1");
+    }
+    size_t count = 1;
+    while (count < shards && count * 2 <= capacity) {
+        count <<= 1;
+    }
+    // The first capacity % count shards take one entry more, so the
+    // shards hold capacity entries in all.
+    for (size_t i = 0; i < count; i++) {
+        shards_.emplace_back(new Shard);
+        shards_.back()->capacity = capacity / count + (i < capacity % count);
+    }
+
+    std::random_device random;
+    for (uint64_t& word : secret_) {
+        word = (static_cast<uint64_t>(random()) << 32) | random();
+    }
+    for (uint64_t& word : check_secret_) {
+        word = (static_cast<uint64_t>(random()) << 32) | random();
+    }
+}
+
+KeyCache::~KeyCache() {
+    Clear();
+    Wipe(secret_, sizeof(secret_));
+    Wipe(check_secret_, sizeof(check_secret_));
+}
+
+uint64_t KeyCache::Fingerprint(const unsigned char* key, int key_bytes) const {
+    return SipHash24(secret_, key, static_cast<size_t>(key_bytes));
+}
+
+uint64_t KeyCache::Check(const unsigned char* key, int key_bytes) const {
+    return SipHash24(check_secret_, key, static_cast<size_t>(key_bytes));
+}
+
+// Called for an entry found under the key's fingerprint.
+bool KeyCache::Matches(const Entry& entry, uint64_t check, int key_bytes) {
+    return entry.key_bytes == key_bytes && entry.check == check;
+}
+
+KeyCache::Shard& KeyCache::ShardFor(uint64_t fingerprint) {
+    // The bucket index takes the low bits; the shard takes the high ones.
+    return *shards_[(fingerprint >> 48) & (shards_.size() - 1)];
+}
+
+void KeyCache::Remove(Shard& shard, std::list<Entry>::iterator entry) {
+    shard.index.erase(entry->fingerprint);
+    shard.lru.erase(entry);
+}
+
+// Drops the shard's least recently used entry; false if it has none.
+bool KeyCache::EvictOldest(Shard& shard) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.lru.empty()) {
+        return false;
+    }
+    Remove(shard, std::prev(shard.lru.end()));
+    shard.evictions++;
+    return true;
+}
+
+// The shards share the arena, so once the requesting shard is empty the
+// others give up their oldest entries in turn, one shard lock at a time.
+AesKey* KeyCache::AllocateSlot(Shard& shard) {
+    for (;;) {
+        AesKey* slot = arena_->Allocate();
+        if (slot) {
+            return slot;
+        }
+        // An evicted schedule frees its slot unless a caller holds it.
+        if (EvictOldest(shard)) {
+            continue;
+        }
+        bool evicted = false;
+        size_t start = evict_cursor_.fetch_add(1, std::memory_order_relaxed);
+        for (size_t i = 0; i < shards_.size() && !evicted; i++) {
+            evicted = EvictOldest(*shards_[(start + i) & (shards_.size() - 1)]);
+        }
+        if (!evicted) {
+            throw std::runtime_error("Key cache: every key arena slot is in use");
+        }
+    }
+}
+
+std::shared_ptr<const AesKey> KeyCache::Get(const unsigned char* key, int key_bytes) {
+    if (key_bytes != 16 && key_bytes != 24 && key_bytes != 32) {
+        throw std::invalid_argument("Unsupported AES key size");
+    }
+    uint64_t fingerprint = Fingerprint(key, key_bytes);
+    uint64_t check = Check(key, key_bytes);
+    Shard& shard = ShardFor(fingerprint);
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto found = shard.index.find(fingerprint);
+        if (found != shard.index.end() && Matches(*found->second, check, key_bytes)) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+            shard.hits++;
+            return found->second->schedule;
+        }
+        shard.misses++;
+    }
+
+    // Expand outside the lock so a miss does not stall the shard's hits.
+    AesKey* slot = arena_ ? AllocateSlot(shard) : new AesKey;
+    std::unique_ptr<AesKey, DeleteAesKey> built(slot, DeleteAesKey{arena_});
+    BuildAesKey(*built, key, key_bytes, engine_);
+    std::shared_ptr<const AesKey> schedule(built.release(), DeleteAesKey{arena_});
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.index.find(fingerprint);
+    if (found != shard.index.end()) {
+        // Another thread got here first with this key, or a different key
+        // collided; either way the newcomer replaces it.
+        if (Matches(*found->second, check, key_bytes)) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+            return found->second->schedule;
+        }
+        Remove(shard, found->second);
+    }
+    while (shard.lru.size() >= shard.capacity) {
+        Remove(shard, std::prev(shard.lru.end()));
+        shard.evictions++;
+    }
+    shard.lru.push_front(Entry());
+    Entry& entry = shard.lru.front();
+    entry.fingerprint = fingerprint;
+    entry.check = check;
+    entry.key_bytes = key_bytes;
+    entry.schedule = schedule;
+    shard.index[fingerprint] = shard.lru.begin();
+    return schedule;
+}
+
+void KeyCache::Erase(const unsigned char* key, int key_bytes) {
+    if (key_bytes != 16 && key_bytes != 24 && key_bytes != 32) {
+        return;
+    }
+    uint64_t fingerprint = Fingerprint(key, key_bytes);
+    uint64_t check = Check(key, key_bytes);
+    Shard& shard = ShardFor(fingerprint);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.index.find(fingerprint);
+    if (found != shard.index.end() && Matches(*found->second, check, key_bytes)) {
+        Remove(shard, found->second);
+    }
+}
+
+void KeyCache::Clear() {
+    for (std::unique_ptr<Shard>& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        while (!shard->lru.empty()) {
+            Remove(*shard, shard->lru.begin());
+        }
+    }
+}
+
+KeyCache::Stats KeyCache::GetStats() const {
+    Stats stats = {};
+    for (const std::unique_ptr<Shard>& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        stats.hits += shard->hits;
+        stats.misses += shard->misses;
+        stats.evictions += shard->evictions;
+        stats.size += shard->lru.size();
+    }
+    return stats;
+}
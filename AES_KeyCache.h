@@ -0,0 +1,99 @@
+// AES_KeyCache.h : Bounded cache of expanded key schedules.
+//
+// For servers where keys rotate per session and many sessions are live:
+// a session's key is expanded on first use and later requests reuse the
+// schedule. Entries are found by a SipHash fingerprint of the raw key
+// under a random per-cache secret, so the table layout reveals nothing
+// about the keys. The raw key is not kept: an entry matches when both the
+// fingerprint and a second SipHash under an independent secret agree, a
+// 128-bit keyed check, so the only copy of the key is the schedule.
+#pragma once
+
+#include <cstddef>
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "AES_KeyArena.h"
+#include "AES_UNSW.h"
+
+class KeyCache {
+public:
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        size_t size;
+    };
+
+    // Holds at most `capacity` schedules built on `engine`, spread over
+    // `shards` independently locked LRU lists (rounded up to a power of 2,
+    // but no more lists than capacity). The capacity is split between the
+    // lists, so a list can evict while others still have room.
+    // With an arena, schedules live only in its locked slots and the arena
+    // must outlive every schedule.
+    explicit KeyCache(size_t capacity, const AesEngine& engine = ActiveEngine(),
+                      size_t shards = 16, KeyArena* arena = nullptr);
+    ~KeyCache();
+
+    KeyCache(const KeyCache&) = delete;
+    KeyCache& operator=(const KeyCache&) = delete;
+
+    // The schedule for key, expanded and inserted if it is not cached.
+    // Throws std::invalid_argument for an unsupported key size. On a miss
+    // with the arena full, least recently used entries are dropped, from
+    // the key's shard first and then from the others, until a slot comes
+    // free; if callers hold them all, std::runtime_error is thrown rather
+    // than the schedule built on the heap. The
+    // returned key stays valid while the caller holds it, even if it is
+    // evicted meanwhile; it is zeroised when the last holder lets go.
+    std::shared_ptr<const AesKey> Get(const unsigned char* key, int key_bytes);
+
+    // Drops the entry for key, if any, e.g. when a session ends.
+    void Erase(const unsigned char* key, int key_bytes);
+
+    // Drops every entry.
+    void Clear();
+
+    Stats GetStats() const;
+
+private:
+    struct Entry {
+        uint64_t fingerprint;
+        uint64_t check;
+        int key_bytes;
+        std::shared_ptr<const AesKey> schedule;
+    };
+
+    // Front of `lru` is the most recently used entry.
+    struct Shard {
+        mutable std::mutex mutex;
+        std::list<Entry> lru;
+        std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+        size_t capacity = 0;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+    };
+
+    uint64_t Fingerprint(const unsigned char* key, int key_bytes) const;
+    uint64_t Check(const unsigned char* key, int key_bytes) const;
+    static bool Matches(const Entry& entry, uint64_t check, int key_bytes);
+    Shard& ShardFor(uint64_t fingerprint);
+    void Remove(Shard& shard, std::list<Entry>::iterator entry);
+    bool EvictOldest(Shard& shard);
+    AesKey* AllocateSlot(Shard& shard);
+
+    const AesEngine& engine_;
+    KeyArena* arena_;
+    uint64_t secret_[2];
+    uint64_t check_secret_[2];
+    std::vector<std::unique_ptr<Shard>> shards_;
+    // Where AllocateSlot starts evicting from other shards, so the
+    // pressure is spread over them.
+    std::atomic<size_t> evict_cursor_;
+};
@@ -0,0 +1,217 @@
+// AES_Modes.h : Block cipher modes of operation over arbitrary-length buffers.
+//
+// All modes take an AesKey built once with BuildAesKey and run on the
+// engine that built it.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "AES_UNSW.h"
+
+#if defined(AES_X86)
+#include <emmintrin.h>
+#endif
+
+// Buffers shorter than ParallelMinBytes() are processed on the calling
+// thread only. PARALLEL_MIN_BYTES is the threshold until the tuning plan
+// measures one for the host.
+#define PARALLEL_MIN_BYTES (1 << 20)
+
+size_t ParallelMinBytes();
+void SetParallelMinBytes(size_t bytes);
+
+// out = a ^ b over length bytes; out may alias a or b. 64 bytes per step
+// with SSE2, which every x86 target of this project has.
+inline void XorBytes(unsigned char* out, const unsigned char* a,
+                     const unsigned char* b, size_t length) {
+    size_t i = 0;
+#if defined(AES_X86)
+    for (; i + 64 <= length; i += 64) {
+        __m128i x0 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)),
+                                   _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+        __m128i x1 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i + 16)),
+                                   _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i + 16)));
+        __m128i x2 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i + 32)),
+                                   _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i + 32)));
+        __m128i x3 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i + 48)),
+                                   _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i + 48)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), x0);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 16), x1);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 32), x2);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 48), x3);
+    }
+    for (; i + 16 <= length; i += 16) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+            _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)),
+                          _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i))));
+    }
+#endif
+    for (; i < length; i++) {
+        out[i] = a[i] ^ b[i];
+    }
+}
+
+// CTR mode (NIST SP 800-38A): block i of the keystream is E(counter + i)
+// with the 16-byte counter incremented as one big-endian integer.
+// Encryption and decryption are the same operation; in may equal out.
+// Large buffers are split into contiguous counter ranges across
+// DefaultThreadPool().
+void CtrCrypt(const AesKey& key, const unsigned char counter[16],
+              const unsigned char* in, unsigned char* out, size_t length);
+
+// counter += n, the 16 bytes taken as one big-endian integer. Moves a
+// counter past the blocks of one CtrCrypt call when a stream is encrypted
+// in pieces.
+void AddCounter(unsigned char counter[16], uint64_t n);
+
+// CBC mode with PKCS#7 padding. Encryption is serial by nature and always
+// appends 1..16 padding bytes: out must hold length + BLOCK_SIZE bytes and
+// the ciphertext length is returned. in may equal out.
+size_t CbcEncrypt(const AesKey& key, const unsigned char iv[16],
+                  const unsigned char* in, size_t length, unsigned char* out);
+
+// Decryption has no chain dependency: every block is D(c[i]) ^ c[i-1].
+// Blocks go through the engine's multi-block path, and large buffers are
+// split across DefaultThreadPool(). out must hold length bytes and may
+// equal in. Returns false, without setting plain_length, when length is
+// not a positive multiple of BLOCK_SIZE or the padding is malformed; the
+// padding is checked without data-dependent branches.
+bool CbcDecrypt(const AesKey& key, const unsigned char iv[16],
+                const unsigned char* in, size_t length, unsigned char* out,
+                size_t& plain_length);
+
+// GCM (NIST SP 800-38D) key material derived from one AesKey: the hash
+// subkey H = E(0^128) and the precomputed GHASH tables. The AesKey is
+// referenced, not copied, and must outlive the GcmKey.
+struct GcmKey {
+    const AesKey* key;
+    // Byte-reversed H^1..H^4 for the carry-less multiply path.
+    alignas(16) unsigned char h_powers[4][16];
+    // i * H for every 4-bit i, in GCM bit order, for the table path.
+    uint64_t h_table_high[16];
+    uint64_t h_table_low[16];
+    bool use_clmul;
+};
+
+// GHASH uses PCLMULQDQ when the CPU has it and the 4-bit tables otherwise.
+void BuildGcmKey(GcmKey& gcm_key, const AesKey& key);
+
+// SP 800-38D limits the plain text to 2^39 - 256 bits; the GCM functions
+// throw std::invalid_argument past it.
+#define GCM_MAX_BYTES ((uint64_t(1) << 36) - 32)
+
+// Authenticated encryption. The CTR keystream and GHASH run stitched over
+// small L1-sized chunks, so every cache line of the data is read once.
+// Any IV length is accepted; 12 bytes is the fast and recommended case.
+// in may equal out.
+void GcmEncrypt(const GcmKey& gcm_key, const unsigned char* iv,
+                size_t iv_length, const unsigned char* aad,
+                size_t aad_length, const unsigned char* in, size_t length,
+                unsigned char* out, unsigned char tag[16]);
+
+// Returns false if the tag does not match; out is zeroed in that case so
+// unauthenticated plain text never reaches the caller.
+bool GcmDecrypt(const GcmKey& gcm_key, const unsigned char* iv,
+                size_t iv_length, const unsigned char* aad,
+                size_t aad_length, const unsigned char* in, size_t length,
+                unsigned char* out, const unsigned char tag[16]);
+
+// Incremental GCM for messages delivered in pieces of any length, e.g.
+// files or network frames. A partial block is carried over between
+// updates, so the output of each update is as long as its input and no
+// heap memory is used. GcmDecryptUpdate releases plain text before the
+// tag can be checked: the caller must compare GcmFinish's tag with
+// GcmTagsEqual and discard everything on a mismatch.
+struct GcmState {
+    const GcmKey* gcm_key;
+    unsigned char j0[16];
+    unsigned char counter[16];
+    unsigned char hash[16];
+    // Keystream and cipher text of the unfinished block.
+    unsigned char keystream[16];
+    unsigned char partial[16];
+    size_t partial_length;
+    uint64_t aad_length;
+    uint64_t length;
+};
+
+void GcmStart(GcmState& state, const GcmKey& gcm_key, const unsigned char* iv,
+              size_t iv_length, const unsigned char* aad, size_t aad_length);
+
+void GcmEncryptUpdate(GcmState& state, const unsigned char* in,
+                      unsigned char* out, size_t length);
+
+void GcmDecryptUpdate(GcmState& state, const unsigned char* in,
+                      unsigned char* out, size_t length);
+
+void GcmFinish(GcmState& state, unsigned char tag[16]);
+
+// Constant-time tag comparison.
+bool GcmTagsEqual(const unsigned char a[16], const unsigned char b[16]);
+
+// CMAC (NIST SP 800-38B, RFC 4493) key material derived from one AesKey:
+// the subkeys K1 = 2 * E(0^128) and K2 = 4 * E(0^128), which mask the
+// last block of a whole or padded message. The AesKey is referenced, not
+// copied, and must outlive the CmacKey.
+struct CmacKey {
+    const AesKey* key;
+    unsigned char k1[16];
+    unsigned char k2[16];
+};
+
+void BuildCmacKey(CmacKey& cmac_key, const AesKey& key);
+
+// Zeroes the subkeys; the AesKey is wiped separately.
+void WipeCmacKey(CmacKey& cmac_key);
+
+// 16-byte tag of one message of any length, including zero. Compare tags
+// with GcmTagsEqual.
+void Cmac(const CmacKey& cmac_key, const unsigned char* in, size_t length,
+          unsigned char tag[16]);
+
+// Messages in flight in CmacBatch: the AES-NI engine's interleave width.
+#define CMAC_LANES 8
+
+// One message of a CMAC batch. Tags must not overlap any message of the
+// batch: jobs finish out of order.
+struct CmacJob {
+    const unsigned char* in;
+    size_t length;
+    unsigned char* tag;
+};
+
+// Tags many independent messages under one key. Each message's chain is
+// serial, so up to CMAC_LANES chains advance in lockstep: one block from
+// every lane goes through the engine's multi-block path per step. Lanes
+// finish at different lengths, each masking its own last block with K1 or
+// K2, and a finished lane takes the next job at once.
+void CmacBatch(const CmacKey& cmac_key, const CmacJob* jobs, size_t count);
+
+// XTS-AES (IEEE 1619, NIST SP 800-38E) for storage. Every sector is
+// encrypted independently under the tweak E(tweak_key, sector number),
+// so any sector can be read or written on its own. A sector length that
+// is not a multiple of BLOCK_SIZE is handled by ciphertext stealing.
+// length must be at least BLOCK_SIZE, and the two keys must differ.
+// in may equal out.
+void XtsEncrypt(const AesKey& data_key, const AesKey& tweak_key,
+                uint64_t sector, const unsigned char* in, unsigned char* out,
+                size_t length);
+
+void XtsDecrypt(const AesKey& data_key, const AesKey& tweak_key,
+                uint64_t sector, const unsigned char* in, unsigned char* out,
+                size_t length);
+
+// Batch form for sector_count contiguous sectors of sector_size bytes,
+// numbered from first_sector. Tweaks for the batch are encrypted with the
+// engine's multi-block path, and large batches are split by sector
+// across DefaultThreadPool().
+void XtsEncryptSectors(const AesKey& data_key, const AesKey& tweak_key,
+                       uint64_t first_sector, const unsigned char* in,
+                       unsigned char* out, size_t sector_size,
+                       size_t sector_count);
+
+void XtsDecryptSectors(const AesKey& data_key, const AesKey& tweak_key,
+                       uint64_t first_sector, const unsigned char* in,
+                       unsigned char* out, size_t sector_size,
+                       size_t sector_count);
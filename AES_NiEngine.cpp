@@ -0,0 +1,362 @@
+// AES_NiEngine.cpp : AES-NI implementation of the key expansion and rounds.
+//
+// Each round key is one 128-bit register; AESENC performs ShiftRows,
+// SubBytes, MixColumns and AddRoundKey in a single instruction.
+#include "AES_Cpu.h"
+
+#if defined(AES_X86)
+
+#include <wmmintrin.h>
+#include <emmintrin.h>
+#include <cstring>
+
+#include "AES_Engine.h"
+#include "AES_Tables.h"
+
+namespace {
+
+// One step of the AES-128 schedule: w[i] = w[i-4] ^ w[i-5] ^ ... folded
+// into the previous round key, then XORed with SubWord(RotWord(w)) ^ rcon
+// broadcast from the AESKEYGENASSIST result.
+AES_TARGET("aes,sse2")
+inline __m128i Expand128Step(__m128i key, __m128i assist) {
+    assist = _mm_shuffle_epi32(assist, 0xFF);
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    return _mm_xor_si128(key, assist);
+}
+
+// AESKEYGENASSIST needs rcon as an immediate.
+#define EXPAND_128(key, rcon) \
+    Expand128Step(key, _mm_aeskeygenassist_si128(key, rcon))
+
+// AES-256 alternates two kinds of step on the two halves of the key: the
+// even round keys take SubWord(RotWord(w)) ^ rcon of the previous odd one
+// (word 3 of the assist), the odd round keys SubWord(w) of the previous
+// even one with no rcon (word 2).
+AES_TARGET("aes,sse2")
+inline __m128i Expand256OddStep(__m128i key, __m128i assist) {
+    assist = _mm_shuffle_epi32(assist, 0xAA);
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    return _mm_xor_si128(key, assist);
+}
+
+#define EXPAND_256_EVEN(even, odd, rcon) \
+    Expand128Step(even, _mm_aeskeygenassist_si128(odd, rcon))
+#define EXPAND_256_ODD(odd, even) \
+    Expand256OddStep(odd, _mm_aeskeygenassist_si128(even, 0))
+
+AES_TARGET("aes,sse2")
+void NiExpandKey128(const unsigned char* key, unsigned char enc_keys[]) {
+    __m128i* rk = reinterpret_cast<__m128i*>(enc_keys);
+    __m128i k = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key));
+    _mm_storeu_si128(rk + 0, k);
+    k = EXPAND_128(k, 0x01); _mm_storeu_si128(rk + 1, k);
+    k = EXPAND_128(k, 0x02); _mm_storeu_si128(rk + 2, k);
+    k = EXPAND_128(k, 0x04); _mm_storeu_si128(rk + 3, k);
+    k = EXPAND_128(k, 0x08); _mm_storeu_si128(rk + 4, k);
+    k = EXPAND_128(k, 0x10); _mm_storeu_si128(rk + 5, k);
+    k = EXPAND_128(k, 0x20); _mm_storeu_si128(rk + 6, k);
+    k = EXPAND_128(k, 0x40); _mm_storeu_si128(rk + 7, k);
+    k = EXPAND_128(k, 0x80); _mm_storeu_si128(rk + 8, k);
+    k = EXPAND_128(k, 0x1B); _mm_storeu_si128(rk + 9, k);
+    k = EXPAND_128(k, 0x36); _mm_storeu_si128(rk + 10, k);
+}
+
+AES_TARGET("aes,sse2")
+void NiExpandKey256(const unsigned char* key, unsigned char enc_keys[]) {
+    __m128i* rk = reinterpret_cast<__m128i*>(enc_keys);
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key + 16));
+    _mm_storeu_si128(rk + 0, a);
+    _mm_storeu_si128(rk + 1, b);
+    a = EXPAND_256_EVEN(a, b, 0x01); _mm_storeu_si128(rk + 2, a);
+    b = EXPAND_256_ODD(b, a);        _mm_storeu_si128(rk + 3, b);
+    a = EXPAND_256_EVEN(a, b, 0x02); _mm_storeu_si128(rk + 4, a);
+    b = EXPAND_256_ODD(b, a);        _mm_storeu_si128(rk + 5, b);
+    a = EXPAND_256_EVEN(a, b, 0x04); _mm_storeu_si128(rk + 6, a);
+    b = EXPAND_256_ODD(b, a);        _mm_storeu_si128(rk + 7, b);
+    a = EXPAND_256_EVEN(a, b, 0x08); _mm_storeu_si128(rk + 8, a);
+    b = EXPAND_256_ODD(b, a);        _mm_storeu_si128(rk + 9, b);
+    a = EXPAND_256_EVEN(a, b, 0x10); _mm_storeu_si128(rk + 10, a);
+    b = EXPAND_256_ODD(b, a);        _mm_storeu_si128(rk + 11, b);
+    a = EXPAND_256_EVEN(a, b, 0x20); _mm_storeu_si128(rk + 12, a);
+    b = EXPAND_256_ODD(b, a);        _mm_storeu_si128(rk + 13, b);
+    a = EXPAND_256_EVEN(a, b, 0x40); _mm_storeu_si128(rk + 14, a);
+}
+
+// AES-192 round keys straddle the 128-bit registers, so it keeps the
+// portable expansion; the schedule is computed once per key anyway.
+void NiExpandKey(const unsigned char* key, int key_bytes,
+                 unsigned char enc_keys[]) {
+    switch (key_bytes) {
+    case Aes128::key_bytes:
+        NiExpandKey128(key, enc_keys);
+        break;
+    case Aes256::key_bytes:
+        NiExpandKey256(key, enc_keys);
+        break;
+    default:
+        PortableExpandKey(key, key_bytes, enc_keys);
+        break;
+    }
+}
+
+// Equivalent inverse cipher schedule, as AESDEC expects it.
+AES_TARGET("aes,sse2")
+void NiInvertKey(const unsigned char enc_keys[], int number_rounds,
+                 unsigned char dec_keys[]) {
+    const __m128i* ek = reinterpret_cast<const __m128i*>(enc_keys);
+    __m128i* dk = reinterpret_cast<__m128i*>(dec_keys);
+    _mm_storeu_si128(dk, _mm_loadu_si128(ek + number_rounds));
+    for (int round = 1; round < number_rounds; round++) {
+        _mm_storeu_si128(dk + round,
+            _mm_aesimc_si128(_mm_loadu_si128(ek + number_rounds - round)));
+    }
+    _mm_storeu_si128(dk + number_rounds, _mm_loadu_si128(ek));
+}
+
+// The round loops below run to a compile-time Nr, so the compiler unrolls
+// them completely; WithRounds picks the instantiation once per call.
+template <int Nr>
+AES_TARGET("aes,sse2")
+void NiEncryptBlockN(const unsigned char enc_keys[],
+                     const unsigned char in[16], unsigned char out[16]) {
+    const __m128i* rk = reinterpret_cast<const __m128i*>(enc_keys);
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+    b = _mm_xor_si128(b, _mm_loadu_si128(rk));
+    for (int round = 1; round < Nr; round++) {
+        b = _mm_aesenc_si128(b, _mm_loadu_si128(rk + round));
+    }
+    b = _mm_aesenclast_si128(b, _mm_loadu_si128(rk + Nr));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), b);
+}
+
+template <int Nr>
+AES_TARGET("aes,sse2")
+void NiDecryptBlockN(const unsigned char dec_keys[],
+                     const unsigned char in[16], unsigned char out[16]) {
+    const __m128i* rk = reinterpret_cast<const __m128i*>(dec_keys);
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+    b = _mm_xor_si128(b, _mm_loadu_si128(rk));
+    for (int round = 1; round < Nr; round++) {
+        b = _mm_aesdec_si128(b, _mm_loadu_si128(rk + round));
+    }
+    b = _mm_aesdeclast_si128(b, _mm_loadu_si128(rk + Nr));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), b);
+}
+
+// AESENC has a latency of several cycles but issues every cycle, so eight
+// independent blocks go through each round key together. Some cores hide
+// the latency with four and lose less to the single-block tail; the
+// tuning plan picks between the two engines built below.
+#define NI_INTERLEAVE 8
+#define NI_INTERLEAVE_NARROW 4
+
+template <int Nr, int Interleave>
+AES_TARGET("aes,sse2")
+void NiEncryptBlocksN(const unsigned char enc_keys[],
+                      const unsigned char* in, unsigned char* out,
+                      size_t blocks) {
+    const __m128i* rk = reinterpret_cast<const __m128i*>(enc_keys);
+    const __m128i* src = reinterpret_cast<const __m128i*>(in);
+    __m128i* dst = reinterpret_cast<__m128i*>(out);
+    size_t i = 0;
+
+    for (; i + Interleave <= blocks; i += Interleave) {
+        __m128i b[Interleave];
+        __m128i k = _mm_loadu_si128(rk);
+        for (int j = 0; j < Interleave; j++) {
+            b[j] = _mm_xor_si128(_mm_loadu_si128(src + i + j), k);
+        }
+        for (int round = 1; round < Nr; round++) {
+            k = _mm_loadu_si128(rk + round);
+            for (int j = 0; j < Interleave; j++) {
+                b[j] = _mm_aesenc_si128(b[j], k);
+            }
+        }
+        k = _mm_loadu_si128(rk + Nr);
+        for (int j = 0; j < Interleave; j++) {
+            _mm_storeu_si128(dst + i + j, _mm_aesenclast_si128(b[j], k));
+        }
+    }
+    for (; i < blocks; i++) {
+        NiEncryptBlockN<Nr>(enc_keys, in + 16 * i, out + 16 * i);
+    }
+}
+
+template <int Nr, int Interleave>
+AES_TARGET("aes,sse2")
+void NiDecryptBlocksN(const unsigned char dec_keys[],
+                      const unsigned char* in, unsigned char* out,
+                      size_t blocks) {
+    const __m128i* rk = reinterpret_cast<const __m128i*>(dec_keys);
+    const __m128i* src = reinterpret_cast<const __m128i*>(in);
+    __m128i* dst = reinterpret_cast<__m128i*>(out);
+    size_t i = 0;
+
+    for (; i + Interleave <= blocks; i += Interleave) {
+        __m128i b[Interleave];
+        __m128i k = _mm_loadu_si128(rk);
+        for (int j = 0; j < Interleave; j++) {
+            b[j] = _mm_xor_si128(_mm_loadu_si128(src + i + j), k);
+        }
+        for (int round = 1; round < Nr; round++) {
+            k = _mm_loadu_si128(rk + round);
+            for (int j = 0; j < Interleave; j++) {
+                b[j] = _mm_aesdec_si128(b[j], k);
+            }
+        }
+        k = _mm_loadu_si128(rk + Nr);
+        for (int j = 0; j < Interleave; j++) {
+            _mm_storeu_si128(dst + i + j, _mm_aesdeclast_si128(b[j], k));
+        }
+    }
+    for (; i < blocks; i++) {
+        NiDecryptBlockN<Nr>(dec_keys, in + 16 * i, out + 16 * i);
+    }
+}
+
+// As NiEncryptBlocksN, but each of the interleaved blocks loads its own
+// round key.
+template <int Nr, int Interleave>
+AES_TARGET("aes,sse2")
+void NiEncryptMultiKeyN(const unsigned char* const keys[],
+                        const unsigned char* const in[],
+                        unsigned char* const out[], size_t count) {
+    size_t i = 0;
+    for (; i + Interleave <= count; i += Interleave) {
+        const __m128i* rk[Interleave];
+        __m128i b[Interleave];
+        for (int j = 0; j < Interleave; j++) {
+            rk[j] = reinterpret_cast<const __m128i*>(keys[i + j]);
+            b[j] = _mm_xor_si128(
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(in[i + j])),
+                _mm_loadu_si128(rk[j]));
+        }
+        for (int round = 1; round < Nr; round++) {
+            for (int j = 0; j < Interleave; j++) {
+                b[j] = _mm_aesenc_si128(b[j], _mm_loadu_si128(rk[j] + round));
+            }
+        }
+        for (int j = 0; j < Interleave; j++) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out[i + j]),
+                _mm_aesenclast_si128(b[j], _mm_loadu_si128(rk[j] + Nr)));
+        }
+    }
+    for (; i < count; i++) {
+        NiEncryptBlockN<Nr>(keys[i], in[i], out[i]);
+    }
+}
+
+template <int Nr, int Interleave>
+AES_TARGET("aes,sse2")
+void NiDecryptMultiKeyN(const unsigned char* const keys[],
+                        const unsigned char* const in[],
+                        unsigned char* const out[], size_t count) {
+    size_t i = 0;
+    for (; i + Interleave <= count; i += Interleave) {
+        const __m128i* rk[Interleave];
+        __m128i b[Interleave];
+        for (int j = 0; j < Interleave; j++) {
+            rk[j] = reinterpret_cast<const __m128i*>(keys[i + j]);
+            b[j] = _mm_xor_si128(
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(in[i + j])),
+                _mm_loadu_si128(rk[j]));
+        }
+        for (int round = 1; round < Nr; round++) {
+            for (int j = 0; j < Interleave; j++) {
+                b[j] = _mm_aesdec_si128(b[j], _mm_loadu_si128(rk[j] + round));
+            }
+        }
+        for (int j = 0; j < Interleave; j++) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out[i + j]),
+                _mm_aesdeclast_si128(b[j], _mm_loadu_si128(rk[j] + Nr)));
+        }
+    }
+    for (; i < count; i++) {
+        NiDecryptBlockN<Nr>(keys[i], in[i], out[i]);
+    }
+}
+
+void NiEncryptBlock(const unsigned char enc_keys[], int number_rounds,
+                    const unsigned char in[16], unsigned char out[16]) {
+    WithRounds(number_rounds, [&](auto rounds) {
+        NiEncryptBlockN<decltype(rounds)::value>(enc_keys, in, out);
+    });
+}
+
+void NiDecryptBlock(const unsigned char dec_keys[], int number_rounds,
+                    const unsigned char in[16], unsigned char out[16]) {
+    WithRounds(number_rounds, [&](auto rounds) {
+        NiDecryptBlockN<decltype(rounds)::value>(dec_keys, in, out);
+    });
+}
+
+template <int Interleave>
+void NiEncryptBlocks(const unsigned char enc_keys[], int number_rounds,
+                     const unsigned char* in, unsigned char* out,
+                     size_t blocks) {
+    WithRounds(number_rounds, [&](auto rounds) {
+        NiEncryptBlocksN<decltype(rounds)::value, Interleave>(enc_keys, in, out, blocks);
+    });
+}
+
+template <int Interleave>
+void NiDecryptBlocks(const unsigned char dec_keys[], int number_rounds,
+                     const unsigned char* in, unsigned char* out,
+                     size_t blocks) {
+    WithRounds(number_rounds, [&](auto rounds) {
+        NiDecryptBlocksN<decltype(rounds)::value, Interleave>(dec_keys, in, out, blocks);
+    });
+}
+
+template <int Interleave>
+void NiEncryptMultiKey(const unsigned char* const keys[], int number_rounds,
+                       const unsigned char* const in[],
+                       unsigned char* const out[], size_t count) {
+    WithRounds(number_rounds, [&](auto rounds) {
+        NiEncryptMultiKeyN<decltype(rounds)::value, Interleave>(keys, in, out, count);
+    });
+}
+
+template <int Interleave>
+void NiDecryptMultiKey(const unsigned char* const keys[], int number_rounds,
+                       const unsigned char* const in[],
+                       unsigned char* const out[], size_t count) {
+    WithRounds(number_rounds, [&](auto rounds) {
+        NiDecryptMultiKeyN<decltype(rounds)::value, Interleave>(keys, in, out, count);
+    });
+}
+
+} // namespace
+
+
+const AesEngine aesni_engine = {
+    "aesni",
+    NiExpandKey,
+    NiInvertKey,
+    NiEncryptBlock,
+    NiDecryptBlock,
+    NiEncryptBlocks<NI_INTERLEAVE>,
+    NiDecryptBlocks<NI_INTERLEAVE>,
+    NiEncryptMultiKey<NI_INTERLEAVE>,
+    NiDecryptMultiKey<NI_INTERLEAVE>,
+};
+
+const AesEngine aesni_x4_engine = {
+    "aesni-x4",
+    NiExpandKey,
+    NiInvertKey,
+    NiEncryptBlock,
+    NiDecryptBlock,
+    NiEncryptBlocks<NI_INTERLEAVE_NARROW>,
+    NiDecryptBlocks<NI_INTERLEAVE_NARROW>,
+    NiEncryptMultiKey<NI_INTERLEAVE_NARROW>,
+    NiDecryptMultiKey<NI_INTERLEAVE_NARROW>,
+};
+
+#endif // AES_X86
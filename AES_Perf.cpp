@@ -0,0 +1,295 @@
+// AES_Perf.cpp : Optional hardware performance counters around the cipher.
+//
+#include "AES_Perf.h"
+
+#if AES_PERF_ENABLED
+
+#include <atomic>
+#include <cstring>
+#include <iomanip>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+const char* const entry_names[PERF_ENTRY_COUNT] = {
+    "encrypt", "decrypt", "expand_key", "ctr", "cbc_encrypt", "cbc_decrypt",
+    "gcm_encrypt", "gcm_decrypt", "xts_encrypt", "xts_decrypt",
+};
+
+enum {
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_L1D_MISSES,
+    COUNTER_BRANCH_MISSES,
+    COUNTER_COUNT,
+};
+
+const char* const counter_names[COUNTER_COUNT] = {
+    "cycles/blk", "instr/blk", "l1d_miss/blk", "br_miss/blk",
+};
+
+struct EntrySnapshot {
+    uint64_t calls;
+    uint64_t blocks;
+    uint64_t counters[COUNTER_COUNT];
+};
+
+void PrintEntries(std::ostream& out, const char* owner,
+                  const EntrySnapshot (&entries)[PERF_ENTRY_COUNT],
+                  const bool (&available)[COUNTER_COUNT]) {
+    for (int e = 0; e < PERF_ENTRY_COUNT; e++) {
+        const EntrySnapshot& entry = entries[e];
+        if (!entry.calls) {
+            continue;
+        }
+        out << std::left << std::setw(10) << owner << std::setw(13)
+            << entry_names[e] << std::right << std::setw(12) << entry.calls
+            << std::setw(14) << entry.blocks;
+        for (int c = 0; c < COUNTER_COUNT; c++) {
+            out << std::setw(14);
+            if (available[c] && entry.blocks) {
+                out << std::fixed << std::setprecision(2)
+                    << static_cast<double>(entry.counters[c]) / entry.blocks;
+            } else {
+                out << "n/a";
+            }
+        }
+        out << '\n';
+    }
+}
+
+void PrintHeader(std::ostream& out) {
+    out << std::left << std::setw(10) << "thread" << std::setw(13) << "entry"
+        << std::right << std::setw(12) << "calls" << std::setw(14) << "blocks";
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        out << std::setw(14) << counter_names[c];
+    }
+    out << '\n';
+}
+
+// Written only by the owning thread; relaxed atomics so a dump from
+// another thread reads whole values.
+struct EntryTotals {
+    std::atomic<uint64_t> calls;
+    std::atomic<uint64_t> blocks;
+    std::atomic<uint64_t> counters[COUNTER_COUNT];
+};
+
+void Add(std::atomic<uint64_t>& total, uint64_t value) {
+    total.store(total.load(std::memory_order_relaxed) + value,
+                std::memory_order_relaxed);
+}
+
+long PerfEventOpen(perf_event_attr& attr, int group_fd) {
+    return syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+// One counter group per thread, read with a single read() through the
+// leader. Counters the kernel or CPU refuses are left out of the group
+// and reported as n/a.
+class ThreadCounters {
+public:
+    ThreadCounters();
+    ~ThreadCounters();
+
+    // Current value of every opened counter; zero for the others.
+    void Read(uint64_t values[COUNTER_COUNT]) const;
+
+    void Snapshot(EntrySnapshot (&entries)[PERF_ENTRY_COUNT]) const;
+
+    EntryTotals totals[PERF_ENTRY_COUNT];
+    int depth;
+    int index;
+
+private:
+    int fds_[COUNTER_COUNT];
+    // Position of each counter in the group read, -1 if not opened.
+    int slots_[COUNTER_COUNT];
+    int opened_;
+};
+
+std::mutex registry_mutex;
+std::vector<ThreadCounters*> registry;
+EntrySnapshot retired[PERF_ENTRY_COUNT];
+bool counter_available[COUNTER_COUNT];
+int next_thread_index = 0;
+
+ThreadCounters::ThreadCounters() : totals(), depth(0), opened_(0) {
+    static const uint32_t types[COUNTER_COUNT] = {
+        PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+        PERF_TYPE_HARDWARE,
+    };
+    static const uint64_t configs[COUNTER_COUNT] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        PERF_COUNT_HW_BRANCH_MISSES,
+    };
+    int leader = -1;
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = types[c];
+        attr.config = configs[c];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        fds_[c] = static_cast<int>(PerfEventOpen(attr, leader));
+        slots_[c] = -1;
+        if (fds_[c] >= 0) {
+            slots_[c] = opened_++;
+            if (leader < 0) {
+                leader = fds_[c];
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    index = next_thread_index++;
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        counter_available[c] |= slots_[c] >= 0;
+    }
+    registry.push_back(this);
+}
+
+ThreadCounters::~ThreadCounters() {
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        EntrySnapshot mine[PERF_ENTRY_COUNT];
+        Snapshot(mine);
+        for (int e = 0; e < PERF_ENTRY_COUNT; e++) {
+            retired[e].calls += mine[e].calls;
+            retired[e].blocks += mine[e].blocks;
+            for (int c = 0; c < COUNTER_COUNT; c++) {
+                retired[e].counters[c] += mine[e].counters[c];
+            }
+        }
+        for (size_t i = 0; i < registry.size(); i++) {
+            if (registry[i] == this) {
+                registry.erase(registry.begin() + i);
+                break;
+            }
+        }
+    }
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        if (fds_[c] >= 0) {
+            close(fds_[c]);
+        }
+    }
+}
+
+void ThreadCounters::Read(uint64_t values[COUNTER_COUNT]) const {
+    // PERF_FORMAT_GROUP layout: the number of counters, then their values.
+    uint64_t group[1 + COUNTER_COUNT] = {};
+    int leader = -1;
+    for (int c = 0; c < COUNTER_COUNT && leader < 0; c++) {
+        leader = fds_[c];
+    }
+    if (leader >= 0 &&
+        read(leader, group, sizeof(group)) < static_cast<ssize_t>(sizeof(uint64_t))) {
+        std::memset(group, 0, sizeof(group));
+    }
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        values[c] = slots_[c] >= 0 ? group[1 + slots_[c]] : 0;
+    }
+}
+
+void ThreadCounters::Snapshot(EntrySnapshot (&entries)[PERF_ENTRY_COUNT]) const {
+    for (int e = 0; e < PERF_ENTRY_COUNT; e++) {
+        entries[e].calls = totals[e].calls.load(std::memory_order_relaxed);
+        entries[e].blocks = totals[e].blocks.load(std::memory_order_relaxed);
+        for (int c = 0; c < COUNTER_COUNT; c++) {
+            entries[e].counters[c] =
+                totals[e].counters[c].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+ThreadCounters& CurrentThreadCounters() {
+    thread_local ThreadCounters counters;
+    return counters;
+}
+
+} // namespace
+
+
+PerfScope::PerfScope(PerfEntry entry, size_t bytes)
+    : entry_(entry), blocks_((bytes + 15) / 16), outermost_(false) {
+    ThreadCounters& counters = CurrentThreadCounters();
+    if (counters.depth++ == 0) {
+        outermost_ = true;
+        counters.Read(start_);
+    }
+}
+
+PerfScope::~PerfScope() {
+    ThreadCounters& counters = CurrentThreadCounters();
+    counters.depth--;
+    if (!outermost_) {
+        return;
+    }
+    uint64_t end[COUNTER_COUNT];
+    counters.Read(end);
+    EntryTotals& totals = counters.totals[entry_];
+    Add(totals.calls, 1);
+    Add(totals.blocks, blocks_ ? blocks_ : 1);
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        Add(totals.counters[c], end[c] - start_[c]);
+    }
+}
+
+void DumpPerfCounters(std::ostream& out) {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    EntrySnapshot total[PERF_ENTRY_COUNT];
+    std::memcpy(total, retired, sizeof(total));
+
+    PrintHeader(out);
+    for (const ThreadCounters* counters : registry) {
+        EntrySnapshot mine[PERF_ENTRY_COUNT];
+        counters->Snapshot(mine);
+        PrintEntries(out, std::to_string(counters->index).c_str(), mine,
+                     counter_available);
+        for (int e = 0; e < PERF_ENTRY_COUNT; e++) {
+            total[e].calls += mine[e].calls;
+            total[e].blocks += mine[e].blocks;
+            for (int c = 0; c < COUNTER_COUNT; c++) {
+                total[e].counters[c] += mine[e].counters[c];
+            }
+        }
+    }
+    PrintEntries(out, "total", total, counter_available);
+    out.flush();
+}
+
+void ResetPerfCounters() {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    std::memset(retired, 0, sizeof(retired));
+    for (ThreadCounters* counters : registry) {
+        for (EntryTotals& totals : counters->totals) {
+            totals.calls.store(0, std::memory_order_relaxed);
+            totals.blocks.store(0, std::memory_order_relaxed);
+            for (std::atomic<uint64_t>& counter : totals.counters) {
+                counter.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+#else // AES_PERF_ENABLED
+
+void DumpPerfCounters(std::ostream& out) {
+    out << "Performance counters are not built in; compile with "
+           "AES_PERF_COUNTERS=1 on Linux." << std::endl;
+}
+
+void ResetPerfCounters() {}
+
+#endif // AES_PERF_ENABLED
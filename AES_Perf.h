@@ -0,0 +1,76 @@
+// AES_Perf.h : Optional hardware performance counters around the cipher.
+//
+// Built with AES_PERF_COUNTERS defined to 1 on Linux, every cipher entry
+// point reads cycles, instructions, L1D read misses and branch misses from
+// perf_event_open around its work and adds them to per-thread totals.
+// Otherwise AES_PERF_SCOPE expands to ((void)0) and nothing is measured.
+//
+// Scopes sit where the blocks are actually processed (the CTR, CBC and
+// XTS ranges on pool threads, not just the public call), so every thread
+// is charged for its own work. Nested scopes are counted by the outermost
+// one only. Each scope costs two read() calls on the thread's counter
+// group, so per-block figures for single-block calls are dominated by
+// that; bulk calls amortise it.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+#if !defined(AES_PERF_COUNTERS)
+#define AES_PERF_COUNTERS 0
+#endif
+
+#if AES_PERF_COUNTERS && defined(__linux__)
+#define AES_PERF_ENABLED 1
+#else
+#define AES_PERF_ENABLED 0
+#endif
+
+enum PerfEntry {
+    PERF_ENCRYPT,
+    PERF_DECRYPT,
+    PERF_EXPAND_KEY,
+    PERF_CTR,
+    PERF_CBC_ENCRYPT,
+    PERF_CBC_DECRYPT,
+    PERF_GCM_ENCRYPT,
+    PERF_GCM_DECRYPT,
+    PERF_XTS_ENCRYPT,
+    PERF_XTS_DECRYPT,
+    PERF_ENTRY_COUNT,
+};
+
+// Writes calls, blocks and the per-block counters for every entry, for
+// each thread that ran one and in total. Threads that have exited are
+// folded into the total. Safe to call at any time from any thread.
+void DumpPerfCounters(std::ostream& out);
+
+// Zeroes every total.
+void ResetPerfCounters();
+
+#if AES_PERF_ENABLED
+
+class PerfScope {
+public:
+    // bytes is the data the call covers; it is charged as whole blocks.
+    PerfScope(PerfEntry entry, size_t bytes);
+    ~PerfScope();
+
+    PerfScope(const PerfScope&) = delete;
+    PerfScope& operator=(const PerfScope&) = delete;
+
+private:
+    PerfEntry entry_;
+    uint64_t blocks_;
+    bool outermost_;
+    uint64_t start_[4];
+};
+
+#define AES_PERF_SCOPE(entry, bytes) PerfScope perf_scope(entry, bytes)
+
+#else
+
+#define AES_PERF_SCOPE(entry, bytes) ((void)0)
+
+#endif
@@ -0,0 +1,1049 @@
+// AES_SelfTest.cpp : Known-answer tests of every engine and mode.
+//
+#include "AES_SelfTest.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "AES_Codec.h"
+#include "AES_CtrAhead.h"
+#include "AES_Daemon.h"
+#include "AES_Drbg.h"
+#include "AES_Engine.h"
+#include "AES_Modes.h"
+
+#if !defined(_WIN32)
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <thread>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// Copies of one block fed to the multi-block paths: more than any
+// engine's interleave width, and not a multiple of it.
+#define SELFTEST_BULK_BLOCKS 37
+
+namespace {
+
+class SelfTest {
+public:
+    SelfTest() : checks_(0), failures_(0) {}
+
+    void Check(const std::string& name, bool passed) {
+        std::cout << (passed ? "ok    " : "FAIL  ") << name << '\n';
+        checks_++;
+        failures_ += !passed;
+    }
+
+    int checks() const { return checks_; }
+    int failures() const { return failures_; }
+
+private:
+    int checks_;
+    int failures_;
+};
+
+std::vector<unsigned char> Hex(const char* text) {
+    size_t length = std::strlen(text);
+    std::vector<unsigned char> bytes(length / 2);
+    if (!HexDecode(text, length, bytes.data())) {
+        throw std::invalid_argument(std::string("Bad vector ") + text);
+    }
+    return bytes;
+}
+
+// Whether data starts with expected; true for an empty vector, whose
+// data() may be null.
+bool Matches(const unsigned char* data, const std::vector<unsigned char>& expected) {
+    return expected.empty() || !std::memcmp(data, expected.data(), expected.size());
+}
+
+// Every engine this CPU can run, the default one included.
+std::vector<const AesEngine*> Engines() {
+    std::vector<const AesEngine*> engines = {
+        &portable_engine, &table_engine, &bitslice_engine,
+    };
+#if defined(AES_X86)
+    if (GetCpuFeatures().aesni) {
+        engines.push_back(&aesni_engine);
+        engines.push_back(&aesni_x4_engine);
+    }
+#endif
+    bool listed = false;
+    for (const AesEngine* engine : engines) {
+        listed = listed || engine == &DefaultEngine();
+    }
+    if (!listed) {
+        engines.push_back(&DefaultEngine());
+    }
+    return engines;
+}
+
+struct BlockVector {
+    const char* name;
+    const char* key;
+    const char* plain;
+    const char* cipher;
+};
+
+// FIPS-197 Appendix B, and the AES-128/192/256 examples of Appendix C.
+const BlockVector fips197_vectors[] = {
+    { "B", "2b7e151628aed2a6abf7158809cf4f3c",
+      "3243f6a8885a308d313198a2e0370734", "3925841d02dc09fbdc118597196a0b32" },
+    { "C.1", "000102030405060708090a0b0c0d0e0f",
+      "00112233445566778899aabbccddeeff", "69c4e0d86a7b0430d8cdb78070b4c55a" },
+    { "C.2", "000102030405060708090a0b0c0d0e0f1011121314151617",
+      "00112233445566778899aabbccddeeff", "dda97ca4864cdfe06eaf70a0ec0d7191" },
+    { "C.3", "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f",
+      "00112233445566778899aabbccddeeff", "8ea2b7ca516745bfeafc49904b496089" },
+};
+
+// Lone blocks, the multi-block path and the multi-key path, both ways.
+void TestFips197(SelfTest& test) {
+    for (const AesEngine* engine : Engines()) {
+        for (const BlockVector& vector : fips197_vectors) {
+            std::vector<unsigned char> key = Hex(vector.key);
+            std::vector<unsigned char> plain = Hex(vector.plain);
+            std::vector<unsigned char> cipher = Hex(vector.cipher);
+            std::string name = std::string("fips197 ") + vector.name + " " + engine->name;
+            AesKey aes_key;
+            BuildAesKey(aes_key, key.data(), static_cast<int>(key.size()), *engine);
+
+            unsigned char block[16];
+            EncryptBlock(aes_key, plain.data(), block);
+            test.Check(name + " encrypt block", !std::memcmp(block, cipher.data(), 16));
+            DecryptBlock(aes_key, cipher.data(), block);
+            test.Check(name + " decrypt block", !std::memcmp(block, plain.data(), 16));
+
+            std::vector<unsigned char> plains(SELFTEST_BULK_BLOCKS * BLOCK_SIZE);
+            std::vector<unsigned char> ciphers(plains.size());
+            std::vector<unsigned char> bulk(plains.size());
+            for (size_t i = 0; i < SELFTEST_BULK_BLOCKS; i++) {
+                std::memcpy(&plains[BLOCK_SIZE * i], plain.data(), BLOCK_SIZE);
+                std::memcpy(&ciphers[BLOCK_SIZE * i], cipher.data(), BLOCK_SIZE);
+            }
+            EncryptBlocks(aes_key, plains.data(), bulk.data(), SELFTEST_BULK_BLOCKS);
+            test.Check(name + " encrypt blocks", bulk == ciphers);
+            DecryptBlocks(aes_key, ciphers.data(), bulk.data(), SELFTEST_BULK_BLOCKS);
+            test.Check(name + " decrypt blocks", bulk == plains);
+
+            std::vector<BlockJob> jobs(SELFTEST_BULK_BLOCKS);
+            for (size_t i = 0; i < jobs.size(); i++) {
+                jobs[i] = BlockJob{ &aes_key, &plains[BLOCK_SIZE * i], &bulk[BLOCK_SIZE * i] };
+            }
+            EncryptBlockBatch(jobs.data(), jobs.size());
+            test.Check(name + " encrypt multi-key", bulk == ciphers);
+            for (size_t i = 0; i < jobs.size(); i++) {
+                jobs[i].in = &ciphers[BLOCK_SIZE * i];
+            }
+            DecryptBlockBatch(jobs.data(), jobs.size());
+            test.Check(name + " decrypt multi-key", bulk == plains);
+            WipeAesKey(aes_key);
+        }
+    }
+}
+
+struct GcmVector {
+    const char* name;
+    const char* key;
+    const char* iv;
+    const char* plain;
+    const char* aad;
+    const char* cipher;
+    const char* tag;
+};
+
+#define GCM_KEY_3 "feffe9928665731c6d6a8f9467308308"
+#define GCM_PLAIN_3 "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72" \
+    "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b391aafd255"
+#define GCM_PLAIN_4 "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72" \
+    "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39"
+#define GCM_AAD_4 "feedfacedeadbeeffeedfacedeadbeefabaddad2"
+
+// Test cases 1-6 of the GCM specification (McGrew and Viega): 96-bit IVs,
+// then a 64-bit and a 480-bit IV, which go through GHASH.
+const GcmVector gcm_vectors[] = {
+    { "1", "00000000000000000000000000000000", "000000000000000000000000", "", "",
+      "", "58e2fccefa7e3061367f1d57a4e7455a" },
+    { "2", "00000000000000000000000000000000", "000000000000000000000000",
+      "00000000000000000000000000000000", "",
+      "0388dace60b6a392f328c2b971b2fe78", "ab6e47d42cec13bdf53a67b21257bddf" },
+    { "3", GCM_KEY_3, "cafebabefacedbaddecaf888", GCM_PLAIN_3, "",
+      "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+      "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091473f5985",
+      "4d5c2af327cd64a62cf35abd2ba6fab4" },
+    { "4", GCM_KEY_3, "cafebabefacedbaddecaf888", GCM_PLAIN_4, GCM_AAD_4,
+      "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+      "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091",
+      "5bc94fbc3221a5db94fae95ae7121a47" },
+    { "5", GCM_KEY_3, "cafebabefacedbad", GCM_PLAIN_4, GCM_AAD_4,
+      "61353b4c2806934a777ff51fa22a4755699b2a714fcdc6f83766e5f97b6c7423"
+      "73806900e49f24b22b097544d4896b424989b5e1ebac0f07c23f4598",
+      "3612d2e79e3b0785561be14aaca2fccb" },
+    { "6", GCM_KEY_3,
+      "9313225df88406e555909c5aff5269aa6a7a9538534f7da1e4c303d2a318a728"
+      "c3c0c95156809539fcf0e2429a6b525416aedbf5a0de6a57a637b39b",
+      GCM_PLAIN_4, GCM_AAD_4,
+      "8ce24998625615b603a033aca13fb894be9112a5c3a211a8ba262a3cca7e2ca7"
+      "01e4a9a4fba43c90ccdcb281d48c7c6fd62875d2aca417034c34aee5",
+      "619cc5aefffe0bfa462af43c1699d050" },
+};
+
+// One-shot and incremental encryption, decryption, and a flipped tag bit,
+// on the carry-less multiply path when the CPU has it and always on the
+// 4-bit table path.
+void TestGcm(SelfTest& test) {
+    for (const GcmVector& vector : gcm_vectors) {
+        std::vector<unsigned char> key = Hex(vector.key);
+        std::vector<unsigned char> iv = Hex(vector.iv);
+        std::vector<unsigned char> plain = Hex(vector.plain);
+        std::vector<unsigned char> aad = Hex(vector.aad);
+        std::vector<unsigned char> cipher = Hex(vector.cipher);
+        std::vector<unsigned char> tag = Hex(vector.tag);
+        AesKey aes_key;
+        BuildAesKey(aes_key, key.data(), static_cast<int>(key.size()));
+
+        for (int path = 0; path < 2; path++) {
+            GcmKey gcm_key;
+            BuildGcmKey(gcm_key, aes_key);
+            if (path == 0 && !gcm_key.use_clmul) {
+                continue;
+            }
+            gcm_key.use_clmul = path == 0;
+            std::string name = std::string("gcm case ") + vector.name +
+                               (path == 0 ? " clmul" : " table");
+
+            // One spare byte keeps data() valid for the empty cases.
+            std::vector<unsigned char> out(plain.size() + 1);
+            unsigned char computed[16];
+            GcmEncrypt(gcm_key, iv.data(), iv.size(), aad.data(), aad.size(),
+                       plain.data(), plain.size(), out.data(), computed);
+            test.Check(name + " encrypt",
+                       Matches(out.data(), cipher) && Matches(computed, tag));
+
+            GcmState state;
+            GcmStart(state, gcm_key, iv.data(), iv.size(), aad.data(), aad.size());
+            for (size_t done = 0, piece = 1; done < plain.size(); done += piece, piece += 7) {
+                piece = std::min(piece, plain.size() - done);
+                GcmEncryptUpdate(state, plain.data() + done, out.data() + done, piece);
+            }
+            GcmFinish(state, computed);
+            test.Check(name + " encrypt in pieces",
+                       Matches(out.data(), cipher) && GcmTagsEqual(computed, tag.data()));
+
+            bool opened = GcmDecrypt(gcm_key, iv.data(), iv.size(), aad.data(), aad.size(),
+                                     cipher.data(), cipher.size(), out.data(), tag.data());
+            test.Check(name + " decrypt",
+                       opened && Matches(out.data(), plain));
+
+            unsigned char forged[16];
+            std::memcpy(forged, tag.data(), 16);
+            forged[15] ^= 1;
+            opened = GcmDecrypt(gcm_key, iv.data(), iv.size(), aad.data(), aad.size(),
+                                cipher.data(), cipher.size(), out.data(), forged);
+            bool wiped = true;
+            for (size_t i = 0; i < plain.size(); i++) {
+                wiped = wiped && out[i] == 0;
+            }
+            test.Check(name + " reject forged tag", !opened && wiped);
+        }
+        WipeAesKey(aes_key);
+    }
+}
+
+struct XtsVector {
+    const char* name;
+    const char* data_key;
+    const char* tweak_key;
+    uint64_t sector;
+    const char* plain;
+    const char* cipher;
+};
+
+// IEEE 1619-2007 Annex B vectors 2 and 3, whole blocks, and 15 and 16,
+// whose 17 and 18 bytes take ciphertext stealing. The standard prints the
+// data unit number as the tweak's little-endian bytes.
+const XtsVector xts_vectors[] = {
+    { "2", "11111111111111111111111111111111", "22222222222222222222222222222222",
+      0x3333333333ull,
+      "4444444444444444444444444444444444444444444444444444444444444444",
+      "c454185e6a16936e39334038acef838bfb186fff7480adc4289382ecd6d394f0" },
+    { "3", "fffefdfcfbfaf9f8f7f6f5f4f3f2f1f0", "22222222222222222222222222222222",
+      0x3333333333ull,
+      "4444444444444444444444444444444444444444444444444444444444444444",
+      "af85336b597afc1a900b2eb21ec949d292df4c047e0b21532186a5971a227a89" },
+    { "15", "fffefdfcfbfaf9f8f7f6f5f4f3f2f1f0", "bfbebdbcbbbab9b8b7b6b5b4b3b2b1b0",
+      0x123456789aull, "000102030405060708090a0b0c0d0e0f10",
+      "6c1625db4671522d3d7599601de7ca09ed" },
+    { "16", "fffefdfcfbfaf9f8f7f6f5f4f3f2f1f0", "bfbebdbcbbbab9b8b7b6b5b4b3b2b1b0",
+      0x123456789aull, "000102030405060708090a0b0c0d0e0f1011",
+      "d069444b7a7e0cab09e24447d24deb1fedbf" },
+};
+
+// Sectors of the batch check: enough for the tweaks to fill several
+// engine calls, each sector ending in a stolen partial block.
+#define SELFTEST_XTS_SECTORS 5
+#define SELFTEST_XTS_SECTOR_BYTES 1000
+
+// The vectors on every engine, then the batch form against one sector at
+// a time.
+void TestXts(SelfTest& test) {
+    for (const AesEngine* engine : Engines()) {
+        for (const XtsVector& vector : xts_vectors) {
+            std::vector<unsigned char> data_bytes = Hex(vector.data_key);
+            std::vector<unsigned char> tweak_bytes = Hex(vector.tweak_key);
+            std::vector<unsigned char> plain = Hex(vector.plain);
+            std::vector<unsigned char> cipher = Hex(vector.cipher);
+            std::string name = std::string("xts vector ") + vector.name + " " + engine->name;
+            AesKey data_key, tweak_key;
+            BuildAesKey(data_key, data_bytes.data(), static_cast<int>(data_bytes.size()), *engine);
+            BuildAesKey(tweak_key, tweak_bytes.data(), static_cast<int>(tweak_bytes.size()), *engine);
+
+            std::vector<unsigned char> out(plain.size());
+            XtsEncrypt(data_key, tweak_key, vector.sector, plain.data(), out.data(), out.size());
+            test.Check(name + " encrypt", out == cipher);
+            XtsDecrypt(data_key, tweak_key, vector.sector, cipher.data(), out.data(), out.size());
+            test.Check(name + " decrypt", out == plain);
+            WipeAesKey(data_key);
+            WipeAesKey(tweak_key);
+        }
+    }
+
+    const XtsVector& vector = xts_vectors[2];
+    std::vector<unsigned char> data_bytes = Hex(vector.data_key);
+    std::vector<unsigned char> tweak_bytes = Hex(vector.tweak_key);
+    AesKey data_key, tweak_key;
+    BuildAesKey(data_key, data_bytes.data(), static_cast<int>(data_bytes.size()));
+    BuildAesKey(tweak_key, tweak_bytes.data(), static_cast<int>(tweak_bytes.size()));
+    size_t bytes = SELFTEST_XTS_SECTORS * SELFTEST_XTS_SECTOR_BYTES;
+    std::vector<unsigned char> plain(bytes), batch(bytes), single(bytes);
+    for (size_t i = 0; i < bytes; i++) {
+        plain[i] = static_cast<unsigned char>(i * 7 + i / 13);
+    }
+    XtsEncryptSectors(data_key, tweak_key, vector.sector, plain.data(), batch.data(),
+                      SELFTEST_XTS_SECTOR_BYTES, SELFTEST_XTS_SECTORS);
+    for (size_t i = 0; i < SELFTEST_XTS_SECTORS; i++) {
+        size_t offset = SELFTEST_XTS_SECTOR_BYTES * i;
+        XtsEncrypt(data_key, tweak_key, vector.sector + i, plain.data() + offset,
+                   single.data() + offset, SELFTEST_XTS_SECTOR_BYTES);
+    }
+    test.Check("xts sectors encrypt", batch == single);
+    XtsDecryptSectors(data_key, tweak_key, vector.sector, batch.data(), batch.data(),
+                      SELFTEST_XTS_SECTOR_BYTES, SELFTEST_XTS_SECTORS);
+    test.Check("xts sectors decrypt", batch == plain);
+    WipeAesKey(data_key);
+    WipeAesKey(tweak_key);
+}
+
+#define CMAC_MESSAGE "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51" \
+    "30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710"
+
+struct CmacVector {
+    const char* name;
+    const char* key;
+    size_t length;
+    const char* tag;
+};
+
+// RFC 4493 section 4 (AES-128) and NIST SP 800-38B Appendix D.3
+// (AES-256), over prefixes of one message: empty, one block, a partial
+// last block and four whole blocks.
+const CmacVector cmac_vectors[] = {
+    { "128/0", "2b7e151628aed2a6abf7158809cf4f3c", 0, "bb1d6929e95937287fa37d129b756746" },
+    { "128/16", "2b7e151628aed2a6abf7158809cf4f3c", 16, "070a16b46b4d4144f79bdd9dd04a287c" },
+    { "128/40", "2b7e151628aed2a6abf7158809cf4f3c", 40, "dfa66747de9ae63030ca32611497c827" },
+    { "128/64", "2b7e151628aed2a6abf7158809cf4f3c", 64, "51f0bebf7e3b9d92fc49741779363cfe" },
+    { "256/0", "603deb1015ca71be2b73aef0857d77811f352c073b6108d72d9810a30914dff4", 0,
+      "028962f61b7bf89efc6b551f4667d983" },
+    { "256/16", "603deb1015ca71be2b73aef0857d77811f352c073b6108d72d9810a30914dff4", 16,
+      "28a7023f452e8f82bd4bf28d8c37c35c" },
+    { "256/64", "603deb1015ca71be2b73aef0857d77811f352c073b6108d72d9810a30914dff4", 64,
+      "e1992190549f6ed5696a2c056c315410" },
+};
+
+// The RFC 4493 subkeys, each vector alone, and all of them in one batch
+// so lanes of different lengths finish at different steps.
+void TestCmac(SelfTest& test) {
+    std::vector<unsigned char> message = Hex(CMAC_MESSAGE);
+    for (const AesEngine* engine : Engines()) {
+        std::vector<unsigned char> key = Hex(cmac_vectors[0].key);
+        AesKey aes_key;
+        BuildAesKey(aes_key, key.data(), static_cast<int>(key.size()), *engine);
+        CmacKey cmac_key;
+        BuildCmacKey(cmac_key, aes_key);
+        test.Check(std::string("cmac subkeys ") + engine->name,
+                   Matches(cmac_key.k1, Hex("fbeed618357133667c85e08f7236a8de")) &&
+                   Matches(cmac_key.k2, Hex("f7ddac306ae266ccf90bc11ee46d513b")));
+        WipeCmacKey(cmac_key);
+        WipeAesKey(aes_key);
+
+        for (const CmacVector& vector : cmac_vectors) {
+            key = Hex(vector.key);
+            BuildAesKey(aes_key, key.data(), static_cast<int>(key.size()), *engine);
+            BuildCmacKey(cmac_key, aes_key);
+            std::string name = std::string("cmac ") + vector.name + " " + engine->name;
+
+            unsigned char tag[16];
+            Cmac(cmac_key, message.data(), vector.length, tag);
+            test.Check(name, Matches(tag, Hex(vector.tag)));
+
+            // Every prefix length up to the whole message in one batch,
+            // this vector's among them.
+            std::vector<CmacJob> jobs(message.size() + 1);
+            std::vector<unsigned char> tags(BLOCK_SIZE * jobs.size());
+            for (size_t i = 0; i < jobs.size(); i++) {
+                jobs[i] = CmacJob{ message.data(), message.size() - i, &tags[BLOCK_SIZE * i] };
+            }
+            CmacBatch(cmac_key, jobs.data(), jobs.size());
+            bool batched = Matches(&tags[BLOCK_SIZE * (message.size() - vector.length)],
+                                   Hex(vector.tag));
+            for (size_t i = 0; i < jobs.size(); i++) {
+                Cmac(cmac_key, jobs[i].in, jobs[i].length, tag);
+                batched = batched && !std::memcmp(tag, &tags[BLOCK_SIZE * i], 16);
+            }
+            test.Check(name + " batch", batched);
+            WipeCmacKey(cmac_key);
+            WipeAesKey(aes_key);
+        }
+    }
+}
+
+// SP 800-38A F.5.1, CTR-AES128.
+#define CTR_KEY "2b7e151628aed2a6abf7158809cf4f3c"
+#define CTR_COUNTER "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff"
+#define CTR_PLAIN "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51" \
+                  "30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710"
+#define CTR_CIPHER "874d6191b620e3261bef6864990db6ce9806f66b7970fdff8617187bb9fffdff" \
+                   "5ae4df3edbd5d35e5b4f09020db03eab1e031dda2fbe03d1792170a0f3009cee"
+#define KEY_256 "603deb1015ca71be2b73aef0857d77811f352c073b6108d72d9810a30914dff4"
+
+// One SP 800-38A example; every one encrypts the four blocks of CTR_PLAIN.
+struct ModeVector {
+    const char* name;
+    const char* key;
+    const char* iv;
+    const char* cipher;
+};
+
+const ModeVector ctr_vectors[] = {
+    { "F.5.1", CTR_KEY, CTR_COUNTER, CTR_CIPHER },
+    { "F.5.5", KEY_256, CTR_COUNTER,
+      "601ec313775789a5b7a7f504bbf3d228f443e3ca4d62b59aca84e990cacaf5c5"
+      "2b0930daa23de94ce87017ba2d84988ddfc9c58db67aada613c2dd08457941a6" },
+};
+
+const ModeVector cbc_vectors[] = {
+    { "F.2.1", CTR_KEY, "000102030405060708090a0b0c0d0e0f",
+      "7649abac8119b246cee98e9b12e9197d5086cb9b507219ee95db113a917678b2"
+      "73bed6b8e3c1743b7116e69e222295163ff1caa1681fac09120eca307586e1a7" },
+    { "F.2.5", KEY_256, "000102030405060708090a0b0c0d0e0f",
+      "f58c4c04d6e5f1ba779eabfb5f7bfbd69cfc4e967edb808d679f777bc6702c7d"
+      "39f23369a9d9bacfa530e26304231461b2eb05e2c39be9fcda6c19078c6a9d1b" },
+};
+
+// A buffer of at least ParallelMinBytes() plus `extra` bytes, so the mode
+// splits it across DefaultThreadPool(). It starts with CTR_PLAIN so the
+// vector's cipher text is also the start of the result.
+std::vector<unsigned char> ParallelPlain(size_t extra) {
+    std::vector<unsigned char> plain = Hex(CTR_PLAIN);
+    size_t bytes = std::max(ParallelMinBytes(), plain.size()) + extra;
+    plain.resize(bytes);
+    for (size_t i = 64; i < bytes; i++) {
+        plain[i] = static_cast<unsigned char>(i * 7 + i / 13);
+    }
+    return plain;
+}
+
+// The vectors on every engine, whole and cut short of a block, then a
+// buffer long enough for the parallel path against the same bytes done
+// in pieces below the threshold.
+void TestCtr(SelfTest& test) {
+    for (const AesEngine* engine : Engines()) {
+        for (const ModeVector& vector : ctr_vectors) {
+            std::vector<unsigned char> key_bytes = Hex(vector.key);
+            std::vector<unsigned char> counter = Hex(vector.iv);
+            std::vector<unsigned char> plain = Hex(CTR_PLAIN);
+            std::vector<unsigned char> cipher = Hex(vector.cipher);
+            std::string name = std::string("ctr ") + vector.name + " " + engine->name;
+            AesKey key;
+            BuildAesKey(key, key_bytes.data(), static_cast<int>(key_bytes.size()), *engine);
+
+            std::vector<unsigned char> out(plain.size());
+            CtrCrypt(key, counter.data(), plain.data(), out.data(), out.size());
+            test.Check(name + " encrypt", out == cipher);
+            CtrCrypt(key, counter.data(), out.data(), out.data(), out.size());
+            test.Check(name + " decrypt in place", out == plain);
+
+            std::vector<unsigned char> partial(plain.size() - 5);
+            CtrCrypt(key, counter.data(), plain.data(), partial.data(), partial.size());
+            test.Check(name + " partial block",
+                       std::equal(partial.begin(), partial.end(), cipher.begin()));
+
+            std::vector<unsigned char> big_plain = ParallelPlain(3 * BLOCK_SIZE + 5);
+            std::vector<unsigned char> parallel(big_plain.size()), pieces(big_plain.size());
+            CtrCrypt(key, counter.data(), big_plain.data(), parallel.data(), parallel.size());
+            std::vector<unsigned char> piece_counter = counter;
+            for (size_t offset = 0; offset < pieces.size();
+                 offset += SELFTEST_BULK_BLOCKS * BLOCK_SIZE) {
+                size_t bytes = std::min<size_t>(SELFTEST_BULK_BLOCKS * BLOCK_SIZE,
+                                                pieces.size() - offset);
+                CtrCrypt(key, piece_counter.data(), big_plain.data() + offset,
+                         pieces.data() + offset, bytes);
+                AddCounter(piece_counter.data(), SELFTEST_BULK_BLOCKS);
+            }
+            test.Check(name + " parallel", Matches(parallel.data(), cipher) && parallel == pieces);
+            CtrCrypt(key, counter.data(), parallel.data(), parallel.data(), parallel.size());
+            test.Check(name + " parallel decrypt in place", parallel == big_plain);
+            WipeAesKey(key);
+        }
+    }
+}
+
+// The vectors on every engine with their padding block, a parallel
+// decryption, and cipher texts whose padding or length is wrong.
+void TestCbc(SelfTest& test) {
+    for (const AesEngine* engine : Engines()) {
+        for (const ModeVector& vector : cbc_vectors) {
+            std::vector<unsigned char> key_bytes = Hex(vector.key);
+            std::vector<unsigned char> iv = Hex(vector.iv);
+            std::vector<unsigned char> plain = Hex(CTR_PLAIN);
+            std::vector<unsigned char> cipher = Hex(vector.cipher);
+            std::string name = std::string("cbc ") + vector.name + " " + engine->name;
+            AesKey key;
+            BuildAesKey(key, key_bytes.data(), static_cast<int>(key_bytes.size()), *engine);
+
+            // A whole block of padding follows the four vector blocks.
+            std::vector<unsigned char> out(plain.size() + BLOCK_SIZE);
+            size_t cipher_length = CbcEncrypt(key, iv.data(), plain.data(), plain.size(), out.data());
+            test.Check(name + " encrypt", cipher_length == out.size() && Matches(out.data(), cipher));
+            size_t plain_length = 0;
+            bool valid = CbcDecrypt(key, iv.data(), out.data(), out.size(), out.data(), plain_length);
+            test.Check(name + " decrypt in place",
+                       valid && plain_length == plain.size() && Matches(out.data(), plain));
+
+            // Five padding bytes.
+            cipher_length = CbcEncrypt(key, iv.data(), plain.data(), plain.size() - 5, out.data());
+            valid = CbcDecrypt(key, iv.data(), out.data(), cipher_length, out.data(), plain_length);
+            test.Check(name + " short padding",
+                       cipher_length == plain.size() && valid && plain_length == plain.size() - 5 &&
+                       std::equal(out.begin(), out.begin() + plain_length, plain.begin()));
+
+            std::vector<unsigned char> big_plain = ParallelPlain(3 * BLOCK_SIZE + 5);
+            std::vector<unsigned char> big(big_plain.size() + BLOCK_SIZE);
+            std::vector<unsigned char> decrypted(big.size());
+            cipher_length = CbcEncrypt(key, iv.data(), big_plain.data(), big_plain.size(), big.data());
+            big.resize(cipher_length);
+            valid = CbcDecrypt(key, iv.data(), big.data(), big.size(), decrypted.data(), plain_length);
+            test.Check(name + " parallel decrypt",
+                       Matches(big.data(), cipher) && valid && plain_length == big_plain.size() &&
+                       std::equal(big_plain.begin(), big_plain.end(), decrypted.begin()));
+            valid = CbcDecrypt(key, iv.data(), big.data(), big.size(), big.data(), plain_length);
+            test.Check(name + " parallel decrypt in place",
+                       valid && plain_length == big_plain.size() &&
+                       std::equal(big_plain.begin(), big_plain.end(), big.begin()));
+            WipeAesKey(key);
+        }
+    }
+
+    // The last byte of the last block decrypts to 0x10 ^ flip: a pad
+    // length of 0, one above BLOCK_SIZE, and 2 over a byte that is not 2.
+    std::vector<unsigned char> key_bytes = Hex(CTR_KEY);
+    std::vector<unsigned char> iv = Hex(cbc_vectors[0].iv);
+    std::vector<unsigned char> plain = Hex(CTR_PLAIN);
+    AesKey key;
+    BuildAesKey(key, key_bytes.data(), static_cast<int>(key_bytes.size()));
+    std::vector<unsigned char> cipher(plain.size() + BLOCK_SIZE), out(cipher.size());
+    CbcEncrypt(key, iv.data(), plain.data(), plain.size(), cipher.data());
+    const unsigned char flips[] = { 0x10, 0x01, 0x12 };
+    for (unsigned char flip : flips) {
+        std::vector<unsigned char> bad = cipher;
+        bad[bad.size() - BLOCK_SIZE - 1] ^= flip;
+        size_t plain_length = 12345;
+        bool valid = CbcDecrypt(key, iv.data(), bad.data(), bad.size(), out.data(), plain_length);
+        test.Check("cbc bad padding " + std::to_string(0x10 ^ flip),
+                   !valid && plain_length == 12345);
+    }
+    size_t plain_length = 0;
+    test.Check("cbc partial block refused",
+               !CbcDecrypt(key, iv.data(), cipher.data(), cipher.size() - 1, out.data(), plain_length));
+    test.Check("cbc empty refused",
+               !CbcDecrypt(key, iv.data(), cipher.data(), 0, out.data(), plain_length));
+    WipeAesKey(key);
+}
+
+template <typename Call>
+bool Throws(Call call) {
+    try {
+        call();
+    } catch (const std::invalid_argument&) {
+        return true;
+    }
+    return false;
+}
+
+// The precomputed stream against the vector, and its refusal to use a
+// counter block twice under one key across Init, Final, key objects and
+// overlapping counters.
+void TestCtrAhead(SelfTest& test) {
+    std::vector<unsigned char> key_bytes = Hex(CTR_KEY);
+    std::vector<unsigned char> iv = Hex(CTR_COUNTER);
+    std::vector<unsigned char> plain = Hex(CTR_PLAIN);
+    std::vector<unsigned char> cipher = Hex(CTR_CIPHER);
+    std::vector<unsigned char> out(plain.size());
+    AesKey key, same_key, other_key;
+    BuildAesKey(key, key_bytes.data(), 16);
+    BuildAesKey(same_key, key_bytes.data(), 16);
+    BuildAesKey(other_key, iv.data(), 16);
+    Span<const uint8_t> iv_span(iv.data(), iv.size());
+
+    CtrAheadStream stream;
+    // In pieces that split counter blocks.
+    stream.Init(key, iv_span);
+    size_t pieces[] = { 5, 27, 32 };
+    size_t done = 0;
+    for (size_t piece : pieces) {
+        stream.Update(Span<const uint8_t>(plain.data() + done, piece),
+                      Span<uint8_t>(out.data() + done, piece));
+        done += piece;
+    }
+    test.Check("ctrahead F.5.1", Matches(out.data(), cipher));
+
+    test.Check("ctrahead init after final", Throws([&] {
+        stream.Final();
+        stream.Init(key, iv_span);
+    }));
+    test.Check("ctrahead init after another key", Throws([&] {
+        stream.Init(other_key, iv_span);
+        stream.Init(key, iv_span);
+    }));
+    test.Check("ctrahead init with a copy of the key",
+               Throws([&] { stream.Init(same_key, iv_span); }));
+
+    // Blocks iv .. iv + 3 are used.
+    std::vector<unsigned char> counter = iv;
+    AddCounter(counter.data(), 2);
+    test.Check("ctrahead overlapping counter", Throws([&] {
+        stream.Init(key, Span<const uint8_t>(counter.data(), counter.size()));
+    }));
+    AddCounter(counter.data(), 2);
+    test.Check("ctrahead counter after the used range", !Throws([&] {
+        stream.Init(key, Span<const uint8_t>(counter.data(), counter.size()));
+    }));
+
+    // Starting two blocks before the used range leaves exactly two.
+    std::vector<unsigned char> before = Hex("f0f1f2f3f4f5f6f7f8f9fafbfcfdfefd");
+    std::vector<unsigned char> expected(32, 0);
+    CtrCrypt(key, before.data(), expected.data(), expected.data(), expected.size());
+    stream.Init(key, Span<const uint8_t>(before.data(), before.size()));
+    std::vector<unsigned char> zeros(32, 0);
+    stream.Update(Span<const uint8_t>(zeros.data(), zeros.size()),
+                  Span<uint8_t>(zeros.data(), zeros.size()));
+    test.Check("ctrahead up to the used range", Matches(zeros.data(), expected));
+    test.Check("ctrahead stops at the used range", Throws([&] {
+        stream.Update(Span<const uint8_t>(zeros.data(), 1), Span<uint8_t>(zeros.data(), 1));
+    }));
+    stream.Final();
+    WipeAesKey(key);
+    WipeAesKey(same_key);
+    WipeAesKey(other_key);
+}
+
+// CTR_DRBG with AES-256 and no derivation function. Each input is
+// DRBG_SEED_BYTES counting up from its first byte. The outputs are from
+// OpenSSL's CTR-DRBG, fed the same entropy through its TEST-RAND source,
+// and agree with a separate implementation written from SP 800-90A
+// 10.2.1 over a plain AES-256 block cipher.
+#define DRBG_OUT_1 "a3d9e95669e317b87cae609913505ea914dc12814f92951e8476b2ef2e33707b" \
+                   "08815b5bc9653748630b9a7f4959a0ff99075bca6d7d12e5764346e874663a19"
+#define DRBG_OUT_2 "1b98e456a3cebb0e682b5d15eb588bf8135f539c703767a56ed631cbe2616154" \
+                   "7761f476d5c271e086a332e08e295866b9e104ab7bf14c384bd428fef7e88cca"
+#define DRBG_OUT_PLAIN "f08f8d021d4b6e0f8b6569e545057aacc2105c82a22a9c535ff30f53bb1916b7" \
+                       "6c1de6f3935b6f316c8f5ce5c6eda6f95331c91dd1ca514266bcf435de0d6d20"
+
+std::vector<unsigned char> DrbgInput(unsigned char first) {
+    std::vector<unsigned char> input(DRBG_SEED_BYTES);
+    for (size_t i = 0; i < input.size(); i++) {
+        input[i] = static_cast<unsigned char>(first + i);
+    }
+    return input;
+}
+
+Span<const uint8_t> ConstSpan(const std::vector<unsigned char>& bytes) {
+    return Span<const uint8_t>(bytes.data(), bytes.size());
+}
+
+// Instantiate, reseed and two generates, with and without personalization
+// and additional input; the second output checks that the state update
+// after a request matches too.
+void TestDrbg(SelfTest& test) {
+    std::vector<unsigned char> entropy = DrbgInput(0x00);
+    std::vector<unsigned char> reseed_entropy = DrbgInput(0x80);
+    std::vector<unsigned char> personalization = DrbgInput(0x40);
+    std::vector<unsigned char> reseed_additional = DrbgInput(0xc0);
+    std::vector<unsigned char> additional_1 = DrbgInput(0x20);
+    std::vector<unsigned char> additional_2 = DrbgInput(0x60);
+    std::vector<unsigned char> out(64);
+    Span<uint8_t> out_span(out.data(), out.size());
+
+    CtrDrbg drbg;
+    test.Check("drbg generate before instantiate",
+               Throws([&] { drbg.Generate(out_span); }));
+
+    drbg.Instantiate(ConstSpan(entropy), ConstSpan(personalization));
+    drbg.Reseed(ConstSpan(reseed_entropy), ConstSpan(reseed_additional));
+    test.Check("drbg generate 1", drbg.Generate(out_span, ConstSpan(additional_1)) &&
+                                      Matches(out.data(), Hex(DRBG_OUT_1)));
+    test.Check("drbg generate 2", drbg.Generate(out_span, ConstSpan(additional_2)) &&
+                                      Matches(out.data(), Hex(DRBG_OUT_2)));
+
+    drbg.Instantiate(ConstSpan(entropy));
+    drbg.Reseed(ConstSpan(reseed_entropy));
+    drbg.Generate(out_span);
+    test.Check("drbg without inputs", drbg.Generate(out_span) &&
+                                          Matches(out.data(), Hex(DRBG_OUT_PLAIN)));
+
+    test.Check("drbg short entropy", Throws([&] {
+        drbg.Reseed(Span<const uint8_t>(entropy.data(), DRBG_SEED_BYTES - 1));
+    }));
+    drbg.Uninstantiate();
+    test.Check("drbg generate after uninstantiate",
+               Throws([&] { drbg.Generate(out_span); }));
+}
+
+#if !defined(_WIN32)
+
+// A connection without a shared region, for requests DaemonClient never
+// sends: attaches of bad regions and descriptors sent with other requests.
+int ConnectRaw(const std::string& path) {
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+// Sends request with attached_fd, if not -1, and returns the response
+// status, or -1 if the connection fails.
+int CallRaw(int socket_fd, const DaemonRequest& request, int attached_fd) {
+    DaemonRequest copy = request;
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    std::memset(control, 0, sizeof(control));
+    iovec io = { &copy, sizeof(copy) };
+    msghdr message;
+    std::memset(&message, 0, sizeof(message));
+    message.msg_iov = &io;
+    message.msg_iovlen = 1;
+    if (attached_fd >= 0) {
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        cmsghdr* header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(header), &attached_fd, sizeof(int));
+    }
+    if (sendmsg(socket_fd, &message, MSG_NOSIGNAL) != static_cast<ssize_t>(sizeof(copy))) {
+        return -1;
+    }
+    DaemonResponse response;
+    if (recv(socket_fd, &response, sizeof(response), MSG_WAITALL) !=
+        static_cast<ssize_t>(sizeof(response))) {
+        return -1;
+    }
+    return static_cast<int>(response.status);
+}
+
+// Descriptors open in process pid, or -1 where /proc is not available.
+int OpenDescriptors(pid_t pid) {
+    DIR* dir = opendir(("/proc/" + std::to_string(pid) + "/fd").c_str());
+    if (!dir) {
+        return -1;
+    }
+    int count = 0;
+    while (readdir(dir)) {
+        count++;
+    }
+    closedir(dir);
+    return count;
+}
+
+// Runs a daemon in a child process and drives it over its socket: every
+// client's requests must take effect in the order sent, however they are
+// batched, and a bad region or stray descriptor must neither crash the
+// daemon nor stay open in it.
+void TestDaemon(SelfTest& test) {
+    std::string path = "/tmp/aes-selftest-" + std::to_string(getpid()) + ".sock";
+    pid_t daemon = fork();
+    if (daemon < 0) {
+        test.Check("daemon start", false);
+        return;
+    }
+    if (daemon == 0) {
+        std::freopen("/dev/null", "w", stdout);
+        std::freopen("/dev/null", "w", stderr);
+        std::string name = "AES_UNSW", command = "daemon";
+        char* args[] = { &name[0], &command[0], &path[0], nullptr };
+        _exit(RunDaemon(3, args));
+    }
+
+    std::unique_ptr<DaemonClient> client;
+    for (int attempt = 0; attempt < 500 && !client; attempt++) {
+        try {
+            client.reset(new DaemonClient(path, 1 << 16));
+        } catch (const std::runtime_error&) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    test.Check("daemon start", client != nullptr);
+    if (client) {
+        unsigned char* buffer = client->Buffer();
+        std::vector<unsigned char> key1 = Hex("000102030405060708090a0b0c0d0e0f");
+        std::vector<unsigned char> key2 = Hex("2b7e151628aed2a6abf7158809cf4f3c");
+        std::vector<unsigned char> plain = Hex("00112233445566778899aabbccddeeff");
+        AesKey aes_key1, aes_key2;
+        BuildAesKey(aes_key1, key1.data(), 16);
+        BuildAesKey(aes_key2, key2.data(), 16);
+        unsigned char expected1[16], expected2[16];
+        EncryptBlock(aes_key1, plain.data(), expected1);
+        EncryptBlock(aes_key2, plain.data(), expected2);
+        std::memcpy(buffer, plain.data(), 16);
+
+        // Pipelined into one batch: a block, the unload of its key, a
+        // block under the unloaded id, a new key that takes the id, and a
+        // block under it.
+        uint32_t key_id = client->LoadKey(key1.data(), 16);
+        DaemonRequest block;
+        std::memset(&block, 0, sizeof(block));
+        block.op = DAEMON_ENCRYPT_ECB;
+        block.key_id = key_id;
+        block.length = BLOCK_SIZE;
+        DaemonRequest unload = block;
+        unload.op = DAEMON_UNLOAD_KEY;
+        DaemonRequest load = unload;
+        load.op = DAEMON_LOAD_KEY;
+        load.key_bytes = 16;
+        std::memcpy(load.key, key2.data(), 16);
+        const DaemonRequest* sequence[] = { &block, &unload, &block, &load, &block };
+        uint32_t statuses[5] = {};
+        uint32_t loaded_id = 0;
+        bool ordered = true;
+        for (size_t i = 0; i < 5; i++) {
+            DaemonRequest request = *sequence[i];
+            request.out_offset = BLOCK_SIZE * (i + 1);
+            client->Send(request);
+        }
+        for (size_t i = 0; i < 5; i++) {
+            DaemonResponse response = client->Receive();
+            ordered = ordered && response.request_id == 3 + i;
+            statuses[i] = response.status;
+            loaded_id = i == 3 ? response.key_id : loaded_id;
+        }
+        test.Check("daemon responses in order", ordered);
+        test.Check("daemon block before unload",
+                   statuses[0] == DAEMON_OK && !std::memcmp(buffer + 16, expected1, 16));
+        test.Check("daemon unload", statuses[1] == DAEMON_OK);
+        test.Check("daemon block after unload", statuses[2] == DAEMON_UNKNOWN_KEY);
+        test.Check("daemon block after reload",
+                   statuses[3] == DAEMON_OK && loaded_id == key_id &&
+                   statuses[4] == DAEMON_OK && !std::memcmp(buffer + 80, expected2, 16));
+
+        // A CBC request, then a block over its output, in one batch.
+        DaemonRequest cbc = block;
+        cbc.op = DAEMON_ENCRYPT_CBC;
+        cbc.key_id = loaded_id;
+        cbc.out_offset = 256;
+        block.key_id = loaded_id;
+        block.in_offset = 256;
+        block.out_offset = 512;
+        client->Send(cbc);
+        client->Send(block);
+        bool run = client->Receive().status == DAEMON_OK &&
+                   client->Receive().status == DAEMON_OK;
+        unsigned char chained[32], expected[16];
+        const unsigned char zero_iv[16] = {};
+        CbcEncrypt(aes_key2, zero_iv, plain.data(), 16, chained);
+        EncryptBlock(aes_key2, chained, expected);
+        test.Check("daemon block after cbc", run && !std::memcmp(buffer + 512, expected, 16));
+        WipeAesKey(aes_key1);
+        WipeAesKey(aes_key2);
+    }
+
+    // A GCM request past the mode's limit, over a sparse region large
+    // enough to hold it.
+    if (sizeof(size_t) >= 8) {
+        size_t huge = static_cast<size_t>(GCM_MAX_BYTES) + 64;
+        std::unique_ptr<DaemonClient> huge_client;
+        try {
+            huge_client.reset(new DaemonClient(path, huge));
+        } catch (const std::runtime_error&) {
+            // No address space or memory file that large here; skipped.
+        }
+        if (huge_client) {
+            uint32_t key_id = huge_client->LoadKey(Hex(CTR_KEY).data(), 16);
+            DaemonRequest gcm;
+            std::memset(&gcm, 0, sizeof(gcm));
+            gcm.op = DAEMON_ENCRYPT_GCM;
+            gcm.key_id = key_id;
+            gcm.iv_length = 12;
+            gcm.length = GCM_MAX_BYTES + 16;
+            test.Check("daemon gcm past the limit refused",
+                       huge_client->Call(gcm).status == DAEMON_BAD_REQUEST);
+            // Free the slot before the next check fills them all.
+            gcm.op = DAEMON_UNLOAD_KEY;
+            huge_client->Call(gcm);
+        }
+    }
+
+    if (client) {
+        // Loads past the locked key slots are refused, not put on the heap.
+        DaemonRequest fill;
+        std::memset(&fill, 0, sizeof(fill));
+        fill.op = DAEMON_LOAD_KEY;
+        fill.key_bytes = 16;
+        for (int i = 0; i < DAEMON_KEY_SLOTS; i++) {
+            client->Send(fill);
+        }
+        int loaded = 0;
+        int refused = 0;
+        for (int i = 0; i < DAEMON_KEY_SLOTS; i++) {
+            uint32_t status = client->Receive().status;
+            loaded += status == DAEMON_OK;
+            refused += status == DAEMON_BAD_REQUEST;
+        }
+        // The client already holds one key.
+        test.Check("daemon key slots exhausted",
+                   loaded == DAEMON_KEY_SLOTS - 1 && refused == 1);
+    }
+
+    DaemonRequest attach;
+    std::memset(&attach, 0, sizeof(attach));
+    attach.op = DAEMON_ATTACH;
+    attach.length = 1 << 16;
+#if defined(__linux__)
+    // A sealed region shorter than claimed, and a long enough one that
+    // could still be truncated.
+    int region = memfd_create("aes-selftest", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    bool refused = false;
+    if (region >= 0 && ftruncate(region, 4096) == 0 &&
+        fcntl(region, F_ADD_SEALS, F_SEAL_SHRINK) == 0) {
+        int connection = ConnectRaw(path);
+        refused = CallRaw(connection, attach, region) == DAEMON_BAD_REQUEST;
+        close(connection);
+    }
+    test.Check("daemon short region refused", refused);
+    if (region >= 0) {
+        close(region);
+    }
+    region = memfd_create("aes-selftest", MFD_CLOEXEC);
+    refused = false;
+    if (region >= 0 && ftruncate(region, 1 << 16) == 0) {
+        int connection = ConnectRaw(path);
+        refused = CallRaw(connection, attach, region) == DAEMON_BAD_REQUEST;
+        close(connection);
+    }
+    test.Check("daemon unsealed region refused", refused);
+    if (region >= 0) {
+        close(region);
+    }
+#endif
+
+    // Descriptors sent with requests other than an attach.
+    if (OpenDescriptors(daemon) >= 0) {
+        int connection = ConnectRaw(path);
+        DaemonRequest unload = attach;
+        unload.op = DAEMON_UNLOAD_KEY;
+        unload.key_id = 1;
+        int before = OpenDescriptors(daemon);
+        bool answered = true;
+        for (int i = 0; i < 8; i++) {
+            answered = answered && CallRaw(connection, unload, connection) == DAEMON_UNKNOWN_KEY;
+        }
+        test.Check("daemon stray descriptors closed",
+                   answered && OpenDescriptors(daemon) == before);
+        close(connection);
+    }
+
+    client.reset();
+    kill(daemon, SIGTERM);
+    int status = 0;
+    waitpid(daemon, &status, 0);
+    test.Check("daemon clean exit", WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+#endif
+
+struct Group {
+    const char* name;
+    void (*run)(SelfTest& test);
+};
+
+const Group groups[] = {
+    { "fips197", TestFips197 },
+    { "gcm", TestGcm },
+    { "xts", TestXts },
+    { "cmac", TestCmac },
+    { "ctr", TestCtr },
+    { "cbc", TestCbc },
+    { "ctrahead", TestCtrAhead },
+    { "drbg", TestDrbg },
+#if !defined(_WIN32)
+    { "daemon", TestDaemon },
+#endif
+};
+
+} // namespace
+
+
+int RunSelfTest(int argc, char* argv[]) {
+    std::vector<const Group*> selected;
+    // argv[1] is "selftest".
+    for (int i = 2; i < argc; i++) {
+        const Group* found = nullptr;
+        for (const Group& group : groups) {
+            if (std::string(argv[i]) == group.name) {
+                found = &group;
+            }
+        }
+        if (!found) {
+            std::cerr << "Unknown selftest group " << argv[i] << "; groups:";
+            for (const Group& group : groups) {
+                std::cerr << ' ' << group.name;
+            }
+            std::cerr << std::endl;
+            return 2;
+        }
+        selected.push_back(found);
+    }
+    if (selected.empty()) {
+        for (const Group& group : groups) {
+            selected.push_back(&group);
+        }
+    }
+
+    SelfTest test;
+    for (const Group* group : selected) {
+        group->run(test);
+    }
+    std::cout << test.checks() - test.failures() << " of " << test.checks()
+              << " checks passed" << std::endl;
+    return test.failures() ? 1 : 0;
+}
@@ -0,0 +1,13 @@
+// AES_SelfTest.h : Known-answer tests of every engine and mode.
+//
+// Each group checks the library against published vectors, run through
+// every engine this CPU supports: a change that breaks one engine or one
+// code path shows up as a named failing line instead of wrong output
+// somewhere downstream. On POSIX systems the daemon group also starts a
+// daemon in a child process and checks request ordering and bad regions.
+#pragma once
+
+// Runs `AES_UNSW selftest [group ...]` and returns the process exit code:
+// 0 if every check passes, 1 if any fails, 2 on an unknown group. Without
+// a group every group runs. One line is printed per check.
+int RunSelfTest(int argc, char* argv[]);
@@ -0,0 +1,40 @@
+// AES_Span.h : Non-owning view of a contiguous buffer.
+//
+// A minimal stand-in for C++20 std::span so the streaming interfaces take
+// caller buffers without copying while the project still builds as C++17.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+template <typename T>
+class Span {
+public:
+    Span() : data_(nullptr), size_(0) {}
+    Span(T* data, size_t size) : data_(data), size_(size) {}
+
+    template <size_t N>
+    Span(T (&array)[N]) : data_(array), size_(N) {}
+
+    // Anything with data() and size(): std::vector, std::array, a Span of
+    // a convertible element type.
+    template <typename Container,
+              typename = decltype(std::declval<Container&>().data()),
+              typename = decltype(std::declval<Container&>().size())>
+    Span(Container&& container)
+        : data_(container.data()), size_(container.size()) {}
+
+    T* data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    T& operator[](size_t i) const { return data_[i]; }
+
+    Span first(size_t count) const { return Span(data_, count); }
+    Span subspan(size_t offset) const { return Span(data_ + offset, size_ - offset); }
+    Span subspan(size_t offset, size_t count) const { return Span(data_ + offset, count); }
+
+private:
+    T* data_;
+    size_t size_;
+};
@@ -0,0 +1,120 @@
+// AES_Stream.cpp : Incremental Init/Update/Final cipher objects.
+//
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "AES_Stream.h"
+
+namespace {
+
+void CheckBuffers(Span<const uint8_t> in, Span<uint8_t> out) {
+    if (out.size() < in.size()) {
+        throw std::invalid_argument("Stream update: output shorter than input");
+    }
+}
+
+void CheckTag(size_t tag_length) {
+    if (tag_length != BLOCK_SIZE) {
+        throw std::invalid_argument("GCM: tags are 16 bytes");
+    }
+}
+
+} // namespace
+
+
+CtrStream::CtrStream() : key_(nullptr), keystream_used_(BLOCK_SIZE) {}
+
+CtrStream::~CtrStream() {
+    Final();
+}
+
+void CtrStream::Init(const AesKey& key, Span<const uint8_t> iv) {
+    if (iv.size() != BLOCK_SIZE) {
+        throw std::invalid_argument("CTR: the initial counter is 16 bytes");
+    }
+    key_ = &key;
+    std::memcpy(counter_, iv.data(), BLOCK_SIZE);
+    keystream_used_ = BLOCK_SIZE;
+}
+
+// Leftover keystream first, then whole blocks through CtrCrypt (threaded
+// for large updates), then one more keystream block for the tail.
+void CtrStream::Update(Span<const uint8_t> in, Span<uint8_t> out) {
+    if (!key_) {
+        throw std::logic_error("CTR: no stream; Init must come first");
+    }
+    CheckBuffers(in, out);
+    const unsigned char* src = in.data();
+    unsigned char* dst = out.data();
+    size_t length = in.size();
+
+    size_t n = std::min(length, BLOCK_SIZE - keystream_used_);
+    XorBytes(dst, src, keystream_ + keystream_used_, n);
+    keystream_used_ += n;
+    src += n;
+    dst += n;
+    length -= n;
+
+    size_t bulk = length - length % BLOCK_SIZE;
+    if (bulk) {
+        CtrCrypt(*key_, counter_, src, dst, bulk);
+        AddCounter(counter_, bulk / BLOCK_SIZE);
+    }
+    if (length > bulk) {
+        EncryptBlock(*key_, counter_, keystream_);
+        AddCounter(counter_, 1);
+        keystream_used_ = length - bulk;
+        XorBytes(dst + bulk, src + bulk, keystream_, keystream_used_);
+    }
+}
+
+void CtrStream::Final() {
+    volatile unsigned char* wipe = keystream_;
+    for (int i = 0; i < BLOCK_SIZE; i++) {
+        wipe[i] = 0;
+    }
+    std::memset(counter_, 0, BLOCK_SIZE);
+    keystream_used_ = BLOCK_SIZE;
+    // Carrying on would restart the keystream at a zero counter.
+    key_ = nullptr;
+}
+
+
+GcmStream::GcmStream() : encrypting_(true) {
+    state_.gcm_key = nullptr;
+}
+
+GcmStream::~GcmStream() {
+    volatile unsigned char* wipe = state_.keystream;
+    for (int i = 0; i < BLOCK_SIZE; i++) {
+        wipe[i] = 0;
+    }
+}
+
+void GcmStream::Init(const GcmKey& gcm_key, Span<const uint8_t> iv,
+                     Span<const uint8_t> aad, bool encrypting) {
+    GcmStart(state_, gcm_key, iv.data(), iv.size(), aad.data(), aad.size());
+    encrypting_ = encrypting;
+}
+
+void GcmStream::Update(Span<const uint8_t> in, Span<uint8_t> out) {
+    CheckBuffers(in, out);
+    if (encrypting_) {
+        GcmEncryptUpdate(state_, in.data(), out.data(), in.size());
+    } else {
+        GcmDecryptUpdate(state_, in.data(), out.data(), in.size());
+    }
+}
+
+void GcmStream::Final(Span<uint8_t> tag) {
+    CheckTag(tag.size());
+    GcmFinish(state_, tag.data());
+}
+
+bool GcmStream::FinalVerify(Span<const uint8_t> tag) {
+    CheckTag(tag.size());
+    unsigned char expected[BLOCK_SIZE];
+    GcmFinish(state_, expected);
+    return GcmTagsEqual(expected, tag.data());
+}
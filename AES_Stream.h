@@ -0,0 +1,66 @@
+// AES_Stream.h : Incremental Init/Update/Final cipher objects.
+//
+// For data that arrives in pieces of arbitrary size, such as network
+// frames. Partial blocks are carried between calls inside the object, so
+// Update writes exactly as many bytes as it reads, out may be the same
+// buffer as in, and nothing is allocated on the heap. Objects can be
+// re-initialised and reused.
+#pragma once
+
+#include <cstdint>
+
+#include "AES_Modes.h"
+#include "AES_Span.h"
+
+// CTR mode over a stream: Update calls chained together produce the same
+// bytes as one CtrCrypt over their concatenation.
+class CtrStream {
+public:
+    CtrStream();
+    ~CtrStream();
+
+    // iv is the 16-byte initial counter block. key must outlive the
+    // stream.
+    void Init(const AesKey& key, Span<const uint8_t> iv);
+
+    // out must be at least as long as in; it may equal in but not overlap
+    // it otherwise. Throws std::logic_error before Init or after Final.
+    void Update(Span<const uint8_t> in, Span<uint8_t> out);
+
+    // Wipes the counter and unused keystream and ends the stream; a new
+    // one needs Init.
+    void Final();
+
+private:
+    const AesKey* key_;
+    unsigned char counter_[16];
+    unsigned char keystream_[16];
+    size_t keystream_used_;
+};
+
+// GCM over a stream. The associated data is given to Init, the message to
+// any number of Update calls.
+class GcmStream {
+public:
+    GcmStream();
+    ~GcmStream();
+
+    // gcm_key must outlive the stream.
+    void Init(const GcmKey& gcm_key, Span<const uint8_t> iv,
+              Span<const uint8_t> aad, bool encrypting);
+
+    // Same buffer rules as CtrStream::Update. When decrypting, the output
+    // is unauthenticated until FinalVerify returns true.
+    void Update(Span<const uint8_t> in, Span<uint8_t> out);
+
+    // Encryption: writes the 16-byte tag.
+    void Final(Span<uint8_t> tag);
+
+    // Decryption: true if tag matches the message, compared in constant
+    // time.
+    bool FinalVerify(Span<const uint8_t> tag);
+
+private:
+    GcmState state_;
+    bool encrypting_;
+};
@@ -0,0 +1,272 @@
+// AES_TableEngine.cpp : T-table implementation of the AES rounds.
+//
+#include <utility>
+
+#include "AES_UNSW.h"
+#include "AES_Engine.h"
+
+namespace {
+
+// Te[n][x] is the MixColumns column produced by S(x) sitting in row n,
+// Td[n][x] the InvMixColumns column produced by InvS(x) sitting in row n.
+// Each table is 256 words = 1 KB; all are generated at compile time.
+const uint32_t (&Te)[4][256] = te_table.v;
+const uint32_t (&Td)[4][256] = td_table.v;
+
+// The S-boxes indexed by the whole byte.
+const unsigned char* const S = &s_box.v[0][0];
+const unsigned char* const IS = &inv_s_box.v[0][0];
+
+inline uint32_t LoadColumn(const unsigned char* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+inline void StoreColumn(unsigned char* p, uint32_t w) {
+    p[0] = (unsigned char)(w >> 24);
+    p[1] = (unsigned char)(w >> 16);
+    p[2] = (unsigned char)(w >> 8);
+    p[3] = (unsigned char)w;
+}
+
+// InvMixColumns of a single column word: Td[n][S[b]] undoes the S-box
+// before applying the inverse mix, which leaves only the mix.
+inline uint32_t InverseMixColumn(uint32_t w) {
+    return Td[0][S[w >> 24]] ^ Td[1][S[(w >> 16) & 0xFF]] ^
+           Td[2][S[(w >> 8) & 0xFF]] ^ Td[3][S[w & 0xFF]];
+}
+
+
+// Equivalent inverse cipher schedule: round r of decryption uses the
+// encryption round key Nr - r, with InvMixColumns applied to the inner ones.
+void TableInvertKey(const unsigned char enc_keys[], int number_rounds,
+                    unsigned char dec_keys[]) {
+    for (int round = 0; round <= number_rounds; round++) {
+        const unsigned char* src = enc_keys + 16 * (number_rounds - round);
+        bool inner = round > 0 && round < number_rounds;
+        for (int c = 0; c < 4; c++) {
+            uint32_t w = LoadColumn(src + 4 * c);
+            StoreColumn(dec_keys + 16 * round + 4 * c,
+                        inner ? InverseMixColumn(w) : w);
+        }
+    }
+}
+
+
+// One full round. Row n of column c comes from column (c + n) mod 4 after
+// ShiftRows.
+inline void EncryptRound(uint32_t s[4], const unsigned char* rk) {
+    uint32_t t0 = Te[0][s[0] >> 24] ^ Te[1][(s[1] >> 16) & 0xFF] ^
+                  Te[2][(s[2] >> 8) & 0xFF] ^ Te[3][s[3] & 0xFF] ^ LoadColumn(rk + 0);
+    uint32_t t1 = Te[0][s[1] >> 24] ^ Te[1][(s[2] >> 16) & 0xFF] ^
+                  Te[2][(s[3] >> 8) & 0xFF] ^ Te[3][s[0] & 0xFF] ^ LoadColumn(rk + 4);
+    uint32_t t2 = Te[0][s[2] >> 24] ^ Te[1][(s[3] >> 16) & 0xFF] ^
+                  Te[2][(s[0] >> 8) & 0xFF] ^ Te[3][s[1] & 0xFF] ^ LoadColumn(rk + 8);
+    uint32_t t3 = Te[0][s[3] >> 24] ^ Te[1][(s[0] >> 16) & 0xFF] ^
+                  Te[2][(s[1] >> 8) & 0xFF] ^ Te[3][s[2] & 0xFF] ^ LoadColumn(rk + 12);
+    s[0] = t0; s[1] = t1; s[2] = t2; s[3] = t3;
+}
+
+// InvShiftRows: row n of column c comes from column (c - n) mod 4.
+inline void DecryptRound(uint32_t s[4], const unsigned char* rk) {
+    uint32_t t0 = Td[0][s[0] >> 24] ^ Td[1][(s[3] >> 16) & 0xFF] ^
+                  Td[2][(s[2] >> 8) & 0xFF] ^ Td[3][s[1] & 0xFF] ^ LoadColumn(rk + 0);
+    uint32_t t1 = Td[0][s[1] >> 24] ^ Td[1][(s[0] >> 16) & 0xFF] ^
+                  Td[2][(s[3] >> 8) & 0xFF] ^ Td[3][s[2] & 0xFF] ^ LoadColumn(rk + 4);
+    uint32_t t2 = Td[0][s[2] >> 24] ^ Td[1][(s[1] >> 16) & 0xFF] ^
+                  Td[2][(s[0] >> 8) & 0xFF] ^ Td[3][s[3] & 0xFF] ^ LoadColumn(rk + 8);
+    uint32_t t3 = Td[0][s[3] >> 24] ^ Td[1][(s[2] >> 16) & 0xFF] ^
+                  Td[2][(s[1] >> 8) & 0xFF] ^ Td[3][s[0] & 0xFF] ^ LoadColumn(rk + 12);
+    s[0] = t0; s[1] = t1; s[2] = t2; s[3] = t3;
+}
+
+// Rounds 1..Nr-1 expanded in line by the fold, with no loop counter.
+template <size_t... Round>
+inline void EncryptRounds(uint32_t s[4], const unsigned char* enc_keys,
+                          std::index_sequence<Round...>) {
+    (EncryptRound(s, enc_keys + 16 * (Round + 1)), ...);
+}
+
+template <size_t... Round>
+inline void DecryptRounds(uint32_t s[4], const unsigned char* dec_keys,
+                          std::index_sequence<Round...>) {
+    (DecryptRound(s, dec_keys + 16 * (Round + 1)), ...);
+}
+
+template <int Nr>
+void TableEncryptBlockN(const unsigned char enc_keys[],
+                        const unsigned char in[16], unsigned char out[16]) {
+    uint32_t s[4];
+    for (int c = 0; c < 4; c++) {
+        s[c] = LoadColumn(in + 4 * c) ^ LoadColumn(enc_keys + 4 * c);
+    }
+    EncryptRounds(s, enc_keys, std::make_index_sequence<Nr - 1>());
+
+    // Last round has no MixColumns: SubBytes + ShiftRows only.
+    const unsigned char* rk = enc_keys + 16 * Nr;
+    for (int c = 0; c < 4; c++) {
+        uint32_t t = ((uint32_t)S[s[c] >> 24] << 24) ^
+                     ((uint32_t)S[(s[(c + 1) & 3] >> 16) & 0xFF] << 16) ^
+                     ((uint32_t)S[(s[(c + 2) & 3] >> 8) & 0xFF] << 8) ^
+                     (uint32_t)S[s[(c + 3) & 3] & 0xFF];
+        StoreColumn(out + 4 * c, t ^ LoadColumn(rk + 4 * c));
+    }
+}
+
+template <int Nr>
+void TableDecryptBlockN(const unsigned char dec_keys[],
+                        const unsigned char in[16], unsigned char out[16]) {
+    uint32_t s[4];
+    for (int c = 0; c < 4; c++) {
+        s[c] = LoadColumn(in + 4 * c) ^ LoadColumn(dec_keys + 4 * c);
+    }
+    DecryptRounds(s, dec_keys, std::make_index_sequence<Nr - 1>());
+
+    const unsigned char* rk = dec_keys + 16 * Nr;
+    for (int c = 0; c < 4; c++) {
+        uint32_t t = ((uint32_t)IS[s[c] >> 24] << 24) ^
+                     ((uint32_t)IS[(s[(c + 3) & 3] >> 16) & 0xFF] << 16) ^
+                     ((uint32_t)IS[(s[(c + 2) & 3] >> 8) & 0xFF] << 8) ^
+                     (uint32_t)IS[s[(c + 1) & 3] & 0xFF];
+        StoreColumn(out + 4 * c, t ^ LoadColumn(rk + 4 * c));
+    }
+}
+
+
+void TableEncryptBlock(const unsigned char enc_keys[], int number_rounds,
+                       const unsigned char in[16], unsigned char out[16]) {
+    WithRounds(number_rounds, [&](auto rounds) {
+        TableEncryptBlockN<decltype(rounds)::value>(enc_keys, in, out);
+    });
+}
+
+void TableDecryptBlock(const unsigned char dec_keys[], int number_rounds,
+                       const unsigned char in[16], unsigned char out[16]) {
+    WithRounds(number_rounds, [&](auto rounds) {
+        TableDecryptBlockN<decltype(rounds)::value>(dec_keys, in, out);
+    });
+}
+
+void TableEncryptBlocks(const unsigned char enc_keys[], int number_rounds,
+                        const unsigned char* in, unsigned char* out,
+                        size_t blocks) {
+    WithRounds(number_rounds, [&](auto rounds) {
+        for (size_t i = 0; i < blocks; i++) {
+            TableEncryptBlockN<decltype(rounds)::value>(enc_keys, in + 16 * i,
+                                                        out + 16 * i);
+        }
+    });
+}
+
+void TableDecryptBlocks(const unsigned char dec_keys[], int number_rounds,
+                        const unsigned char* in, unsigned char* out,
+                        size_t blocks) {
+    WithRounds(number_rounds, [&](auto rounds) {
+        for (size_t i = 0; i < blocks; i++) {
+            TableDecryptBlockN<decltype(rounds)::value>(dec_keys, in + 16 * i,
+                                                        out + 16 * i);
+        }
+    });
+}
+
+// Four blocks under four schedules advance one round at a time. The
+// lookups of one block depend on its previous round, so the other three
+// fill the load latency.
+#define TABLE_MULTI_KEY_BLOCKS 4
+
+template <int Nr>
+void TableEncryptMultiKeyN(const unsigned char* const keys[],
+                           const unsigned char* const in[],
+                           unsigned char* const out[], size_t count) {
+    size_t i = 0;
+    for (; i + TABLE_MULTI_KEY_BLOCKS <= count; i += TABLE_MULTI_KEY_BLOCKS) {
+        uint32_t s[TABLE_MULTI_KEY_BLOCKS][4];
+        for (int b = 0; b < TABLE_MULTI_KEY_BLOCKS; b++) {
+            for (int c = 0; c < 4; c++) {
+                s[b][c] = LoadColumn(in[i + b] + 4 * c) ^ LoadColumn(keys[i + b] + 4 * c);
+            }
+        }
+        for (int round = 1; round < Nr; round++) {
+            for (int b = 0; b < TABLE_MULTI_KEY_BLOCKS; b++) {
+                EncryptRound(s[b], keys[i + b] + 16 * round);
+            }
+        }
+        for (int b = 0; b < TABLE_MULTI_KEY_BLOCKS; b++) {
+            const unsigned char* rk = keys[i + b] + 16 * Nr;
+            for (int c = 0; c < 4; c++) {
+                uint32_t t = ((uint32_t)S[s[b][c] >> 24] << 24) ^
+                             ((uint32_t)S[(s[b][(c + 1) & 3] >> 16) & 0xFF] << 16) ^
+                             ((uint32_t)S[(s[b][(c + 2) & 3] >> 8) & 0xFF] << 8) ^
+                             (uint32_t)S[s[b][(c + 3) & 3] & 0xFF];
+                StoreColumn(out[i + b] + 4 * c, t ^ LoadColumn(rk + 4 * c));
+            }
+        }
+    }
+    for (; i < count; i++) {
+        TableEncryptBlockN<Nr>(keys[i], in[i], out[i]);
+    }
+}
+
+template <int Nr>
+void TableDecryptMultiKeyN(const unsigned char* const keys[],
+                           const unsigned char* const in[],
+                           unsigned char* const out[], size_t count) {
+    size_t i = 0;
+    for (; i + TABLE_MULTI_KEY_BLOCKS <= count; i += TABLE_MULTI_KEY_BLOCKS) {
+        uint32_t s[TABLE_MULTI_KEY_BLOCKS][4];
+        for (int b = 0; b < TABLE_MULTI_KEY_BLOCKS; b++) {
+            for (int c = 0; c < 4; c++) {
+                s[b][c] = LoadColumn(in[i + b] + 4 * c) ^ LoadColumn(keys[i + b] + 4 * c);
+            }
+        }
+        for (int round = 1; round < Nr; round++) {
+            for (int b = 0; b < TABLE_MULTI_KEY_BLOCKS; b++) {
+                DecryptRound(s[b], keys[i + b] + 16 * round);
+            }
+        }
+        for (int b = 0; b < TABLE_MULTI_KEY_BLOCKS; b++) {
+            const unsigned char* rk = keys[i + b] + 16 * Nr;
+            for (int c = 0; c < 4; c++) {
+                uint32_t t = ((uint32_t)IS[s[b][c] >> 24] << 24) ^
+                             ((uint32_t)IS[(s[b][(c + 3) & 3] >> 16) & 0xFF] << 16) ^
+                             ((uint32_t)IS[(s[b][(c + 2) & 3] >> 8) & 0xFF] << 8) ^
+                             (uint32_t)IS[s[b][(c + 1) & 3] & 0xFF];
+                StoreColumn(out[i + b] + 4 * c, t ^ LoadColumn(rk + 4 * c));
+            }
+        }
+    }
+    for (; i < count; i++) {
+        TableDecryptBlockN<Nr>(keys[i], in[i], out[i]);
+    }
+}
+
+void TableEncryptMultiKey(const unsigned char* const keys[], int number_rounds,
+                          const unsigned char* const in[],
+                          unsigned char* const out[], size_t count) {
+    WithRounds(number_rounds, [&](auto rounds) {
+        TableEncryptMultiKeyN<decltype(rounds)::value>(keys, in, out, count);
+    });
+}
+
+void TableDecryptMultiKey(const unsigned char* const keys[], int number_rounds,
+                          const unsigned char* const in[],
+                          unsigned char* const out[], size_t count) {
+    WithRounds(number_rounds, [&](auto rounds) {
+        TableDecryptMultiKeyN<decltype(rounds)::value>(keys, in, out, count);
+    });
+}
+
+} // namespace
+
+
+const AesEngine table_engine = {
+    "table",
+    PortableExpandKey,
+    TableInvertKey,
+    TableEncryptBlock,
+    TableDecryptBlock,
+    TableEncryptBlocks,
+    TableDecryptBlocks,
+    TableEncryptMultiKey,
+    TableDecryptMultiKey,
+};
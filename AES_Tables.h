@@ -0,0 +1,164 @@
+// AES_Tables.h : AES constants generated at compile time.
+//
+// The S-boxes, round constants and T-tables are computed by constexpr
+// functions from their definitions in FIPS-197 instead of being typed in,
+// so every translation unit sees them as constants the compiler can fold.
+#pragma once
+
+#include <cstdint>
+
+// Parameters of one AES key size: Nk 32-bit words of key, Nr rounds.
+template <int Nk>
+struct AesParams {
+    static_assert(Nk == 4 || Nk == 6 || Nk == 8,
+                  "AES keys are 128, 192 or 256 bits");
+    static constexpr int key_words = Nk;
+    static constexpr int key_bytes = 4 * Nk;
+    static constexpr int rounds = Nk + 6;
+    static constexpr int schedule_words = 4 * (rounds + 1);
+};
+
+typedef AesParams<4> Aes128;
+typedef AesParams<6> Aes192;
+typedef AesParams<8> Aes256;
+
+// (x * {02}) mod {11b}.
+constexpr unsigned char GfDouble(unsigned char x) {
+    return static_cast<unsigned char>((x << 1) ^ ((x >> 7) * 0x1b));
+}
+
+constexpr unsigned char GfMultiply(unsigned char a, unsigned char b) {
+    unsigned char product = 0;
+    while (b) {
+        if (b & 1) {
+            product ^= a;
+        }
+        a = GfDouble(a);
+        b >>= 1;
+    }
+    return product;
+}
+
+// Powers of the generator {03} and their logarithms, so that inverses
+// cost two lookups while the tables are being generated.
+struct GfLogTables {
+    unsigned char exp[256];
+    unsigned char log[256];
+};
+
+constexpr GfLogTables MakeLogTables() {
+    GfLogTables tables = {};
+    unsigned char x = 1;
+    for (int i = 0; i < 255; i++) {
+        tables.exp[i] = x;
+        tables.log[x] = static_cast<unsigned char>(i);
+        x = static_cast<unsigned char>(x ^ GfDouble(x));
+    }
+    return tables;
+}
+
+// x^-1 in GF(2^8), with 0 mapped to 0.
+constexpr unsigned char GfInverse(const GfLogTables& tables, unsigned char x) {
+    return x ? tables.exp[(255 - tables.log[x]) % 255] : 0;
+}
+
+constexpr unsigned char RotateLeft8(unsigned char x, int n) {
+    return static_cast<unsigned char>((x << n) | (x >> (8 - n)));
+}
+
+// S(x) = A * x^-1 + {63}.
+constexpr unsigned char SubstituteValue(const GfLogTables& tables,
+                                        unsigned char x) {
+    unsigned char b = GfInverse(tables, x);
+    return static_cast<unsigned char>(b ^ RotateLeft8(b, 1) ^ RotateLeft8(b, 2) ^
+                                      RotateLeft8(b, 3) ^ RotateLeft8(b, 4) ^ 0x63);
+}
+
+// Indexed [high nibble][low nibble], like the FIPS-197 figures.
+struct SboxTable {
+    unsigned char v[16][16];
+    constexpr const unsigned char* operator[](int row) const { return v[row]; }
+};
+
+constexpr SboxTable MakeSbox() {
+    SboxTable table = {};
+    GfLogTables logs = MakeLogTables();
+    for (int x = 0; x < 256; x++) {
+        table.v[x >> 4][x & 0x0F] = SubstituteValue(logs, static_cast<unsigned char>(x));
+    }
+    return table;
+}
+
+constexpr SboxTable MakeInverseSbox() {
+    SboxTable table = {};
+    GfLogTables logs = MakeLogTables();
+    for (int x = 0; x < 256; x++) {
+        unsigned char s = SubstituteValue(logs, static_cast<unsigned char>(x));
+        table.v[s >> 4][s & 0x0F] = static_cast<unsigned char>(x);
+    }
+    return table;
+}
+
+// rcon[i] = x^i: the constant XORed into the first word of key schedule
+// step i + 1. AES-128 uses all ten, AES-192 eight, AES-256 seven.
+struct RconTable {
+    unsigned char v[10];
+    constexpr unsigned char operator[](int i) const { return v[i]; }
+};
+
+constexpr RconTable MakeRcon() {
+    RconTable table = {};
+    unsigned char value = 0x01;
+    for (int i = 0; i < 10; i++) {
+        table.v[i] = value;
+        value = GfDouble(value);
+    }
+    return table;
+}
+
+inline constexpr SboxTable s_box = MakeSbox();
+inline constexpr SboxTable inv_s_box = MakeInverseSbox();
+inline constexpr RconTable rcon = MakeRcon();
+
+// Spot checks against FIPS-197 figure 7, figure 14 and section 5.2.
+static_assert(s_box[0][0] == 0x63 && s_box[5][3] == 0xed && s_box[15][15] == 0x16,
+              "S-box generation is wrong");
+static_assert(inv_s_box[0][0] == 0x52 && inv_s_box[15][15] == 0x7d,
+              "inverse S-box generation is wrong");
+static_assert(rcon[8] == 0x1b && rcon[9] == 0x36, "rcon generation is wrong");
+
+// T-tables: t[n][x] is the column produced by S(x) (InvS(x) for the
+// decryption table) sitting in row n after MixColumns (InvMixColumns),
+// packed big-endian. Rows 1..3 are byte rotations of row 0.
+struct RoundTable {
+    uint32_t v[4][256];
+};
+
+constexpr uint32_t PackColumn(unsigned char b0, unsigned char b1,
+                              unsigned char b2, unsigned char b3) {
+    return (static_cast<uint32_t>(b0) << 24) | (static_cast<uint32_t>(b1) << 16) |
+           (static_cast<uint32_t>(b2) << 8) | b3;
+}
+
+constexpr RoundTable MakeRoundTable(bool inverse) {
+    RoundTable table = {};
+    for (int x = 0; x < 256; x++) {
+        uint32_t column = 0;
+        if (!inverse) {
+            unsigned char s = s_box[x >> 4][x & 0x0F];
+            column = PackColumn(GfMultiply(s, 2), s, s, GfMultiply(s, 3));
+        } else {
+            unsigned char s = inv_s_box[x >> 4][x & 0x0F];
+            column = PackColumn(GfMultiply(s, 14), GfMultiply(s, 9),
+                                GfMultiply(s, 13), GfMultiply(s, 11));
+        }
+        table.v[0][x] = column;
+        for (int n = 1; n < 4; n++) {
+            table.v[n][x] = (column >> (8 * n)) | (column << (32 - 8 * n));
+        }
+    }
+    return table;
+}
+
+inline constexpr RoundTable te_table = MakeRoundTable(false);
+inline constexpr RoundTable td_table = MakeRoundTable(true);
@@ -0,0 +1,107 @@
+// AES_ThreadPool.cpp : Fixed pool of worker threads for the parallel modes.
+//
+#include "AES_ThreadPool.h"
+
+ThreadPool::ThreadPool(unsigned thread_count)
+    : body_(nullptr), generation_(0), pending_(0), active_(1),
+      stopping_(false) {
+    if (thread_count == 0) {
+        thread_count = std::thread::hardware_concurrency();
+    }
+    if (thread_count == 0) {
+        thread_count = 1;
+    }
+    // The calling thread always runs one range itself.
+    for (unsigned i = 1; i < thread_count; i++) {
+        workers_.emplace_back(&ThreadPool::WorkerLoop, this, i);
+    }
+    active_ = thread_count;
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    work_ready_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+void ThreadPool::SetSize(unsigned thread_count) {
+    if (thread_count == 0 || thread_count > Capacity()) {
+        thread_count = Capacity();
+    }
+    active_ = thread_count;
+}
+
+void ThreadPool::ParallelFor(size_t count, size_t parts,
+                             const std::function<void(size_t, size_t)>& body) {
+    if (parts > Size()) {
+        parts = Size();
+    }
+    if (parts > count) {
+        parts = count;
+    }
+    if (parts <= 1) {
+        if (count) {
+            body(0, count);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> submit(submit_mutex_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // Range i is [bounds_[i], bounds_[i + 1]); workers take 1..parts-1
+        // and every worker past them finds an empty range.
+        bounds_.assign(Capacity() + 1, count);
+        for (size_t i = 0; i < parts; i++) {
+            bounds_[i] = count * i / parts;
+        }
+        body_ = &body;
+        pending_ = static_cast<unsigned>(parts - 1);
+        generation_++;
+    }
+    work_ready_.notify_all();
+
+    body(bounds_[0], bounds_[1]);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    work_done_.wait(lock, [this] { return pending_ == 0; });
+    body_ = nullptr;
+}
+
+void ThreadPool::WorkerLoop(unsigned index) {
+    size_t seen = 0;
+    for (;;) {
+        size_t begin, end;
+        const std::function<void(size_t, size_t)>* body;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            work_ready_.wait(lock, [&] { return stopping_ || generation_ != seen; });
+            if (stopping_) {
+                return;
+            }
+            seen = generation_;
+            begin = bounds_[index];
+            end = bounds_[index + 1];
+            body = body_;
+        }
+        if (begin >= end) {
+            continue;
+        }
+        (*body)(begin, end);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pending_--;
+        }
+        work_done_.notify_one();
+    }
+}
+
+ThreadPool& DefaultThreadPool() {
+    static ThreadPool pool;
+    return pool;
+}
@@ -0,0 +1,56 @@
+// AES_ThreadPool.h : Fixed pool of worker threads for the parallel modes.
+//
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+    // thread_count == 0 uses std::thread::hardware_concurrency().
+    explicit ThreadPool(unsigned thread_count = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Total threads that take part in ParallelFor, the caller included.
+    unsigned Size() const { return active_; }
+
+    // Threads the pool was created with, the caller included.
+    unsigned Capacity() const { return static_cast<unsigned>(workers_.size()) + 1; }
+
+    // Limits ParallelFor to thread_count threads, clamped to 1..Capacity();
+    // 0 restores Capacity(). Used to measure scaling without rebuilding the
+    // pool. Must not be called while a ParallelFor is running.
+    void SetSize(unsigned thread_count);
+
+    // Splits [0, count) into at most `parts` contiguous ranges and runs
+    // body(begin, end) on each, one range on the calling thread. Returns
+    // once every range is done. Calls from different threads are
+    // serialised; a body must not call ParallelFor on the same pool.
+    void ParallelFor(size_t count, size_t parts,
+                     const std::function<void(size_t, size_t)>& body);
+
+private:
+    void WorkerLoop(unsigned index);
+
+    std::vector<std::thread> workers_;
+    std::mutex submit_mutex_;
+    std::mutex mutex_;
+    std::condition_variable work_ready_;
+    std::condition_variable work_done_;
+    const std::function<void(size_t, size_t)>* body_;
+    std::vector<size_t> bounds_;
+    size_t generation_;
+    unsigned pending_;
+    unsigned active_;
+    bool stopping_;
+};
+
+// Process-wide pool shared by the parallel modes, created on first use.
+ThreadPool& DefaultThreadPool();
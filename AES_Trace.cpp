@@ -0,0 +1,67 @@
+// AES_Trace.cpp : Compile-time switchable tracing of the cipher internals.
+//
+#include "AES_Trace.h"
+
+#if AES_TRACE_LEVEL >= AES_TRACE_STEPS
+
+#include <iostream>
+#include <string>
+
+namespace {
+
+#if AES_TRACE_LEVEL >= AES_TRACE_ROUNDS
+RoundHook round_hook = nullptr;
+void* round_hook_context = nullptr;
+#endif
+
+} // namespace
+
+
+// Formats each row into one line before writing it, instead of building a
+// string per byte.
+void TraceMatrix(const unsigned char matrix[][4], int column_size,
+                 int row_size, const char* message) {
+    static const char hex_chars[] = "0123456789ABCDEF";
+    std::string rule(std::char_traits<char>::length(message), '-');
+    std::cout << rule << '\n' << message << '\n' << rule << '\n';
+
+    std::string line;
+    for (int i = 0; i < row_size; i++) {
+        line.clear();
+        for (int j = 0; j < column_size; j++) {
+            line += hex_chars[matrix[i][j] >> 4];
+            line += hex_chars[matrix[i][j] & 0x0F];
+            line += ' ';
+        }
+        std::cout << line << '\n';
+    }
+    std::cout << std::endl;
+}
+
+void TraceBlock(const unsigned char block[16], const char* message) {
+    unsigned char state_matrix[4][4];
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            state_matrix[i][j] = block[i + (4 * j)];
+        }
+    }
+    TraceMatrix(state_matrix, 4, 4, message);
+}
+
+#if AES_TRACE_LEVEL >= AES_TRACE_ROUNDS
+
+void SetRoundHook(RoundHook hook, void* context) {
+    round_hook = hook;
+    round_hook_context = context;
+}
+
+void TraceRound(bool decrypting, int round, RoundStep step,
+                const unsigned char state_matrix[][4]) {
+    if (round_hook) {
+        round_hook(round_hook_context, decrypting, round, step, state_matrix);
+    }
+}
+
+#endif // AES_TRACE_ROUNDS
+
+#endif // AES_TRACE_STEPS
@@ -0,0 +1,77 @@
+// AES_Trace.h : Compile-time switchable tracing of the cipher internals.
+//
+// AES_TRACE_LEVEL selects what is compiled in. Debug builds (_DEBUG)
+// default to AES_TRACE_ROUNDS and release builds to AES_TRACE_NONE, where
+// every trace macro expands to ((void)0) and no trace code or data is left
+// in the binary. Define AES_TRACE_LEVEL on the command line to override.
+#pragma once
+
+// Nothing is traced.
+#define AES_TRACE_NONE 0
+// Key schedules and block inputs/outputs are printed as state matrices.
+#define AES_TRACE_STEPS 1
+// Additionally, the reference rounds report every step to a round hook.
+#define AES_TRACE_ROUNDS 2
+
+#ifndef AES_TRACE_LEVEL
+#if defined(_DEBUG)
+#define AES_TRACE_LEVEL AES_TRACE_ROUNDS
+#else
+#define AES_TRACE_LEVEL AES_TRACE_NONE
+#endif
+#endif
+
+// The round step that has just been applied to the state. Decryption
+// reports the inverse steps under the same names.
+enum RoundStep {
+    ROUND_SUB_BYTES,
+    ROUND_SHIFT_ROWS,
+    ROUND_MIX_COLUMNS,
+    ROUND_ADD_ROUND_KEY,
+};
+
+// Receives the state matrix after each step of round `round` (0 is the
+// initial AddRoundKey). Called on the thread doing the work; it must not
+// modify or keep the state.
+typedef void (*RoundHook)(void* context, bool decrypting, int round,
+                          RoundStep step, const unsigned char state_matrix[][4]);
+
+#if AES_TRACE_LEVEL >= AES_TRACE_STEPS
+
+// Prints row_size rows of column_size bytes in hex under a title.
+void TraceMatrix(const unsigned char matrix[][4], int column_size,
+                 int row_size, const char* message);
+
+// Prints a 16-byte block as its column-major state matrix.
+void TraceBlock(const unsigned char block[16], const char* message);
+
+#define AES_TRACE_MATRIX(matrix, column_size, row_size, message) \
+    TraceMatrix(matrix, column_size, row_size, message)
+#define AES_TRACE_BLOCK(block, message) TraceBlock(block, message)
+
+#else
+
+#define AES_TRACE_MATRIX(matrix, column_size, row_size, message) ((void)0)
+#define AES_TRACE_BLOCK(block, message) ((void)0)
+
+#endif
+
+#if AES_TRACE_LEVEL >= AES_TRACE_ROUNDS
+
+// Installs hook for every later block processed by the portable engine;
+// a null hook removes it. The other engines fuse or bitslice the steps and
+// do not report them, so build the key with portable_engine to inspect
+// rounds. Set it before starting worker threads.
+void SetRoundHook(RoundHook hook, void* context);
+
+void TraceRound(bool decrypting, int round, RoundStep step,
+                const unsigned char state_matrix[][4]);
+
+#define AES_TRACE_ROUND(decrypting, round, step, state_matrix) \
+    TraceRound(decrypting, round, step, state_matrix)
+
+#else
+
+#define AES_TRACE_ROUND(decrypting, round, step, state_matrix) ((void)0)
+
+#endif
@@ -0,0 +1,416 @@
+// AES_Tune.cpp : Per-host choice of engine, thread count and parallel threshold.
+//
+#include "AES_Tune.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+#if defined(_WIN32)
+// std::min and std::numeric_limits::max are used below.
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+#include "AES_Async.h"
+#include "AES_Modes.h"
+#include "AES_ThreadPool.h"
+
+// Engines are timed on one batch small enough to stay in cache, as the
+// modes feed them keystream and blocks.
+#define TUNE_ENGINE_BYTES (16 * 1024)
+// Thread scaling is timed on CTR over a buffer larger than most last-level
+// caches, so the memory bandwidth limit shows.
+#define TUNE_SCALING_BYTES (32 << 20)
+// Threshold candidates go 128 KB, 256 KB, ... 8 MB; if splitting never
+// pays, the threshold is twice the largest. The smallest stays above the
+// chunks AsyncQueue workers pass to the modes, so a worker never waits on
+// the shared pool's submit mutex for a piece of work it was meant to run
+// alone; a saved plan below it is retuned.
+#define TUNE_MIN_PARALLEL_BYTES (2 * ASYNC_CHUNK_BYTES)
+#define TUNE_MAX_PARALLEL_BYTES (8 << 20)
+// Time spent on each candidate.
+#define TUNE_SECONDS 0.02
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+std::atomic<size_t> parallel_min_bytes(PARALLEL_MIN_BYTES);
+
+std::mutex plan_mutex;
+TunePlan applied_plan;
+bool plan_applied = false;
+
+// GB/s of body over bytes, after one untimed call that pays for page
+// faults and waking the pool.
+template <typename Body>
+double MeasureRate(size_t bytes, Body&& body) {
+    body();
+    uint64_t calls = 0;
+    double seconds = 0;
+    Clock::time_point start = Clock::now();
+    do {
+        body();
+        calls++;
+        seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (seconds < TUNE_SECONDS);
+    return static_cast<double>(bytes) * calls / seconds / 1e9;
+}
+
+// The default engine first, so it wins ties.
+std::vector<const AesEngine*> Candidates() {
+    std::vector<const AesEngine*> engines = { &DefaultEngine() };
+#if defined(AES_X86)
+    if (GetCpuFeatures().aesni) {
+        engines.push_back(&aesni_engine);
+        engines.push_back(&aesni_x4_engine);
+    }
+#endif
+    engines.push_back(&bitslice_engine);
+    engines.erase(std::unique(engines.begin(), engines.end()), engines.end());
+    return engines;
+}
+
+const AesEngine* FindCandidate(const std::string& name) {
+    for (const AesEngine* engine : Candidates()) {
+        if (name == engine->name) {
+            return engine;
+        }
+    }
+    return nullptr;
+}
+
+void Record(TunePlan& plan, const char* setting, const std::string& candidate,
+            double gb_per_s) {
+    TuneMeasurement measurement = { setting, candidate, gb_per_s };
+    plan.measurements.push_back(measurement);
+}
+
+std::string ThresholdCandidate(size_t bytes, unsigned threads) {
+    return std::to_string(bytes) + "/" + std::to_string(threads);
+}
+
+bool ReplaceFile(const std::string& from, const std::string& to) {
+#if defined(_WIN32)
+    return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+} // namespace
+
+
+size_t ParallelMinBytes() {
+    return parallel_min_bytes.load(std::memory_order_relaxed);
+}
+
+void SetParallelMinBytes(size_t bytes) {
+    parallel_min_bytes.store(bytes, std::memory_order_relaxed);
+}
+
+std::string TuneHostFingerprint() {
+    const CpuFeatures& cpu = GetCpuFeatures();
+    std::string host;
+    const struct { bool present; const char* name; } features[] = {
+        { cpu.aesni, "aesni" }, { cpu.pclmul, "pclmul" },
+        { cpu.ssse3, "ssse3" }, { cpu.avx2, "avx2" },
+    };
+    for (const auto& feature : features) {
+        if (feature.present) {
+            host += host.empty() ? "" : "+";
+            host += feature.name;
+        }
+    }
+    if (host.empty()) {
+        host = "generic";
+    }
+    return host + "/" + std::to_string(DefaultThreadPool().Capacity());
+}
+
+TunePlan DefaultTunePlan() {
+    TunePlan plan;
+    plan.host = TuneHostFingerprint();
+    plan.engine = DefaultEngine().name;
+    plan.threads = DefaultThreadPool().Capacity();
+    plan.parallel_min_bytes = PARALLEL_MIN_BYTES;
+    plan.source = "default";
+    return plan;
+}
+
+TunePlan Autotune() {
+    TunePlan plan = DefaultTunePlan();
+    plan.source = "measured";
+    ThreadPool& pool = DefaultThreadPool();
+    const AesEngine& saved_engine = ActiveEngine();
+    unsigned saved_threads = pool.Size();
+    size_t saved_min_bytes = ParallelMinBytes();
+
+    unsigned char key_bytes[16];
+    for (int i = 0; i < 16; i++) {
+        key_bytes[i] = static_cast<unsigned char>(i * 29 + 7);
+    }
+    const unsigned char iv[16] = {};
+    std::vector<unsigned char> buffer(TUNE_SCALING_BYTES, 0x5A);
+    unsigned char* data = buffer.data();
+    AesKey key;
+
+    // Engine, and with it the AES-NI interleave width: a challenger must
+    // beat the current choice by more than the tolerance.
+    double engine_rate = 0;
+    for (const AesEngine* engine : Candidates()) {
+        BuildAesKey(key, key_bytes, 16, *engine);
+        double rate = MeasureRate(TUNE_ENGINE_BYTES, [&] {
+            EncryptBlocks(key, data, data, TUNE_ENGINE_BYTES / BLOCK_SIZE);
+        });
+        Record(plan, "engine", engine->name, rate);
+        if (rate > engine_rate * (1 + TUNE_TOLERANCE)) {
+            engine_rate = rate;
+            plan.engine = engine->name;
+        }
+    }
+    const AesEngine& engine = *FindCandidate(plan.engine);
+    SetActiveEngine(engine);
+    BuildAesKey(key, key_bytes, 16, engine);
+
+    // Threads: the fewest that come within the tolerance of the best, as
+    // extra threads past the memory bandwidth limit only add contention.
+    std::vector<std::pair<unsigned, double> > scaling;
+    double best_rate = 0;
+    for (unsigned threads = 1;; threads = std::min(2 * threads, pool.Capacity())) {
+        pool.SetSize(threads);
+        double rate = MeasureRate(buffer.size(), [&] {
+            CtrCrypt(key, iv, data, data, buffer.size());
+        });
+        Record(plan, "threads", std::to_string(threads), rate);
+        scaling.push_back(std::make_pair(threads, rate));
+        best_rate = std::max(best_rate, rate);
+        if (threads == pool.Capacity()) {
+            break;
+        }
+    }
+    for (const auto& entry : scaling) {
+        if (entry.second >= best_rate * (1 - TUNE_TOLERANCE)) {
+            plan.threads = entry.first;
+            break;
+        }
+    }
+
+    // Threshold: the smallest buffer that is clearly faster split across
+    // the chosen threads than on one.
+    if (plan.threads > 1) {
+        plan.parallel_min_bytes = 2 * TUNE_MAX_PARALLEL_BYTES;
+        pool.SetSize(plan.threads);
+        for (size_t bytes = TUNE_MIN_PARALLEL_BYTES; bytes <= TUNE_MAX_PARALLEL_BYTES;
+             bytes *= 2) {
+            SetParallelMinBytes(std::numeric_limits<size_t>::max());
+            double serial = MeasureRate(bytes, [&] { CtrCrypt(key, iv, data, data, bytes); });
+            SetParallelMinBytes(0);
+            double parallel = MeasureRate(bytes, [&] { CtrCrypt(key, iv, data, data, bytes); });
+            Record(plan, "parallel_min_bytes", ThresholdCandidate(bytes, 1), serial);
+            Record(plan, "parallel_min_bytes", ThresholdCandidate(bytes, plan.threads), parallel);
+            if (parallel > serial * (1 + TUNE_TOLERANCE)) {
+                plan.parallel_min_bytes = bytes;
+                break;
+            }
+        }
+    }
+
+    WipeAesKey(key);
+    SetActiveEngine(saved_engine);
+    pool.SetSize(saved_threads);
+    SetParallelMinBytes(saved_min_bytes);
+    return plan;
+}
+
+bool LoadTunePlan(const std::string& path, TunePlan& plan) {
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+    TunePlan loaded;
+    loaded.threads = 0;
+    loaded.parallel_min_bytes = 0;
+    loaded.source = "profile";
+    int version = 0;
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string name;
+        if (!(fields >> name) || name[0] == '#') {
+            continue;
+        }
+        bool valid = true;
+        if (name == "version") {
+            valid = static_cast<bool>(fields >> version);
+        } else if (name == "host") {
+            valid = static_cast<bool>(fields >> loaded.host);
+        } else if (name == "engine") {
+            valid = static_cast<bool>(fields >> loaded.engine);
+        } else if (name == "threads") {
+            valid = static_cast<bool>(fields >> loaded.threads);
+        } else if (name == "parallel_min_bytes") {
+            valid = static_cast<bool>(fields >> loaded.parallel_min_bytes);
+        } else if (name == "measured") {
+            TuneMeasurement measurement;
+            valid = static_cast<bool>(fields >> measurement.setting >>
+                                      measurement.candidate >> measurement.gb_per_s);
+            loaded.measurements.push_back(measurement);
+        }
+        if (!valid) {
+            return false;
+        }
+    }
+    if (version != TUNE_PROFILE_VERSION || loaded.host != TuneHostFingerprint() ||
+        !FindCandidate(loaded.engine) || loaded.threads == 0 ||
+        loaded.parallel_min_bytes < TUNE_MIN_PARALLEL_BYTES) {
+        return false;
+    }
+    plan = loaded;
+    return true;
+}
+
+bool SaveTunePlan(const std::string& path, const TunePlan& plan) {
+    std::string temporary = path + ".tmp" + std::to_string(std::random_device()());
+    {
+        std::ofstream file(temporary, std::ios::trunc);
+        file << "# AES_UNSW tuning profile. Delete it or run \"AES_UNSW tune "
+                "--retune\" to measure again.\n"
+             << "version " << TUNE_PROFILE_VERSION << '\n'
+             << "host " << plan.host << '\n'
+             << "engine " << plan.engine << '\n'
+             << "threads " << plan.threads << '\n'
+             << "parallel_min_bytes " << plan.parallel_min_bytes << '\n';
+        for (const TuneMeasurement& measurement : plan.measurements) {
+            file << "measured " << measurement.setting << ' '
+                 << measurement.candidate << ' ' << measurement.gb_per_s << '\n';
+        }
+        file.close();
+        if (!file) {
+            std::remove(temporary.c_str());
+            return false;
+        }
+    }
+    if (!ReplaceFile(temporary, path)) {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+void ApplyTunePlan(const TunePlan& plan) {
+    const AesEngine* engine = FindCandidate(plan.engine);
+    if (!engine) {
+        throw std::invalid_argument("Tuning plan: engine " + plan.engine +
+                                    " is not available on this host");
+    }
+    SetActiveEngine(*engine);
+    DefaultThreadPool().SetSize(plan.threads);
+    SetParallelMinBytes(plan.parallel_min_bytes);
+    std::lock_guard<std::mutex> lock(plan_mutex);
+    applied_plan = plan;
+    plan_applied = true;
+}
+
+TunePlan CurrentTunePlan() {
+    std::lock_guard<std::mutex> lock(plan_mutex);
+    return plan_applied ? applied_plan : DefaultTunePlan();
+}
+
+TunePlan TuneAtStartup(const std::string& path) {
+    TunePlan plan;
+    if (!LoadTunePlan(path, plan)) {
+        std::cerr << "Tuning for this host; the plan is saved to " << path << std::endl;
+        plan = Autotune();
+        if (!SaveTunePlan(path, plan)) {
+            std::cerr << "Cannot write the tuning profile " << path << std::endl;
+        }
+    }
+    ApplyTunePlan(plan);
+    return plan;
+}
+
+std::string DefaultTuneProfilePath() {
+    const char* path = std::getenv("AES_UNSW_PROFILE");
+    if (path && *path) {
+        return path;
+    }
+#if defined(_WIN32)
+    const char* home = std::getenv("LOCALAPPDATA");
+    const char separator = '\\';
+#else
+    const char* home = std::getenv("HOME");
+    const char separator = '/';
+#endif
+    if (home && *home) {
+        return std::string(home) + separator + ".aes_unsw_profile";
+    }
+    return ".aes_unsw_profile";
+}
+
+void PrintTunePlan(std::ostream& out, const TunePlan& plan) {
+    out << "Tuning plan (" << plan.source << ") for " << plan.host << '\n'
+        << "  engine " << plan.engine << '\n'
+        << "  threads " << plan.threads << '\n'
+        << "  parallel_min_bytes " << plan.parallel_min_bytes << '\n';
+    if (plan.measurements.empty()) {
+        return;
+    }
+    out << "Measurements in GB/s; * marks the choice. A candidate within "
+        << 100 * TUNE_TOLERANCE << "% of the best\n"
+           "counts as the best, and the default engine and fewer threads win\n"
+           "ties. Threshold candidates are bytes/threads; splitting is chosen\n"
+           "from the first size where it clearly beats one thread.\n";
+    for (const TuneMeasurement& measurement : plan.measurements) {
+        bool chosen =
+            (measurement.setting == "engine" && measurement.candidate == plan.engine) ||
+            (measurement.setting == "threads" &&
+             measurement.candidate == std::to_string(plan.threads)) ||
+            (measurement.setting == "parallel_min_bytes" &&
+             measurement.candidate ==
+                 ThresholdCandidate(plan.parallel_min_bytes, plan.threads));
+        out << (chosen ? "* " : "  ") << measurement.setting << ' '
+            << measurement.candidate << ' ' << measurement.gb_per_s << '\n';
+    }
+}
+
+int RunTune(int argc, char* argv[]) {
+    std::string path = DefaultTuneProfilePath();
+    bool retune = false;
+    // argv[1] is "tune".
+    for (int i = 2; i < argc; i++) {
+        std::string option(argv[i]);
+        if (option == "--retune") {
+            retune = true;
+        } else if (option == "--profile" && i + 1 < argc) {
+            path = argv[++i];
+        } else {
+            std::cerr << "Usage: AES_UNSW tune [--profile PATH] [--retune]" << std::endl;
+            return 2;
+        }
+    }
+
+    TunePlan plan;
+    int status = 0;
+    if (retune || !LoadTunePlan(path, plan)) {
+        plan = Autotune();
+        if (!SaveTunePlan(path, plan)) {
+            std::cerr << "Cannot write the tuning profile " << path << std::endl;
+            status = 1;
+        }
+    }
+    std::cout << "Profile: " << path << '\n';
+    PrintTunePlan(std::cout, plan);
+    return status;
+}
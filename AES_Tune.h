@@ -0,0 +1,93 @@
+// AES_Tune.h : Per-host choice of engine, thread count and parallel threshold.
+//
+// The fastest settings differ across machines: AES-NI with eight or four
+// blocks in flight, or the bitsliced rounds without it; how many threads
+// help before memory bandwidth runs out; and how large a buffer must be
+// before splitting it across threads pays. Autotune measures them with
+// short microbenchmarks on the running host. The winning plan is written
+// to a profile file and read back on later starts, so only the first
+// start pays for the measurements.
+//
+// Only engines whose multi-block path is constant time are candidates;
+// the table and portable engines are never picked however fast they are.
+#pragma once
+
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// Bumped whenever the plan or the measurements change meaning; profiles
+// of another version are measured again.
+#define TUNE_PROFILE_VERSION 1
+// A candidate within this fraction of the best is as good as the best,
+// and the cheaper one (fewer threads, the default engine) is kept.
+#define TUNE_TOLERANCE 0.05
+
+// One candidate tried for one setting.
+struct TuneMeasurement {
+    // "engine", "threads" or "parallel_min_bytes".
+    std::string setting;
+    // Engine name, thread count or buffer size.
+    std::string candidate;
+    double gb_per_s;
+};
+
+struct TunePlan {
+    // CPU features and core count the plan was measured on; a profile
+    // from another host is ignored.
+    std::string host;
+    std::string engine;
+    unsigned threads;
+    size_t parallel_min_bytes;
+    // Every candidate tried, so the choice can be explained later.
+    std::vector<TuneMeasurement> measurements;
+    // "measured", "profile" or "default".
+    std::string source;
+};
+
+// Identifies the host for profile validity, e.g. "aesni+pclmul+avx2/8".
+std::string TuneHostFingerprint();
+
+// The settings used without tuning: DefaultEngine(), every core and
+// PARALLEL_MIN_BYTES.
+TunePlan DefaultTunePlan();
+
+// Runs the microbenchmarks, in well under a second. Changes the active
+// engine, pool size and threshold while it measures and restores them
+// before returning, so it must run before other threads use the library.
+TunePlan Autotune();
+
+// Reads a profile written by SaveTunePlan. Returns false if the file is
+// missing or malformed, or was written for another host or version.
+bool LoadTunePlan(const std::string& path, TunePlan& plan);
+
+// Writes the profile through a temporary file renamed into place, so a
+// reader never sees half of it. Returns false if it cannot be written.
+bool SaveTunePlan(const std::string& path, const TunePlan& plan);
+
+// Makes plan the process-wide settings: SetActiveEngine,
+// DefaultThreadPool().SetSize and SetParallelMinBytes. Throws
+// std::invalid_argument if the engine is not a candidate on this host.
+void ApplyTunePlan(const TunePlan& plan);
+
+// The plan last applied, or DefaultTunePlan() if none was.
+TunePlan CurrentTunePlan();
+
+// Applies the profile at path, or tunes and writes it when the file is
+// missing or stale. A profile that cannot be written is reported on
+// std::cerr and the measured plan is used anyway.
+TunePlan TuneAtStartup(const std::string& path);
+
+// $AES_UNSW_PROFILE if set, otherwise .aes_unsw_profile in the home
+// directory (%LOCALAPPDATA% on Windows), otherwise the working directory.
+std::string DefaultTuneProfilePath();
+
+// The plan and every measurement behind it, one line each.
+void PrintTunePlan(std::ostream& out, const TunePlan& plan);
+
+// Runs `AES_UNSW tune [--profile PATH] [--retune]` and returns the process
+// exit code: 0 on success, 1 if the profile cannot be written, 2 on bad
+// arguments. Prints the plan in use and why; --retune measures again even
+// when the profile is valid.
+int RunTune(int argc, char* argv[]);
@@ -7,12 +7,21 @@
 #include <vector>
 #include <xstring>
 #include <array>
-
-#define BLOCK_SIZE 16
-#define KEY_SIZE 16
-#define WORD_SIZE 4
-#define ROW_SIZE 4
-#define COL_SIZE 4
+#include <cstring>
+#include <stdexcept>
+
+#include "AES_UNSW.h"
+#include "AES_Engine.h"
+#include "AES_Modes.h"
+#include "AES_FileTool.h"
+#include "AES_Bench.h"
+#include "AES_Codec.h"
+#include "AES_Drbg.h"
+#include "AES_Daemon.h"
+#include "AES_Trace.h"
+#include "AES_Tune.h"
+#include "AES_Perf.h"
+#include "AES_SelfTest.h"
 
 
 /**
@@ -30,97 +39,14 @@
 //#define xtime(x) ((x << 1) ^ (((x >> 7) & 0x01) * 0x1b))
 
 
-// Substitution table
-const unsigned char s_box[16][16] = {
-{ 0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5,
-  0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76 },
-{ 0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0,
-  0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0 },
-{ 0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc,
-  0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15 },
-{ 0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a,
-  0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75 },
-{ 0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0,
-  0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84 },
-{ 0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b,
-  0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf },
-{ 0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85,
-  0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8 },
-{ 0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5,
-  0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2 },
-{ 0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17,
-  0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73 },
-{ 0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88,
-  0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb },
-{ 0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c,
-  0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79 },
-{ 0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9,
-  0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08 },
-{ 0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6,
-  0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a },
-{ 0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e,
-  0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e },
-{ 0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94,
-  0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf },
-{ 0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68,
-  0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16 },
-};
-
-// Inverse substitution table
-const unsigned char inv_s_box[16][16] = {
-{ 0x52, 0x09, 0x6a, 0xd5, 0x30, 0x36, 0xa5, 0x38,
-  0xbf, 0x40, 0xa3, 0x9e, 0x81, 0xf3, 0xd7, 0xfb },
-{ 0x7c, 0xe3, 0x39, 0x82, 0x9b, 0x2f, 0xff, 0x87,
-  0x34, 0x8e, 0x43, 0x44, 0xc4, 0xde, 0xe9, 0xcb },
-{ 0x54, 0x7b, 0x94, 0x32, 0xa6, 0xc2, 0x23, 0x3d,
-  0xee, 0x4c, 0x95, 0x0b, 0x42, 0xfa, 0xc3, 0x4e },
-{ 0x08, 0x2e, 0xa1, 0x66, 0x28, 0xd9, 0x24, 0xb2,
-  0x76, 0x5b, 0xa2, 0x49, 0x6d, 0x8b, 0xd1, 0x25 },
-{ 0x72, 0xf8, 0xf6, 0x64, 0x86, 0x68, 0x98, 0x16,
-  0xd4, 0xa4, 0x5c, 0xcc, 0x5d, 0x65, 0xb6, 0x92 },
-{ 0x6c, 0x70, 0x48, 0x50, 0xfd, 0xed, 0xb9, 0xda,
-  0x5e, 0x15, 0x46, 0x57, 0xa7, 0x8d, 0x9d, 0x84 },
-{ 0x90, 0xd8, 0xab, 0x00, 0x8c, 0xbc, 0xd3, 0x0a,
-  0xf7, 0xe4, 0x58, 0x05, 0xb8, 0xb3, 0x45, 0x06 },
-{ 0xd0, 0x2c, 0x1e, 0x8f, 0xca, 0x3f, 0x0f, 0x02,
-  0xc1, 0xaf, 0xbd, 0x03, 0x01, 0x13, 0x8a, 0x6b },
-{ 0x3a, 0x91, 0x11, 0x41, 0x4f, 0x67, 0xdc, 0xea,
-  0x97, 0xf2, 0xcf, 0xce, 0xf0, 0xb4, 0xe6, 0x73 },
-{ 0x96, 0xac, 0x74, 0x22, 0xe7, 0xad, 0x35, 0x85,
-  0xe2, 0xf9, 0x37, 0xe8, 0x1c, 0x75, 0xdf, 0x6e },
-{ 0x47, 0xf1, 0x1a, 0x71, 0x1d, 0x29, 0xc5, 0x89,
-  0x6f, 0xb7, 0x62, 0x0e, 0xaa, 0x18, 0xbe, 0x1b },
-{ 0xfc, 0x56, 0x3e, 0x4b, 0xc6, 0xd2, 0x79, 0x20,
-  0x9a, 0xdb, 0xc0, 0xfe, 0x78, 0xcd, 0x5a, 0xf4 },
-{ 0x1f, 0xdd, 0xa8, 0x33, 0x88, 0x07, 0xc7, 0x31,
-  0xb1, 0x12, 0x10, 0x59, 0x27, 0x80, 0xec, 0x5f },
-{ 0x60, 0x51, 0x7f, 0xa9, 0x19, 0xb5, 0x4a, 0x0d,
-  0x2d, 0xe5, 0x7a, 0x9f, 0x93, 0xc9, 0x9c, 0xef },
-{ 0xa0, 0xe0, 0x3b, 0x4d, 0xae, 0x2a, 0xf5, 0xb0,
-  0xc8, 0xeb, 0xbb, 0x3c, 0x83, 0x53, 0x99, 0x61 },
-{ 0x17, 0x2b, 0x04, 0x7e, 0xba, 0x77, 0xd6, 0x26,
-  0xe1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0c, 0x7d },
-};
-
 // Returns a string object that contains hexadecimal value of the input string.
 std::string HexConvert(std::string &str_obj)
-{  
-    
-    std::string hex_value;
-    char const hex_chars[16] = { '0', '1', '2', '3', '4', '5', '6', '7', \
-                                 '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' };
-
-    for (auto& byte : str_obj) {
-        // Mask the lower 4 bits of input byte with 0xF0 and right 
-        // shift 4 times so that higer 4 bits are now located in 
-        // the lower 4 bits
-
-        hex_value += hex_chars[(byte & 0xF0) >> 4];
-        // Mask the higher 4 bits of the input byte with 0x0F and 
-        // extact the lower for bits
-        hex_value += hex_chars[(byte & 0x0F) >> 0];
-    }
-
+{
+    // Sized once and filled by the SIMD encoder; appending a character at
+    // a time reallocated as the string grew.
+    std::string hex_value(HexEncodedLength(str_obj.size()), '\0');
+    HexEncode(reinterpret_cast<const unsigned char*>(str_obj.data()),
+              str_obj.size(), &hex_value[0]);
     return hex_value;
 }
 
@@ -152,30 +78,13 @@ void SubstituteWord(unsigned char* input_byte) {
 }
 
 
-// This function pretty prints the given matrix.
-// 
-void PrintMatrix(unsigned char ary[][4], int ColumnSize, \
-                 int RowSize, std::string message_to_display)
-{
-    size_t message_to_display_size = message_to_display.size();
-    std::cout << std::string(message_to_display_size, '-') << std::endl;
-    std::cout << message_to_display << std::endl;
-    std::cout << std::string(message_to_display_size, '-') << std::endl;
-    for (int i = 0; i < RowSize; i++) {
-        for (int j = 0; j < ColumnSize; j++) {
-            std::string print_character(1, ary[i][j]);
-            std::cout << HexConvert(print_character) << " ";
-        }
-        std::cout << std::endl;
-    }
-    std::cout << std::endl;
-}
-
 // This function calculates KeySchedule and populates word_matrix
 // number of rounds is key's size + 6  therefore for 128 bit key its 128-bit key
 // and each round needs 16 bytes of keying + one extra key permutation at the very end
 // so the key schedule is of 176 bytes long which is stored in 44 x 4 matrix.
 // In 176 bytes includes 16 byte input + 160 bytes that are computed 4 at a time.
+// AES-192 and AES-256 follow the same pattern with Nk = 6 or 8 key words
+// and 12 or 14 rounds, giving 52 x 4 and 60 x 4 matrices.
 
 // W[0]         W[i]  W[i-1]                                W[44]
 //  |             |     |                                     |
@@ -190,36 +99,62 @@ void PrintMatrix(unsigned char ary[][4], int ColumnSize, \
 //  | 6 | 7 | 8 | 8 |   9  | 6 | 7 | 8 |        | 6 | 6 | 7 | 8 |
 //  +---------------+------------------+        +---------------+
 //  
-void BuildKeySchedule(unsigned char word_matrix[][4], std::string &key) {
-    unsigned char rcon = 0x01;
-    std::memcpy(word_matrix, key.c_str(), key.size());
-
-    PrintMatrix(word_matrix, 4, 4, "Input Key in Hex");
-    //key size in 4 byte word
-    int key_word = KEY_SIZE >> 2;
-    // key word size + 1 extra permutation times key word size
-    for (int i = key_word; i < (4 * (key_word + 7)); i++) {
+template <int Nk>
+void ExpandKeyWords(const unsigned char* key, unsigned char enc_keys[]) {
+    typedef AesParams<Nk> Params;
+    unsigned char (*word_matrix)[4] =
+        reinterpret_cast<unsigned char(*)[4]>(enc_keys);
+    std::memcpy(word_matrix, key, Params::key_bytes);
+
+    // Bounds and the i % Nk tests are compile-time constants per key size.
+    for (int i = Nk; i < Params::schedule_words; i++) {
         std::memcpy(word_matrix[i], word_matrix[i - 1], WORD_SIZE);
-        if (!(i % key_word))
+        if (i % Nk == 0)
         {
             RotateWord(word_matrix[i]);
             SubstituteWord(word_matrix[i]);
-            if( !(i % 36)) { 
-                rcon = 0x1B; 
-            }
-            word_matrix[i][0] ^= rcon;
-            rcon <<= 1;
+            word_matrix[i][0] ^= rcon[i / Nk - 1];
         }
-        word_matrix[i][0] ^= word_matrix[i - key_word][0];
-        word_matrix[i][1] ^= word_matrix[i - key_word][1];
-        word_matrix[i][2] ^= word_matrix[i - key_word][2];
-        word_matrix[i][3] ^= word_matrix[i - key_word][3];
+        else if (Nk > 6 && i % Nk == 4)
+        {
+            // AES-256 also substitutes the middle word of each step.
+            SubstituteWord(word_matrix[i]);
+        }
+        word_matrix[i][0] ^= word_matrix[i - Nk][0];
+        word_matrix[i][1] ^= word_matrix[i - Nk][1];
+        word_matrix[i][2] ^= word_matrix[i - Nk][2];
+        word_matrix[i][3] ^= word_matrix[i - Nk][3];
+    }
+}
+
+void PortableExpandKey(const unsigned char* key, int key_bytes,
+                       unsigned char enc_keys[]) {
+    switch (key_bytes) {
+    case Aes128::key_bytes:
+        ExpandKeyWords<Aes128::key_words>(key, enc_keys);
+        break;
+    case Aes192::key_bytes:
+        ExpandKeyWords<Aes192::key_words>(key, enc_keys);
+        break;
+    case Aes256::key_bytes:
+        ExpandKeyWords<Aes256::key_words>(key, enc_keys);
+        break;
+    default:
+        throw std::invalid_argument("unsupported AES key size");
     }
 }
 
+// Expands the cipher key with the active engine
+// (AESKEYGENASSIST when available, PortableExpandKey otherwise).
+void BuildKeySchedule(unsigned char word_matrix[][4], std::string &key) {
+    ActiveEngine().expand_key(
+        reinterpret_cast<const unsigned char*>(key.data()),
+        static_cast<int>(key.size()), &word_matrix[0][0]);
+}
+
 // This function XORs state matrix 4 bytes with previous 4 bytes.
 void AddRoundKey(unsigned char state_matrix[][4], 
-                 unsigned char word_matrix[][4]){
+                 const unsigned char word_matrix[][4]){
     for (int i = 0; i < COL_SIZE; i++) {
         for (int j = 0; j < ROW_SIZE; j++) {
             state_matrix[j][i] = state_matrix[j][i] ^ word_matrix[i][j];
@@ -454,7 +389,7 @@ unsigned char dot(unsigned char x, unsigned char y)
 // They've written it as + because, in GF(2^n) fields, XOR is addition operation.
 // if the column [d4 bf 5d 30] needs to be multipled with galios matrix it is
 // ( d4 * 0 2) + ( bf * 03 ) + ( 5d * 01 ) + (30 * 01 )
-// d402  is d4 << 1 and XORed with 0x1B as their is a carry over (high bit of d4 is set)
+// d4�02  is d4 << 1 and XORed with 0x1B as their is a carry over (high bit of d4 is set)
 // which gives the result b3.
 // Similiarly, 0xbf x 03 is 0xbf << 1 and XORed with 0x1B resulting in 0xda
 // 5d * 01 = 5d
@@ -509,90 +444,162 @@ static void InverseMixColumns(unsigned char s[][4])
 }
 
 
-//This function encrypts the input string with input cipher key
-std::string Encrypt(std::string &input, std::string &key) {
-    unsigned char state_matrix[4][4];
-    // for 128bit key 10 rounds required.
-    const int number_rounds = 10;
-    // Array to store Key schedule for 128 bit keys
-    unsigned char word_matrix[60][4];
-
-    for (int i = 0; i < ROW_SIZE; i++) {
-        for (int j = 0; j < COL_SIZE; j++) {
-            state_matrix[i][j] = input[i + (4 * j)];
-        }
-    }
-
-    PrintMatrix(state_matrix, 4, 4, "Input Message in Hex");
-    BuildKeySchedule(word_matrix, key);
-    PrintMatrix(word_matrix, 44, 4, "Key Schedule Matrix");
+// Runs the byte-at-a-time round pipeline over an already loaded state
+// matrix. Kept as the reference implementation the table engine is
+// checked against; word_matrix must hold the full key schedule.
+void ReferenceEncryptBlock(unsigned char state_matrix[][4],
+                           const unsigned char word_matrix[][4],
+                           int number_rounds) {
     AddRoundKey(state_matrix, &word_matrix[0]);
+    AES_TRACE_ROUND(false, 0, ROUND_ADD_ROUND_KEY, state_matrix);
 
     for (int round = 0; round < number_rounds; round++)
     {
         SubstituteByte(state_matrix);
+        AES_TRACE_ROUND(false, round + 1, ROUND_SUB_BYTES, state_matrix);
         ShiftRows(state_matrix);
+        AES_TRACE_ROUND(false, round + 1, ROUND_SHIFT_ROWS, state_matrix);
         if (round < number_rounds - 1) {
             MixColumns(state_matrix);
+            AES_TRACE_ROUND(false, round + 1, ROUND_MIX_COLUMNS, state_matrix);
         }
         AddRoundKey(state_matrix, &word_matrix[(round + 1) * 4]);
- 
+        AES_TRACE_ROUND(false, round + 1, ROUND_ADD_ROUND_KEY, state_matrix);
     }
-
-    std::string encrypted_char(16,' ');
-    for (int i = 0; i < 4; i++) {
-        for (int j = 0; j < 4; j++) {
-            encrypted_char[i+(4*j)] = state_matrix[i][j];
-        }
-    }
-
-    PrintMatrix(state_matrix, 4, 4, "Encrypted Message Matrix");
-    std::cout << "Encrypted message string = "<< encrypted_char << std::endl;
-    return encrypted_char;
 }
 
-//This function decrypts the input string with input cipher key
-std::string Decrypt(std::string& output, std::string& key){
-    unsigned char state_matrix[4][4];
-    // for 128bit key 10 rounds required.
-    const int number_rounds = 10;
-    // Array to store Key schedule for 128 bit keys
-    unsigned char word_matrix[44][4];
-    std::string decrypt_output(16,' ');
-
-    for (int i = 0; i < ROW_SIZE; i++){
-        for(int j=0; j< COL_SIZE; j++){
-            state_matrix[i][j] = output[i + (4*j)];
-        }
-    }
-
-    BuildKeySchedule(word_matrix, key);
+// Inverse of ReferenceEncryptBlock, consuming the round keys backwards.
+void ReferenceDecryptBlock(unsigned char state_matrix[][4],
+                           const unsigned char word_matrix[][4],
+                           int number_rounds) {
     AddRoundKey(state_matrix, &word_matrix[number_rounds * 4]);
+    AES_TRACE_ROUND(true, 0, ROUND_ADD_ROUND_KEY, state_matrix);
 
+    // Decryption round n undoes encryption round number_rounds + 1 - n;
+    // the hook sees the decryption round number.
     for (int round = number_rounds; round > 0; round--)
     {
         InverseSubstituteByte(state_matrix);
+        AES_TRACE_ROUND(true, number_rounds + 1 - round, ROUND_SUB_BYTES, state_matrix);
         InverseShiftRows(state_matrix);
-        AddRoundKey(state_matrix, &word_matrix[(round + 1) * 4]);
+        AES_TRACE_ROUND(true, number_rounds + 1 - round, ROUND_SHIFT_ROWS, state_matrix);
+        AddRoundKey(state_matrix, &word_matrix[(round - 1) * 4]);
+        AES_TRACE_ROUND(true, number_rounds + 1 - round, ROUND_ADD_ROUND_KEY, state_matrix);
         if (round > 1) {
             InverseMixColumns(state_matrix);
+            AES_TRACE_ROUND(true, number_rounds + 1 - round, ROUND_MIX_COLUMNS, state_matrix);
         }
     }
+}
 
-    for (int i = 0; i < 4; i++) {
-        for (int j = 0; j < 4; j++) {
-            decrypt_output += state_matrix[i][j];
-        }
+
+// Expands the cipher key once into aes_key. Nothing in AesKey is written
+// after this returns, so one context can be shared read-only by any number
+// of threads and reused for every block under that key.
+void BuildAesKey(AesKey& aes_key, const unsigned char* key, int key_bytes,
+                 const AesEngine& engine) {
+    // Charged as one block per key.
+    AES_PERF_SCOPE(PERF_EXPAND_KEY, BLOCK_SIZE);
+    if (key_bytes != Aes128::key_bytes && key_bytes != Aes192::key_bytes &&
+        key_bytes != Aes256::key_bytes) {
+        throw std::invalid_argument("unsupported AES key size");
+    }
+    aes_key.engine = &engine;
+    aes_key.number_rounds = (key_bytes >> 2) + 6;
+    engine.expand_key(key, key_bytes, aes_key.enc_keys);
+    engine.invert_key(aes_key.enc_keys, aes_key.number_rounds,
+                      aes_key.dec_keys);
+}
+
+void BuildAesKey(AesKey& aes_key, std::string& key) {
+    BuildAesKey(aes_key, reinterpret_cast<const unsigned char*>(key.data()),
+                static_cast<int>(key.size()));
+}
+
+void WipeAesKey(AesKey& aes_key) {
+    volatile unsigned char* wipe = reinterpret_cast<unsigned char*>(&aes_key);
+    for (size_t i = 0; i < sizeof(aes_key); i++) {
+        wipe[i] = 0;
     }
+}
+
+
+//This function encrypts the 16-byte input string with an expanded key
+std::string Encrypt(std::string &input, const AesKey &key) {
+    AES_PERF_SCOPE(PERF_ENCRYPT, BLOCK_SIZE);
+    std::string encrypted_char(16,' ');
+    EncryptBlock(key, reinterpret_cast<const unsigned char*>(input.data()),
+                 reinterpret_cast<unsigned char*>(&encrypted_char[0]));
+    return encrypted_char;
+}
 
+//This function decrypts the 16-byte input string with an expanded key
+//and returns the plain text in hex
+std::string Decrypt(std::string& output, const AesKey& key){
+    AES_PERF_SCOPE(PERF_DECRYPT, BLOCK_SIZE);
+    std::string decrypt_output(16,' ');
+    DecryptBlock(key, reinterpret_cast<const unsigned char*>(output.data()),
+                 reinterpret_cast<unsigned char*>(&decrypt_output[0]));
     return HexConvert(decrypt_output);
 }
 
 
-int main()
+//This function encrypts the input string with input cipher key
+std::string Encrypt(std::string &input, std::string &key) {
+    AesKey aes_key;
+
+    AES_TRACE_BLOCK(reinterpret_cast<const unsigned char*>(input.data()),
+                    "Input Message in Hex");
+    BuildAesKey(aes_key, key);
+    AES_TRACE_MATRIX(reinterpret_cast<const unsigned char(*)[4]>(aes_key.enc_keys),
+                     4, 4, "Input Key in Hex");
+    AES_TRACE_MATRIX(reinterpret_cast<const unsigned char(*)[4]>(aes_key.enc_keys),
+                     4, 4 * (aes_key.number_rounds + 1), "Key Schedule Matrix");
+
+    std::string encrypted_char = Encrypt(input, aes_key);
+    WipeAesKey(aes_key);
+
+    AES_TRACE_BLOCK(reinterpret_cast<const unsigned char*>(encrypted_char.data()),
+                    "Encrypted Message Matrix");
+    return encrypted_char;
+}
+
+//This function decrypts the input string with input cipher key
+std::string Decrypt(std::string& output, std::string& key){
+    AesKey aes_key;
+    BuildAesKey(aes_key, key);
+    std::string decrypted = Decrypt(output, aes_key);
+    WipeAesKey(aes_key);
+    return decrypted;
+}
+
+
+int main(int argc, char* argv[])
 {
+    if (argc > 1 && std::string(argv[1]) == "bench") {
+        return RunBenchmark(argc, argv);
+    }
+    if (argc > 1 && std::string(argv[1]) == "tune") {
+        return RunTune(argc, argv);
+    }
+    if (argc > 1 && std::string(argv[1]) == "selftest") {
+        return RunSelfTest(argc, argv);
+    }
+    // The daemon and the file tool run with the host's tuning plan, which
+    // is measured on their first start and read back afterwards; each
+    // tunes only once its arguments are accepted.
+    if (argc > 1 && std::string(argv[1]) == "daemon") {
+        return RunDaemon(argc, argv, DefaultTuneProfilePath());
+    }
+    if (argc > 1) {
+        return RunFileTool(argc, argv, DefaultTuneProfilePath());
+    }
+
     std::string sample_message("MY AES TOOL DEMO");
-    std::string init_vector("UNSW_INIT_VECTOR");
+    // A fresh IV per run: a fixed one would repeat GCM's keystream and
+    // reveal equal CBC prefixes across runs.
+    std::string init_vector(BLOCK_SIZE, '\0');
+    RandomBytes(reinterpret_cast<unsigned char*>(&init_vector[0]), init_vector.size());
     std::string key("UNSW_PROJECT_AES");
 
 
@@ -600,12 +607,66 @@ int main()
     std::cout << "Encrypted Output:" << std::endl;
     std::cout << "-------------------------" << std::endl << std::endl;
     std::string encrypted_hex_string = Encrypt(sample_message, key);
+    std::cout << "Encrypted message string = "<< encrypted_hex_string << std::endl;
     std::cout << "------------------" << std::endl;
     std::cout << "Decrypted Output :" << std::endl;
     std::cout << "------------------" << std::endl;
     std::string decrypted_hex_string = Decrypt(encrypted_hex_string, key);
+    std::cout << "In Hex:" << decrypted_hex_string << std::endl;
     std::cout << "In ASCII characters:" << sample_message <<std::endl;
     std::cout << std::endl<<std::endl;
+    std::cout << "--------------------" << std::endl;
+
+    // Longer message chained with init_vector in CBC mode.
+    std::string cbc_message("MY AES TOOL DEMO IN CBC MODE WITH PKCS#7 PADDING");
+    AesKey aes_key;
+    BuildAesKey(aes_key, key);
+    const unsigned char* iv =
+        reinterpret_cast<const unsigned char*>(init_vector.data());
+
+    std::string cbc_cipher(cbc_message.size() + BLOCK_SIZE, '\0');
+    cbc_cipher.resize(CbcEncrypt(aes_key, iv,
+        reinterpret_cast<const unsigned char*>(cbc_message.data()),
+        cbc_message.size(), reinterpret_cast<unsigned char*>(&cbc_cipher[0])));
+    std::cout << "IV In Hex:" << HexConvert(init_vector) << std::endl;
+    std::cout << "CBC Encrypted Output In Hex:" << HexConvert(cbc_cipher) << std::endl;
+
+    std::string cbc_plain(cbc_cipher.size(), '\0');
+    size_t cbc_plain_length = 0;
+    if (CbcDecrypt(aes_key, iv,
+                   reinterpret_cast<const unsigned char*>(cbc_cipher.data()),
+                   cbc_cipher.size(),
+                   reinterpret_cast<unsigned char*>(&cbc_plain[0]),
+                   cbc_plain_length)) {
+        cbc_plain.resize(cbc_plain_length);
+        std::cout << "CBC Decrypted Output In ASCII characters:" << cbc_plain << std::endl;
+    }
+    std::cout << "--------------------" << std::endl;
+
+    // Same message authenticated in GCM mode, with the first 12 bytes of
+    // init_vector as the nonce.
+    GcmKey gcm_key;
+    BuildGcmKey(gcm_key, aes_key);
+    std::string gcm_message("MY AES TOOL DEMO IN GCM MODE");
+    std::string gcm_aad("UNSW");
+    std::string gcm_cipher(gcm_message.size(), '\0');
+    std::string gcm_tag(BLOCK_SIZE, '\0');
+    GcmEncrypt(gcm_key, iv, 12,
+               reinterpret_cast<const unsigned char*>(gcm_aad.data()), gcm_aad.size(),
+               reinterpret_cast<const unsigned char*>(gcm_message.data()), gcm_message.size(),
+               reinterpret_cast<unsigned char*>(&gcm_cipher[0]),
+               reinterpret_cast<unsigned char*>(&gcm_tag[0]));
+    std::cout << "GCM Encrypted Output In Hex:" << HexConvert(gcm_cipher) << std::endl;
+    std::cout << "GCM Tag In Hex:" << HexConvert(gcm_tag) << std::endl;
+
+    std::string gcm_plain(gcm_cipher.size(), '\0');
+    if (GcmDecrypt(gcm_key, iv, 12,
+                   reinterpret_cast<const unsigned char*>(gcm_aad.data()), gcm_aad.size(),
+                   reinterpret_cast<const unsigned char*>(gcm_cipher.data()), gcm_cipher.size(),
+                   reinterpret_cast<unsigned char*>(&gcm_plain[0]),
+                   reinterpret_cast<const unsigned char*>(gcm_tag.data()))) {
+        std::cout << "GCM Decrypted Output In ASCII characters:" << gcm_plain << std::endl;
+    }
     std::cout << "--------------------";
 
 }
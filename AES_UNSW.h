@@ -0,0 +1,93 @@
+// AES_UNSW.h : Declarations shared between the AES demo and its round engines.
+//
+#pragma once
+
+#include <string>
+
+#include "AES_Engine.h"
+#include "AES_Tables.h"
+
+#define BLOCK_SIZE 16
+#define WORD_SIZE 4
+#define ROW_SIZE 4
+#define COL_SIZE 4
+
+
+// (x * {02}) mod {1b} over GF(2^8).
+unsigned char xtime(unsigned char x);
+
+// Returns a string object that contains hexadecimal value of the input string.
+std::string HexConvert(std::string &str_obj);
+
+// Expands the cipher key into 4 * (number_rounds + 1) words of word_matrix
+// using the engine picked by ActiveEngine().
+void BuildKeySchedule(unsigned char word_matrix[][4], std::string &key);
+
+// Byte-at-a-time reference rounds operating on the column-major state matrix.
+void ReferenceEncryptBlock(unsigned char state_matrix[][4],
+                           const unsigned char word_matrix[][4],
+                           int number_rounds);
+void ReferenceDecryptBlock(unsigned char state_matrix[][4],
+                           const unsigned char word_matrix[][4],
+                           int number_rounds);
+
+// Expanded key context: encryption and decryption round keys laid out for
+// the engine that built them. Build it once per key with BuildAesKey and
+// pass it by const reference; it is never modified afterwards, so it can
+// be shared read-only across threads.
+struct AesKey {
+    alignas(16) unsigned char enc_keys[MAX_ROUND_KEY_BYTES];
+    alignas(16) unsigned char dec_keys[MAX_ROUND_KEY_BYTES];
+    int number_rounds;
+    const AesEngine* engine;
+};
+
+void BuildAesKey(AesKey& aes_key, const unsigned char* key, int key_bytes,
+                 const AesEngine& engine = ActiveEngine());
+void BuildAesKey(AesKey& aes_key, std::string& key);
+
+// Zeroes every byte of aes_key in a way the compiler cannot drop as a
+// dead store. Call it before a key context goes out of scope.
+void WipeAesKey(AesKey& aes_key);
+
+inline void EncryptBlock(const AesKey& key, const unsigned char in[16],
+                         unsigned char out[16]) {
+    key.engine->encrypt_block(key.enc_keys, key.number_rounds, in, out);
+}
+
+inline void DecryptBlock(const AesKey& key, const unsigned char in[16],
+                         unsigned char out[16]) {
+    key.engine->decrypt_block(key.dec_keys, key.number_rounds, in, out);
+}
+
+// ECB over consecutive blocks, through the engine's multi-block path.
+inline void EncryptBlocks(const AesKey& key, const unsigned char* in,
+                          unsigned char* out, size_t blocks) {
+    key.engine->encrypt_blocks(key.enc_keys, key.number_rounds, in, out, blocks);
+}
+
+inline void DecryptBlocks(const AesKey& key, const unsigned char* in,
+                          unsigned char* out, size_t blocks) {
+    key.engine->decrypt_blocks(key.dec_keys, key.number_rounds, in, out, blocks);
+}
+
+// One block of a multi-key batch: in -> out under key. out may equal in.
+struct BlockJob {
+    const AesKey* key;
+    const unsigned char* in;
+    unsigned char* out;
+};
+
+// One block per job, each under its own key, for many small records under
+// many keys. Consecutive jobs whose keys share an engine and key size are
+// handed to the engine together, which interleaves 4 to 16 of them round
+// by round instead of waiting out each block's latency in turn.
+void EncryptBlockBatch(const BlockJob* jobs, size_t count);
+void DecryptBlockBatch(const BlockJob* jobs, size_t count);
+
+// Single 16-byte block encrypt/decrypt entry points. The std::string key
+// overloads expand the key on every call; prefer the AesKey ones.
+std::string Encrypt(std::string &input, const AesKey &key);
+std::string Decrypt(std::string& output, const AesKey& key);
+std::string Encrypt(std::string &input, std::string &key);
+std::string Decrypt(std::string& output, std::string& key);
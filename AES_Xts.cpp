@@ -0,0 +1,217 @@
+// AES_Xts.cpp : XTS tweakable block cipher mode for sector encryption.
+//
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include "AES_Modes.h"
+#include "AES_Perf.h"
+#include "AES_ThreadPool.h"
+
+#if defined(AES_X86)
+#include <emmintrin.h>
+#endif
+
+// Data blocks, and sector tweaks, passed to the engine per call.
+#define XTS_BATCH_BLOCKS 32
+
+namespace {
+
+// tweak = tweak * alpha: xtime() stretched over the 128-bit tweak, which
+// IEEE 1619 stores least significant byte first.
+void DoubleTweak(unsigned char tweak[16]) {
+    unsigned char carry = tweak[15] >> 7;
+    for (int i = 15; i > 0; i--) {
+        tweak[i] = static_cast<unsigned char>((tweak[i] << 1) | (tweak[i - 1] >> 7));
+    }
+    tweak[0] = static_cast<unsigned char>((tweak[0] << 1) ^ (0x87 & (0u - carry)));
+}
+
+#if defined(AES_X86)
+
+// The same doubling on one register: each 32-bit lane is shifted left and
+// receives the top bit of the lane below; the bit leaving the top lane is
+// reduced into the bottom one as 0x87.
+AES_TARGET("sse2")
+void FillTweaksSse2(unsigned char tweak[16], unsigned char* tweaks,
+                    size_t blocks) {
+    const __m128i feedback = _mm_set_epi32(1, 1, 1, 0x87);
+    __m128i t = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tweak));
+    for (size_t i = 0; i < blocks; i++) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(tweaks + BLOCK_SIZE * i), t);
+        __m128i carry = _mm_shuffle_epi32(_mm_srai_epi32(t, 31), 0x93);
+        t = _mm_xor_si128(_mm_add_epi32(t, t), _mm_and_si128(carry, feedback));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(tweak), t);
+}
+
+#endif // AES_X86
+
+// Writes the tweaks for the next `blocks` blocks and advances tweak past
+// them.
+void FillTweaks(unsigned char tweak[16], unsigned char* tweaks,
+                size_t blocks) {
+#if defined(AES_X86)
+    FillTweaksSse2(tweak, tweaks, blocks);
+#else
+    for (size_t i = 0; i < blocks; i++) {
+        std::memcpy(tweaks + BLOCK_SIZE * i, tweak, BLOCK_SIZE);
+        DoubleTweak(tweak);
+    }
+#endif
+}
+
+// out = E(in ^ T) ^ T for whole blocks, or the D() equivalent. Advances
+// tweak past the blocks processed. in may equal out.
+void XtsBlocks(const AesKey& data_key, unsigned char tweak[16],
+               const unsigned char* in, unsigned char* out, size_t blocks,
+               bool encrypting) {
+    alignas(16) unsigned char tweaks[XTS_BATCH_BLOCKS * BLOCK_SIZE];
+    alignas(16) unsigned char buffer[XTS_BATCH_BLOCKS * BLOCK_SIZE];
+
+    while (blocks) {
+        size_t n = std::min<size_t>(blocks, XTS_BATCH_BLOCKS);
+        size_t bytes = BLOCK_SIZE * n;
+        FillTweaks(tweak, tweaks, n);
+        XorBytes(buffer, in, tweaks, bytes);
+        if (encrypting) {
+            EncryptBlocks(data_key, buffer, out, n);
+        } else {
+            DecryptBlocks(data_key, buffer, out, n);
+        }
+        XorBytes(out, out, tweaks, bytes);
+        in += bytes;
+        out += bytes;
+        blocks -= n;
+    }
+}
+
+// One sector under an already encrypted tweak. With a partial last block
+// the final two blocks swap tweaks on decryption: the stolen block was
+// produced under the later one.
+void XtsSector(const AesKey& data_key, const unsigned char sector_tweak[16],
+               const unsigned char* in, unsigned char* out, size_t length,
+               bool encrypting) {
+    unsigned char tweak[BLOCK_SIZE];
+    std::memcpy(tweak, sector_tweak, BLOCK_SIZE);
+    size_t tail = length % BLOCK_SIZE;
+    size_t bulk = length / BLOCK_SIZE - (tail ? 1 : 0);
+    XtsBlocks(data_key, tweak, in, out, bulk, encrypting);
+    if (!tail) {
+        return;
+    }
+
+    unsigned char next_tweak[BLOCK_SIZE];
+    std::memcpy(next_tweak, tweak, BLOCK_SIZE);
+    DoubleTweak(next_tweak);
+    const unsigned char* last_in = in + BLOCK_SIZE * bulk;
+    unsigned char* last_out = out + BLOCK_SIZE * bulk;
+
+    unsigned char block[BLOCK_SIZE];
+    unsigned char stolen[BLOCK_SIZE];
+    XtsBlocks(data_key, encrypting ? tweak : next_tweak, last_in, block, 1,
+              encrypting);
+    std::memcpy(stolen, last_in + BLOCK_SIZE, tail);
+    std::memcpy(stolen + tail, block + tail, BLOCK_SIZE - tail);
+    std::memcpy(last_out + BLOCK_SIZE, block, tail);
+    XtsBlocks(data_key, encrypting ? next_tweak : tweak, stolen, last_out, 1,
+              encrypting);
+}
+
+// Sectors are handled XTS_BATCH_BLOCKS at a time so their tweaks can be
+// encrypted in one multi-block call.
+void XtsSectorRange(const AesKey& data_key, const AesKey& tweak_key,
+                    uint64_t first_sector, const unsigned char* in,
+                    unsigned char* out, size_t sector_size,
+                    size_t sector_count, bool encrypting) {
+    AES_PERF_SCOPE(encrypting ? PERF_XTS_ENCRYPT : PERF_XTS_DECRYPT,
+                   sector_size * sector_count);
+    alignas(16) unsigned char numbers[XTS_BATCH_BLOCKS * BLOCK_SIZE] = {};
+    alignas(16) unsigned char tweaks[XTS_BATCH_BLOCKS * BLOCK_SIZE];
+
+    while (sector_count) {
+        size_t n = std::min<size_t>(sector_count, XTS_BATCH_BLOCKS);
+        // The sector number as a little-endian 128-bit value.
+        for (size_t i = 0; i < n; i++) {
+            uint64_t sector = first_sector + i;
+            for (int k = 0; k < 8; k++) {
+                numbers[BLOCK_SIZE * i + k] = static_cast<unsigned char>(sector >> (8 * k));
+            }
+        }
+        EncryptBlocks(tweak_key, numbers, tweaks, n);
+        for (size_t i = 0; i < n; i++) {
+            XtsSector(data_key, tweaks + BLOCK_SIZE * i, in, out, sector_size,
+                      encrypting);
+            in += sector_size;
+            out += sector_size;
+        }
+        first_sector += n;
+        sector_count -= n;
+    }
+}
+
+// The first two round keys hold the whole cipher key for every key size.
+void CheckArguments(const AesKey& data_key, const AesKey& tweak_key,
+                    size_t sector_size) {
+    if (sector_size < BLOCK_SIZE) {
+        throw std::invalid_argument("XTS: sectors must be at least one block");
+    }
+    if (data_key.number_rounds == tweak_key.number_rounds &&
+        std::memcmp(data_key.enc_keys, tweak_key.enc_keys, 2 * BLOCK_SIZE) == 0) {
+        throw std::invalid_argument("XTS: data and tweak keys must differ");
+    }
+}
+
+void XtsSectors(const AesKey& data_key, const AesKey& tweak_key,
+                uint64_t first_sector, const unsigned char* in,
+                unsigned char* out, size_t sector_size, size_t sector_count,
+                bool encrypting) {
+    CheckArguments(data_key, tweak_key, sector_size);
+    if (sector_size * sector_count < ParallelMinBytes()) {
+        XtsSectorRange(data_key, tweak_key, first_sector, in, out,
+                       sector_size, sector_count, encrypting);
+        return;
+    }
+
+    ThreadPool& pool = DefaultThreadPool();
+    pool.ParallelFor(sector_count, pool.Size(), [&](size_t begin, size_t end) {
+        size_t offset = sector_size * begin;
+        XtsSectorRange(data_key, tweak_key, first_sector + begin, in + offset,
+                       out + offset, sector_size, end - begin, encrypting);
+    });
+}
+
+} // namespace
+
+
+void XtsEncrypt(const AesKey& data_key, const AesKey& tweak_key,
+                uint64_t sector, const unsigned char* in, unsigned char* out,
+                size_t length) {
+    XtsSectors(data_key, tweak_key, sector, in, out, length, 1, true);
+}
+
+
+void XtsDecrypt(const AesKey& data_key, const AesKey& tweak_key,
+                uint64_t sector, const unsigned char* in, unsigned char* out,
+                size_t length) {
+    XtsSectors(data_key, tweak_key, sector, in, out, length, 1, false);
+}
+
+
+void XtsEncryptSectors(const AesKey& data_key, const AesKey& tweak_key,
+                       uint64_t first_sector, const unsigned char* in,
+                       unsigned char* out, size_t sector_size,
+                       size_t sector_count) {
+    XtsSectors(data_key, tweak_key, first_sector, in, out, sector_size,
+               sector_count, true);
+}
+
+
+void XtsDecryptSectors(const AesKey& data_key, const AesKey& tweak_key,
+                       uint64_t first_sector, const unsigned char* in,
+                       unsigned char* out, size_t sector_size,
+                       size_t sector_count) {
+    XtsSectors(data_key, tweak_key, first_sector, in, out, sector_size,
+               sector_count, false);
+}